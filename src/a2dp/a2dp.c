@@ -0,0 +1,528 @@
+/*
+ * a2dp.c - BlueZ A2DP sink endpoint
+ * 	- Registers an org.bluez.MediaEndpoint1 object for the A2DP sink role on
+ * 	  an adapter, follows the transport BlueZ configures on it and hands the
+ * 	  acquired transport file descriptor to the caller. The descriptor is a
+ * 	  SEQPACKET socket, every read returns one RTP packet of codec frames.
+ * 	- Works against any service owning org.bluez on the chosen bus, so
+ * 	  bluez-mock (src/mock) on the session bus can stand in for bluetoothd.
+ */
+
+#include "a2dp.h"
+#include <gio/gunixfdlist.h>
+#include <unistd.h>
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(a2dp->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(a2dp->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(a2dp->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(a2dp->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(a2dp->logger, TRACE, FORMAT, __VA_ARGS__);
+
+#define A2DP_BLUEZ "org.bluez"
+#define A2DP_MEDIA_INTERFACE "org.bluez.Media1"
+#define A2DP_TRANSPORT_INTERFACE "org.bluez.MediaTransport1"
+
+// SBC capability and configuration octets, A2DP 1.3 section 4.3.2
+#define A2DP_SBC_FREQUENCY_16000 0x80
+#define A2DP_SBC_FREQUENCY_32000 0x40
+#define A2DP_SBC_FREQUENCY_44100 0x20
+#define A2DP_SBC_FREQUENCY_48000 0x10
+#define A2DP_SBC_CHANNEL_MODE_MONO 0x08
+#define A2DP_SBC_CHANNEL_MODE_DUAL 0x04
+#define A2DP_SBC_CHANNEL_MODE_STEREO 0x02
+#define A2DP_SBC_CHANNEL_MODE_JOINT 0x01
+#define A2DP_SBC_BLOCKS_16 0x10
+#define A2DP_SBC_SUBBANDS_8 0x04
+#define A2DP_SBC_ALLOCATION_LOUDNESS 0x01
+#define A2DP_SBC_MIN_BITPOOL 2
+#define A2DP_SBC_MAX_BITPOOL 53
+
+static const char a2dp_introspection[] =
+    "<node>"
+    "  <interface name='org.bluez.MediaEndpoint1'>"
+    "    <method name='SetConfiguration'>"
+    "      <arg name='transport' type='o' direction='in'/>"
+    "      <arg name='properties' type='a{sv}' direction='in'/>"
+    "    </method>"
+    "    <method name='SelectConfiguration'>"
+    "      <arg name='capabilities' type='ay' direction='in'/>"
+    "      <arg name='configuration' type='ay' direction='out'/>"
+    "    </method>"
+    "    <method name='ClearConfiguration'>"
+    "      <arg name='transport' type='o' direction='in'/>"
+    "    </method>"
+    "    <method name='Release'/>"
+    "  </interface>"
+    "</node>";
+
+static void a2dp_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name,
+                             const gchar *method_name, GVariant *parameters, GDBusMethodInvocation *invocation, gpointer user_data);
+
+static void a2dp_set_configuration(a2dp_t a2dp, GVariant *parameters, GDBusMethodInvocation *invocation);
+
+static void a2dp_select_configuration(a2dp_t a2dp, GVariant *parameters, GDBusMethodInvocation *invocation);
+
+static void a2dp_clear_configuration(a2dp_t a2dp);
+
+static void a2dp_properties_changed(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name,
+                                    const gchar *signal_name, GVariant *parameters, gpointer user_data);
+
+static void a2dp_acquire(a2dp_t a2dp);
+
+static void a2dp_release(a2dp_t a2dp, gboolean notify_bluez);
+
+static int a2dp_parse_sbc(a2dp_transport_t transport);
+
+static guint8 a2dp_pick(guint8 supported, const guint8 *preferred, int count);
+
+static void a2dp_transport_destroy(a2dp_transport_t transport);
+
+static void a2dp_destroy(a2dp_t a2dp);
+
+static const GDBusInterfaceVTable a2dp_vtable = {a2dp_method_call, NULL, NULL};
+
+int a2dp_create(a2dp_t *a2dp, GBusType bus_type, const char *adapter, const char *endpoint, logger_t logger, const char **error)
+{
+    int status;
+    a2dp_t new_a2dp;
+    GError *bus_error;
+
+    status = STATUS_OK;
+    new_a2dp = NULL;
+    bus_error = NULL;
+
+    IF_THROW(a2dp == NULL, "a2dp_create: null a2dp")
+    IF_THROW(adapter == NULL, "a2dp_create: null adapter")
+    IF_THROW(endpoint == NULL, "a2dp_create: null endpoint")
+    IF_THROW(logger == NULL, "a2dp_create: null logger")
+
+    new_a2dp = calloc(1, sizeof(struct a2dp_s));
+    IF_THROW(new_a2dp == NULL, "a2dp_create: failed to allocate a2dp")
+
+    new_a2dp->ref = 1;
+    new_a2dp->logger = logger;
+    logger_ref(logger);
+
+    new_a2dp->adapter_path = g_strdup_printf("/org/bluez/%s", adapter);
+    new_a2dp->endpoint_path = g_strdup_printf("/org/soundsystem/%s", endpoint);
+    IF_THROW(new_a2dp->adapter_path == NULL || new_a2dp->endpoint_path == NULL, "a2dp_create: failed to allocate paths")
+    IF_THROW(!g_variant_is_object_path(new_a2dp->endpoint_path), "a2dp_create: endpoint is not a valid object path element")
+
+    new_a2dp->connection = g_bus_get_sync(bus_type, NULL, &bus_error);
+    if (bus_error != NULL)
+    {
+        logger_errorf(logger, "a2dp_create: %s\n", bus_error->message);
+    }
+    IF_THROW(new_a2dp->connection == NULL, "a2dp_create: failed to connect to bus")
+
+    new_a2dp->node_info = g_dbus_node_info_new_for_xml(a2dp_introspection, NULL);
+    IF_THROW(new_a2dp->node_info == NULL, "a2dp_create: failed to parse endpoint interface")
+
+    *a2dp = new_a2dp;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_a2dp, a2dp_destroy(new_a2dp))
+done:
+    CLEANUP_FUNCTION(bus_error, g_error_free(bus_error))
+    return status;
+}
+
+void a2dp_set_callbacks(a2dp_t a2dp, a2dp_transport_fn acquired_fn, a2dp_transport_fn released_fn, void *user_data)
+{
+    a2dp->acquired_fn = acquired_fn;
+    a2dp->released_fn = released_fn;
+    a2dp->user_data = user_data;
+}
+
+int a2dp_register(a2dp_t a2dp, const char **error)
+{
+    int status;
+    GError *call_error;
+    GVariantBuilder properties;
+    GVariant *reply;
+    static const guint8 capabilities[] = {
+        // every rate and channel mode, every block length, subband count and
+        // allocation method, and the bitpool range of high quality SBC
+        0xff,
+        0xff,
+        A2DP_SBC_MIN_BITPOOL,
+        A2DP_SBC_MAX_BITPOOL,
+    };
+
+    status = STATUS_OK;
+    call_error = NULL;
+    reply = NULL;
+
+    a2dp->registration = g_dbus_connection_register_object(a2dp->connection, a2dp->endpoint_path, a2dp->node_info->interfaces[0],
+                                                           &a2dp_vtable, a2dp, NULL, &call_error);
+    IF_THROW(a2dp->registration == 0, "a2dp_register: failed to export endpoint")
+
+    g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&properties, "{sv}", "UUID", g_variant_new_string(A2DP_SINK_UUID));
+    g_variant_builder_add(&properties, "{sv}", "Codec", g_variant_new_byte(A2DP_CODEC_SBC));
+    g_variant_builder_add(&properties, "{sv}", "Capabilities",
+                          g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, capabilities, sizeof(capabilities), sizeof(guint8)));
+
+    reply = g_dbus_connection_call_sync(a2dp->connection, A2DP_BLUEZ, a2dp->adapter_path, A2DP_MEDIA_INTERFACE, "RegisterEndpoint",
+                                        g_variant_new("(oa{sv})", a2dp->endpoint_path, &properties), NULL,
+                                        G_DBUS_CALL_FLAGS_NONE, -1, NULL, &call_error);
+    IF_THROW(reply == NULL, "a2dp_register: failed to register endpoint with BlueZ")
+
+    INFOF("a2dp_register: sink endpoint %s registered on %s\n", a2dp->endpoint_path, a2dp->adapter_path)
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    if (call_error != NULL)
+    {
+        ERRORF("a2dp_register: %s\n", call_error->message)
+    }
+done:
+    CLEANUP_FUNCTION(reply, g_variant_unref(reply))
+    CLEANUP_FUNCTION(call_error, g_error_free(call_error))
+    return status;
+}
+
+void a2dp_ref(a2dp_t a2dp)
+{
+    a2dp->ref++;
+}
+
+void a2dp_unref(a2dp_t a2dp)
+{
+    assert(a2dp != NULL);
+    assert(a2dp->ref >= 1);
+    if (--a2dp->ref == 0)
+    {
+        a2dp_destroy(a2dp);
+    }
+}
+
+void a2dp_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name,
+                      const gchar *method_name, GVariant *parameters, GDBusMethodInvocation *invocation, gpointer user_data)
+{
+    a2dp_t a2dp;
+
+    a2dp = (a2dp_t)user_data;
+    DEBUGF("a2dp_method_call: %s from %s\n", method_name, sender)
+
+    if (strcmp(method_name, "SetConfiguration") == 0)
+    {
+        a2dp_set_configuration(a2dp, parameters, invocation);
+    }
+    else if (strcmp(method_name, "SelectConfiguration") == 0)
+    {
+        a2dp_select_configuration(a2dp, parameters, invocation);
+    }
+    else if (strcmp(method_name, "ClearConfiguration") == 0)
+    {
+        a2dp_clear_configuration(a2dp);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+    else if (strcmp(method_name, "Release") == 0)
+    {
+        // bluetoothd is going away, the registration goes with it
+        a2dp_clear_configuration(a2dp);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+    else
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.NotSupported", method_name);
+    }
+}
+
+void a2dp_set_configuration(a2dp_t a2dp, GVariant *parameters, GDBusMethodInvocation *invocation)
+{
+    const gchar *path;
+    GVariant *properties;
+    GVariant *configuration;
+    const guint8 *octets;
+    const gchar *state;
+    a2dp_transport_t transport;
+    gsize size;
+
+    g_variant_get(parameters, "(&o@a{sv})", &path, &properties);
+    configuration = g_variant_lookup_value(properties, "Configuration", G_VARIANT_TYPE_BYTESTRING);
+    transport = calloc(1, sizeof(struct a2dp_transport_s));
+    if (transport != NULL)
+    {
+        transport->fd = -1;
+    }
+
+    if (transport == NULL || configuration == NULL)
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidArguments", "missing configuration");
+        goto done;
+    }
+
+    transport->path = g_strdup(path);
+    transport->codec = A2DP_CODEC_SBC;
+    g_variant_lookup(properties, "Codec", "y", &transport->codec);
+    octets = g_variant_get_fixed_array(configuration, &size, sizeof(guint8));
+    transport->configuration_size = MIN(size, sizeof(transport->configuration));
+    memcpy(transport->configuration, octets, transport->configuration_size);
+
+    if (transport->codec != A2DP_CODEC_SBC || a2dp_parse_sbc(transport) != STATUS_OK)
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidArguments", "unsupported configuration");
+        goto done;
+    }
+
+    // only one source streams into a speaker at a time
+    a2dp_clear_configuration(a2dp);
+    a2dp->transport = transport;
+    a2dp->subscription = g_dbus_connection_signal_subscribe(a2dp->connection, A2DP_BLUEZ, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                                                            transport->path, A2DP_TRANSPORT_INTERFACE, G_DBUS_SIGNAL_FLAGS_NONE,
+                                                            a2dp_properties_changed, a2dp, NULL);
+    transport = NULL;
+
+    INFOF("a2dp_set_configuration: %s: SBC %d Hz %d ch\n", a2dp->transport->path, a2dp->transport->rate, a2dp->transport->channels)
+    g_dbus_method_invocation_return_value(invocation, NULL);
+
+    // a source that is already streaming announces no state change
+    if (g_variant_lookup(properties, "State", "&s", &state) && strcmp(state, "pending") == 0)
+    {
+        a2dp_acquire(a2dp);
+    }
+
+done:
+    CLEANUP_FUNCTION(transport, a2dp_transport_destroy(transport))
+    CLEANUP_FUNCTION(configuration, g_variant_unref(configuration))
+    g_variant_unref(properties);
+}
+
+void a2dp_select_configuration(a2dp_t a2dp, GVariant *parameters, GDBusMethodInvocation *invocation)
+{
+    GVariant *capabilities;
+    const guint8 *octets;
+    guint8 configuration[4];
+    gsize size;
+    static const guint8 frequencies[] = {A2DP_SBC_FREQUENCY_48000, A2DP_SBC_FREQUENCY_44100, A2DP_SBC_FREQUENCY_32000, A2DP_SBC_FREQUENCY_16000};
+    static const guint8 modes[] = {A2DP_SBC_CHANNEL_MODE_JOINT, A2DP_SBC_CHANNEL_MODE_STEREO, A2DP_SBC_CHANNEL_MODE_DUAL, A2DP_SBC_CHANNEL_MODE_MONO};
+    static const guint8 blocks[] = {A2DP_SBC_BLOCKS_16, 0x20, 0x40, 0x80};
+    static const guint8 subbands[] = {A2DP_SBC_SUBBANDS_8, 0x08};
+    static const guint8 allocations[] = {A2DP_SBC_ALLOCATION_LOUDNESS, 0x02};
+
+    g_variant_get(parameters, "(@ay)", &capabilities);
+    octets = g_variant_get_fixed_array(capabilities, &size, sizeof(guint8));
+
+    // best quality both sides support
+    if (size != 4)
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidArguments", "invalid SBC capabilities");
+        g_variant_unref(capabilities);
+        return;
+    }
+    configuration[0] = a2dp_pick(octets[0] & 0xf0, frequencies, 4) | a2dp_pick(octets[0] & 0x0f, modes, 4);
+    configuration[1] = a2dp_pick(octets[1] & 0xf0, blocks, 4) | a2dp_pick(octets[1] & 0x0c, subbands, 2) | a2dp_pick(octets[1] & 0x03, allocations, 2);
+    configuration[2] = MAX(octets[2], A2DP_SBC_MIN_BITPOOL);
+    configuration[3] = MIN(octets[3], A2DP_SBC_MAX_BITPOOL);
+
+    if ((configuration[0] & 0xf0) == 0 || (configuration[0] & 0x0f) == 0 || (configuration[1] & 0xf0) == 0 || (configuration[1] & 0x0c) == 0 ||
+        (configuration[1] & 0x03) == 0 || configuration[2] > configuration[3])
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidArguments", "no common SBC configuration");
+    }
+    else
+    {
+        DEBUGF("a2dp_select_configuration: %02x %02x %u-%u\n", configuration[0], configuration[1], configuration[2], configuration[3])
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(@ay)",
+                                                                        g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, configuration, 4, sizeof(guint8))));
+    }
+    g_variant_unref(capabilities);
+}
+
+void a2dp_clear_configuration(a2dp_t a2dp)
+{
+    if (a2dp->transport == NULL)
+    {
+        return;
+    }
+
+    INFOF("a2dp_clear_configuration: %s\n", a2dp->transport->path)
+    a2dp_release(a2dp, TRUE);
+    if (a2dp->subscription != 0)
+    {
+        g_dbus_connection_signal_unsubscribe(a2dp->connection, a2dp->subscription);
+        a2dp->subscription = 0;
+    }
+    a2dp_transport_destroy(a2dp->transport);
+    a2dp->transport = NULL;
+}
+
+void a2dp_properties_changed(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name,
+                             const gchar *signal_name, GVariant *parameters, gpointer user_data)
+{
+    a2dp_t a2dp;
+    GVariant *changed;
+    const gchar *state;
+
+    a2dp = (a2dp_t)user_data;
+    g_variant_get(parameters, "(&s@a{sv}@as)", NULL, &changed, NULL);
+
+    // pending means the source started streaming and waits for us to acquire,
+    // idle means it suspended and bluetoothd already dropped its end
+    if (g_variant_lookup(changed, "State", "&s", &state))
+    {
+        DEBUGF("a2dp_properties_changed: %s: %s\n", object_path, state)
+        if (strcmp(state, "pending") == 0)
+        {
+            a2dp_acquire(a2dp);
+        }
+        else if (strcmp(state, "idle") == 0)
+        {
+            a2dp_release(a2dp, FALSE);
+        }
+    }
+
+    g_variant_unref(changed);
+}
+
+void a2dp_acquire(a2dp_t a2dp)
+{
+    GVariant *reply;
+    GUnixFDList *fd_list;
+    GError *call_error;
+    gint32 handle;
+
+    reply = NULL;
+    fd_list = NULL;
+    call_error = NULL;
+
+    if (a2dp->transport == NULL || a2dp->acquired)
+    {
+        return;
+    }
+
+    // TryAcquire only succeeds while the transport is pending, which is the
+    // only time we ask
+    reply = g_dbus_connection_call_with_unix_fd_list_sync(a2dp->connection, A2DP_BLUEZ, a2dp->transport->path, A2DP_TRANSPORT_INTERFACE, "TryAcquire",
+                                                          NULL, G_VARIANT_TYPE("(hqq)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &fd_list, NULL,
+                                                          &call_error);
+    if (reply == NULL)
+    {
+        ERRORF("a2dp_acquire: %s: %s\n", a2dp->transport->path, call_error != NULL ? call_error->message : "no reply")
+        goto done;
+    }
+
+    g_variant_get(reply, "(hqq)", &handle, &a2dp->transport->read_mtu, &a2dp->transport->write_mtu);
+    a2dp->transport->fd = g_unix_fd_list_get(fd_list, handle, &call_error);
+    if (a2dp->transport->fd < 0)
+    {
+        ERRORF("a2dp_acquire: %s: %s\n", a2dp->transport->path, call_error != NULL ? call_error->message : "no descriptor")
+        goto done;
+    }
+
+    a2dp->acquired = TRUE;
+    INFOF("a2dp_acquire: %s: fd %d, read mtu %u\n", a2dp->transport->path, a2dp->transport->fd, a2dp->transport->read_mtu)
+    if (a2dp->acquired_fn != NULL)
+    {
+        a2dp->acquired_fn(a2dp->transport, a2dp->user_data);
+    }
+
+done:
+    CLEANUP_FUNCTION(call_error, g_error_free(call_error))
+    CLEANUP_FUNCTION(fd_list, g_object_unref(fd_list))
+    CLEANUP_FUNCTION(reply, g_variant_unref(reply))
+}
+
+void a2dp_release(a2dp_t a2dp, gboolean notify_bluez)
+{
+    GVariant *reply;
+
+    if (a2dp->transport == NULL || !a2dp->acquired)
+    {
+        return;
+    }
+
+    // the pipeline reading the descriptor stops before it is closed
+    if (a2dp->released_fn != NULL)
+    {
+        a2dp->released_fn(a2dp->transport, a2dp->user_data);
+    }
+    if (notify_bluez)
+    {
+        reply = g_dbus_connection_call_sync(a2dp->connection, A2DP_BLUEZ, a2dp->transport->path, A2DP_TRANSPORT_INTERFACE, "Release",
+                                            NULL, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+        CLEANUP_FUNCTION(reply, g_variant_unref(reply))
+    }
+    close(a2dp->transport->fd);
+    a2dp->transport->fd = -1;
+    a2dp->acquired = FALSE;
+    INFOF("a2dp_release: %s\n", a2dp->transport->path)
+}
+
+int a2dp_parse_sbc(a2dp_transport_t transport)
+{
+    if (transport->configuration_size != 4)
+    {
+        return STATUS_ERROR;
+    }
+
+    switch (transport->configuration[0] & 0xf0)
+    {
+    case A2DP_SBC_FREQUENCY_16000:
+        transport->rate = 16000;
+        break;
+    case A2DP_SBC_FREQUENCY_32000:
+        transport->rate = 32000;
+        break;
+    case A2DP_SBC_FREQUENCY_44100:
+        transport->rate = 44100;
+        break;
+    case A2DP_SBC_FREQUENCY_48000:
+        transport->rate = 48000;
+        break;
+    default:
+        return STATUS_ERROR;
+    }
+
+    transport->channels = (transport->configuration[0] & 0x0f) == A2DP_SBC_CHANNEL_MODE_MONO ? 1 : 2;
+    return STATUS_OK;
+}
+
+guint8 a2dp_pick(guint8 supported, const guint8 *preferred, int count)
+{
+    int index;
+
+    for (index = 0; index < count; index++)
+    {
+        if (supported & preferred[index])
+        {
+            return preferred[index];
+        }
+    }
+    return 0;
+}
+
+void a2dp_transport_destroy(a2dp_transport_t transport)
+{
+    if (transport->fd >= 0)
+    {
+        close(transport->fd);
+    }
+    CLEANUP_FUNCTION(transport->path, g_free(transport->path))
+    free(transport);
+}
+
+void a2dp_destroy(a2dp_t a2dp)
+{
+    GVariant *reply;
+
+    a2dp_clear_configuration(a2dp);
+    if (a2dp->registration != 0)
+    {
+        reply = g_dbus_connection_call_sync(a2dp->connection, A2DP_BLUEZ, a2dp->adapter_path, A2DP_MEDIA_INTERFACE, "UnregisterEndpoint",
+                                            g_variant_new("(o)", a2dp->endpoint_path), NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+        CLEANUP_FUNCTION(reply, g_variant_unref(reply))
+        g_dbus_connection_unregister_object(a2dp->connection, a2dp->registration);
+    }
+    CLEANUP_FUNCTION(a2dp->node_info, g_dbus_node_info_unref(a2dp->node_info))
+    CLEANUP_FUNCTION(a2dp->connection, g_object_unref(a2dp->connection))
+    CLEANUP_FUNCTION(a2dp->adapter_path, g_free(a2dp->adapter_path))
+    CLEANUP_FUNCTION(a2dp->endpoint_path, g_free(a2dp->endpoint_path))
+    CLEANUP_FUNCTION(a2dp->logger, logger_unref(a2dp->logger))
+    free(a2dp);
+}
@@ -0,0 +1,187 @@
+/*
+ * main.c - dsp-bench
+ * 	- Runs the zone DSP stage over 48 kHz stereo S16 in 10 ms blocks with
+ * 	  each kernel this CPU supports, once with gain and limiter only and
+ * 	  once with a full EQ, and reports samples per second on one core, the
+ * 	  speedup over the scalar kernel and the largest difference from it.
+ * usage: dsp-bench [-s seconds]
+ */
+
+#include "dsp.h"
+#include <math.h>
+#include <unistd.h>
+
+#define MAIN_RATE 48000
+#define MAIN_CHANNELS 2
+#define MAIN_FRAMES (MAIN_RATE / 100)
+
+struct main_result_s
+{
+    double rate;
+    int16_t output[MAIN_FRAMES * MAIN_CHANNELS];
+};
+typedef struct main_result_s *main_result_t;
+
+static void main_device(device_t device, int eq);
+
+static void main_signal(int16_t *samples, size_t frames);
+
+static int main_run(device_t device, int kernel, double seconds, logger_t logger, main_result_t result, const char **error);
+
+int main(int argc, char **argv)
+{
+    struct device_s device;
+    struct main_result_s results[DSP_KERNELS];
+    logger_t logger;
+    double seconds;
+    int option;
+    int status;
+    int eq;
+    int kernel;
+    int index;
+    int difference;
+    const char *error;
+
+    status = STATUS_OK;
+    logger = NULL;
+    seconds = 2;
+
+    while ((option = getopt(argc, argv, "s:")) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            seconds = atof(optarg);
+            break;
+        default:
+            puts("usage: dsp-bench [-s seconds]");
+            return STATUS_ERROR;
+        }
+    }
+
+    if (logger_create(&logger, WARN, stderr, NULL, NULL, &error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: logger_create failed");
+        goto error;
+    }
+
+    printf("%-8s %-8s %14s %8s %8s\n", "stage", "kernel", "samples/s", "speedup", "maxdiff");
+    for (eq = 0; eq <= 1; eq++)
+    {
+        main_device(&device, eq);
+        for (kernel = 0; kernel < DSP_KERNELS; kernel++)
+        {
+            if (!dsp_kernel_available(kernel))
+            {
+                continue;
+            }
+            if (main_run(&device, kernel, seconds, logger, results + kernel, &error) != STATUS_OK)
+            {
+                logger_errorf(logger, "%s\n", error);
+                goto error;
+            }
+
+            // the scalar kernel is the reference every other one has to match
+            difference = 0;
+            for (index = 0; index < MAIN_FRAMES * MAIN_CHANNELS; index++)
+            {
+                difference = MAX(difference, abs(results[kernel].output[index] - results[DSP_KERNEL_SCALAR].output[index]));
+            }
+            printf("%-8s %-8s %14.0f %7.2fx %8d\n", eq ? "eq" : "gain", dsp_kernel_name(kernel), results[kernel].rate,
+                   results[kernel].rate / results[DSP_KERNEL_SCALAR].rate, difference);
+        }
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(logger, logger_unref(logger))
+    return status;
+}
+
+void main_device(device_t device, int eq)
+{
+    // loud enough that the limiter works on every peak
+    memset(device, 0, sizeof(struct device_s));
+    device->rate = MAIN_RATE;
+    device->channels = MAIN_CHANNELS;
+    device->gain = 6;
+    device->limiter = TRUE;
+    device->limiter_threshold = -3;
+    if (!eq)
+    {
+        return;
+    }
+    device->neq = 3;
+    device->eq[0] = (struct eq_band_s){EQ_TYPE_LOW_SHELF, 120, 4, 0.707};
+    device->eq[1] = (struct eq_band_s){EQ_TYPE_PEAK, 2500, -3, 1.4};
+    device->eq[2] = (struct eq_band_s){EQ_TYPE_HIGH_SHELF, 9000, 2, 0.707};
+}
+
+void main_signal(int16_t *samples, size_t frames)
+{
+    size_t frame;
+    int channel;
+
+    for (frame = 0; frame < frames; frame++)
+    {
+        for (channel = 0; channel < MAIN_CHANNELS; channel++)
+        {
+            samples[frame * MAIN_CHANNELS + channel] =
+                (int16_t)(20000 * sin(2 * G_PI * (440 + 220 * channel) * frame / MAIN_RATE) + 6000 * sin(2 * G_PI * 7000 * frame / MAIN_RATE));
+        }
+    }
+}
+
+int main_run(device_t device, int kernel, double seconds, logger_t logger, main_result_t result, const char **error)
+{
+    int status;
+    dsp_t dsp;
+    int16_t input[MAIN_FRAMES * MAIN_CHANNELS];
+    gint64 start;
+    gint64 elapsed;
+    long blocks;
+
+    status = STATUS_OK;
+    dsp = NULL;
+
+    if (dsp_create(&dsp, device, "bench", kernel, logger, error) != STATUS_OK)
+    {
+        goto error;
+    }
+    IF_THROW(dsp_configure(dsp, "S16LE", MAIN_RATE, MAIN_CHANNELS) != STATUS_OK, "main_run: failed to configure dsp")
+    main_signal(input, MAIN_FRAMES);
+
+    memcpy(result->output, input, sizeof(input));
+
+    blocks = 0;
+    start = g_get_monotonic_time();
+    do
+    {
+        // in place like the pad probe, the limiter keeps the level bounded
+        dsp_process(dsp, result->output, sizeof(input));
+        blocks++;
+        elapsed = g_get_monotonic_time() - start;
+    } while (elapsed < seconds * G_USEC_PER_SEC);
+    result->rate = (double)blocks * MAIN_FRAMES * MAIN_CHANNELS / (elapsed / 1e6);
+
+    // every kernel gets the same fresh block so the outputs compare
+    dsp_unref(dsp);
+    dsp = NULL;
+    if (dsp_create(&dsp, device, "bench", kernel, logger, error) != STATUS_OK)
+    {
+        goto error;
+    }
+    IF_THROW(dsp_configure(dsp, "S16LE", MAIN_RATE, MAIN_CHANNELS) != STATUS_OK, "main_run: failed to configure dsp")
+    memcpy(result->output, input, sizeof(input));
+    dsp_process(dsp, result->output, sizeof(input));
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(dsp, dsp_unref(dsp))
+    return status;
+}
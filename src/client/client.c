@@ -0,0 +1,502 @@
+#include "client.h"
+#include "a2dp.h"
+#include <glib-unix.h>
+#include <gst/gst.h>
+#include <sys/resource.h>
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(client->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(client->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(client->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(client->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(client->logger, TRACE, FORMAT, __VA_ARGS__);
+
+#define ERRORLN(STRING) logger_errorln(client->logger, STRING);
+#define WARNLN(STRING) logger_warnln(client->logger, STRING);
+#define INFOLN(STRING) logger_infoln(client->logger, STRING);
+#define DEBUGLN(STRING) logger_debugln(client->logger, STRING);
+#define TRACELN(STRING) logger_traceln(client->logger, STRING);
+
+// what a phone negotiates for SBC over a typical EDR link
+#define CLIENT_TEST_RATE 48000
+#define CLIENT_TEST_CHANNELS 2
+#define CLIENT_TEST_MTU 895
+
+#define CLIENT_CPU_INTERVAL 10
+
+struct client_internal_s
+{
+    GMainLoop *main_loop;
+    a2dp_t a2dp;
+    GstElement *pipeline;
+    guint watch;
+    gint64 started;
+    gint64 acquired;
+    gint64 first_packet;
+    gint64 recording;
+    gboolean reported;
+    guint cpu_source;
+    gint64 cpu_wall;
+    gint64 cpu_time;
+};
+typedef struct client_internal_s *client_internal_t;
+
+static int client_internal_create(client_internal_t *client_internal, client_t client, config_t config, const char **error);
+
+static void client_acquired(a2dp_transport_t transport, void *user_data);
+
+static void client_released(a2dp_transport_t transport, void *user_data);
+
+static int client_start(client_t client, a2dp_transport_t transport, const char **error);
+
+static char *client_source_string(client_t client, a2dp_transport_t transport);
+
+static char *client_codec_string(client_t client);
+
+static void client_stop(client_t client);
+
+static gboolean client_message(GstBus *bus, GstMessage *message, gpointer user_data);
+
+static GstPadProbeReturn client_first_packet(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static gboolean client_report_startup(gpointer user_data);
+
+static gboolean client_report_cpu(gpointer user_data);
+
+static gint64 client_cpu_time(void);
+
+static gboolean client_signal(gpointer user_data);
+
+static void client_internal_destroy(client_internal_t client_internal);
+
+static void client_destroy(client_t client);
+
+int client_create(client_t *client, config_t config, logger_t logger, const char **error)
+{
+    int status;
+    client_t new_client;
+
+    status = STATUS_OK;
+    new_client = NULL;
+
+    IF_THROW(client == NULL, "client_create: null client address")
+    IF_THROW(config == NULL, "client_create: null config")
+    IF_THROW(logger == NULL, "client_create: null logger")
+
+    new_client = (client_t)calloc(1, sizeof(struct client_s));
+    IF_THROW(new_client == NULL, "client_create: failed to allocate client")
+
+    new_client->ref = 1;
+    new_client->config = config;
+    config_ref(config);
+    new_client->logger = logger;
+    logger_ref(logger);
+    new_client->internal = NULL;
+    if (client_internal_create((client_internal_t *)&new_client->internal, new_client, config, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
+    *client = new_client;
+
+    goto done;
+error:
+    CLEANUP_FUNCTION(new_client, client_destroy(new_client))
+    status = STATUS_ERROR;
+done:
+    return status;
+}
+
+void client_deploy(client_t client)
+{
+    client_internal_t client_internal;
+    const char *error;
+
+    client_internal = (client_internal_t)client->internal;
+
+    INFOLN("client_deploy: starting")
+
+    g_unix_signal_add(SIGINT, client_signal, client);
+    g_unix_signal_add(SIGTERM, client_signal, client);
+
+    client_internal->cpu_wall = g_get_monotonic_time();
+    client_internal->cpu_time = client_cpu_time();
+    client_internal->cpu_source = g_timeout_add_seconds(CLIENT_CPU_INTERVAL, client_report_cpu, client);
+
+    if (client_internal->a2dp == NULL)
+    {
+        // no bluetooth at all, start streaming the stand-in right away
+        client_internal->acquired = g_get_monotonic_time();
+        if (client_start(client, NULL, &error) != STATUS_OK)
+        {
+            ERRORF("client_deploy: %s\n", error)
+            goto done;
+        }
+    }
+    else if (a2dp_register(client_internal->a2dp, &error) != STATUS_OK)
+    {
+        ERRORF("client_deploy: %s\n", error)
+        goto done;
+    }
+
+    DEBUGLN("client_deploy: starting main loop")
+    g_main_loop_run(client_internal->main_loop);
+
+done:
+    client_stop(client);
+    if (client_internal->cpu_source != 0)
+    {
+        g_source_remove(client_internal->cpu_source);
+        client_internal->cpu_source = 0;
+    }
+    INFOLN("client_deploy: client exit")
+}
+
+void client_ref(client_t client)
+{
+    client->ref++;
+}
+
+void client_unref(client_t client)
+{
+    assert(client != NULL);
+    assert(client->ref >= 1);
+    if (--client->ref == 0)
+    {
+        client_destroy(client);
+    }
+}
+
+int client_internal_create(client_internal_t *client_internal, client_t client, config_t config, const char **error)
+{
+    int status;
+    client_internal_t new_client_internal;
+
+    status = STATUS_OK;
+    new_client_internal = NULL;
+
+    new_client_internal = calloc(1, sizeof(struct client_internal_s));
+    IF_THROW(new_client_internal == NULL, "client_create: client_internal_create: failed to allocate client_internal")
+
+    new_client_internal->started = g_get_monotonic_time();
+
+    new_client_internal->main_loop = g_main_loop_new(NULL, FALSE);
+    IF_THROW(new_client_internal->main_loop == NULL, "client_create: client_internal_create: failed to allocate loop")
+
+    if (config->bluetooth_source == BLUETOOTH_SOURCE_TRANSPORT)
+    {
+        if (a2dp_create(&new_client_internal->a2dp, config->bluetooth_bus == BLUETOOTH_BUS_SESSION ? G_BUS_TYPE_SESSION : G_BUS_TYPE_SYSTEM,
+                        config->bluetooth_adapter, config->bluetooth_endpoint, client->logger, error) != STATUS_OK)
+        {
+            goto error;
+        }
+        a2dp_set_callbacks(new_client_internal->a2dp, client_acquired, client_released, client);
+    }
+
+    *client_internal = new_client_internal;
+
+    goto done;
+error:
+    CLEANUP_FUNCTION(new_client_internal, client_internal_destroy(new_client_internal))
+    status = STATUS_ERROR;
+done:
+    return status;
+}
+
+void client_acquired(a2dp_transport_t transport, void *user_data)
+{
+    client_t client;
+    client_internal_t client_internal;
+    const char *error;
+
+    client = (client_t)user_data;
+    client_internal = (client_internal_t)client->internal;
+
+    client_stop(client);
+    client_internal->acquired = g_get_monotonic_time();
+    if (client_start(client, transport, &error) != STATUS_OK)
+    {
+        ERRORF("client_acquired: %s\n", error)
+        client_stop(client);
+    }
+}
+
+void client_released(a2dp_transport_t transport, void *user_data)
+{
+    client_t client;
+
+    client = (client_t)user_data;
+    DEBUGF("client_released: %s\n", transport->path)
+    client_stop(client);
+}
+
+int client_start(client_t client, a2dp_transport_t transport, const char **error)
+{
+    int status;
+    client_internal_t client_internal;
+    char *source;
+    char *codec;
+    char *rtx;
+    char *description;
+    GError *parse_error;
+    GstElement *element;
+    GstPad *pad;
+    GstBus *bus;
+
+    status = STATUS_OK;
+    client_internal = (client_internal_t)client->internal;
+    parse_error = NULL;
+    element = NULL;
+    pad = NULL;
+
+    client_internal->first_packet = 0;
+    client_internal->recording = 0;
+    client_internal->reported = FALSE;
+
+    // the transport packets are RTP already, fdsrc reads each one straight
+    // into the buffer the depayloader slices frames out of
+    source = client_source_string(client, transport);
+    codec = client_codec_string(client);
+    // packets are only kept for resending as long as the server could still
+    // play them, which is bounded by the latency both ends agree on
+    rtx = client->config->rtsp_rtx ? g_strdup_printf("profiles=avpf rtx-time=%d", client->config->rtsp_latency) : g_strdup("rtx-time=0");
+    description = g_strdup_printf("%s ! rtpsbcdepay ! %s ! rtspclientsink name=sink location=rtsp://%s:%s/%s latency=%d %s", source, codec,
+                                  client->config->rtsp_host, client->config->rtsp_port, client->config->rtsp_endpoint, client->config->rtsp_latency,
+                                  rtx);
+    IF_THROW(source == NULL || codec == NULL || rtx == NULL || description == NULL, "client_start: failed to allocate description")
+
+    client_internal->pipeline = gst_parse_launch(description, &parse_error);
+    if (parse_error != NULL)
+    {
+        ERRORF("client_start: %s\n", parse_error->message)
+    }
+    IF_THROW(client_internal->pipeline == NULL || parse_error != NULL, "client_start: failed to build pipeline")
+    DEBUGF("client_start: %s\n", description)
+
+    element = gst_bin_get_by_name(GST_BIN(client_internal->pipeline), "transport");
+    IF_THROW(element == NULL, "client_start: missing transport source")
+    pad = gst_element_get_static_pad(element, "src");
+    IF_THROW(pad == NULL, "client_start: missing transport pad")
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, client_first_packet, client, NULL);
+
+    bus = gst_element_get_bus(client_internal->pipeline);
+    client_internal->watch = gst_bus_add_watch(bus, client_message, client);
+    gst_object_unref(bus);
+
+    IF_THROW(gst_element_set_state(client_internal->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE,
+             "client_start: failed to start pipeline")
+
+    INFOF("client_start: recording to rtsp://%s:%s/%s (%s)\n", client->config->rtsp_host, client->config->rtsp_port, client->config->rtsp_endpoint,
+          client->config->rtsp_mode == RTSP_MODE_PASSTHROUGH ? "passthrough" : "transcode")
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(pad, gst_object_unref(pad))
+    CLEANUP_FUNCTION(element, gst_object_unref(element))
+    CLEANUP_FUNCTION(parse_error, g_error_free(parse_error))
+    CLEANUP_FUNCTION(description, g_free(description))
+    CLEANUP_FUNCTION(rtx, g_free(rtx))
+    CLEANUP_FUNCTION(codec, g_free(codec))
+    CLEANUP_FUNCTION(source, g_free(source))
+    return status;
+}
+
+char *client_source_string(client_t client, a2dp_transport_t transport)
+{
+    // SEQPACKET reads return one packet of at most the read MTU, the test
+    // source encodes and packetizes SBC the same way a phone would
+    if (transport == NULL)
+    {
+        return g_strdup_printf("audiotestsrc is-live=true wave=sine ! audio/x-raw,rate=%d,channels=%d ! sbcenc ! rtpsbcpay name=transport mtu=%d",
+                               CLIENT_TEST_RATE, CLIENT_TEST_CHANNELS, CLIENT_TEST_MTU);
+    }
+    return g_strdup_printf("fdsrc name=transport fd=%d blocksize=%u do-timestamp=true ! "
+                           "application/x-rtp,media=audio,payload=96,clock-rate=%d,encoding-name=SBC",
+                           transport->fd, transport->read_mtu, transport->rate);
+}
+
+char *client_codec_string(client_t client)
+{
+    config_t config;
+
+    config = client->config;
+
+    // rtspclientsink payloads the SBC frames again without touching them,
+    // the server decodes with its "sbc" codec chain and does not resample,
+    // so its device runs at the rate the phone picked, 48 kHz when offered
+    if (config->rtsp_mode == RTSP_MODE_PASSTHROUGH)
+    {
+        return g_strdup("sbcparse");
+    }
+
+    // in-band fec carries a low bitrate copy of each frame in the next
+    // packet, the server's opusdec rebuilds a single lost packet from it
+    return g_strdup_printf("sbcparse ! sbcdec ! audioconvert ! audioresample ! "
+                           "opusenc audio-type=generic bitrate=%d frame-size=%d inband-fec=%s packet-loss-percentage=%d",
+                           config->opus_bitrate, config->opus_frame_size, config->opus_fec ? "true" : "false", config->opus_packet_loss);
+}
+
+void client_stop(client_t client)
+{
+    client_internal_t client_internal;
+
+    client_internal = (client_internal_t)client->internal;
+    if (client_internal->watch != 0)
+    {
+        g_source_remove(client_internal->watch);
+        client_internal->watch = 0;
+    }
+    if (client_internal->pipeline != NULL)
+    {
+        // sends TEARDOWN, the transport descriptor is closed by its owner
+        gst_element_set_state(client_internal->pipeline, GST_STATE_NULL);
+        gst_object_unref(client_internal->pipeline);
+        client_internal->pipeline = NULL;
+        INFOLN("client_stop: recording stopped")
+    }
+}
+
+gboolean client_message(GstBus *bus, GstMessage *message, gpointer user_data)
+{
+    client_t client;
+    client_internal_t client_internal;
+    GError *message_error;
+    gchar *debug;
+    GstState old_state;
+    GstState new_state;
+
+    client = (client_t)user_data;
+    client_internal = (client_internal_t)client->internal;
+    message_error = NULL;
+    debug = NULL;
+
+    switch (GST_MESSAGE_TYPE(message))
+    {
+    case GST_MESSAGE_ERROR:
+        gst_message_parse_error(message, &message_error, &debug);
+        ERRORF("client_message: %s\n", message_error->message)
+        DEBUGF("client_message: %s\n", debug != NULL ? debug : "no debug info")
+        break;
+    case GST_MESSAGE_WARNING:
+        gst_message_parse_warning(message, &message_error, &debug);
+        WARNF("client_message: %s\n", message_error->message)
+        break;
+    case GST_MESSAGE_STATE_CHANGED:
+        // rtspclientsink holds the pipeline back from PLAYING until RECORD
+        if (GST_MESSAGE_SRC(message) != GST_OBJECT(client_internal->pipeline) || client_internal->recording != 0)
+        {
+            break;
+        }
+        gst_message_parse_state_changed(message, &old_state, &new_state, NULL);
+        if (new_state == GST_STATE_PLAYING)
+        {
+            client_internal->recording = g_get_monotonic_time();
+            client_report_startup(client);
+        }
+        break;
+    default:
+        break;
+    }
+
+    CLEANUP_FUNCTION(message_error, g_error_free(message_error))
+    CLEANUP_FUNCTION(debug, g_free(debug))
+    return G_SOURCE_CONTINUE;
+}
+
+GstPadProbeReturn client_first_packet(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    client_t client;
+    client_internal_t client_internal;
+
+    client = (client_t)user_data;
+    client_internal = (client_internal_t)client->internal;
+
+    // streaming thread, the report itself runs on the main loop
+    client_internal->first_packet = g_get_monotonic_time();
+    g_idle_add(client_report_startup, client);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+gboolean client_report_startup(gpointer user_data)
+{
+    client_t client;
+    client_internal_t client_internal;
+
+    client = (client_t)user_data;
+    client_internal = (client_internal_t)client->internal;
+
+    if (client_internal->reported || client_internal->first_packet == 0 || client_internal->recording == 0)
+    {
+        return G_SOURCE_REMOVE;
+    }
+    client_internal->reported = TRUE;
+
+    INFOF("client_report_startup: audio flowing %.1f ms after startup (transport acquired %.1f ms, first packet %.1f ms, recording %.1f ms)\n",
+          (MAX(client_internal->first_packet, client_internal->recording) - client_internal->started) / 1000.0,
+          (client_internal->acquired - client_internal->started) / 1000.0, (client_internal->first_packet - client_internal->started) / 1000.0,
+          (client_internal->recording - client_internal->started) / 1000.0)
+
+    return G_SOURCE_REMOVE;
+}
+
+gboolean client_report_cpu(gpointer user_data)
+{
+    client_t client;
+    client_internal_t client_internal;
+    gint64 wall;
+    gint64 time;
+
+    client = (client_t)user_data;
+    client_internal = (client_internal_t)client->internal;
+
+    // logged with the mode so runs in either mode compare line for line
+    wall = g_get_monotonic_time();
+    time = client_cpu_time();
+    if (client_internal->pipeline != NULL && wall > client_internal->cpu_wall)
+    {
+        INFOF("client_report_cpu: %s: %.1f%% cpu over the last %.1f s\n",
+              client->config->rtsp_mode == RTSP_MODE_PASSTHROUGH ? "passthrough" : "transcode",
+              100.0 * (time - client_internal->cpu_time) / (wall - client_internal->cpu_wall), (wall - client_internal->cpu_wall) / 1000000.0)
+    }
+    client_internal->cpu_wall = wall;
+    client_internal->cpu_time = time;
+
+    return G_SOURCE_CONTINUE;
+}
+
+gint64 client_cpu_time(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+    return (gint64)usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec + (gint64)usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
+}
+
+gboolean client_signal(gpointer user_data)
+{
+    client_t client;
+
+    client = (client_t)user_data;
+    INFOLN("client_signal: signal received")
+    g_main_loop_quit(((client_internal_t)client->internal)->main_loop);
+    return G_SOURCE_CONTINUE;
+}
+
+void client_internal_destroy(client_internal_t client_internal)
+{
+    CLEANUP_FUNCTION(client_internal->a2dp, a2dp_unref(client_internal->a2dp))
+    CLEANUP_FUNCTION(client_internal->main_loop, g_main_loop_unref(client_internal->main_loop))
+    free(client_internal);
+}
+
+void client_destroy(client_t client)
+{
+    CLEANUP_FUNCTION(client->internal, client_internal_destroy((client_internal_t)client->internal))
+    CLEANUP_FUNCTION(client->config, config_unref(client->config))
+    CLEANUP_FUNCTION(client->logger, logger_unref(client->logger))
+    free(client);
+}
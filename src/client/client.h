@@ -1,11 +1,25 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
-struct
+#include "config.h"
+#include "logger.h"
+
+struct client_s
 {
+    int ref;
+    config_t config;
+    logger_t logger;
     void *internal;
-} client_s;
+};
+
+typedef struct client_s *client_t;
+
+int client_create(client_t *client, config_t config, logger_t logger, const char **error);
+
+void client_deploy(client_t client);
 
+void client_ref(client_t client);
 
+void client_unref(client_t client);
 
-#endif
\ No newline at end of file
+#endif
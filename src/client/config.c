@@ -0,0 +1,393 @@
+#include "config.h"
+#include "logger.h"
+#include <cjson/cJSON.h>
+
+static void config_parse(config_t config, cJSON *json);
+
+static void config_parse_log(config_t config, const cJSON *log);
+
+static void config_parse_rtsp(config_t config, const cJSON *rtsp);
+
+static void config_parse_opus(config_t config, const cJSON *opus);
+
+static void config_parse_bluetooth(config_t config, const cJSON *bluetooth);
+
+static void config_destroy(config_t config);
+
+int config_create(config_t *config, const char **error)
+{
+    int status;
+
+    status = STATUS_OK;
+
+    *config = (config_t)calloc(1, sizeof(struct config_s));
+    IF_THROW(*config == NULL, "config_create: failed to allocate config")
+
+    (*config)->ref = 1;
+    (*config)->log_path = "stdout";
+    (*config)->log_level = INFO;
+    (*config)->rtsp_host = "127.0.0.1";
+    (*config)->rtsp_port = "8554";
+    (*config)->rtsp_endpoint = NULL;
+    (*config)->rtsp_latency = 200;
+    (*config)->rtsp_mode = RTSP_MODE_TRANSCODE;
+    (*config)->rtsp_rtx = 0;
+    (*config)->opus_bitrate = 128000;
+    (*config)->opus_frame_size = 10;
+    (*config)->opus_fec = 1;
+    (*config)->opus_packet_loss = 5;
+    (*config)->bluetooth_endpoint = NULL;
+    (*config)->bluetooth_adapter = "hci0";
+    (*config)->bluetooth_bus = BLUETOOTH_BUS_SYSTEM;
+    (*config)->bluetooth_source = BLUETOOTH_SOURCE_TRANSPORT;
+    (*config)->json = NULL;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    return status;
+}
+
+int config_load(config_t config, const char *const path, const char **error)
+{
+    int status;
+    FILE *config_file;
+    long file_size;
+    void *file_buffer;
+    cJSON *json;
+
+    status = STATUS_OK;
+    config_file = NULL;
+    file_buffer = NULL;
+    json = NULL;
+
+    config_file = fopen(path, "r");
+    IF_THROW(config_file == NULL, "config_load: failed to open config file")
+
+    IF_THROW(fseek(config_file, 0, SEEK_END) != 0, "config_load: failed to seek end of file")
+
+    file_size = ftell(config_file);
+    IF_THROW(file_size <= 0, "config_load: empty config file")
+
+    IF_THROW(fseek(config_file, 0, SEEK_SET) != 0, "config_load: failed to seek start of file")
+
+    file_buffer = calloc(file_size, 1);
+    IF_THROW(file_buffer == NULL, "config_load: failed to allocate file buffer")
+
+    IF_THROW(fread(file_buffer, sizeof(char), file_size, config_file) != (size_t)file_size, "config_load: failed to read config file")
+
+    json = cJSON_ParseWithLength(file_buffer, file_size);
+    IF_THROW(json == NULL, "config_load: failed to create json parser")
+
+    config_parse(config, json);
+    config->path = path;
+
+    CLEANUP_FUNCTION(config->json, cJSON_Delete((cJSON *)config->json))
+
+    config->json = (void *)json;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(config_file, fclose(config_file))
+    CLEANUP(file_buffer)
+    return status;
+}
+
+int config_validate(config_t config, const char **error)
+{
+    int status;
+    int port;
+
+    status = STATUS_OK;
+
+    IF_THROW(config->log_path == NULL || strlen(config->log_path) > PATH_MAX, "config_validate: invalid log path")
+
+    IF_THROW(config->log_level < ERROR || config->log_level > TRACE, "config_validate: invalid log level")
+
+    IF_THROW(config->rtsp_host == NULL, "config_validate: invalid rtsp host")
+
+    IF_THROW(config->rtsp_port == NULL, "config_validate: invalid rtsp port")
+    port = atoi(config->rtsp_port);
+    IF_THROW(port < 1 || port > UINT16_MAX, "config_validate: invalid rtsp port")
+
+    IF_THROW(config->rtsp_endpoint == NULL, "config_validate: missing rtsp endpoint")
+
+    IF_THROW(config->rtsp_latency < 0, "config_validate: invalid rtsp latency")
+
+    IF_THROW(config->rtsp_mode < 0, "config_validate: invalid rtsp mode")
+
+    IF_THROW(config->rtsp_rtx < 0, "config_validate: invalid rtsp rtx")
+
+    IF_THROW(config->opus_bitrate < 6000 || config->opus_bitrate > 510000, "config_validate: invalid opus bitrate")
+
+    IF_THROW(config->opus_frame_size != 5 && config->opus_frame_size != 10 && config->opus_frame_size != 20 && config->opus_frame_size != 40 &&
+                 config->opus_frame_size != 60,
+             "config_validate: invalid opus frame size")
+
+    IF_THROW(config->opus_fec < 0, "config_validate: invalid opus fec")
+
+    IF_THROW(config->opus_packet_loss < 0 || config->opus_packet_loss > 100, "config_validate: invalid opus packet loss")
+
+    IF_THROW(config->bluetooth_bus < 0, "config_validate: invalid bluetooth bus")
+
+    IF_THROW(config->bluetooth_source < 0, "config_validate: invalid bluetooth source")
+
+    IF_THROW(config->bluetooth_source == BLUETOOTH_SOURCE_TRANSPORT && config->bluetooth_endpoint == NULL,
+             "config_validate: missing bluetooth endpoint")
+
+    IF_THROW(config->bluetooth_adapter == NULL, "config_validate: invalid bluetooth adapter")
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    return status;
+}
+
+void config_ref(config_t config)
+{
+    config->ref++;
+}
+
+void config_unref(config_t config)
+{
+    assert(config != NULL);
+    assert(config->ref >= 1);
+    if (--config->ref == 0)
+    {
+        config_destroy(config);
+    }
+}
+
+void config_parse(config_t config, cJSON *json)
+{
+    const cJSON *log;
+    const cJSON *rtsp;
+    const cJSON *bluetooth;
+
+    log = cJSON_GetObjectItem(json, "log");
+    if (log != NULL && cJSON_IsObject(log))
+    {
+        config_parse_log(config, log);
+    }
+
+    rtsp = cJSON_GetObjectItem(json, "rtsp");
+    if (rtsp != NULL && cJSON_IsObject(rtsp))
+    {
+        config_parse_rtsp(config, rtsp);
+    }
+
+    bluetooth = cJSON_GetObjectItem(json, "bluetooth");
+    if (bluetooth != NULL && cJSON_IsObject(bluetooth))
+    {
+        config_parse_bluetooth(config, bluetooth);
+    }
+}
+
+void config_parse_log(config_t config, const cJSON *log)
+{
+    const cJSON *log_path;
+    const cJSON *log_level;
+
+    log_path = cJSON_GetObjectItem(log, "path");
+    if (log_path != NULL && cJSON_IsString(log_path))
+    {
+        config->log_path = log_path->valuestring;
+    }
+
+    log_level = cJSON_GetObjectItem(log, "level");
+    if (log_level != NULL && cJSON_IsString(log_level))
+    {
+        if (strcmp(log_level->valuestring, "error") == 0)
+        {
+            config->log_level = ERROR;
+        }
+        else if (strcmp(log_level->valuestring, "warn") == 0)
+        {
+            config->log_level = WARN;
+        }
+        else if (strcmp(log_level->valuestring, "info") == 0)
+        {
+            config->log_level = INFO;
+        }
+        else if (strcmp(log_level->valuestring, "debug") == 0)
+        {
+            config->log_level = DEBUG;
+        }
+        else if (strcmp(log_level->valuestring, "trace") == 0)
+        {
+            config->log_level = TRACE;
+        }
+        else
+        {
+            config->log_level = -1;
+        }
+    }
+}
+
+void config_parse_rtsp(config_t config, const cJSON *rtsp)
+{
+    const cJSON *rtsp_host;
+    const cJSON *rtsp_port;
+    const cJSON *rtsp_endpoint;
+    const cJSON *rtsp_latency;
+    const cJSON *rtsp_mode;
+    const cJSON *rtsp_rtx;
+    const cJSON *opus;
+
+    rtsp_host = cJSON_GetObjectItem(rtsp, "host");
+    if (rtsp_host != NULL)
+    {
+        config->rtsp_host = cJSON_IsString(rtsp_host) ? rtsp_host->valuestring : NULL;
+    }
+
+    rtsp_port = cJSON_GetObjectItem(rtsp, "port");
+    if (rtsp_port != NULL)
+    {
+        config->rtsp_port = cJSON_IsString(rtsp_port) ? rtsp_port->valuestring : NULL;
+    }
+
+    rtsp_endpoint = cJSON_GetObjectItem(rtsp, "endpoint");
+    if (rtsp_endpoint != NULL && cJSON_IsString(rtsp_endpoint))
+    {
+        config->rtsp_endpoint = rtsp_endpoint->valuestring;
+    }
+
+    rtsp_latency = cJSON_GetObjectItem(rtsp, "latency");
+    if (rtsp_latency != NULL)
+    {
+        config->rtsp_latency = cJSON_IsNumber(rtsp_latency) ? rtsp_latency->valueint : -1;
+    }
+
+    // passthrough sends the A2DP frames as received, the endpoint has to
+    // use the matching codec on the server
+    rtsp_mode = cJSON_GetObjectItem(rtsp, "mode");
+    if (rtsp_mode != NULL && cJSON_IsString(rtsp_mode))
+    {
+        if (strcmp(rtsp_mode->valuestring, "transcode") == 0)
+        {
+            config->rtsp_mode = RTSP_MODE_TRANSCODE;
+        }
+        else if (strcmp(rtsp_mode->valuestring, "passthrough") == 0)
+        {
+            config->rtsp_mode = RTSP_MODE_PASSTHROUGH;
+        }
+        else
+        {
+            config->rtsp_mode = -1;
+        }
+    }
+
+    rtsp_rtx = cJSON_GetObjectItem(rtsp, "rtx");
+    if (rtsp_rtx != NULL)
+    {
+        config->rtsp_rtx = cJSON_IsBool(rtsp_rtx) ? cJSON_IsTrue(rtsp_rtx) : -1;
+    }
+
+    opus = cJSON_GetObjectItem(rtsp, "opus");
+    if (opus != NULL && cJSON_IsObject(opus))
+    {
+        config_parse_opus(config, opus);
+    }
+}
+
+void config_parse_opus(config_t config, const cJSON *opus)
+{
+    const cJSON *opus_bitrate;
+    const cJSON *opus_frame_size;
+    const cJSON *opus_fec;
+    const cJSON *opus_packet_loss;
+
+    opus_bitrate = cJSON_GetObjectItem(opus, "bitrate");
+    if (opus_bitrate != NULL)
+    {
+        config->opus_bitrate = cJSON_IsNumber(opus_bitrate) ? opus_bitrate->valueint : -1;
+    }
+
+    opus_frame_size = cJSON_GetObjectItem(opus, "frame_size");
+    if (opus_frame_size != NULL)
+    {
+        config->opus_frame_size = cJSON_IsNumber(opus_frame_size) ? opus_frame_size->valueint : -1;
+    }
+
+    opus_fec = cJSON_GetObjectItem(opus, "fec");
+    if (opus_fec != NULL)
+    {
+        config->opus_fec = cJSON_IsBool(opus_fec) ? cJSON_IsTrue(opus_fec) : -1;
+    }
+
+    // the encoder only spends bits on fec when it expects loss
+    opus_packet_loss = cJSON_GetObjectItem(opus, "packet_loss");
+    if (opus_packet_loss != NULL)
+    {
+        config->opus_packet_loss = cJSON_IsNumber(opus_packet_loss) ? opus_packet_loss->valueint : -1;
+    }
+}
+
+void config_parse_bluetooth(config_t config, const cJSON *bluetooth)
+{
+    const cJSON *bluetooth_endpoint;
+    const cJSON *bluetooth_adapter;
+    const cJSON *bluetooth_bus;
+    const cJSON *bluetooth_source;
+
+    bluetooth_endpoint = cJSON_GetObjectItem(bluetooth, "endpoint");
+    if (bluetooth_endpoint != NULL && cJSON_IsString(bluetooth_endpoint))
+    {
+        config->bluetooth_endpoint = bluetooth_endpoint->valuestring;
+    }
+
+    bluetooth_adapter = cJSON_GetObjectItem(bluetooth, "adapter");
+    if (bluetooth_adapter != NULL)
+    {
+        config->bluetooth_adapter = cJSON_IsString(bluetooth_adapter) ? bluetooth_adapter->valuestring : NULL;
+    }
+
+    // bluez-mock runs on the session bus without root
+    bluetooth_bus = cJSON_GetObjectItem(bluetooth, "bus");
+    if (bluetooth_bus != NULL && cJSON_IsString(bluetooth_bus))
+    {
+        if (strcmp(bluetooth_bus->valuestring, "system") == 0)
+        {
+            config->bluetooth_bus = BLUETOOTH_BUS_SYSTEM;
+        }
+        else if (strcmp(bluetooth_bus->valuestring, "session") == 0)
+        {
+            config->bluetooth_bus = BLUETOOTH_BUS_SESSION;
+        }
+        else
+        {
+            config->bluetooth_bus = -1;
+        }
+    }
+
+    // the test source stands in for the transport with locally encoded SBC
+    bluetooth_source = cJSON_GetObjectItem(bluetooth, "source");
+    if (bluetooth_source != NULL && cJSON_IsString(bluetooth_source))
+    {
+        if (strcmp(bluetooth_source->valuestring, "transport") == 0)
+        {
+            config->bluetooth_source = BLUETOOTH_SOURCE_TRANSPORT;
+        }
+        else if (strcmp(bluetooth_source->valuestring, "test") == 0)
+        {
+            config->bluetooth_source = BLUETOOTH_SOURCE_TEST;
+        }
+        else
+        {
+            config->bluetooth_source = -1;
+        }
+    }
+}
+
+void config_destroy(config_t config)
+{
+    if (config->json != NULL)
+    {
+        cJSON_Delete((cJSON *)config->json);
+    }
+    free(config);
+}
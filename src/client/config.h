@@ -0,0 +1,57 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+#include "common.h"
+
+enum rtsp_modes
+{
+    RTSP_MODE_TRANSCODE,
+    RTSP_MODE_PASSTHROUGH
+};
+
+enum bluetooth_buses
+{
+    BLUETOOTH_BUS_SYSTEM,
+    BLUETOOTH_BUS_SESSION
+};
+
+enum bluetooth_sources
+{
+    BLUETOOTH_SOURCE_TRANSPORT,
+    BLUETOOTH_SOURCE_TEST
+};
+
+struct config_s
+{
+    int ref;
+    const char *path;
+    char *log_path;
+    int log_level;
+    char *rtsp_host;
+    char *rtsp_port;
+    char *rtsp_endpoint;
+    int rtsp_latency;
+    int rtsp_mode;
+    int rtsp_rtx;
+    int opus_bitrate;
+    int opus_frame_size;
+    int opus_fec;
+    int opus_packet_loss;
+    char *bluetooth_endpoint;
+    char *bluetooth_adapter;
+    int bluetooth_bus;
+    int bluetooth_source;
+    void *json;
+};
+typedef struct config_s *config_t;
+
+int config_create(config_t *config, const char ** error);
+
+int config_load(config_t config, const char * const path, const char ** error);
+
+int config_validate(config_t config, const char ** error);
+
+void config_ref(config_t config);
+
+void config_unref(config_t config);
+
+#endif
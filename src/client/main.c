@@ -1,22 +1,122 @@
 /*
- * bluez_list_devices.c - Find the Bluetooth devices
- * 	- The example uses GDBUS to get the list of bluetooth devices using DBUS
- * 	  interfaces provided by bluez. This lists only the devices which are already or
- *	  currently enumerated by the Adapter.
- * 	- The device may be appeared in followind conditions,
- *		- Previously paired with Adapter
- *		- Previously paired and connected with Adapter
- *		- Appeared after StartDiscovery session (but not yet used/removed)
- * gcc `pkg-config --cflags glib-2.0 gio-2.0` -Wall -Wextra -o ./bin/bluez_list_devices ./bluez_list_devices.c `pkg-config --libs glib-2.0 gio-2.0`
+ * main.c - sound system client
+ * 	- Registers an A2DP sink endpoint with BlueZ and, once a phone starts
+ * 	  streaming, reads the SBC transport and records it to a server endpoint
+ * 	  over RTSP RECORD.
+ * 	- Usage: client <config.json>
  */
 
-#include <glib.h>
-#include <gio/gio.h>
-#include <glib-unix.h>
-#include "a2dp.h"
+#include "client.h"
+#include <gst/gst.h>
 
-int main(void)
+static int main_open_log(config_t config, FILE **file, close_file_fn *close_fn, const char **error);
+
+int main(int argc, char **argv)
+{
+    gst_init(NULL,NULL);
+    config_t config;
+    logger_t logger;
+    client_t client;
+    FILE *log_file;
+    close_file_fn log_close_fn;
+    int status;
+    const char *error;
+
+    status = STATUS_OK;
+    config = NULL;
+    logger = NULL;
+    client = NULL;
+    log_file = NULL;
+    log_close_fn = NULL;
+
+    if(argc < 2)
+    {
+        puts("main: no config file");
+        goto error;
+    }
+
+    if(config_create(&config,&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: config_create failed");
+        goto error;
+    }
+
+    if(config_load(config,argv[1],&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: config_load failed");
+        goto error;
+    }
+
+    if(config_validate(config,&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: config_validate failed");
+        goto error;
+    }
+
+    if(main_open_log(config,&log_file,&log_close_fn,&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: failed to open log file");
+        goto error;
+    }
+
+    if(logger_create(&logger,config->log_level,log_file,log_close_fn,NULL,&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: logger_create failed");
+        CLEANUP_FUNCTION(log_close_fn, log_close_fn(log_file))
+        goto error;
+    }
+
+    if(client_create(&client,config,logger,&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: client_create failed");
+        goto error;
+    }
+
+    client_deploy(client);
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(client, client_unref(client))
+    CLEANUP_FUNCTION(config, config_unref(config))
+    CLEANUP_FUNCTION(logger, logger_unref(logger))
+    gst_deinit();
+    return status;
+}
+
+int main_open_log(config_t config, FILE **file, close_file_fn *close_fn, const char **error)
 {
-	
-	return 0;
-}
\ No newline at end of file
+    int status;
+
+    status = STATUS_OK;
+    *file = NULL;
+    *close_fn = NULL;
+
+    if(strcmp(config->log_path, "stdout") == 0)
+    {
+        *file = stdout;
+    }
+    else if(strcmp(config->log_path, "stderr") == 0)
+    {
+        *file = stderr;
+    }
+    else
+    {
+        *file = fopen(config->log_path, "a");
+        IF_THROW(*file == NULL, "main_open_log: failed to open log path")
+        *close_fn = fclose;
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    return status;
+}
@@ -0,0 +1,54 @@
+#ifndef A2DP_H
+#define A2DP_H
+
+#include "logger.h"
+#include <gio/gio.h>
+
+#define A2DP_SINK_UUID "0000110b-0000-1000-8000-00805f9b34fb"
+#define A2DP_CODEC_SBC 0x00
+
+struct a2dp_transport_s
+{
+    char *path;
+    int fd;
+    guint16 read_mtu;
+    guint16 write_mtu;
+    guint8 codec;
+    int rate;
+    int channels;
+    guint8 configuration[8];
+    gsize configuration_size;
+};
+typedef struct a2dp_transport_s *a2dp_transport_t;
+
+typedef void (*a2dp_transport_fn)(a2dp_transport_t transport, void *user_data);
+
+struct a2dp_s
+{
+    int ref;
+    logger_t logger;
+    GDBusConnection *connection;
+    GDBusNodeInfo *node_info;
+    char *adapter_path;
+    char *endpoint_path;
+    guint registration;
+    guint subscription;
+    a2dp_transport_t transport;
+    gboolean acquired;
+    a2dp_transport_fn acquired_fn;
+    a2dp_transport_fn released_fn;
+    void *user_data;
+};
+typedef struct a2dp_s *a2dp_t;
+
+int a2dp_create(a2dp_t *a2dp, GBusType bus_type, const char *adapter, const char *endpoint, logger_t logger, const char **error);
+
+void a2dp_set_callbacks(a2dp_t a2dp, a2dp_transport_fn acquired_fn, a2dp_transport_fn released_fn, void *user_data);
+
+int a2dp_register(a2dp_t a2dp, const char **error);
+
+void a2dp_ref(a2dp_t a2dp);
+
+void a2dp_unref(a2dp_t a2dp);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef BINARY_H
+#define BINARY_H
+#include "common.h"
+
+#define BINARY_VERSION 1
+#define BINARY_MAGIC "SLOG"
+#define BINARY_RECORD_SIZE 512
+#define BINARY_MAX_FORMATS 1024
+#define BINARY_MAX_ARGS 16
+#define BINARY_TEXT_ID 0xffff
+// precision of a spec without one, and of one taken from a star argument
+#define BINARY_PRECISION_NONE -1
+#define BINARY_PRECISION_STAR -2
+
+enum binary_kinds
+{
+    BINARY_PADDING,
+    BINARY_HEADER,
+    BINARY_DEFINE,
+    BINARY_RECORD
+};
+
+enum binary_types
+{
+    BINARY_NONE,
+    BINARY_INT,
+    BINARY_LONG,
+    BINARY_LONG_LONG,
+    BINARY_SIZE,
+    BINARY_INTMAX,
+    BINARY_PTRDIFF,
+    BINARY_DOUBLE,
+    BINARY_STRING,
+    BINARY_POINTER,
+    BINARY_UNSUPPORTED
+};
+
+// every record starts with this header in native byte order, followed by
+// length bytes of payload: the magic for a header, the format string for a
+// define and the raw arguments (or preformatted text) for a record
+struct binary_record_s
+{
+    uint8_t kind;
+    uint8_t level;
+    uint16_t id;
+    uint16_t length;
+    uint16_t reserved;
+    uint64_t timestamp;
+};
+typedef struct binary_record_s *binary_record_t;
+
+struct binary_spec_s
+{
+    const char *start;
+    size_t length;
+    int stars;
+    int precision;
+    int type;
+};
+typedef struct binary_spec_s *binary_spec_t;
+
+struct binary_signature_s
+{
+    int ntypes;
+    unsigned char types[BINARY_MAX_ARGS];
+    // strings are never read past their precision
+    int precisions[BINARY_MAX_ARGS];
+};
+typedef struct binary_signature_s *binary_signature_t;
+
+const char *binary_next_spec(const char *format, binary_spec_t spec);
+
+int binary_parse(binary_signature_t signature, const char *format);
+
+int binary_encode_header(char *buffer, size_t size);
+
+int binary_encode_define(char *buffer, size_t size, int id, const char *format);
+
+int binary_encode_record(char *buffer, size_t size, int level, int id, binary_signature_t signature, va_list args);
+
+int binary_encode_text(char *buffer, size_t size, int level, const char *format, va_list args);
+
+int binary_decode_record(FILE *file, const char *format, const char *payload, size_t length);
+
+#endif
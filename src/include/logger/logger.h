@@ -1,9 +1,37 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 #include "common.h"
+#include <stdatomic.h>
 
 typedef int (*close_file_fn)(FILE *);
 
+enum logger_modes
+{
+    LOGGER_MODE_SYNC,
+    LOGGER_MODE_ASYNC
+};
+
+enum logger_formats
+{
+    LOGGER_FORMAT_TEXT,
+    LOGGER_FORMAT_BINARY
+};
+
+enum logger_overflow_policies
+{
+    LOGGER_OVERFLOW_DROP,
+    LOGGER_OVERFLOW_BLOCK
+};
+
+struct logger_options_s
+{
+    int mode;
+    int format;
+    int overflow;
+    int capacity;
+};
+typedef struct logger_options_s *logger_options_t;
+
 struct logger_s
 {
     int ref;
@@ -12,15 +40,41 @@ struct logger_s
     close_file_fn close_fn;
     int color;
     void *mutex;
+    void *queue;
+    void *formats;
 };
 typedef struct logger_s *logger_t;
 
-int logger_create(logger_t *logger, int level, FILE *file, close_file_fn close_fn, const char ** error);
+// binary logs look a format up once per call site, the site keeps the entry
+// its format was interned in and later calls only copy their arguments. The
+// format has to be the same string every time the site runs
+struct logger_site_s
+{
+    _Atomic(void *) entry;
+};
+typedef struct logger_site_s *logger_site_t;
+
+#define LOGGER_SITEF(LOGGER, LEVEL, FORMAT, ...)                       \
+    do                                                                 \
+    {                                                                  \
+        static struct logger_site_s logger_site;                       \
+        logger_logf(LOGGER, LEVEL, &logger_site, FORMAT, __VA_ARGS__); \
+    } while (0)
+
+int logger_create(logger_t *logger, int level, FILE *file, close_file_fn close_fn, logger_options_t options, const char ** error);
+
+uint64_t logger_dropped(logger_t logger);
+
+int logger_rotate(logger_t logger, char *buffer, size_t size);
+
+void logger_print_level(FILE *file, int level, int color);
 
 void logger_ref(logger_t logger);
 
 void logger_unref(logger_t logger);
 
+void logger_logf(logger_t logger, int level, logger_site_t site, const char *format, ...);
+
 void logger_errorf(logger_t logger, const char *format, ...);
 
 void logger_errorln(logger_t logger, const char *const message);
@@ -0,0 +1,18 @@
+#ifndef SINK_H
+#define SINK_H
+#include "common.h"
+
+// fills the start of a new segment, returns the number of bytes written
+typedef int (*sink_rotate_fn)(void *, char *, size_t);
+
+typedef struct sink_s *sink_t;
+
+int sink_open(FILE **file, sink_t *sink, const char *path, size_t segment_size, int segment_count, const char **error);
+
+void sink_set_rotate_fn(sink_t sink, sink_rotate_fn rotate_fn, void *user_data);
+
+uint64_t sink_rotations(sink_t sink);
+
+uint64_t sink_truncate_errors(sink_t sink);
+
+#endif
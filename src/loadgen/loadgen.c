@@ -0,0 +1,482 @@
+#include "loadgen.h"
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(loadgen->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(loadgen->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(loadgen->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(loadgen->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(loadgen->logger, TRACE, FORMAT, __VA_ARGS__);
+
+// RTCP receiver reports arrive every few seconds, sampling faster only
+// repeats the last round trip
+#define LOADGEN_SAMPLE_INTERVAL 500
+
+static int loadgen_session_start(loadgen_t loadgen, loadgen_session_t session, const char **error);
+
+static void loadgen_new_manager(GstElement *sink, GstElement *manager, gpointer user_data);
+
+static gboolean loadgen_message(GstBus *bus, GstMessage *message, gpointer user_data);
+
+static gboolean loadgen_sample(gpointer user_data);
+
+static void loadgen_sample_session(loadgen_t loadgen, loadgen_session_t session);
+
+static gboolean loadgen_stop(gpointer user_data);
+
+static cJSON *loadgen_distribution(GArray *values);
+
+static double loadgen_percentile(GArray *sorted, double percentile);
+
+static gint loadgen_compare(gconstpointer a, gconstpointer b);
+
+static void loadgen_destroy(loadgen_t loadgen);
+
+int loadgen_create(loadgen_t *loadgen, loadgen_options_t options, logger_t logger, const char **error)
+{
+    int status;
+    loadgen_t new_loadgen;
+    int index;
+
+    status = STATUS_OK;
+    new_loadgen = NULL;
+
+    IF_THROW(loadgen == NULL, "loadgen_create: null loadgen")
+    IF_THROW(options == NULL, "loadgen_create: null options")
+    IF_THROW(logger == NULL, "loadgen_create: null logger")
+    IF_THROW(options->sessions < 1, "loadgen_create: invalid session count")
+    IF_THROW(options->duration < 1, "loadgen_create: invalid duration")
+
+    new_loadgen = calloc(1, sizeof(struct loadgen_s));
+    IF_THROW(new_loadgen == NULL, "loadgen_create: failed to allocate loadgen")
+
+    new_loadgen->ref = 1;
+    new_loadgen->logger = logger;
+    logger_ref(logger);
+    new_loadgen->options = *options;
+
+    new_loadgen->sessions = calloc(options->sessions, sizeof(struct loadgen_session_s));
+    IF_THROW(new_loadgen->sessions == NULL, "loadgen_create: failed to allocate sessions")
+
+    for (index = 0; index < options->sessions; index++)
+    {
+        new_loadgen->sessions[index].loadgen = new_loadgen;
+        new_loadgen->sessions[index].index = index;
+        new_loadgen->sessions[index].setup = -1;
+        new_loadgen->sessions[index].location = g_strdup_printf("rtsp://%s:%d/%s%d", options->host, options->port, options->prefix, index);
+        new_loadgen->sessions[index].round_trips = g_array_new(FALSE, FALSE, sizeof(double));
+        IF_THROW(new_loadgen->sessions[index].location == NULL || new_loadgen->sessions[index].round_trips == NULL,
+                 "loadgen_create: failed to allocate session")
+    }
+
+    new_loadgen->main_loop = g_main_loop_new(NULL, FALSE);
+    IF_THROW(new_loadgen->main_loop == NULL, "loadgen_create: failed to allocate loop")
+
+    *loadgen = new_loadgen;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_loadgen, loadgen_destroy(new_loadgen))
+done:
+    return status;
+}
+
+int loadgen_run(loadgen_t loadgen, const char **error)
+{
+    int status;
+    int index;
+
+    status = STATUS_OK;
+
+    INFOF("loadgen_run: starting %d sessions for %d s\n", loadgen->options.sessions, loadgen->options.duration)
+
+    for (index = 0; index < loadgen->options.sessions; index++)
+    {
+        if (loadgen_session_start(loadgen, loadgen->sessions + index, error) != STATUS_OK)
+        {
+            goto error;
+        }
+    }
+
+    loadgen->sample_source = g_timeout_add(LOADGEN_SAMPLE_INTERVAL, loadgen_sample, loadgen);
+    g_timeout_add_seconds(loadgen->options.duration, loadgen_stop, loadgen);
+    g_main_loop_run(loadgen->main_loop);
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    // stopping sends TEARDOWN, do it before the report so sessions end together
+    for (index = 0; index < loadgen->options.sessions; index++)
+    {
+        if (loadgen->sessions[index].pipeline != NULL)
+        {
+            gst_element_set_state(loadgen->sessions[index].pipeline, GST_STATE_NULL);
+        }
+    }
+    return status;
+}
+
+cJSON *loadgen_report(loadgen_t loadgen)
+{
+    cJSON *report;
+    cJSON *streams;
+    cJSON *stream;
+    GArray *setups;
+    GArray *round_trips;
+    GArray *latencies;
+    loadgen_session_t session;
+    double value;
+    guint64 packets_sent;
+    gint64 packets_lost;
+    int connected;
+    int index;
+    guint sample;
+
+    report = cJSON_CreateObject();
+    streams = cJSON_CreateArray();
+    setups = g_array_new(FALSE, FALSE, sizeof(double));
+    round_trips = g_array_new(FALSE, FALSE, sizeof(double));
+    latencies = g_array_new(FALSE, FALSE, sizeof(double));
+    packets_sent = 0;
+    packets_lost = 0;
+    connected = 0;
+
+    for (index = 0; index < loadgen->options.sessions; index++)
+    {
+        session = loadgen->sessions + index;
+        stream = cJSON_CreateObject();
+        cJSON_AddStringToObject(stream, "location", session->location);
+        cJSON_AddStringToObject(stream, "state", session->failed ? "failed" : session->setup >= 0 ? "playing" : "pending");
+
+        if (session->setup >= 0)
+        {
+            value = session->setup / 1000.0;
+            g_array_append_val(setups, value);
+            cJSON_AddNumberToObject(stream, "setup_ms", value);
+            connected++;
+        }
+        else
+        {
+            cJSON_AddNullToObject(stream, "setup_ms");
+        }
+
+        // RECORD has no media return path, so end to end is only estimated,
+        // as half the RTCP round trip plus the server's jitterbuffer. The
+        // field name says so, nothing here is measured at the sink
+        for (sample = 0; sample < session->round_trips->len; sample++)
+        {
+            value = g_array_index(session->round_trips, double, sample);
+            g_array_append_val(round_trips, value);
+            value = value / 2.0 + loadgen->options.latency;
+            g_array_append_val(latencies, value);
+        }
+
+        cJSON_AddNumberToObject(stream, "packets_sent", (double)session->packets_sent);
+        cJSON_AddNumberToObject(stream, "packets_lost", (double)session->packets_lost);
+        cJSON_AddItemToObject(stream, "round_trip_ms", loadgen_distribution(session->round_trips));
+        cJSON_AddItemToArray(streams, stream);
+
+        packets_sent += session->packets_sent;
+        packets_lost += session->packets_lost;
+    }
+
+    cJSON_AddNumberToObject(report, "sessions", loadgen->options.sessions);
+    cJSON_AddNumberToObject(report, "connected", connected);
+    cJSON_AddNumberToObject(report, "duration_s", loadgen->options.duration);
+    cJSON_AddNumberToObject(report, "jitterbuffer_ms", loadgen->options.latency);
+    cJSON_AddItemToObject(report, "setup_ms", loadgen_distribution(setups));
+    cJSON_AddItemToObject(report, "round_trip_ms", loadgen_distribution(round_trips));
+    cJSON_AddItemToObject(report, "estimated_latency_ms", loadgen_distribution(latencies));
+    cJSON_AddStringToObject(report, "estimated_latency_method", "rtcp_round_trip_half_plus_jitterbuffer");
+    cJSON_AddNumberToObject(report, "packets_sent", (double)packets_sent);
+    cJSON_AddNumberToObject(report, "packets_lost", (double)packets_lost);
+    cJSON_AddNumberToObject(report, "loss_ratio", packets_sent > 0 ? (double)packets_lost / packets_sent : 0.0);
+    cJSON_AddItemToObject(report, "streams", streams);
+
+    g_array_unref(setups);
+    g_array_unref(round_trips);
+    g_array_unref(latencies);
+    return report;
+}
+
+void loadgen_ref(loadgen_t loadgen)
+{
+    loadgen->ref++;
+}
+
+void loadgen_unref(loadgen_t loadgen)
+{
+    assert(loadgen != NULL);
+    assert(loadgen->ref >= 1);
+    if (--loadgen->ref == 0)
+    {
+        loadgen_destroy(loadgen);
+    }
+}
+
+int loadgen_session_start(loadgen_t loadgen, loadgen_session_t session, const char **error)
+{
+    int status;
+    char *description;
+    GError *parse_error;
+    GstElement *sink;
+    GstBus *bus;
+
+    status = STATUS_OK;
+    parse_error = NULL;
+    sink = NULL;
+
+    // the same opus chain the client uses with its default settings, driven
+    // by a live test tone
+    description = g_strdup_printf(
+        "audiotestsrc is-live=true wave=sine ! audio/x-raw,rate=%d,channels=%d ! audioconvert ! "
+        "opusenc audio-type=generic bitrate=128000 frame-size=10 inband-fec=true packet-loss-percentage=5 ! "
+        "rtspclientsink name=sink location=%s",
+        loadgen->options.rate, loadgen->options.channels, session->location);
+    IF_THROW(description == NULL, "loadgen_session_start: failed to allocate description")
+
+    session->pipeline = gst_parse_launch(description, &parse_error);
+    if (parse_error != NULL)
+    {
+        ERRORF("loadgen_session_start: %s\n", parse_error->message)
+    }
+    IF_THROW(session->pipeline == NULL || parse_error != NULL, "loadgen_session_start: failed to build pipeline")
+
+    sink = gst_bin_get_by_name(GST_BIN(session->pipeline), "sink");
+    IF_THROW(sink == NULL, "loadgen_session_start: missing rtspclientsink")
+    g_signal_connect(sink, "new-manager", G_CALLBACK(loadgen_new_manager), session);
+
+    bus = gst_element_get_bus(session->pipeline);
+    session->watch = gst_bus_add_watch(bus, loadgen_message, session);
+    gst_object_unref(bus);
+
+    session->started = g_get_monotonic_time();
+    IF_THROW(gst_element_set_state(session->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE,
+             "loadgen_session_start: failed to start pipeline")
+
+    DEBUGF("loadgen_session_start: %s\n", session->location)
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(sink, gst_object_unref(sink))
+    CLEANUP_FUNCTION(parse_error, g_error_free(parse_error))
+    CLEANUP_FUNCTION(description, g_free(description))
+    return status;
+}
+
+void loadgen_new_manager(GstElement *sink, GstElement *manager, gpointer user_data)
+{
+    loadgen_session_t session;
+
+    session = (loadgen_session_t)user_data;
+    CLEANUP_FUNCTION(session->manager, gst_object_unref(session->manager))
+    session->manager = gst_object_ref(manager);
+}
+
+gboolean loadgen_message(GstBus *bus, GstMessage *message, gpointer user_data)
+{
+    loadgen_session_t session;
+    loadgen_t loadgen;
+    GError *message_error;
+    gchar *debug;
+    GstState old_state;
+    GstState new_state;
+
+    session = (loadgen_session_t)user_data;
+    loadgen = (loadgen_t)session->loadgen;
+    message_error = NULL;
+    debug = NULL;
+
+    switch (GST_MESSAGE_TYPE(message))
+    {
+    case GST_MESSAGE_ERROR:
+        gst_message_parse_error(message, &message_error, &debug);
+        ERRORF("loadgen_message: %s: %s\n", session->location, message_error->message)
+        session->failed = TRUE;
+        break;
+    case GST_MESSAGE_STATE_CHANGED:
+        // rtspclientsink only lets the pipeline reach PLAYING once RECORD
+        // has been answered, which is what a phone waits for on reconnect
+        if (GST_MESSAGE_SRC(message) != GST_OBJECT(session->pipeline) || session->setup >= 0)
+        {
+            break;
+        }
+        gst_message_parse_state_changed(message, &old_state, &new_state, NULL);
+        if (new_state == GST_STATE_PLAYING)
+        {
+            session->setup = g_get_monotonic_time() - session->started;
+            INFOF("loadgen_message: %s: recording after %.1f ms\n", session->location, session->setup / 1000.0)
+        }
+        break;
+    default:
+        break;
+    }
+
+    CLEANUP_FUNCTION(message_error, g_error_free(message_error))
+    CLEANUP_FUNCTION(debug, g_free(debug))
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean loadgen_sample(gpointer user_data)
+{
+    loadgen_t loadgen;
+    int index;
+
+    loadgen = (loadgen_t)user_data;
+    for (index = 0; index < loadgen->options.sessions; index++)
+    {
+        if (loadgen->sessions[index].manager != NULL && !loadgen->sessions[index].failed)
+        {
+            loadgen_sample_session(loadgen, loadgen->sessions + index);
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+void loadgen_sample_session(loadgen_t loadgen, loadgen_session_t session)
+{
+    GObject *rtp_session;
+    GstStructure *stats;
+    const GValue *value;
+    GValueArray *sources;
+    const GstStructure *source;
+    gboolean internal;
+    gboolean have_rb;
+    guint round_trip;
+    gint lost;
+    double round_trip_ms;
+    guint index;
+
+    rtp_session = NULL;
+    stats = NULL;
+
+    g_signal_emit_by_name(session->manager, "get-session", 0, &rtp_session);
+    if (rtp_session == NULL)
+    {
+        return;
+    }
+    g_object_get(rtp_session, "stats", &stats, NULL);
+    if (stats == NULL)
+    {
+        g_object_unref(rtp_session);
+        return;
+    }
+
+    value = gst_structure_get_value(stats, "source-stats");
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    sources = value != NULL ? (GValueArray *)g_value_get_boxed(value) : NULL;
+    for (index = 0; sources != NULL && index < sources->n_values; index++)
+    {
+        // our own sender source carries the report blocks the server sent back
+        source = gst_value_get_structure(g_value_array_get_nth(sources, index));
+        internal = have_rb = FALSE;
+        gst_structure_get_boolean(source, "internal", &internal);
+        if (!internal)
+        {
+            continue;
+        }
+        gst_structure_get_uint64(source, "packets-sent", &session->packets_sent);
+        gst_structure_get_boolean(source, "have-rb", &have_rb);
+        if (have_rb && gst_structure_get_int(source, "rb-packetslost", &lost) && gst_structure_get_uint(source, "rb-round-trip", &round_trip))
+        {
+            session->packets_lost = MAX(lost, 0);
+            // compact NTP, 16.16 fixed point seconds
+            round_trip_ms = round_trip * 1000.0 / 65536.0;
+            g_array_append_val(session->round_trips, round_trip_ms);
+            TRACEF("loadgen_sample_session: %s: rtt %.2f ms lost %d\n", session->location, round_trip_ms, lost)
+        }
+    }
+    G_GNUC_END_IGNORE_DEPRECATIONS
+
+    gst_structure_free(stats);
+    g_object_unref(rtp_session);
+}
+
+gboolean loadgen_stop(gpointer user_data)
+{
+    loadgen_t loadgen;
+
+    loadgen = (loadgen_t)user_data;
+    INFOF("loadgen_stop: %d s elapsed\n", loadgen->options.duration)
+    g_main_loop_quit(loadgen->main_loop);
+    return G_SOURCE_REMOVE;
+}
+
+cJSON *loadgen_distribution(GArray *values)
+{
+    cJSON *distribution;
+    GArray *sorted;
+
+    if (values->len == 0)
+    {
+        return cJSON_CreateNull();
+    }
+
+    sorted = g_array_sized_new(FALSE, FALSE, sizeof(double), values->len);
+    g_array_append_vals(sorted, values->data, values->len);
+    g_array_sort(sorted, loadgen_compare);
+
+    distribution = cJSON_CreateObject();
+    cJSON_AddNumberToObject(distribution, "count", sorted->len);
+    cJSON_AddNumberToObject(distribution, "min", g_array_index(sorted, double, 0));
+    cJSON_AddNumberToObject(distribution, "p50", loadgen_percentile(sorted, 50.0));
+    cJSON_AddNumberToObject(distribution, "p90", loadgen_percentile(sorted, 90.0));
+    cJSON_AddNumberToObject(distribution, "p99", loadgen_percentile(sorted, 99.0));
+    cJSON_AddNumberToObject(distribution, "max", g_array_index(sorted, double, sorted->len - 1));
+
+    g_array_unref(sorted);
+    return distribution;
+}
+
+double loadgen_percentile(GArray *sorted, double percentile)
+{
+    guint rank;
+
+    // nearest rank, exact for the small sample counts of a run
+    rank = (guint)((percentile / 100.0) * sorted->len + 0.999999);
+    rank = CLAMP(rank, 1, sorted->len);
+    return g_array_index(sorted, double, rank - 1);
+}
+
+gint loadgen_compare(gconstpointer a, gconstpointer b)
+{
+    double left;
+    double right;
+
+    left = *(const double *)a;
+    right = *(const double *)b;
+    return (left > right) - (left < right);
+}
+
+void loadgen_destroy(loadgen_t loadgen)
+{
+    loadgen_session_t session;
+    int index;
+
+    for (index = 0; loadgen->sessions != NULL && index < loadgen->options.sessions; index++)
+    {
+        session = loadgen->sessions + index;
+        if (session->watch != 0)
+        {
+            g_source_remove(session->watch);
+        }
+        if (session->pipeline != NULL)
+        {
+            gst_element_set_state(session->pipeline, GST_STATE_NULL);
+            gst_object_unref(session->pipeline);
+        }
+        CLEANUP_FUNCTION(session->manager, gst_object_unref(session->manager))
+        CLEANUP_FUNCTION(session->round_trips, g_array_unref(session->round_trips))
+        CLEANUP_FUNCTION(session->location, g_free(session->location))
+    }
+    if (loadgen->sample_source != 0)
+    {
+        g_source_remove(loadgen->sample_source);
+    }
+    CLEANUP(loadgen->sessions)
+    CLEANUP_FUNCTION(loadgen->main_loop, g_main_loop_unref(loadgen->main_loop))
+    CLEANUP_FUNCTION(loadgen->logger, logger_unref(loadgen->logger))
+    free(loadgen);
+}
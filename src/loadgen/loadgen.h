@@ -0,0 +1,59 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include "logger.h"
+#include <cjson/cJSON.h>
+#include <gst/gst.h>
+
+struct loadgen_options_s
+{
+    const char *host;
+    int port;
+    const char *prefix;
+    int sessions;
+    int duration;
+    int latency;
+    int rate;
+    int channels;
+};
+typedef struct loadgen_options_s *loadgen_options_t;
+
+struct loadgen_session_s
+{
+    void *loadgen;
+    int index;
+    char *location;
+    GstElement *pipeline;
+    GstElement *manager;
+    guint watch;
+    gint64 started;
+    gint64 setup;
+    gboolean failed;
+    guint64 packets_sent;
+    gint64 packets_lost;
+    GArray *round_trips;
+};
+typedef struct loadgen_session_s *loadgen_session_t;
+
+struct loadgen_s
+{
+    int ref;
+    logger_t logger;
+    struct loadgen_options_s options;
+    loadgen_session_t sessions;
+    GMainLoop *main_loop;
+    guint sample_source;
+};
+typedef struct loadgen_s *loadgen_t;
+
+int loadgen_create(loadgen_t *loadgen, loadgen_options_t options, logger_t logger, const char **error);
+
+int loadgen_run(loadgen_t loadgen, const char **error);
+
+cJSON *loadgen_report(loadgen_t loadgen);
+
+void loadgen_ref(loadgen_t loadgen);
+
+void loadgen_unref(loadgen_t loadgen);
+
+#endif
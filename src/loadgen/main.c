@@ -0,0 +1,340 @@
+/*
+ * main.c - loadgen
+ * 	- Starts N RTSP RECORD sessions of a live test tone against a server and
+ * 	  reports setup time, estimated end to end latency, packet loss and
+ * 	  server CPU per stream as JSON.
+ * 	- With -s the server binary is started on a generated config that maps
+ * 	  every session to its own fakesink device, otherwise the server at
+ * 	  -H/-p is expected to mount endpoints <prefix>0 .. <prefix>N-1.
+ * usage: loadgen [-n sessions] [-d seconds] [-H host] [-p port] [-l latency]
+ * 	          [-P prefix] [-s server] [-o output]
+ */
+
+#include "loadgen.h"
+#include <arpa/inet.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAIN_SERVER_WAIT 50
+#define MAIN_SERVER_POLL 100000
+
+static int main_spawn_server(const char *binary, loadgen_options_t options, GPid *pid, char **config_path, const char **error);
+
+static int main_write_config(loadgen_options_t options, char **config_path, const char **error);
+
+static gboolean main_wait_for_port(int port);
+
+static guint64 main_cpu_ticks(GPid pid);
+
+int main(int argc, char **argv)
+{
+    struct loadgen_options_s options;
+    loadgen_t loadgen;
+    logger_t logger;
+    cJSON *report;
+    char *text;
+    const char *server_binary;
+    const char *output_path;
+    FILE *output;
+    char *config_path;
+    GPid server_pid;
+    guint64 cpu_start;
+    gint64 wall_start;
+    double cpu_percent;
+    int connected;
+    int option;
+    int status;
+    const char *error;
+
+    gst_init(NULL, NULL);
+
+    status = STATUS_OK;
+    loadgen = NULL;
+    logger = NULL;
+    report = NULL;
+    text = NULL;
+    server_binary = NULL;
+    output_path = NULL;
+    config_path = NULL;
+    server_pid = 0;
+    cpu_start = 0;
+
+    options.host = "127.0.0.1";
+    options.port = 8554;
+    options.prefix = "load";
+    options.sessions = 4;
+    options.duration = 30;
+    options.latency = 200;
+    options.rate = 48000;
+    options.channels = 2;
+
+    while ((option = getopt(argc, argv, "n:d:H:p:l:P:s:o:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            options.sessions = atoi(optarg);
+            break;
+        case 'd':
+            options.duration = atoi(optarg);
+            break;
+        case 'H':
+            options.host = optarg;
+            break;
+        case 'p':
+            options.port = atoi(optarg);
+            break;
+        case 'l':
+            options.latency = atoi(optarg);
+            break;
+        case 'P':
+            options.prefix = optarg;
+            break;
+        case 's':
+            server_binary = optarg;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        default:
+            puts("usage: loadgen [-n sessions] [-d seconds] [-H host] [-p port] [-l latency] [-P prefix] [-s server] [-o output]");
+            return STATUS_ERROR;
+        }
+    }
+
+    if (logger_create(&logger, INFO, stderr, NULL, NULL, &error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: logger_create failed");
+        goto error;
+    }
+
+    if (server_binary != NULL)
+    {
+        if (main_spawn_server(server_binary, &options, &server_pid, &config_path, &error) != STATUS_OK)
+        {
+            logger_errorf(logger, "%s\n", error);
+            goto error;
+        }
+        cpu_start = main_cpu_ticks(server_pid);
+    }
+
+    if (loadgen_create(&loadgen, &options, logger, &error) != STATUS_OK)
+    {
+        logger_errorf(logger, "%s\n", error);
+        goto error;
+    }
+
+    wall_start = g_get_monotonic_time();
+    if (loadgen_run(loadgen, &error) != STATUS_OK)
+    {
+        logger_errorf(logger, "%s\n", error);
+        goto error;
+    }
+
+    report = loadgen_report(loadgen);
+
+    // CPU is only known for a server this process started, and is shared
+    // by the sessions that actually connected
+    if (server_pid > 0)
+    {
+        connected = cJSON_GetObjectItem(report, "connected")->valueint;
+        cpu_percent = (main_cpu_ticks(server_pid) - cpu_start) * 100.0 / sysconf(_SC_CLK_TCK) /
+                      ((g_get_monotonic_time() - wall_start) / 1e6);
+        cJSON_AddNumberToObject(report, "server_cpu_percent", cpu_percent);
+        if (connected > 0)
+        {
+            cJSON_AddNumberToObject(report, "server_cpu_percent_per_stream", cpu_percent / connected);
+        }
+        else
+        {
+            cJSON_AddNullToObject(report, "server_cpu_percent_per_stream");
+        }
+    }
+    else
+    {
+        cJSON_AddNullToObject(report, "server_cpu_percent");
+        cJSON_AddNullToObject(report, "server_cpu_percent_per_stream");
+    }
+
+    text = cJSON_Print(report);
+    output = output_path != NULL ? fopen(output_path, "w") : stdout;
+    if (text == NULL || output == NULL)
+    {
+        logger_errorln(logger, "main: failed to write report");
+        goto error;
+    }
+    fprintf(output, "%s\n", text);
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(loadgen, loadgen_unref(loadgen))
+    if (server_pid > 0)
+    {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+        g_spawn_close_pid(server_pid);
+    }
+    if (config_path != NULL)
+    {
+        unlink(config_path);
+        g_free(config_path);
+    }
+    CLEANUP_FUNCTION(text, cJSON_free(text))
+    CLEANUP_FUNCTION(report, cJSON_Delete(report))
+    CLEANUP_FUNCTION(logger, logger_unref(logger))
+    return status;
+}
+
+int main_spawn_server(const char *binary, loadgen_options_t options, GPid *pid, char **config_path, const char **error)
+{
+    int status;
+    char *argv[3];
+    GError *spawn_error;
+
+    status = STATUS_OK;
+    spawn_error = NULL;
+
+    IF_THROW(strcmp(options->host, "127.0.0.1") != 0 && strcmp(options->host, "localhost") != 0,
+             "main_spawn_server: a spawned server only listens locally, drop -H")
+    IF_THROW(main_write_config(options, config_path, error) != STATUS_OK, *error)
+
+    argv[0] = (char *)binary;
+    argv[1] = *config_path;
+    argv[2] = NULL;
+    IF_THROW(!g_spawn_async(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH, NULL, NULL, pid, &spawn_error),
+             "main_spawn_server: failed to start server")
+    IF_THROW(!main_wait_for_port(options->port), "main_spawn_server: server did not open its port")
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(spawn_error, g_error_free(spawn_error))
+    return status;
+}
+
+int main_write_config(loadgen_options_t options, char **config_path, const char **error)
+{
+    int status;
+    cJSON *config;
+    cJSON *log;
+    cJSON *devices;
+    cJSON *device;
+    char *text;
+    char *name;
+    char port[8];
+    FILE *file;
+    int fd;
+    int index;
+
+    status = STATUS_OK;
+    text = NULL;
+    file = NULL;
+
+    // every session gets its own zone rendering into a clocked fakesink, so
+    // the numbers reflect the server and not the sound cards
+    config = cJSON_CreateObject();
+    snprintf(port, sizeof(port), "%d", options->port);
+    cJSON_AddStringToObject(config, "port", port);
+    log = cJSON_AddObjectToObject(config, "log");
+    cJSON_AddStringToObject(log, "path", "stderr");
+    cJSON_AddStringToObject(log, "level", "warn");
+    devices = cJSON_AddArrayToObject(config, "devices");
+    for (index = 0; index < options->sessions; index++)
+    {
+        name = g_strdup_printf("%s%d", options->prefix, index);
+        device = cJSON_CreateObject();
+        cJSON_AddStringToObject(device, "name", name);
+        cJSON_AddStringToObject(device, "endpoint", name);
+        cJSON_AddStringToObject(device, "sink", "fake");
+        cJSON_AddStringToObject(device, "codec", "opus");
+        cJSON_AddNumberToObject(device, "rate", options->rate);
+        cJSON_AddNumberToObject(device, "channels", options->channels);
+        cJSON_AddNumberToObject(device, "latency", options->latency);
+        cJSON_AddItemToArray(devices, device);
+        g_free(name);
+    }
+
+    text = cJSON_Print(config);
+    IF_THROW(text == NULL, "main_write_config: failed to print config")
+
+    fd = g_file_open_tmp("loadgen-XXXXXX.json", config_path, NULL);
+    IF_THROW(fd < 0, "main_write_config: failed to create config file")
+    file = fdopen(fd, "w");
+    IF_THROW(file == NULL, "main_write_config: failed to open config file")
+    IF_THROW(fputs(text, file) < 0, "main_write_config: failed to write config file")
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(file, fclose(file))
+    CLEANUP_FUNCTION(text, cJSON_free(text))
+    cJSON_Delete(config);
+    return status;
+}
+
+gboolean main_wait_for_port(int port)
+{
+    struct sockaddr_in address;
+    int attempt;
+    int fd;
+    int connected;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (attempt = 0; attempt < MAIN_SERVER_WAIT; attempt++)
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return FALSE;
+        }
+        connected = connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+        close(fd);
+        if (connected)
+        {
+            return TRUE;
+        }
+        g_usleep(MAIN_SERVER_POLL);
+    }
+    return FALSE;
+}
+
+guint64 main_cpu_ticks(GPid pid)
+{
+    char path[64];
+    char line[1024];
+    char *fields;
+    FILE *file;
+    unsigned long long utime;
+    unsigned long long stime;
+
+    utime = stime = 0;
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    // the command name may contain spaces, fields restart after its ')'
+    if (fgets(line, sizeof(line), file) != NULL && (fields = strrchr(line, ')')) != NULL)
+    {
+        sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime);
+    }
+    fclose(file);
+    return (guint64)(utime + stime);
+}
@@ -0,0 +1,504 @@
+#include "binary.h"
+#include <stddef.h>
+#include <time.h>
+
+#define BINARY_SPEC_SIZE 64
+
+#define BINARY_PUT(BUFFER, OFFSET, SIZE, TYPE, VALUE) \
+    {                                                 \
+        TYPE value = (VALUE);                         \
+        if (OFFSET + sizeof(TYPE) > SIZE)             \
+        {                                             \
+            return -1;                                \
+        }                                             \
+        memcpy(BUFFER + OFFSET, &value, sizeof(TYPE)); \
+        OFFSET += sizeof(TYPE);                       \
+    }
+
+#define BINARY_GET(PAYLOAD, OFFSET, LENGTH, TYPE, VALUE) \
+    if (OFFSET + sizeof(TYPE) > LENGTH)                  \
+    {                                                    \
+        return STATUS_ERROR;                             \
+    }                                                    \
+    memcpy(&VALUE, PAYLOAD + OFFSET, sizeof(TYPE));      \
+    OFFSET += sizeof(TYPE);
+
+#define BINARY_PRINT(FILE, SPEC, STARS, STAR_ARGS, VALUE)              \
+    switch (STARS)                                                     \
+    {                                                                  \
+    case 0:                                                            \
+        fprintf(FILE, SPEC, VALUE);                                    \
+        break;                                                         \
+    case 1:                                                            \
+        fprintf(FILE, SPEC, STAR_ARGS[0], VALUE);                      \
+        break;                                                         \
+    default:                                                           \
+        fprintf(FILE, SPEC, STAR_ARGS[0], STAR_ARGS[1], VALUE);        \
+        break;                                                         \
+    }
+
+static uint64_t binary_timestamp();
+
+static int binary_length_type(const char *length);
+
+static void binary_header(char *buffer, int kind, int level, int id, size_t length);
+
+const char *binary_next_spec(const char *format, binary_spec_t spec)
+{
+    const char *start;
+    const char *cursor;
+    char length[3];
+    size_t nlength;
+
+    start = strchr(format, '%');
+    if (start == NULL)
+    {
+        return NULL;
+    }
+
+    spec->start = start;
+    spec->stars = 0;
+    spec->precision = BINARY_PRECISION_NONE;
+    cursor = start + 1;
+
+    if (*cursor == '%')
+    {
+        spec->length = 2;
+        spec->type = BINARY_NONE;
+        return start;
+    }
+
+    while (*cursor != '\0' && strchr("-+ #0'", *cursor) != NULL)
+    {
+        cursor++;
+    }
+
+    if (*cursor == '*')
+    {
+        spec->stars++;
+        cursor++;
+    }
+    while (*cursor >= '0' && *cursor <= '9')
+    {
+        cursor++;
+    }
+
+    if (*cursor == '.')
+    {
+        cursor++;
+        if (*cursor == '*')
+        {
+            spec->stars++;
+            spec->precision = BINARY_PRECISION_STAR;
+            cursor++;
+        }
+        else
+        {
+            spec->precision = 0;
+        }
+        while (*cursor >= '0' && *cursor <= '9' && spec->precision >= 0)
+        {
+            spec->precision = spec->precision < INT_MAX / 10 ? spec->precision * 10 + (*cursor - '0') : INT_MAX;
+            cursor++;
+        }
+    }
+
+    nlength = 0;
+    memset(length, 0, sizeof(length));
+    while (*cursor != '\0' && strchr("hlqLjzZt", *cursor) != NULL && nlength < 2)
+    {
+        length[nlength++] = *cursor;
+        cursor++;
+    }
+
+    switch (*cursor)
+    {
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        spec->type = binary_length_type(length);
+        break;
+    case 'c':
+        spec->type = nlength == 0 ? BINARY_INT : BINARY_UNSUPPORTED;
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec->type = (nlength == 0 || strcmp(length, "l") == 0) ? BINARY_DOUBLE : BINARY_UNSUPPORTED;
+        break;
+    case 's':
+        spec->type = nlength == 0 ? BINARY_STRING : BINARY_UNSUPPORTED;
+        break;
+    case 'p':
+        spec->type = nlength == 0 ? BINARY_POINTER : BINARY_UNSUPPORTED;
+        break;
+    default:
+        spec->type = BINARY_UNSUPPORTED;
+        break;
+    }
+
+    spec->length = (size_t)(cursor - start) + (*cursor != '\0' ? 1 : 0);
+    return start;
+}
+
+int binary_parse(binary_signature_t signature, const char *format)
+{
+    int status;
+    struct binary_spec_s spec;
+    const char *cursor;
+    int star;
+
+    status = STATUS_OK;
+    signature->ntypes = 0;
+    cursor = format;
+
+    while ((cursor = binary_next_spec(cursor, &spec)) != NULL)
+    {
+        if (spec.type == BINARY_UNSUPPORTED || spec.length >= BINARY_SPEC_SIZE)
+        {
+            goto error;
+        }
+
+        for (star = 0; star < spec.stars; star++)
+        {
+            if (signature->ntypes == BINARY_MAX_ARGS)
+            {
+                goto error;
+            }
+            signature->types[signature->ntypes++] = BINARY_INT;
+        }
+
+        if (spec.type != BINARY_NONE)
+        {
+            if (signature->ntypes == BINARY_MAX_ARGS)
+            {
+                goto error;
+            }
+            signature->precisions[signature->ntypes] = spec.precision;
+            signature->types[signature->ntypes++] = (unsigned char)spec.type;
+        }
+
+        cursor += spec.length;
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    return status;
+}
+
+int binary_encode_header(char *buffer, size_t size)
+{
+    size_t length;
+
+    length = strlen(BINARY_MAGIC);
+    if (sizeof(struct binary_record_s) + length > size)
+    {
+        return -1;
+    }
+
+    binary_header(buffer, BINARY_HEADER, BINARY_VERSION, 0, length);
+    memcpy(buffer + sizeof(struct binary_record_s), BINARY_MAGIC, length);
+    return (int)(sizeof(struct binary_record_s) + length);
+}
+
+int binary_encode_define(char *buffer, size_t size, int id, const char *format)
+{
+    size_t length;
+
+    length = strlen(format);
+    if (sizeof(struct binary_record_s) + length > size)
+    {
+        return -1;
+    }
+
+    binary_header(buffer, BINARY_DEFINE, 0, id, length);
+    memcpy(buffer + sizeof(struct binary_record_s), format, length);
+    return (int)(sizeof(struct binary_record_s) + length);
+}
+
+int binary_encode_record(char *buffer, size_t size, int level, int id, binary_signature_t signature, va_list args)
+{
+    size_t offset;
+    int index;
+    const char *string;
+    size_t length;
+    int star;
+    int precision;
+
+    offset = sizeof(struct binary_record_s);
+    if (offset > size)
+    {
+        return -1;
+    }
+    star = BINARY_PRECISION_NONE;
+
+    for (index = 0; index < signature->ntypes; index++)
+    {
+        switch (signature->types[index])
+        {
+        case BINARY_INT:
+            // a star precision is always the int right before its string
+            star = va_arg(args, int);
+            BINARY_PUT(buffer, offset, size, int, star)
+            break;
+        case BINARY_LONG:
+            BINARY_PUT(buffer, offset, size, long, va_arg(args, long))
+            break;
+        case BINARY_LONG_LONG:
+            BINARY_PUT(buffer, offset, size, long long, va_arg(args, long long))
+            break;
+        case BINARY_SIZE:
+            BINARY_PUT(buffer, offset, size, size_t, va_arg(args, size_t))
+            break;
+        case BINARY_INTMAX:
+            BINARY_PUT(buffer, offset, size, intmax_t, va_arg(args, intmax_t))
+            break;
+        case BINARY_PTRDIFF:
+            BINARY_PUT(buffer, offset, size, ptrdiff_t, va_arg(args, ptrdiff_t))
+            break;
+        case BINARY_DOUBLE:
+            BINARY_PUT(buffer, offset, size, double, va_arg(args, double))
+            break;
+        case BINARY_POINTER:
+            BINARY_PUT(buffer, offset, size, void *, va_arg(args, void *))
+            break;
+        case BINARY_STRING:
+            string = va_arg(args, const char *);
+            if (string == NULL)
+            {
+                string = "(null)";
+            }
+            // strings are the only variable sized argument, clip them to their
+            // precision, which may leave them unterminated, and to the record
+            precision = signature->precisions[index] == BINARY_PRECISION_STAR ? star : signature->precisions[index];
+            length = precision >= 0 ? strnlen(string, (size_t)precision) : strlen(string);
+            if (offset + sizeof(uint16_t) > size)
+            {
+                return -1;
+            }
+            if (length > size - offset - sizeof(uint16_t))
+            {
+                length = size - offset - sizeof(uint16_t);
+            }
+            BINARY_PUT(buffer, offset, size, uint16_t, (uint16_t)length)
+            memcpy(buffer + offset, string, length);
+            offset += length;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (offset - sizeof(struct binary_record_s) > UINT16_MAX)
+    {
+        return -1;
+    }
+
+    binary_header(buffer, BINARY_RECORD, level, id, offset - sizeof(struct binary_record_s));
+    return (int)offset;
+}
+
+int binary_encode_text(char *buffer, size_t size, int level, const char *format, va_list args)
+{
+    size_t offset;
+    int length;
+
+    offset = sizeof(struct binary_record_s);
+    if (offset >= size)
+    {
+        return -1;
+    }
+
+    length = vsnprintf(buffer + offset, size - offset, format, args);
+    if (length < 0)
+    {
+        return -1;
+    }
+    if ((size_t)length >= size - offset)
+    {
+        // truncated, keep the record line terminated
+        length = (int)(size - offset - 1);
+        buffer[offset + length - 1] = '\n';
+    }
+
+    binary_header(buffer, BINARY_RECORD, level, BINARY_TEXT_ID, (size_t)length);
+    return (int)(offset + length);
+}
+
+int binary_decode_record(FILE *file, const char *format, const char *payload, size_t length)
+{
+    struct binary_spec_s spec;
+    const char *cursor;
+    const char *next;
+    char spec_string[BINARY_SPEC_SIZE];
+    int star_args[2];
+    int star;
+    size_t offset;
+    uint16_t string_length;
+
+    offset = 0;
+    cursor = format;
+
+    while ((next = binary_next_spec(cursor, &spec)) != NULL)
+    {
+        fwrite(cursor, 1, (size_t)(next - cursor), file);
+        if (spec.type == BINARY_UNSUPPORTED || spec.length >= BINARY_SPEC_SIZE)
+        {
+            return STATUS_ERROR;
+        }
+
+        memcpy(spec_string, spec.start, spec.length);
+        spec_string[spec.length] = '\0';
+
+        for (star = 0; star < spec.stars; star++)
+        {
+            BINARY_GET(payload, offset, length, int, star_args[star])
+        }
+
+        switch (spec.type)
+        {
+        case BINARY_NONE:
+            fputc('%', file);
+            break;
+        case BINARY_INT:
+        {
+            int value;
+            BINARY_GET(payload, offset, length, int, value)
+            BINARY_PRINT(file, spec_string, spec.stars, star_args, value)
+            break;
+        }
+        case BINARY_LONG:
+        {
+            long value;
+            BINARY_GET(payload, offset, length, long, value)
+            BINARY_PRINT(file, spec_string, spec.stars, star_args, value)
+            break;
+        }
+        case BINARY_LONG_LONG:
+        {
+            long long value;
+            BINARY_GET(payload, offset, length, long long, value)
+            BINARY_PRINT(file, spec_string, spec.stars, star_args, value)
+            break;
+        }
+        case BINARY_SIZE:
+        {
+            size_t value;
+            BINARY_GET(payload, offset, length, size_t, value)
+            BINARY_PRINT(file, spec_string, spec.stars, star_args, value)
+            break;
+        }
+        case BINARY_INTMAX:
+        {
+            intmax_t value;
+            BINARY_GET(payload, offset, length, intmax_t, value)
+            BINARY_PRINT(file, spec_string, spec.stars, star_args, value)
+            break;
+        }
+        case BINARY_PTRDIFF:
+        {
+            ptrdiff_t value;
+            BINARY_GET(payload, offset, length, ptrdiff_t, value)
+            BINARY_PRINT(file, spec_string, spec.stars, star_args, value)
+            break;
+        }
+        case BINARY_DOUBLE:
+        {
+            double value;
+            BINARY_GET(payload, offset, length, double, value)
+            BINARY_PRINT(file, spec_string, spec.stars, star_args, value)
+            break;
+        }
+        case BINARY_POINTER:
+        {
+            void *value;
+            BINARY_GET(payload, offset, length, void *, value)
+            BINARY_PRINT(file, spec_string, spec.stars, star_args, value)
+            break;
+        }
+        case BINARY_STRING:
+        {
+            char *value;
+            BINARY_GET(payload, offset, length, uint16_t, string_length)
+            if (offset + string_length > length)
+            {
+                return STATUS_ERROR;
+            }
+            value = strndup(payload + offset, string_length);
+            if (value == NULL)
+            {
+                return STATUS_ERROR;
+            }
+            offset += string_length;
+            BINARY_PRINT(file, spec_string, spec.stars, star_args, value)
+            free(value);
+            break;
+        }
+        }
+
+        cursor = next + spec.length;
+    }
+
+    fputs(cursor, file);
+    return STATUS_OK;
+}
+
+uint64_t binary_timestamp()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+int binary_length_type(const char *length)
+{
+    if (length[0] == '\0' || strcmp(length, "h") == 0 || strcmp(length, "hh") == 0)
+    {
+        return BINARY_INT;
+    }
+    if (strcmp(length, "l") == 0)
+    {
+        return BINARY_LONG;
+    }
+    if (strcmp(length, "ll") == 0 || strcmp(length, "q") == 0)
+    {
+        return BINARY_LONG_LONG;
+    }
+    if (strcmp(length, "z") == 0 || strcmp(length, "Z") == 0)
+    {
+        return BINARY_SIZE;
+    }
+    if (strcmp(length, "j") == 0)
+    {
+        return BINARY_INTMAX;
+    }
+    if (strcmp(length, "t") == 0)
+    {
+        return BINARY_PTRDIFF;
+    }
+    return BINARY_UNSUPPORTED;
+}
+
+void binary_header(char *buffer, int kind, int level, int id, size_t length)
+{
+    struct binary_record_s record;
+
+    record.kind = (uint8_t)kind;
+    record.level = (uint8_t)level;
+    record.id = (uint16_t)id;
+    record.length = (uint16_t)length;
+    record.reserved = 0;
+    record.timestamp = binary_timestamp();
+    memcpy(buffer, &record, sizeof(struct binary_record_s));
+}
@@ -0,0 +1,178 @@
+/*
+ * decode.c - logger-decode
+ * 	- Converts binary logs written with LOGGER_FORMAT_BINARY back into the
+ * 	  text output of the logger. Records are read in native byte order, so
+ * 	  decode on the same architecture that wrote the file.
+ * usage: logger-decode [-c] [-t] [file...]
+ * 	-c	colorize levels
+ * 	-t	prefix each line with the record timestamp
+ */
+
+#include "binary.h"
+#include "logger.h"
+#include <time.h>
+#include <unistd.h>
+
+struct decoder_s
+{
+    int color;
+    int timestamps;
+    char *formats[BINARY_MAX_FORMATS];
+};
+typedef struct decoder_s *decoder_t;
+
+static int decoder_run(decoder_t decoder, FILE *file, const char **error);
+
+static void decoder_reset(char **formats);
+
+static void decoder_print_timestamp(uint64_t timestamp);
+
+int main(int argc, char **argv)
+{
+    struct decoder_s decoder;
+    FILE *file;
+    int option;
+    int index;
+    int status;
+    const char *error;
+
+    memset(&decoder, 0, sizeof(decoder));
+    status = STATUS_OK;
+
+    while ((option = getopt(argc, argv, "ct")) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            decoder.color = 1;
+            break;
+        case 't':
+            decoder.timestamps = 1;
+            break;
+        default:
+            puts("usage: logger-decode [-c] [-t] [file...]");
+            return STATUS_ERROR;
+        }
+    }
+
+    if (optind == argc)
+    {
+        if (decoder_run(&decoder, stdin, &error) != STATUS_OK)
+        {
+            fprintf(stderr, "%s\n", error);
+            status = STATUS_ERROR;
+        }
+    }
+
+    for (index = optind; index < argc; index++)
+    {
+        file = fopen(argv[index], "rb");
+        if (file == NULL)
+        {
+            fprintf(stderr, "main: failed to open %s\n", argv[index]);
+            status = STATUS_ERROR;
+            continue;
+        }
+        if (decoder_run(&decoder, file, &error) != STATUS_OK)
+        {
+            fprintf(stderr, "%s: %s\n", argv[index], error);
+            status = STATUS_ERROR;
+        }
+        fclose(file);
+    }
+
+    decoder_reset(decoder.formats);
+    return status;
+}
+
+int decoder_run(decoder_t decoder, FILE *file, const char **error)
+{
+    int status;
+    struct binary_record_s record;
+    char payload[UINT16_MAX + 1];
+    const char *format;
+
+    status = STATUS_OK;
+
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        // preallocated segments are zero filled past the last record
+        if (record.kind == BINARY_PADDING)
+        {
+            break;
+        }
+
+        IF_THROW(fread(payload, 1, record.length, file) != record.length, "decoder_run: truncated record")
+        payload[record.length] = '\0';
+
+        switch (record.kind)
+        {
+        case BINARY_HEADER:
+            IF_THROW(record.length != strlen(BINARY_MAGIC) || memcmp(payload, BINARY_MAGIC, record.length) != 0, "decoder_run: bad header")
+            IF_THROW(record.level != BINARY_VERSION, "decoder_run: unsupported version")
+            // format ids are only unique within one logger instance, and every
+            // segment defines the ones it uses again after its header
+            decoder_reset(decoder->formats);
+            break;
+        case BINARY_DEFINE:
+            IF_THROW(record.id >= BINARY_MAX_FORMATS, "decoder_run: format id out of range")
+            CLEANUP(decoder->formats[record.id])
+            decoder->formats[record.id] = strdup(payload);
+            IF_THROW(decoder->formats[record.id] == NULL, "decoder_run: failed to allocate format")
+            break;
+        case BINARY_RECORD:
+            IF_THROW(record.level > TRACE, "decoder_run: invalid level")
+            if (decoder->timestamps)
+            {
+                decoder_print_timestamp(record.timestamp);
+            }
+            logger_print_level(stdout, record.level, decoder->color);
+            if (record.id == BINARY_TEXT_ID)
+            {
+                fwrite(payload, 1, record.length, stdout);
+                break;
+            }
+            format = record.id < BINARY_MAX_FORMATS ? decoder->formats[record.id] : NULL;
+            if (format == NULL)
+            {
+                printf("<undefined format %u>\n", record.id);
+            }
+            else if (binary_decode_record(stdout, format, payload, record.length) != STATUS_OK)
+            {
+                printf("<malformed record for format %u>\n", record.id);
+            }
+            break;
+        default:
+            IF_THROW(1, "decoder_run: unknown record kind")
+        }
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    fflush(stdout);
+    return status;
+}
+
+void decoder_reset(char **formats)
+{
+    int index;
+    for (index = 0; index < BINARY_MAX_FORMATS; index++)
+    {
+        CLEANUP(formats[index])
+        formats[index] = NULL;
+    }
+}
+
+void decoder_print_timestamp(uint64_t timestamp)
+{
+    time_t seconds;
+    struct tm local;
+    char buffer[32];
+
+    seconds = (time_t)(timestamp / 1000000000ULL);
+    localtime_r(&seconds, &local);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+    printf("%s.%06lu ", buffer, (unsigned long)((timestamp % 1000000000ULL) / 1000ULL));
+}
@@ -1,5 +1,8 @@
 #include "logger.h"
+#include "binary.h"
+#include "queue.h"
 #include <pthread.h>
+#include <stdatomic.h>
 
 const char *const log_colors[] = {
     "\e[0;37m\e[41m",
@@ -9,50 +12,124 @@ const char *const log_colors[] = {
     "\e[0;37m\e[45m",
 };
 
+const char *const log_level_names[] = {
+    "ERROR",
+    "WARN",
+    "INFO",
+    "DEBUG",
+    "TRACE",
+};
+
 #define LEVEL_STRING(LEVEL) #LEVEL
 #define RESET_COLOR "\e[0m"
 
-#define LOGGER_PRINT_LEVEL(LOGGER, LEVEL)                                              \
-    if (LOGGER->color == 1)                                                            \
-    {                                                                                  \
-        fprintf(LOGGER->file, "%s%-*s%s ", log_colors[LEVEL], 5, #LEVEL, RESET_COLOR); \
-    }                                                                                  \
-    else                                                                               \
-    {                                                                                  \
-        fprintf(LOGGER->file, "%-*s ", 5, #LEVEL);                                     \
-    }
+#define LOGGER_PRINT_LEVEL(LOGGER, LEVEL) logger_print_level(LOGGER->file, LEVEL, LOGGER->color);
 
-#define LOGGER_LOGF(LOGGER, LEVEL, FORMAT, ARGS)                     \
+#define LOGGER_LOGF(LOGGER, LEVEL, SITE, FORMAT, ARGS)               \
     pthread_mutex_t *const mutex = (pthread_mutex_t *)LOGGER->mutex; \
     if (LOGGER->level >= LEVEL)                                      \
     {                                                                \
-        pthread_mutex_lock(mutex);                                   \
-        LOGGER_PRINT_LEVEL(LOGGER, LEVEL)                            \
-        vfprintf(LOGGER->file, FORMAT, ARGS);                        \
-        pthread_mutex_unlock(mutex);                                 \
+        if (LOGGER->formats != NULL)                                 \
+        {                                                            \
+            logger_encode(LOGGER, LEVEL, SITE, FORMAT, ARGS);        \
+        }                                                            \
+        else if (LOGGER->queue != NULL)                              \
+        {                                                            \
+            logger_push(LOGGER, LEVEL, FORMAT, ARGS);                \
+        }                                                            \
+        else                                                         \
+        {                                                            \
+            pthread_mutex_lock(mutex);                               \
+            LOGGER_PRINT_LEVEL(LOGGER, LEVEL)                        \
+            vfprintf(LOGGER->file, FORMAT, ARGS);                    \
+            pthread_mutex_unlock(mutex);                             \
+        }                                                            \
     }
 
-#define LOGGER_LOGLN(LOGGER, LEVEL, MESSAGE)                         \
-    pthread_mutex_t *const mutex = (pthread_mutex_t *)LOGGER->mutex; \
-    if (LOGGER->level >= LEVEL)                                      \
-    {                                                                \
-        pthread_mutex_lock(mutex);                                   \
-        LOGGER_PRINT_LEVEL(LOGGER, LEVEL)                            \
-        fprintf(LOGGER->file, "%s\n", MESSAGE);                      \
-        pthread_mutex_unlock(mutex);                                 \
+#define LOGGER_LOGLN(LOGGER, LEVEL, MESSAGE)                                               \
+    pthread_mutex_t *const mutex = (pthread_mutex_t *)LOGGER->mutex;                       \
+    if (LOGGER->level >= LEVEL)                                                            \
+    {                                                                                      \
+        if (LOGGER->formats != NULL)                                                       \
+        {                                                                                  \
+            logger_encodef(LOGGER, LEVEL, &logger_line_site, logger_line_format, MESSAGE); \
+        }                                                                                  \
+        else if (LOGGER->queue != NULL)                                                    \
+        {                                                                                  \
+            logger_pushf(LOGGER, LEVEL, logger_line_format, MESSAGE);                      \
+        }                                                                                  \
+        else                                                                               \
+        {                                                                                  \
+            pthread_mutex_lock(mutex);                                                     \
+            LOGGER_PRINT_LEVEL(LOGGER, LEVEL)                                              \
+            fprintf(LOGGER->file, "%s\n", MESSAGE);                                        \
+            pthread_mutex_unlock(mutex);                                                   \
+        }                                                                                  \
     }
 
+enum logger_format_states
+{
+    FORMAT_STATE_UNDEFINED,
+    FORMAT_STATE_DEFINING,
+    FORMAT_STATE_DEFINED,
+    FORMAT_STATE_UNSUPPORTED
+};
+
+// binary mode interns each format string by contents, a copy is kept so a
+// reused buffer never decodes as the text first seen at its address. The
+// first caller to see a format emits its define record before anyone may
+// reference its id
+struct logger_format_s
+{
+    _Atomic(const char *) format;
+    atomic_uint state;
+    int parsed;
+    struct binary_signature_s signature;
+};
+typedef struct logger_format_s *logger_format_t;
+
+struct logger_formats_s
+{
+    struct logger_format_s entries[BINARY_MAX_FORMATS];
+};
+typedef struct logger_formats_s *logger_formats_t;
+
+static const char logger_line_format[] = "%s\n";
+
+// every line shares one format, so one site serves them all
+static struct logger_site_s logger_line_site;
+
+static int logger_write(logger_t logger, const char *data, size_t length);
+
+static uint64_t logger_hash(const char *format);
+
+static int logger_define(logger_t logger, const char *format, logger_site_t site, logger_format_t *entry);
+
+static void logger_encode(logger_t logger, int level, logger_site_t site, const char *format, va_list args);
+
+static void logger_encodef(logger_t logger, int level, logger_site_t site, const char *format, ...);
+
+static void logger_push(logger_t logger, int level, const char *format, va_list args);
+
+static void logger_pushf(logger_t logger, int level, const char *format, ...);
+
 static void logger_destroy(logger_t logger);
 
-int logger_create(logger_t *logger, int level, FILE *file, close_file_fn close_fn, const char **error)
+int logger_create(logger_t *logger, int level, FILE *file, close_file_fn close_fn, logger_options_t options, const char **error)
 {
     int status;
     logger_t new_logger;
     pthread_mutex_t *new_mutex;
+    queue_t new_queue;
+    logger_formats_t new_formats;
+    char header[BINARY_RECORD_SIZE];
+    int header_length;
 
     status = 0;
     new_logger = NULL;
     new_mutex = NULL;
+    new_queue = NULL;
+    new_formats = NULL;
 
     IF_THROW(logger == NULL, "logger_create: null logger")
 
@@ -64,23 +141,106 @@ int logger_create(logger_t *logger, int level, FILE *file, close_file_fn close_f
     IF_THROW(new_mutex == NULL, "logger_create: failed to allocate mutex")
     IF_THROW(pthread_mutex_init(new_mutex, NULL) != 0, "logger_create: failed to initialize mutex")
 
+    if (options != NULL && options->mode == LOGGER_MODE_ASYNC)
+    {
+        if (queue_create(&new_queue, file, options->capacity, options->overflow, error) != STATUS_OK)
+        {
+            goto error;
+        }
+    }
+
+    if (options != NULL && options->format == LOGGER_FORMAT_BINARY)
+    {
+        new_formats = calloc(1, sizeof(struct logger_formats_s));
+        IF_THROW(new_formats == NULL, "logger_create: failed to allocate format table")
+    }
+
     new_logger->ref = 1;
     new_logger->level = level;
     new_logger->file = file;
     new_logger->close_fn = close_fn;
     new_logger->mutex = new_mutex;
+    new_logger->queue = new_queue;
+    new_logger->formats = new_formats;
+
+    if (new_formats != NULL)
+    {
+        header_length = binary_encode_header(header, sizeof(header));
+        IF_THROW(logger_write(new_logger, header, (size_t)header_length) != STATUS_OK, "logger_create: failed to write binary header")
+    }
 
     *logger = new_logger;
 
     goto done;
 error:
     status = STATUS_ERROR;
+    CLEANUP(new_formats)
+    CLEANUP_FUNCTION(new_queue, queue_destroy(new_queue))
     CLEANUP(new_mutex)
     CLEANUP(new_logger)
 done:
     return status;
 }
 
+uint64_t logger_dropped(logger_t logger)
+{
+    assert(logger != NULL);
+    return logger->queue != NULL ? queue_dropped((queue_t)logger->queue) : 0;
+}
+
+int logger_rotate(logger_t logger, char *buffer, size_t size)
+{
+    logger_formats_t formats;
+    const char *format;
+    unsigned int state;
+    int index;
+    int offset;
+    int length;
+
+    assert(logger != NULL);
+    if (logger->formats == NULL)
+    {
+        return 0;
+    }
+
+    // records queued before the rotation land in the new segment, so it
+    // opens with the header and every format that may already be in use
+    formats = (logger_formats_t)logger->formats;
+    offset = binary_encode_header(buffer, size);
+    if (offset < 0)
+    {
+        return 0;
+    }
+    for (index = 0; index < BINARY_MAX_FORMATS; index++)
+    {
+        format = atomic_load_explicit(&formats->entries[index].format, memory_order_acquire);
+        state = atomic_load_explicit(&formats->entries[index].state, memory_order_acquire);
+        if (format == NULL || (state != FORMAT_STATE_DEFINING && state != FORMAT_STATE_DEFINED))
+        {
+            continue;
+        }
+        length = binary_encode_define(buffer + offset, size - (size_t)offset, index, format);
+        if (length < 0)
+        {
+            break;
+        }
+        offset += length;
+    }
+    return offset;
+}
+
+void logger_print_level(FILE *file, int level, int color)
+{
+    if (color == 1)
+    {
+        fprintf(file, "%s%-*s%s ", log_colors[level], 5, log_level_names[level], RESET_COLOR);
+    }
+    else
+    {
+        fprintf(file, "%-*s ", 5, log_level_names[level]);
+    }
+}
+
 void logger_ref(logger_t logger)
 {
     logger->ref++;
@@ -96,11 +256,19 @@ void logger_unref(logger_t logger)
     }
 }
 
+void logger_logf(logger_t logger, int level, logger_site_t site, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    LOGGER_LOGF(logger, level, site, format, args);
+    va_end(args);
+}
+
 void logger_errorf(logger_t logger, const char *format, ...)
 {
     va_list args;
     va_start(args, format);
-    LOGGER_LOGF(logger, ERROR, format, args);
+    LOGGER_LOGF(logger, ERROR, NULL, format, args);
     va_end(args);
 }
 
@@ -113,7 +281,7 @@ void logger_warnf(logger_t logger, const char *format, ...)
 {
     va_list args;
     va_start(args, format);
-    LOGGER_LOGF(logger, WARN, format, args);
+    LOGGER_LOGF(logger, WARN, NULL, format, args);
     va_end(args);
 }
 
@@ -126,7 +294,7 @@ void logger_infof(logger_t logger, const char *format, ...)
 {
     va_list args;
     va_start(args, format);
-    LOGGER_LOGF(logger, INFO, format, args);
+    LOGGER_LOGF(logger, INFO, NULL, format, args);
     va_end(args);
 }
 
@@ -139,7 +307,7 @@ void logger_debugf(logger_t logger, const char *format, ...)
 {
     va_list args;
     va_start(args, format);
-    LOGGER_LOGF(logger, DEBUG, format, args);
+    LOGGER_LOGF(logger, DEBUG, NULL, format, args);
     va_end(args);
 }
 
@@ -152,7 +320,7 @@ void logger_tracef(logger_t logger, const char *format, ...)
 {
     va_list args;
     va_start(args, format);
-    LOGGER_LOGF(logger, TRACE, format, args);
+    LOGGER_LOGF(logger, TRACE, NULL, format, args);
     va_end(args);
 }
 
@@ -161,10 +329,289 @@ void logger_traceln(logger_t logger, const char *const message)
     LOGGER_LOGLN(logger, TRACE, message)
 }
 
+int logger_write(logger_t logger, const char *data, size_t length)
+{
+    queue_record_t record;
+
+    if (logger->queue != NULL)
+    {
+        if (length > QUEUE_RECORD_SIZE || queue_acquire((queue_t)logger->queue, &record) != STATUS_OK)
+        {
+            return STATUS_ERROR;
+        }
+        memcpy(record->data, data, length);
+        record->length = length;
+        queue_commit((queue_t)logger->queue, record);
+    }
+    else
+    {
+        pthread_mutex_lock((pthread_mutex_t *)logger->mutex);
+        fwrite(data, 1, length, logger->file);
+        pthread_mutex_unlock((pthread_mutex_t *)logger->mutex);
+    }
+    return STATUS_OK;
+}
+
+uint64_t logger_hash(const char *format)
+{
+    uint64_t hash;
+
+    // 64 bit FNV-1a, also on targets with a 32 bit size_t
+    hash = 14695981039346656037ull;
+    for (; *format != '\0'; format++)
+    {
+        hash = (hash ^ (unsigned char)*format) * 1099511628211ull;
+    }
+    return hash;
+}
+
+int logger_define(logger_t logger, const char *format, logger_site_t site, logger_format_t *entry)
+{
+    logger_formats_t formats;
+    logger_format_t candidate;
+    uint64_t hash;
+    size_t probe;
+    size_t index;
+    const char *key;
+    char *copy;
+    unsigned int state;
+    char buffer[BINARY_RECORD_SIZE];
+    int length;
+
+    formats = (logger_formats_t)logger->formats;
+
+    // a site only remembers a defined entry and definitions are never taken
+    // back, the entry just has to be from this logger's table
+    if (site != NULL)
+    {
+        candidate = (logger_format_t)atomic_load_explicit(&site->entry, memory_order_acquire);
+        if ((uintptr_t)candidate >= (uintptr_t)formats->entries && (uintptr_t)candidate < (uintptr_t)(formats->entries + BINARY_MAX_FORMATS))
+        {
+            *entry = candidate;
+            return (int)(candidate - formats->entries);
+        }
+    }
+
+    hash = logger_hash(format);
+    candidate = NULL;
+    copy = NULL;
+
+    for (probe = 0; probe < BINARY_MAX_FORMATS; probe++)
+    {
+        index = (hash + probe) & (BINARY_MAX_FORMATS - 1);
+        candidate = &formats->entries[index];
+        key = atomic_load_explicit(&candidate->format, memory_order_acquire);
+        if (key == NULL)
+        {
+            if (copy == NULL)
+            {
+                copy = strdup(format);
+                if (copy == NULL)
+                {
+                    return BINARY_TEXT_ID;
+                }
+            }
+            if (atomic_compare_exchange_strong_explicit(&candidate->format, &key, copy, memory_order_acq_rel, memory_order_acquire))
+            {
+                key = copy;
+                copy = NULL;
+            }
+        }
+        if (key != NULL && strcmp(key, format) == 0)
+        {
+            break;
+        }
+    }
+    CLEANUP(copy)
+
+    if (probe == BINARY_MAX_FORMATS)
+    {
+        return BINARY_TEXT_ID;
+    }
+
+    *entry = candidate;
+    state = atomic_load_explicit(&candidate->state, memory_order_acquire);
+    if (state == FORMAT_STATE_DEFINED)
+    {
+        if (site != NULL)
+        {
+            atomic_store_explicit(&site->entry, candidate, memory_order_release);
+        }
+        return (int)index;
+    }
+
+    // unsupported for good, or another thread is mid-definition: fall back
+    // to text rather than wait
+    if (state == FORMAT_STATE_UNSUPPORTED || state == FORMAT_STATE_DEFINING)
+    {
+        return BINARY_TEXT_ID;
+    }
+
+    if (!atomic_compare_exchange_strong(&candidate->state, &state, FORMAT_STATE_DEFINING))
+    {
+        return BINARY_TEXT_ID;
+    }
+
+    if (!candidate->parsed)
+    {
+        if (binary_parse(&candidate->signature, format) != STATUS_OK)
+        {
+            atomic_store_explicit(&candidate->state, FORMAT_STATE_UNSUPPORTED, memory_order_release);
+            return BINARY_TEXT_ID;
+        }
+        candidate->parsed = 1;
+    }
+
+    length = binary_encode_define(buffer, sizeof(buffer), (int)index, format);
+    if (length < 0)
+    {
+        atomic_store_explicit(&candidate->state, FORMAT_STATE_UNSUPPORTED, memory_order_release);
+        return BINARY_TEXT_ID;
+    }
+
+    if (logger_write(logger, buffer, (size_t)length) != STATUS_OK)
+    {
+        atomic_store_explicit(&candidate->state, FORMAT_STATE_UNDEFINED, memory_order_release);
+        return BINARY_TEXT_ID;
+    }
+
+    atomic_store_explicit(&candidate->state, FORMAT_STATE_DEFINED, memory_order_release);
+    if (site != NULL)
+    {
+        atomic_store_explicit(&site->entry, candidate, memory_order_release);
+    }
+    return (int)index;
+}
+
+void logger_encode(logger_t logger, int level, logger_site_t site, const char *format, va_list args)
+{
+    char buffer[BINARY_RECORD_SIZE];
+    queue_record_t record;
+    char *data;
+    size_t size;
+    logger_format_t entry;
+    int id;
+    int length;
+    va_list copy;
+
+    record = NULL;
+    entry = NULL;
+    id = logger_define(logger, format, site, &entry);
+
+    if (logger->queue != NULL)
+    {
+        if (queue_acquire((queue_t)logger->queue, &record) != STATUS_OK)
+        {
+            return;
+        }
+        data = record->data;
+        size = QUEUE_RECORD_SIZE;
+    }
+    else
+    {
+        data = buffer;
+        size = sizeof(buffer);
+    }
+
+    length = -1;
+    if (id != BINARY_TEXT_ID)
+    {
+        va_copy(copy, args);
+        length = binary_encode_record(data, size, level, id, &entry->signature, copy);
+        va_end(copy);
+    }
+
+    if (length < 0)
+    {
+        length = binary_encode_text(data, size, level, format, args);
+    }
+
+    if (record != NULL)
+    {
+        // a claimed slot has to be committed even if it ends up empty
+        record->length = length < 0 ? 0 : (size_t)length;
+        queue_commit((queue_t)logger->queue, record);
+    }
+    else if (length > 0)
+    {
+        pthread_mutex_lock((pthread_mutex_t *)logger->mutex);
+        fwrite(data, 1, (size_t)length, logger->file);
+        pthread_mutex_unlock((pthread_mutex_t *)logger->mutex);
+    }
+}
+
+void logger_encodef(logger_t logger, int level, logger_site_t site, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    logger_encode(logger, level, site, format, args);
+    va_end(args);
+}
+
+void logger_push(logger_t logger, int level, const char *format, va_list args)
+{
+    queue_record_t record;
+    int length;
+    int message_length;
+
+    if (queue_acquire((queue_t)logger->queue, &record) != STATUS_OK)
+    {
+        return;
+    }
+
+    if (logger->color == 1)
+    {
+        length = snprintf(record->data, QUEUE_RECORD_SIZE, "%s%-*s%s ", log_colors[level], 5, log_level_names[level], RESET_COLOR);
+    }
+    else
+    {
+        length = snprintf(record->data, QUEUE_RECORD_SIZE, "%-*s ", 5, log_level_names[level]);
+    }
+
+    message_length = vsnprintf(record->data + length, QUEUE_RECORD_SIZE - length, format, args);
+    if (message_length >= 0 && length + message_length < QUEUE_RECORD_SIZE)
+    {
+        length += message_length;
+    }
+    else
+    {
+        // truncated, keep the record line terminated
+        length = QUEUE_RECORD_SIZE - 1;
+        record->data[length - 1] = '\n';
+    }
+
+    record->length = length;
+    queue_commit((queue_t)logger->queue, record);
+}
+
+void logger_pushf(logger_t logger, int level, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    logger_push(logger, level, format, args);
+    va_end(args);
+}
+
 void logger_destroy(logger_t logger)
 {
+    size_t index;
+
     if (logger != NULL)
     {
+        if (logger->queue != NULL)
+        {
+            queue_destroy((queue_t)logger->queue);
+        }
+
+        if (logger->formats != NULL)
+        {
+            for (index = 0; index < BINARY_MAX_FORMATS; index++)
+            {
+                free((char *)atomic_load(&((logger_formats_t)logger->formats)->entries[index].format));
+            }
+            free(logger->formats);
+        }
+
         if (logger->mutex != NULL)
         {
             pthread_mutex_destroy((pthread_mutex_t *)logger->mutex);
@@ -0,0 +1,299 @@
+#include "queue.h"
+#include "logger.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define QUEUE_DEFAULT_CAPACITY 1024
+
+// bounded MPSC ring: producers claim a slot with a CAS on head, the writer
+// thread is the only consumer and owns tail
+struct queue_slot_s
+{
+    atomic_size_t sequence;
+    struct queue_record_s record;
+};
+typedef struct queue_slot_s *queue_slot_t;
+
+struct queue_s
+{
+    queue_slot_t slots;
+    size_t mask;
+    size_t tail;
+    int overflow;
+    FILE *file;
+    atomic_size_t head;
+    atomic_int sleeping;
+    atomic_int running;
+    atomic_uint_fast64_t dropped;
+    sem_t wake;
+    int has_wake;
+    // producers blocked on a full ring sleep here until a batch is written
+    atomic_int blocked;
+    pthread_mutex_t space_lock;
+    pthread_cond_t space;
+    int has_space_lock;
+    int has_space;
+    pthread_t writer;
+    int has_writer;
+};
+
+#define QUEUE_SLOT(RECORD) ((queue_slot_t)((char *)(RECORD)-offsetof(struct queue_slot_s, record)))
+
+static void *queue_write(void *user_data);
+
+static size_t queue_drain(queue_t queue);
+
+static int queue_ready(queue_t queue);
+
+static void queue_wake(queue_t queue);
+
+static void queue_wait(queue_t queue, queue_slot_t slot, size_t position);
+
+static void queue_release(queue_t queue);
+
+int queue_create(queue_t *queue, FILE *file, int capacity, int overflow, const char **error)
+{
+    int status;
+    queue_t new_queue;
+    size_t size;
+    size_t index;
+
+    status = STATUS_OK;
+    new_queue = NULL;
+
+    IF_THROW(queue == NULL, "queue_create: null queue")
+    IF_THROW(file == NULL, "queue_create: null file")
+
+    if (capacity <= 0)
+    {
+        capacity = QUEUE_DEFAULT_CAPACITY;
+    }
+
+    // round up to a power of two so positions can be masked
+    size = 1;
+    while (size < (size_t)capacity)
+    {
+        size <<= 1;
+    }
+
+    new_queue = calloc(1, sizeof(struct queue_s));
+    IF_THROW(new_queue == NULL, "queue_create: failed to allocate queue")
+
+    new_queue->slots = calloc(size, sizeof(struct queue_slot_s));
+    IF_THROW(new_queue->slots == NULL, "queue_create: failed to allocate slots")
+
+    for (index = 0; index < size; index++)
+    {
+        atomic_init(&new_queue->slots[index].sequence, index);
+    }
+
+    new_queue->mask = size - 1;
+    new_queue->tail = 0;
+    new_queue->overflow = overflow;
+    new_queue->file = file;
+    atomic_init(&new_queue->head, 0);
+    atomic_init(&new_queue->sleeping, 0);
+    atomic_init(&new_queue->running, 1);
+    atomic_init(&new_queue->dropped, 0);
+    atomic_init(&new_queue->blocked, 0);
+
+    IF_THROW(sem_init(&new_queue->wake, 0, 0) != 0, "queue_create: failed to initialize semaphore")
+    new_queue->has_wake = 1;
+
+    IF_THROW(pthread_mutex_init(&new_queue->space_lock, NULL) != 0, "queue_create: failed to initialize space lock")
+    new_queue->has_space_lock = 1;
+
+    IF_THROW(pthread_cond_init(&new_queue->space, NULL) != 0, "queue_create: failed to initialize space condition")
+    new_queue->has_space = 1;
+
+    IF_THROW(pthread_create(&new_queue->writer, NULL, queue_write, new_queue) != 0, "queue_create: failed to start writer")
+    new_queue->has_writer = 1;
+
+    *queue = new_queue;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_queue, queue_destroy(new_queue))
+done:
+    return status;
+}
+
+int queue_acquire(queue_t queue, queue_record_t *record)
+{
+    queue_slot_t slot;
+    size_t position;
+    size_t sequence;
+    intptr_t difference;
+
+    position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    for (;;)
+    {
+        slot = &queue->slots[position & queue->mask];
+        sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(
+                    &queue->head, &position, position + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                slot->record.position = position;
+                slot->record.length = 0;
+                *record = &slot->record;
+                return STATUS_OK;
+            }
+        }
+        else if (difference < 0)
+        {
+            // ring is full, the writer has not released this slot yet
+            if (queue->overflow == LOGGER_OVERFLOW_DROP)
+            {
+                atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+                return STATUS_ERROR;
+            }
+            queue_wait(queue, slot, position);
+            position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+        else
+        {
+            position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+}
+
+void queue_commit(queue_t queue, queue_record_t record)
+{
+    atomic_store_explicit(&QUEUE_SLOT(record)->sequence, record->position + 1, memory_order_seq_cst);
+    queue_wake(queue);
+}
+
+uint64_t queue_dropped(queue_t queue)
+{
+    return atomic_load_explicit(&queue->dropped, memory_order_relaxed);
+}
+
+void queue_destroy(queue_t queue)
+{
+    if (queue->has_writer)
+    {
+        atomic_store(&queue->running, 0);
+        sem_post(&queue->wake);
+        pthread_join(queue->writer, NULL);
+    }
+    if (queue->has_wake)
+    {
+        sem_destroy(&queue->wake);
+    }
+    if (queue->has_space)
+    {
+        pthread_cond_destroy(&queue->space);
+    }
+    if (queue->has_space_lock)
+    {
+        pthread_mutex_destroy(&queue->space_lock);
+    }
+    CLEANUP(queue->slots)
+    free(queue);
+}
+
+void *queue_write(void *user_data)
+{
+    queue_t queue;
+
+    queue = (queue_t)user_data;
+
+    for (;;)
+    {
+        if (queue_drain(queue) > 0)
+        {
+            continue;
+        }
+
+        if (!atomic_load(&queue->running))
+        {
+            // producers are gone, flush whatever landed after the last batch
+            queue_drain(queue);
+            break;
+        }
+
+        atomic_store(&queue->sleeping, 1);
+        if (queue_ready(queue) || !atomic_load(&queue->running))
+        {
+            atomic_store(&queue->sleeping, 0);
+            continue;
+        }
+        sem_wait(&queue->wake);
+    }
+
+    return NULL;
+}
+
+size_t queue_drain(queue_t queue)
+{
+    queue_slot_t slot;
+    size_t count;
+
+    count = 0;
+    while (queue_ready(queue))
+    {
+        slot = &queue->slots[queue->tail & queue->mask];
+        fwrite(slot->record.data, 1, slot->record.length, queue->file);
+        atomic_store_explicit(&slot->sequence, queue->tail + queue->mask + 1, memory_order_release);
+        queue->tail++;
+        count++;
+    }
+
+    if (count > 0)
+    {
+        fflush(queue->file);
+        queue_release(queue);
+    }
+
+    return count;
+}
+
+int queue_ready(queue_t queue)
+{
+    queue_slot_t slot;
+
+    slot = &queue->slots[queue->tail & queue->mask];
+    return atomic_load_explicit(&slot->sequence, memory_order_seq_cst) == queue->tail + 1;
+}
+
+void queue_wake(queue_t queue)
+{
+    if (atomic_exchange(&queue->sleeping, 0) == 1)
+    {
+        sem_post(&queue->wake);
+    }
+}
+
+void queue_wait(queue_t queue, queue_slot_t slot, size_t position)
+{
+    // a stalled sink parks producers instead of spinning them, the slot is
+    // checked again once registered so a batch written in between is seen
+    pthread_mutex_lock(&queue->space_lock);
+    atomic_fetch_add(&queue->blocked, 1);
+    queue_wake(queue);
+    while ((intptr_t)atomic_load(&slot->sequence) - (intptr_t)position < 0)
+    {
+        pthread_cond_wait(&queue->space, &queue->space_lock);
+    }
+    atomic_fetch_sub(&queue->blocked, 1);
+    pthread_mutex_unlock(&queue->space_lock);
+}
+
+void queue_release(queue_t queue)
+{
+    // pairs with the registration in queue_wait, either the writer sees the
+    // producer or the producer sees the freed slots
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&queue->blocked) > 0)
+    {
+        pthread_mutex_lock(&queue->space_lock);
+        pthread_cond_broadcast(&queue->space);
+        pthread_mutex_unlock(&queue->space_lock);
+    }
+}
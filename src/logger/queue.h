@@ -0,0 +1,27 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+#include "common.h"
+
+#define QUEUE_RECORD_SIZE 512
+
+struct queue_record_s
+{
+    size_t position;
+    size_t length;
+    char data[QUEUE_RECORD_SIZE];
+};
+typedef struct queue_record_s *queue_record_t;
+
+typedef struct queue_s *queue_t;
+
+int queue_create(queue_t *queue, FILE *file, int capacity, int overflow, const char **error);
+
+int queue_acquire(queue_t queue, queue_record_t *record);
+
+void queue_commit(queue_t queue, queue_record_t record);
+
+uint64_t queue_dropped(queue_t queue);
+
+void queue_destroy(queue_t queue);
+
+#endif
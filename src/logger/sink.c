@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include "sink.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a FILE backed by a pre-sized, memory mapped segment: writes are a memcpy
+// into the mapping and the segment is rolled over to path.1 .. path.N-1 once
+// it is full, so closing it with fclose is all the logger needs to know
+struct sink_s
+{
+    char *path;
+    size_t segment_size;
+    int segment_count;
+    int fd;
+    char *segment;
+    size_t offset;
+    uint64_t rotations;
+    // segments left at full size because their tail could not be dropped
+    uint64_t truncate_errors;
+    sink_rotate_fn rotate_fn;
+    void *user_data;
+};
+
+static ssize_t sink_write(void *cookie, const char *buffer, size_t size);
+
+static int sink_close(void *cookie);
+
+static int sink_open_segment(sink_t sink, const char **error);
+
+static void sink_close_segment(sink_t sink);
+
+static int sink_rotate(sink_t sink);
+
+static void sink_shift(sink_t sink);
+
+static void sink_destroy(sink_t sink);
+
+int sink_open(FILE **file, sink_t *sink, const char *path, size_t segment_size, int segment_count, const char **error)
+{
+    int status;
+    sink_t new_sink;
+    FILE *new_file;
+    cookie_io_functions_t functions;
+
+    status = STATUS_OK;
+    new_sink = NULL;
+    new_file = NULL;
+
+    IF_THROW(file == NULL, "sink_open: null file")
+    IF_THROW(path == NULL, "sink_open: null path")
+    IF_THROW(segment_size == 0, "sink_open: invalid segment size")
+    IF_THROW(segment_count < 1, "sink_open: invalid segment count")
+
+    new_sink = calloc(1, sizeof(struct sink_s));
+    IF_THROW(new_sink == NULL, "sink_open: failed to allocate sink")
+
+    new_sink->path = strdup(path);
+    IF_THROW(new_sink->path == NULL, "sink_open: failed to allocate path")
+
+    new_sink->segment_size = segment_size;
+    new_sink->segment_count = segment_count;
+    new_sink->fd = -1;
+
+    // keep the previous run's log rather than truncating it
+    sink_shift(new_sink);
+    if (sink_open_segment(new_sink, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
+    memset(&functions, 0, sizeof(functions));
+    functions.write = sink_write;
+    functions.close = sink_close;
+
+    new_file = fopencookie(new_sink, "w", functions);
+    IF_THROW(new_file == NULL, "sink_open: failed to open stream")
+
+    // stdio buffering would only add a second copy in front of the mapping
+    setvbuf(new_file, NULL, _IONBF, 0);
+
+    *file = new_file;
+    if (sink != NULL)
+    {
+        *sink = new_sink;
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_sink, sink_destroy(new_sink))
+done:
+    return status;
+}
+
+void sink_set_rotate_fn(sink_t sink, sink_rotate_fn rotate_fn, void *user_data)
+{
+    assert(sink != NULL);
+    sink->rotate_fn = rotate_fn;
+    sink->user_data = user_data;
+}
+
+uint64_t sink_rotations(sink_t sink)
+{
+    assert(sink != NULL);
+    return sink->rotations;
+}
+
+uint64_t sink_truncate_errors(sink_t sink)
+{
+    assert(sink != NULL);
+    return sink->truncate_errors;
+}
+
+ssize_t sink_write(void *cookie, const char *buffer, size_t size)
+{
+    sink_t sink;
+    size_t written;
+    size_t length;
+
+    sink = (sink_t)cookie;
+    written = 0;
+
+    // only split a write across segments when it cannot fit in one
+    if (size <= sink->segment_size && sink->offset + size > sink->segment_size)
+    {
+        if (sink_rotate(sink) != STATUS_OK)
+        {
+            return -1;
+        }
+    }
+
+    while (written < size)
+    {
+        if (sink->offset == sink->segment_size && sink_rotate(sink) != STATUS_OK)
+        {
+            break;
+        }
+
+        length = sink->segment_size - sink->offset;
+        if (length > size - written)
+        {
+            length = size - written;
+        }
+
+        memcpy(sink->segment + sink->offset, buffer + written, length);
+        sink->offset += length;
+        written += length;
+    }
+
+    return written > 0 ? (ssize_t)written : -1;
+}
+
+int sink_close(void *cookie)
+{
+    sink_destroy((sink_t)cookie);
+    return 0;
+}
+
+int sink_open_segment(sink_t sink, const char **error)
+{
+    int status;
+    void *segment;
+
+    status = STATUS_OK;
+
+    sink->fd = open(sink->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    IF_THROW(sink->fd < 0, "sink_open_segment: failed to open segment")
+    IF_THROW(ftruncate(sink->fd, (off_t)sink->segment_size) != 0, "sink_open_segment: failed to size segment")
+
+    segment = mmap(NULL, sink->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, sink->fd, 0);
+    IF_THROW(segment == MAP_FAILED, "sink_open_segment: failed to map segment")
+
+    sink->segment = (char *)segment;
+    sink->offset = 0;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    if (sink->fd >= 0)
+    {
+        close(sink->fd);
+        sink->fd = -1;
+    }
+done:
+    return status;
+}
+
+void sink_close_segment(sink_t sink)
+{
+    if (sink->segment != NULL)
+    {
+        munmap(sink->segment, sink->segment_size);
+        sink->segment = NULL;
+    }
+    if (sink->fd >= 0)
+    {
+        // drop the unused, zero filled tail of the segment
+        if (ftruncate(sink->fd, (off_t)sink->offset) != 0)
+        {
+            sink->truncate_errors++;
+        }
+        close(sink->fd);
+        sink->fd = -1;
+    }
+    // nothing is mapped, the next write has to rotate first
+    sink->offset = sink->segment_size;
+}
+
+int sink_rotate(sink_t sink)
+{
+    int length;
+
+    sink_close_segment(sink);
+    sink_shift(sink);
+    if (sink_open_segment(sink, NULL) != STATUS_OK)
+    {
+        return STATUS_ERROR;
+    }
+
+    sink->rotations++;
+    // at most half the segment goes to the prologue, the rest is left for
+    // the records that follow it
+    if (sink->rotate_fn != NULL)
+    {
+        length = sink->rotate_fn(sink->user_data, sink->segment, sink->segment_size / 2);
+        sink->offset = length > 0 ? (size_t)length : 0;
+    }
+    return STATUS_OK;
+}
+
+void sink_shift(sink_t sink)
+{
+    char *from;
+    char *to;
+    int index;
+    size_t length;
+
+    length = strlen(sink->path) + 16;
+    from = malloc(length);
+    to = malloc(length);
+    if (from == NULL || to == NULL)
+    {
+        goto done;
+    }
+
+    // path.N-1 falls off the end, everything else moves up by one
+    for (index = sink->segment_count - 1; index > 0; index--)
+    {
+        if (index == 1)
+        {
+            snprintf(from, length, "%s", sink->path);
+        }
+        else
+        {
+            snprintf(from, length, "%s.%d", sink->path, index - 1);
+        }
+        snprintf(to, length, "%s.%d", sink->path, index);
+        rename(from, to);
+    }
+
+done:
+    CLEANUP(from)
+    CLEANUP(to)
+}
+
+void sink_destroy(sink_t sink)
+{
+    sink_close_segment(sink);
+    CLEANUP(sink->path)
+    free(sink);
+}
@@ -0,0 +1,611 @@
+/*
+ * main.c - bluez-mock
+ * 	- Stands in for bluetoothd on the session bus so the client can run
+ * 	  without an adapter or a phone: owns org.bluez, exports org.bluez.Media1
+ * 	  on the adapter and configures a 48 kHz joint stereo SBC transport on
+ * 	  the first A2DP sink endpoint that registers, then starts "streaming".
+ * 	- TryAcquire and Acquire hand out one end of a SOCK_SEQPACKET socketpair
+ * 	  and a test tone is encoded and packetized into the other, one RTP
+ * 	  packet per write, the way bluetoothd passes on its L2CAP socket.
+ * 	- With -i the source suspends after that many seconds of streaming and
+ * 	  resumes as many seconds later, to exercise release and re-acquire.
+ * 	- Point the client at it with "bus": "session" and adapter "hci0".
+ * usage: bluez-mock [-a adapter] [-m mtu] [-i seconds]
+ */
+
+#include "logger.h"
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <glib-unix.h>
+#include <gst/gst.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(mock->logger, ERROR, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(mock->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(mock->logger, DEBUG, FORMAT, __VA_ARGS__);
+
+#define MOCK_BLUEZ "org.bluez"
+#define MOCK_SINK_UUID "0000110b-0000-1000-8000-00805f9b34fb"
+#define MOCK_DEVICE "dev_00_11_22_33_44_55"
+#define MOCK_CODEC_SBC 0x00
+#define MOCK_RATE 48000
+#define MOCK_CHANNELS 2
+// a typical EDR phone's L2CAP MTU
+#define MOCK_MTU 895
+// seconds between configuring the transport and the source starting
+#define MOCK_PENDING_DELAY 1
+
+// 48 kHz joint stereo, 16 blocks, 8 subbands, loudness, bitpool 2-53, the
+// octets of A2DP 1.3 section 4.3.2
+static const guint8 mock_configuration[] = {0x11, 0x15, 2, 53};
+
+static const char mock_introspection[] =
+    "<node>"
+    "  <interface name='org.bluez.Media1'>"
+    "    <method name='RegisterEndpoint'>"
+    "      <arg name='endpoint' type='o' direction='in'/>"
+    "      <arg name='properties' type='a{sv}' direction='in'/>"
+    "    </method>"
+    "    <method name='UnregisterEndpoint'>"
+    "      <arg name='endpoint' type='o' direction='in'/>"
+    "    </method>"
+    "  </interface>"
+    "  <interface name='org.bluez.MediaTransport1'>"
+    "    <method name='Acquire'>"
+    "      <arg name='fd' type='h' direction='out'/>"
+    "      <arg name='read_mtu' type='q' direction='out'/>"
+    "      <arg name='write_mtu' type='q' direction='out'/>"
+    "    </method>"
+    "    <method name='TryAcquire'>"
+    "      <arg name='fd' type='h' direction='out'/>"
+    "      <arg name='read_mtu' type='q' direction='out'/>"
+    "      <arg name='write_mtu' type='q' direction='out'/>"
+    "    </method>"
+    "    <method name='Release'/>"
+    "    <property name='Device' type='o' access='read'/>"
+    "    <property name='UUID' type='s' access='read'/>"
+    "    <property name='Codec' type='y' access='read'/>"
+    "    <property name='Configuration' type='ay' access='read'/>"
+    "    <property name='State' type='s' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+struct mock_s
+{
+    logger_t logger;
+    GMainLoop *loop;
+    GDBusConnection *connection;
+    GDBusNodeInfo *node_info;
+    char *adapter_path;
+    char *device_path;
+    char *transport_path;
+    guint media_registration;
+    guint transport_registration;
+    // the one sink endpoint the transport is configured on
+    char *owner;
+    char *endpoint_path;
+    guint owner_watch;
+    const char *state;
+    int mtu;
+    int interval;
+    guint timer;
+    // writes into the end of the socketpair that was not handed out
+    GstElement *pipeline;
+    int fd;
+};
+typedef struct mock_s *mock_t;
+
+static void mock_bus_acquired(GDBusConnection *connection, const gchar *name, gpointer user_data);
+
+static void mock_name_lost(GDBusConnection *connection, const gchar *name, gpointer user_data);
+
+static void mock_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name,
+                             const gchar *method_name, GVariant *parameters, GDBusMethodInvocation *invocation, gpointer user_data);
+
+static GVariant *mock_get_property(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name,
+                                   const gchar *property_name, GError **error, gpointer user_data);
+
+static void mock_register_endpoint(mock_t mock, const gchar *sender, GVariant *parameters, GDBusMethodInvocation *invocation);
+
+static void mock_acquire(mock_t mock, gboolean try, GDBusMethodInvocation *invocation);
+
+static gboolean mock_configure(gpointer user_data);
+
+static void mock_configured(GObject *source, GAsyncResult *result, gpointer user_data);
+
+static gboolean mock_timer(gpointer user_data);
+
+static void mock_set_state(mock_t mock, const char *state);
+
+static int mock_start_stream(mock_t mock, int fd);
+
+static void mock_stop_stream(mock_t mock);
+
+static void mock_owner_vanished(GDBusConnection *connection, const gchar *name, gpointer user_data);
+
+static void mock_clear(mock_t mock);
+
+static gboolean mock_quit(gpointer user_data);
+
+static const GDBusInterfaceVTable mock_vtable = {mock_method_call, mock_get_property, NULL};
+
+int main(int argc, char **argv)
+{
+    struct mock_s mock;
+    const char *adapter;
+    guint owner_id;
+    int option;
+    int status;
+    const char *error;
+
+    gst_init(NULL, NULL);
+
+    memset(&mock, 0, sizeof(mock));
+    status = STATUS_OK;
+    adapter = "hci0";
+    owner_id = 0;
+    mock.mtu = MOCK_MTU;
+    mock.fd = -1;
+    mock.state = "idle";
+
+    while ((option = getopt(argc, argv, "a:m:i:")) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            adapter = optarg;
+            break;
+        case 'm':
+            mock.mtu = atoi(optarg);
+            break;
+        case 'i':
+            mock.interval = atoi(optarg);
+            break;
+        default:
+            puts("usage: bluez-mock [-a adapter] [-m mtu] [-i seconds]");
+            return STATUS_ERROR;
+        }
+    }
+
+    if (logger_create(&mock.logger, DEBUG, stderr, NULL, NULL, &error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: logger_create failed");
+        goto error;
+    }
+
+    if (mock.mtu <= 0 || mock.mtu > G_MAXUINT16 || mock.interval < 0)
+    {
+        logger_errorln(mock.logger, "main: invalid mtu or interval");
+        goto error;
+    }
+
+    mock.adapter_path = g_strdup_printf("/org/bluez/%s", adapter);
+    mock.device_path = g_strdup_printf("%s/%s", mock.adapter_path, MOCK_DEVICE);
+    mock.transport_path = g_strdup_printf("%s/sep1/fd0", mock.device_path);
+    if (!g_variant_is_object_path(mock.transport_path))
+    {
+        logger_errorln(mock.logger, "main: adapter is not a valid object path element");
+        goto error;
+    }
+
+    mock.node_info = g_dbus_node_info_new_for_xml(mock_introspection, NULL);
+    mock.loop = g_main_loop_new(NULL, FALSE);
+
+    // the client closing its end mid-write must not take the mock down
+    signal(SIGPIPE, SIG_IGN);
+    g_unix_signal_add(SIGINT, mock_quit, &mock);
+    g_unix_signal_add(SIGTERM, mock_quit, &mock);
+
+    owner_id = g_bus_own_name(G_BUS_TYPE_SESSION, MOCK_BLUEZ, G_BUS_NAME_OWNER_FLAGS_NONE, mock_bus_acquired, NULL, mock_name_lost, &mock, NULL);
+    g_main_loop_run(mock.loop);
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    mock_clear(&mock);
+    if (mock.connection != NULL)
+    {
+        if (mock.media_registration != 0)
+        {
+            g_dbus_connection_unregister_object(mock.connection, mock.media_registration);
+        }
+        if (mock.transport_registration != 0)
+        {
+            g_dbus_connection_unregister_object(mock.connection, mock.transport_registration);
+        }
+        g_object_unref(mock.connection);
+    }
+    if (owner_id != 0)
+    {
+        g_bus_unown_name(owner_id);
+    }
+    CLEANUP_FUNCTION(mock.loop, g_main_loop_unref(mock.loop))
+    CLEANUP_FUNCTION(mock.node_info, g_dbus_node_info_unref(mock.node_info))
+    CLEANUP_FUNCTION(mock.adapter_path, g_free(mock.adapter_path))
+    CLEANUP_FUNCTION(mock.device_path, g_free(mock.device_path))
+    CLEANUP_FUNCTION(mock.transport_path, g_free(mock.transport_path))
+    CLEANUP_FUNCTION(mock.logger, logger_unref(mock.logger))
+    return status;
+}
+
+void mock_bus_acquired(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+    mock_t mock;
+
+    mock = (mock_t)user_data;
+    mock->connection = g_object_ref(connection);
+
+    // the transport object is exported up front, a client only learns its
+    // path from SetConfiguration
+    mock->media_registration = g_dbus_connection_register_object(connection, mock->adapter_path, mock->node_info->interfaces[0],
+                                                                 &mock_vtable, mock, NULL, NULL);
+    mock->transport_registration = g_dbus_connection_register_object(connection, mock->transport_path, mock->node_info->interfaces[1],
+                                                                     &mock_vtable, mock, NULL, NULL);
+    if (mock->media_registration == 0 || mock->transport_registration == 0)
+    {
+        logger_errorln(mock->logger, "mock_bus_acquired: failed to export objects");
+        g_main_loop_quit(mock->loop);
+        return;
+    }
+    INFOF("mock_bus_acquired: Media1 on %s, waiting for a sink endpoint\n", mock->adapter_path)
+}
+
+void mock_name_lost(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+    mock_t mock;
+
+    mock = (mock_t)user_data;
+    ERRORF("mock_name_lost: could not own %s on the session bus, is another mock running?\n", name)
+    g_main_loop_quit(mock->loop);
+}
+
+void mock_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name,
+                      const gchar *method_name, GVariant *parameters, GDBusMethodInvocation *invocation, gpointer user_data)
+{
+    mock_t mock;
+    const gchar *path;
+
+    mock = (mock_t)user_data;
+    DEBUGF("mock_method_call: %s.%s from %s\n", interface_name, method_name, sender)
+
+    if (strcmp(method_name, "RegisterEndpoint") == 0)
+    {
+        mock_register_endpoint(mock, sender, parameters, invocation);
+    }
+    else if (strcmp(method_name, "UnregisterEndpoint") == 0)
+    {
+        g_variant_get(parameters, "(&o)", &path);
+        if (mock->endpoint_path != NULL && strcmp(path, mock->endpoint_path) == 0 && strcmp(sender, mock->owner) == 0)
+        {
+            mock_clear(mock);
+        }
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+    else if (strcmp(method_name, "Acquire") == 0 || strcmp(method_name, "TryAcquire") == 0)
+    {
+        mock_acquire(mock, strcmp(method_name, "TryAcquire") == 0, invocation);
+    }
+    else if (strcmp(method_name, "Release") == 0)
+    {
+        mock_stop_stream(mock);
+        mock_set_state(mock, "idle");
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    }
+    else
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.NotSupported", method_name);
+    }
+}
+
+GVariant *mock_get_property(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name,
+                            const gchar *property_name, GError **error, gpointer user_data)
+{
+    mock_t mock;
+
+    mock = (mock_t)user_data;
+    if (strcmp(property_name, "Device") == 0)
+    {
+        return g_variant_new_object_path(mock->device_path);
+    }
+    if (strcmp(property_name, "UUID") == 0)
+    {
+        return g_variant_new_string(MOCK_SINK_UUID);
+    }
+    if (strcmp(property_name, "Codec") == 0)
+    {
+        return g_variant_new_byte(MOCK_CODEC_SBC);
+    }
+    if (strcmp(property_name, "Configuration") == 0)
+    {
+        return g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, mock_configuration, sizeof(mock_configuration), sizeof(guint8));
+    }
+    if (strcmp(property_name, "State") == 0)
+    {
+        return g_variant_new_string(mock->state);
+    }
+    g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY, "unknown property %s", property_name);
+    return NULL;
+}
+
+void mock_register_endpoint(mock_t mock, const gchar *sender, GVariant *parameters, GDBusMethodInvocation *invocation)
+{
+    const gchar *path;
+    GVariant *properties;
+    const gchar *uuid;
+    guint8 codec;
+
+    g_variant_get(parameters, "(&o@a{sv})", &path, &properties);
+    uuid = NULL;
+    codec = 0xff;
+    g_variant_lookup(properties, "UUID", "&s", &uuid);
+    g_variant_lookup(properties, "Codec", "y", &codec);
+
+    // a speaker is a sink and the only codec every source has is SBC
+    if (uuid == NULL || strcmp(uuid, MOCK_SINK_UUID) != 0 || codec != MOCK_CODEC_SBC)
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.NotSupported", "only SBC sink endpoints are mocked");
+    }
+    else if (mock->endpoint_path != NULL)
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.AlreadyExists", mock->endpoint_path);
+    }
+    else
+    {
+        mock->owner = g_strdup(sender);
+        mock->endpoint_path = g_strdup(path);
+        mock->owner_watch = g_bus_watch_name_on_connection(mock->connection, sender, G_BUS_NAME_WATCHER_FLAGS_NONE, NULL,
+                                                           mock_owner_vanished, mock, NULL);
+        INFOF("mock_register_endpoint: %s%s\n", sender, path)
+        g_dbus_method_invocation_return_value(invocation, NULL);
+
+        // bluetoothd configures the endpoint once a device connects, which
+        // here is right after the reply
+        g_idle_add(mock_configure, mock);
+    }
+    g_variant_unref(properties);
+}
+
+void mock_acquire(mock_t mock, gboolean try, GDBusMethodInvocation *invocation)
+{
+    GUnixFDList *fd_list;
+    int fds[2];
+
+    // TryAcquire only succeeds while the source waits to stream
+    if (mock->endpoint_path == NULL || strcmp(mock->state, "active") == 0)
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.NotAuthorized", "transport already acquired");
+        return;
+    }
+    if (try && strcmp(mock->state, "pending") != 0)
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.NotAvailable", "transport is not pending");
+        return;
+    }
+
+    // a pipe would merge packets, SEQPACKET keeps one read per write
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+    {
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Failed", "socketpair failed");
+        return;
+    }
+    if (mock_start_stream(mock, fds[0]) != STATUS_OK)
+    {
+        close(fds[1]);
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Failed", "failed to start the test source");
+        return;
+    }
+
+    // the list holds its own duplicate of the descriptor
+    fd_list = g_unix_fd_list_new();
+    g_unix_fd_list_append(fd_list, fds[1], NULL);
+    close(fds[1]);
+    g_dbus_method_invocation_return_value_with_unix_fd_list(invocation, g_variant_new("(hqq)", 0, (guint16)mock->mtu, (guint16)mock->mtu), fd_list);
+    g_object_unref(fd_list);
+
+    INFOF("mock_acquire: %s acquired, mtu %d\n", mock->transport_path, mock->mtu)
+    mock_set_state(mock, "active");
+    if (mock->timer != 0)
+    {
+        g_source_remove(mock->timer);
+        mock->timer = 0;
+    }
+    if (mock->interval > 0)
+    {
+        mock->timer = g_timeout_add_seconds(mock->interval, mock_timer, mock);
+    }
+}
+
+gboolean mock_configure(gpointer user_data)
+{
+    mock_t mock;
+    GVariantBuilder properties;
+
+    mock = (mock_t)user_data;
+    if (mock->endpoint_path == NULL)
+    {
+        return G_SOURCE_REMOVE;
+    }
+
+    g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&properties, "{sv}", "Device", g_variant_new_object_path(mock->device_path));
+    g_variant_builder_add(&properties, "{sv}", "UUID", g_variant_new_string(MOCK_SINK_UUID));
+    g_variant_builder_add(&properties, "{sv}", "Codec", g_variant_new_byte(MOCK_CODEC_SBC));
+    g_variant_builder_add(&properties, "{sv}", "Configuration",
+                          g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, mock_configuration, sizeof(mock_configuration), sizeof(guint8)));
+    g_variant_builder_add(&properties, "{sv}", "State", g_variant_new_string(mock->state));
+
+    g_dbus_connection_call(mock->connection, mock->owner, mock->endpoint_path, "org.bluez.MediaEndpoint1", "SetConfiguration",
+                           g_variant_new("(oa{sv})", mock->transport_path, &properties), NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                           mock_configured, mock);
+    return G_SOURCE_REMOVE;
+}
+
+void mock_configured(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+    mock_t mock;
+    GVariant *reply;
+    GError *call_error;
+
+    mock = (mock_t)user_data;
+    call_error = NULL;
+
+    reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &call_error);
+    if (reply == NULL)
+    {
+        ERRORF("mock_configured: SetConfiguration failed: %s\n", call_error->message)
+        g_error_free(call_error);
+        return;
+    }
+    g_variant_unref(reply);
+
+    INFOF("mock_configured: %s configured, SBC %d Hz %d ch\n", mock->transport_path, MOCK_RATE, MOCK_CHANNELS)
+    if (mock->endpoint_path != NULL && mock->timer == 0)
+    {
+        mock->timer = g_timeout_add_seconds(MOCK_PENDING_DELAY, mock_timer, mock);
+    }
+}
+
+gboolean mock_timer(gpointer user_data)
+{
+    mock_t mock;
+
+    mock = (mock_t)user_data;
+    mock->timer = 0;
+
+    // a suspending source drops its end before saying so, the client is
+    // not expected to call Release
+    if (strcmp(mock->state, "active") == 0)
+    {
+        mock_stop_stream(mock);
+        mock_set_state(mock, "idle");
+        if (mock->interval > 0)
+        {
+            mock->timer = g_timeout_add_seconds(mock->interval, mock_timer, mock);
+        }
+    }
+    else if (strcmp(mock->state, "idle") == 0)
+    {
+        mock_set_state(mock, "pending");
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void mock_set_state(mock_t mock, const char *state)
+{
+    GVariantBuilder changed;
+
+    if (strcmp(mock->state, state) == 0)
+    {
+        return;
+    }
+    mock->state = state;
+    INFOF("mock_set_state: %s %s\n", mock->transport_path, state)
+
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&changed, "{sv}", "State", g_variant_new_string(state));
+    g_dbus_connection_emit_signal(mock->connection, NULL, mock->transport_path, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                                  g_variant_new("(sa{sv}as)", "org.bluez.MediaTransport1", &changed, NULL), NULL);
+}
+
+int mock_start_stream(mock_t mock, int fd)
+{
+    int status;
+    char *description;
+    GError *parse_error;
+
+    status = STATUS_OK;
+    parse_error = NULL;
+    description = NULL;
+
+    mock_stop_stream(mock);
+
+    // fdsink writes every buffer with one write, so each payloaded RTP packet
+    // arrives as one SEQPACKET read on the client
+    description = g_strdup_printf("audiotestsrc is-live=true wave=sine ! audio/x-raw,rate=%d,channels=%d ! sbcenc ! "
+                                  "audio/x-sbc,channel-mode=joint,blocks=16,subbands=8,allocation-method=loudness ! "
+                                  "rtpsbcpay mtu=%d ! fdsink fd=%d",
+                                  MOCK_RATE, MOCK_CHANNELS, mock->mtu, fd);
+    mock->pipeline = gst_parse_launch(description, &parse_error);
+    mock->fd = fd;
+    if (mock->pipeline == NULL || parse_error != NULL)
+    {
+        ERRORF("mock_start_stream: %s\n", parse_error != NULL ? parse_error->message : "failed to build pipeline")
+        goto error;
+    }
+    if (gst_element_set_state(mock->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    {
+        logger_errorln(mock->logger, "mock_start_stream: failed to start pipeline");
+        goto error;
+    }
+    DEBUGF("mock_start_stream: %s\n", description)
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    mock_stop_stream(mock);
+done:
+    CLEANUP_FUNCTION(parse_error, g_error_free(parse_error))
+    CLEANUP_FUNCTION(description, g_free(description))
+    return status;
+}
+
+void mock_stop_stream(mock_t mock)
+{
+    // fdsink leaves the descriptor open, it is closed once nothing writes
+    if (mock->pipeline != NULL)
+    {
+        gst_element_set_state(mock->pipeline, GST_STATE_NULL);
+        gst_object_unref(mock->pipeline);
+        mock->pipeline = NULL;
+    }
+    if (mock->fd >= 0)
+    {
+        close(mock->fd);
+        mock->fd = -1;
+    }
+}
+
+void mock_owner_vanished(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+    mock_t mock;
+
+    mock = (mock_t)user_data;
+    INFOF("mock_owner_vanished: %s left the bus\n", name)
+    mock_clear(mock);
+}
+
+void mock_clear(mock_t mock)
+{
+    if (mock->timer != 0)
+    {
+        g_source_remove(mock->timer);
+        mock->timer = 0;
+    }
+    mock_stop_stream(mock);
+    if (mock->connection != NULL)
+    {
+        mock_set_state(mock, "idle");
+    }
+    if (mock->owner_watch != 0)
+    {
+        g_bus_unwatch_name(mock->owner_watch);
+        mock->owner_watch = 0;
+    }
+    CLEANUP_FUNCTION(mock->owner, g_free(mock->owner))
+    CLEANUP_FUNCTION(mock->endpoint_path, g_free(mock->endpoint_path))
+    mock->owner = NULL;
+    mock->endpoint_path = NULL;
+}
+
+gboolean mock_quit(gpointer user_data)
+{
+    mock_t mock;
+
+    mock = (mock_t)user_data;
+    g_main_loop_quit(mock->loop);
+    return G_SOURCE_REMOVE;
+}
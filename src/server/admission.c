@@ -0,0 +1,509 @@
+#include "admission.h"
+#include <sys/resource.h>
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(admission->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(admission->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(admission->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(admission->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(admission->logger, TRACE, FORMAT, __VA_ARGS__);
+
+// load is sampled on the main loop at this interval, the averages below
+// give it about a second of history
+#define ADMISSION_SAMPLE_INTERVAL 250
+
+// one per admitted ANNOUNCE, pending until it has a media and counted
+// until that media is unprepared, the ANNOUNCE fails or the client goes
+struct admission_client_s
+{
+    GstRTSPClient *client;
+    GMainContext *context;
+    GstRTSPMedia *media;
+    char *path;
+    gint64 admitted;
+};
+typedef struct admission_client_s *admission_client_t;
+
+static gint64 admission_cpu_time(void);
+
+static gboolean admission_sample(gpointer user_data);
+
+static admission_client_t admission_find_pending(admission_t admission, GstRTSPClient *client);
+
+static int admission_remove(admission_t admission, GstRTSPClient *client);
+
+static void admission_count(admission_t admission, const char *path, int *endpoint_sessions, int *total_sessions);
+
+static admission_client_t admission_oldest(admission_t admission, GstRTSPClient *client, const char *path);
+
+static char *admission_load_string(admission_t admission, int endpoint_sessions, int limit, int total_sessions);
+
+static const char *admission_address(GstRTSPClient *client);
+
+static gboolean admission_close(gpointer user_data);
+
+static void admission_client_closed(GstRTSPClient *client, gpointer user_data);
+
+static void admission_media_unprepared(GstRTSPMedia *media, gpointer user_data);
+
+static void admission_closure_notify(gpointer data, GClosure *closure);
+
+static void admission_client_destroy(gpointer user_data);
+
+static void admission_destroy(admission_t admission);
+
+int admission_create(admission_t *admission, config_t config, logger_t logger, const char **error)
+{
+    int status;
+    admission_t new_admission;
+
+    status = STATUS_OK;
+    new_admission = NULL;
+
+    IF_THROW(admission == NULL, "admission_create: null admission")
+    IF_THROW(config == NULL, "admission_create: null config")
+    IF_THROW(logger == NULL, "admission_create: null logger")
+
+    new_admission = calloc(1, sizeof(struct admission_s));
+    IF_THROW(new_admission == NULL, "admission_create: failed to allocate admission")
+
+    new_admission->ref = 1;
+    new_admission->logger = logger;
+    logger_ref(logger);
+    g_mutex_init(&new_admission->lock);
+    new_admission->clients = g_ptr_array_new_with_free_func(admission_client_destroy);
+    IF_THROW(new_admission->clients == NULL, "admission_create: failed to allocate clients")
+    new_admission->sampled = g_get_monotonic_time();
+    new_admission->cpu_time = admission_cpu_time();
+
+    admission_update(new_admission, config);
+
+    *admission = new_admission;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_admission, admission_destroy(new_admission))
+done:
+    return status;
+}
+
+void admission_update(admission_t admission, config_t config)
+{
+    g_mutex_lock(&admission->lock);
+    admission->sessions = config->admission_sessions;
+    admission->cpu = config->admission_cpu;
+    admission->lag = config->admission_lag;
+    admission->policy = config->admission_policy;
+    g_mutex_unlock(&admission->lock);
+}
+
+void admission_start(admission_t admission)
+{
+    // the main loop serves reloads and metrics, when it falls behind the
+    // streaming threads have the cores
+    admission->sampled = g_get_monotonic_time();
+    admission->cpu_time = admission_cpu_time();
+    admission->sampler = g_timeout_source_new(ADMISSION_SAMPLE_INTERVAL);
+    g_source_set_callback(admission->sampler, admission_sample, admission, NULL);
+    g_source_attach(admission->sampler, NULL);
+}
+
+gboolean admission_admit(admission_t admission, GstRTSPClient *client, const char *path, int limit)
+{
+    admission_client_t entry;
+    admission_client_t victim;
+    const char *reason;
+    GstRTSPClient *victim_client;
+    GMainContext *victim_context;
+    char *victim_address;
+    char *load;
+    int endpoint_sessions;
+    int total_sessions;
+    gboolean endpoint_full;
+
+    reason = NULL;
+    victim = NULL;
+    victim_client = NULL;
+    victim_context = NULL;
+    victim_address = NULL;
+
+    g_mutex_lock(&admission->lock);
+    // an ANNOUNCE that never got its reply does not hold a place
+    entry = admission_find_pending(admission, client);
+    if (entry != NULL)
+    {
+        g_ptr_array_remove(admission->clients, entry);
+    }
+    admission_count(admission, path, &endpoint_sessions, &total_sessions);
+    endpoint_full = limit > 0 && endpoint_sessions >= limit;
+
+    // shedding an old session for a new one does not bring the load down,
+    // over budget every policy turns the newcomer away
+    if (admission->cpu > 0 && admission->load > admission->cpu)
+    {
+        reason = "cpu budget exceeded";
+    }
+    else if (admission->lag > 0 && admission->dispatch_lag > admission->lag)
+    {
+        reason = "latency budget exceeded";
+    }
+    else if (endpoint_full || (admission->sessions > 0 && total_sessions >= admission->sessions))
+    {
+        // a full endpoint gives up its own oldest session, which also frees
+        // a place in the total, a full server its oldest anywhere
+        victim = admission->policy == ADMISSION_POLICY_PREEMPT ? admission_oldest(admission, client, endpoint_full ? path : NULL) : NULL;
+        if (victim == NULL)
+        {
+            reason = endpoint_full ? "endpoint session limit reached" : "server session limit reached";
+        }
+    }
+
+    if (victim != NULL)
+    {
+        // closing the victim ends every session on its connection, none of
+        // them count from here on
+        victim_client = g_object_ref(victim->client);
+        victim_context = g_main_context_ref(victim->context);
+        victim_address = g_strdup(admission_address(victim_client));
+        admission_remove(admission, victim_client);
+        admission_count(admission, path, &endpoint_sessions, &total_sessions);
+    }
+
+    if (reason == NULL)
+    {
+        entry = calloc(1, sizeof(struct admission_client_s));
+        if (entry != NULL)
+        {
+            entry->client = client;
+            entry->context = g_main_context_ref_thread_default();
+            entry->path = g_strdup(path);
+            entry->admitted = g_get_monotonic_time();
+            g_ptr_array_add(admission->clients, entry);
+        }
+        endpoint_sessions++;
+        total_sessions++;
+    }
+
+    load = admission_load_string(admission, endpoint_sessions, limit, total_sessions);
+    g_mutex_unlock(&admission->lock);
+
+    // closed outside the lock: on the loop serving it, which is usually
+    // this one, the close runs right here and emits "closed", so its media
+    // and mixer input are gone before the newcomer's media is built
+    if (victim_client != NULL)
+    {
+        g_main_context_invoke_full(victim_context, G_PRIORITY_DEFAULT, admission_close, victim_client, g_object_unref);
+        g_main_context_unref(victim_context);
+    }
+
+    if (victim_address != NULL)
+    {
+        WARNF("admission_admit: %s: preempting oldest session from %s for %s\n", path, victim_address, admission_address(client))
+    }
+    if (reason != NULL)
+    {
+        WARNF("admission_admit: %s: rejected %s, %s (%s)\n", path, admission_address(client), reason, load)
+    }
+    else
+    {
+        INFOF("admission_admit: %s: admitted %s (%s)\n", path, admission_address(client), load)
+    }
+
+    g_free(victim_address);
+    g_free(load);
+    return reason == NULL;
+}
+
+void admission_watch_client(admission_t admission, GstRTSPClient *client)
+{
+    admission_ref(admission);
+    g_signal_connect_data(client, "closed", G_CALLBACK(admission_client_closed), admission, admission_closure_notify, 0);
+}
+
+void admission_bind(admission_t admission, GstRTSPClient *client, GstRTSPMedia *media)
+{
+    admission_client_t entry;
+
+    // the session counts for as long as the media it announced lives
+    g_mutex_lock(&admission->lock);
+    entry = admission_find_pending(admission, client);
+    if (entry != NULL)
+    {
+        entry->media = media;
+    }
+    g_mutex_unlock(&admission->lock);
+
+    if (entry != NULL)
+    {
+        admission_ref(admission);
+        g_signal_connect_data(media, "unprepared", G_CALLBACK(admission_media_unprepared), admission, admission_closure_notify, 0);
+    }
+}
+
+void admission_release(admission_t admission, GstRTSPClient *client)
+{
+    admission_client_t entry;
+
+    // the ANNOUNCE failed after it was admitted
+    g_mutex_lock(&admission->lock);
+    entry = admission_find_pending(admission, client);
+    if (entry != NULL)
+    {
+        DEBUGF("admission_release: %s: released %s\n", entry->path, admission_address(client))
+        g_ptr_array_remove(admission->clients, entry);
+    }
+    g_mutex_unlock(&admission->lock);
+}
+
+void admission_ref(admission_t admission)
+{
+    g_atomic_int_inc(&admission->ref);
+}
+
+void admission_unref(admission_t admission)
+{
+    assert(admission != NULL);
+    if (g_atomic_int_dec_and_test(&admission->ref))
+    {
+        admission_destroy(admission);
+    }
+}
+
+gint64 admission_cpu_time(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+    return (gint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+gboolean admission_sample(gpointer user_data)
+{
+    admission_t admission;
+    gint64 now;
+    gint64 cpu_time;
+    gint64 elapsed;
+    double load;
+    double lag;
+
+    admission = (admission_t)user_data;
+    now = g_get_monotonic_time();
+    cpu_time = admission_cpu_time();
+    elapsed = now - admission->sampled;
+    if (elapsed <= 0)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    // load is the share of every core this process used, lag how much
+    // later than asked for the timer was dispatched
+    load = (double)(cpu_time - admission->cpu_time) * 100 / elapsed / g_get_num_processors();
+    lag = MAX(elapsed - ADMISSION_SAMPLE_INTERVAL * 1000, 0) / 1000.0;
+
+    // one busy sample does not turn clients away, a stall is felt at once
+    // and fades over the next second
+    g_mutex_lock(&admission->lock);
+    admission->load = admission->load * 0.75 + load * 0.25;
+    admission->dispatch_lag = MAX(lag, admission->dispatch_lag * 0.75);
+    g_mutex_unlock(&admission->lock);
+
+    admission->sampled = now;
+    admission->cpu_time = cpu_time;
+    return G_SOURCE_CONTINUE;
+}
+
+admission_client_t admission_find_pending(admission_t admission, GstRTSPClient *client)
+{
+    admission_client_t entry;
+    guint index;
+
+    // a connection announces one session at a time
+    for (index = 0; index < admission->clients->len; index++)
+    {
+        entry = (admission_client_t)g_ptr_array_index(admission->clients, index);
+        if (entry->client == client && entry->media == NULL)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int admission_remove(admission_t admission, GstRTSPClient *client)
+{
+    admission_client_t entry;
+    guint index;
+    int removed;
+
+    removed = 0;
+    index = 0;
+    while (index < admission->clients->len)
+    {
+        entry = (admission_client_t)g_ptr_array_index(admission->clients, index);
+        if (entry->client == client)
+        {
+            g_ptr_array_remove_index_fast(admission->clients, index);
+            removed++;
+            continue;
+        }
+        index++;
+    }
+    return removed;
+}
+
+void admission_count(admission_t admission, const char *path, int *endpoint_sessions, int *total_sessions)
+{
+    admission_client_t entry;
+    guint index;
+
+    *endpoint_sessions = 0;
+    *total_sessions = 0;
+    for (index = 0; index < admission->clients->len; index++)
+    {
+        entry = (admission_client_t)g_ptr_array_index(admission->clients, index);
+        *endpoint_sessions += strcmp(entry->path, path) == 0;
+        (*total_sessions)++;
+    }
+}
+
+admission_client_t admission_oldest(admission_t admission, GstRTSPClient *client, const char *path)
+{
+    admission_client_t entry;
+    admission_client_t oldest;
+    guint index;
+
+    oldest = NULL;
+    for (index = 0; index < admission->clients->len; index++)
+    {
+        entry = (admission_client_t)g_ptr_array_index(admission->clients, index);
+        if (entry->client == client || (path != NULL && strcmp(entry->path, path) != 0))
+        {
+            continue;
+        }
+        if (oldest == NULL || entry->admitted < oldest->admitted)
+        {
+            oldest = entry;
+        }
+    }
+    return oldest;
+}
+
+char *admission_load_string(admission_t admission, int endpoint_sessions, int limit, int total_sessions)
+{
+    GString *load;
+
+    // each figure is followed by its bound, unlimited ones have none
+    load = g_string_new(NULL);
+    g_string_append_printf(load, "endpoint %d", endpoint_sessions);
+    if (limit > 0)
+    {
+        g_string_append_printf(load, "/%d", limit);
+    }
+    g_string_append_printf(load, ", total %d", total_sessions);
+    if (admission->sessions > 0)
+    {
+        g_string_append_printf(load, "/%d", admission->sessions);
+    }
+    g_string_append_printf(load, ", cpu %.0f%%", admission->load);
+    if (admission->cpu > 0)
+    {
+        g_string_append_printf(load, "/%d%%", admission->cpu);
+    }
+    g_string_append_printf(load, ", lag %.1f", admission->dispatch_lag);
+    if (admission->lag > 0)
+    {
+        g_string_append_printf(load, "/%d", admission->lag);
+    }
+    g_string_append(load, " ms");
+    return g_string_free(load, FALSE);
+}
+
+const char *admission_address(GstRTSPClient *client)
+{
+    GstRTSPConnection *connection;
+    const char *address;
+
+    connection = gst_rtsp_client_get_connection(client);
+    address = connection != NULL ? gst_rtsp_connection_get_ip(connection) : NULL;
+    return address != NULL ? address : "unknown client";
+}
+
+gboolean admission_close(gpointer user_data)
+{
+    // tears down every session the client holds, its media unprepares and
+    // gives back the sink and any mixer input
+    gst_rtsp_client_close((GstRTSPClient *)user_data);
+    return G_SOURCE_REMOVE;
+}
+
+void admission_client_closed(GstRTSPClient *client, gpointer user_data)
+{
+    admission_t admission;
+    int removed;
+
+    admission = (admission_t)user_data;
+
+    // a preempted client was let go of when it was picked
+    g_mutex_lock(&admission->lock);
+    removed = admission_remove(admission, client);
+    g_mutex_unlock(&admission->lock);
+
+    if (removed > 0)
+    {
+        DEBUGF("admission_client_closed: released %d sessions of %s\n", removed, admission_address(client))
+    }
+}
+
+void admission_media_unprepared(GstRTSPMedia *media, gpointer user_data)
+{
+    admission_t admission;
+    admission_client_t entry;
+    guint index;
+
+    admission = (admission_t)user_data;
+
+    // torn down, timed out or closed, the place is free
+    g_mutex_lock(&admission->lock);
+    for (index = 0; index < admission->clients->len; index++)
+    {
+        entry = (admission_client_t)g_ptr_array_index(admission->clients, index);
+        if (entry->media == media)
+        {
+            DEBUGF("admission_media_unprepared: %s: released %s\n", entry->path, admission_address(entry->client))
+            g_ptr_array_remove_index_fast(admission->clients, index);
+            break;
+        }
+    }
+    g_mutex_unlock(&admission->lock);
+}
+
+void admission_closure_notify(gpointer data, GClosure *closure)
+{
+    admission_unref((admission_t)data);
+}
+
+void admission_client_destroy(gpointer user_data)
+{
+    admission_client_t entry;
+
+    entry = (admission_client_t)user_data;
+    CLEANUP_FUNCTION(entry->context, g_main_context_unref(entry->context))
+    CLEANUP_FUNCTION(entry->path, g_free(entry->path))
+    free(entry);
+}
+
+void admission_destroy(admission_t admission)
+{
+    if (admission->sampler != NULL)
+    {
+        g_source_destroy(admission->sampler);
+        g_source_unref(admission->sampler);
+    }
+    CLEANUP_FUNCTION(admission->clients, g_ptr_array_unref(admission->clients))
+    g_mutex_clear(&admission->lock);
+    CLEANUP_FUNCTION(admission->logger, logger_unref(admission->logger))
+    free(admission);
+}
@@ -0,0 +1,50 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "config.h"
+#include "logger.h"
+#include <gst/rtsp-server/rtsp-server.h>
+
+// the per-endpoint session limit, set on each media factory
+#define ADMISSION_LIMIT_KEY "admission-limit"
+
+struct admission_s
+{
+    int ref;
+    logger_t logger;
+    GMutex lock;
+    // limits are swapped on reload, admitted clients stay counted
+    int sessions;
+    int cpu;
+    int lag;
+    int policy;
+    // admitted sessions, several may share one client connection
+    GPtrArray *clients;
+    // sampled on the main loop, read by every loop under the lock
+    GSource *sampler;
+    gint64 sampled;
+    gint64 cpu_time;
+    double load;
+    double dispatch_lag;
+};
+typedef struct admission_s *admission_t;
+
+int admission_create(admission_t *admission, config_t config, logger_t logger, const char **error);
+
+void admission_update(admission_t admission, config_t config);
+
+void admission_start(admission_t admission);
+
+void admission_watch_client(admission_t admission, GstRTSPClient *client);
+
+gboolean admission_admit(admission_t admission, GstRTSPClient *client, const char *path, int limit);
+
+void admission_bind(admission_t admission, GstRTSPClient *client, GstRTSPMedia *media);
+
+void admission_release(admission_t admission, GstRTSPClient *client);
+
+void admission_ref(admission_t admission);
+
+void admission_unref(admission_t admission);
+
+#endif
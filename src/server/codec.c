@@ -0,0 +1,74 @@
+#include "codec.h"
+#include <glib.h>
+
+struct codec_s
+{
+    const char *name;
+    const char *chain;
+    // sample format the chain ends in, NULL when the decoder negotiates it
+    const char *format;
+};
+
+// each chain starts with the depayloader rtsp-server links the RECORD stream
+// to and ends in raw audio, from the element named decode0 when there is a
+// decoder to time. Nothing in them converts: L16 arrives big endian and SBC
+// decodes to little endian, a converter is only put behind them for a device
+// that wants the other byte order. opusdec conceals a lost packet and
+// rebuilds it from the next packet's in-band fec when the client sent any
+static const struct codec_s codecs[] = {
+    {"L16", "rtpL16depay name=depay0", "S16BE"},
+    {"opus", "rtpopusdepay name=depay0 ! opusdec name=decode0 plc=true use-inband-fec=true", NULL},
+    {"sbc", "rtpsbcdepay name=depay0 ! sbcparse ! sbcdec name=decode0", "S16LE"},
+};
+
+static const struct codec_s *codec_find(const char *codec);
+
+gboolean codec_known(const char *codec)
+{
+    return codec_find(codec) != NULL;
+}
+
+char *codec_chain(device_t device)
+{
+    const struct codec_s *codec;
+
+    codec = codec_find(device->codec);
+    if (codec == NULL)
+    {
+        return NULL;
+    }
+
+    // the rate is never converted, a stream at another rate than the device
+    // fails to link against codec_caps
+    if (codec->format != NULL && g_ascii_strcasecmp(codec->format, device->format) != 0)
+    {
+        return g_strdup_printf("%s ! audioconvert", codec->chain);
+    }
+    return g_strdup(codec->chain);
+}
+
+char *codec_caps(device_t device)
+{
+    // the decoder negotiates straight to the sink's native format, anything
+    // else fails to link instead of silently resampling
+    return g_strdup_printf("audio/x-raw,format=%s,rate=%d,channels=%d", device->format, device->rate, device->channels);
+}
+
+const struct codec_s *codec_find(const char *codec)
+{
+    size_t index;
+
+    if (codec == NULL)
+    {
+        return NULL;
+    }
+
+    for (index = 0; index < G_N_ELEMENTS(codecs); index++)
+    {
+        if (g_ascii_strcasecmp(codecs[index].name, codec) == 0)
+        {
+            return &codecs[index];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "config.h"
+#include <glib.h>
+
+gboolean codec_known(const char *codec);
+
+char *codec_chain(device_t device);
+
+char *codec_caps(device_t device);
+
+#endif
@@ -1,8 +1,57 @@
 #include "config.h"
+#include "logger.h"
 #include <cjson/cJSON.h>
 
+#define DEVICE_DEFAULT_LATENCY 500
+#define DEVICE_DEFAULT_LATENCY_MIN 20
+#define DEVICE_DEFAULT_LATENCY_MAX 2000
+#define DEVICE_DEFAULT_FORMAT "S16LE"
+#define DEVICE_DEFAULT_RATE 48000
+#define DEVICE_DEFAULT_CHANNELS 2
+#define DEVICE_MAX_CPUS 62
+#define DEVICE_MAX_MIX 16
+#define DEVICE_DEFAULT_PACKET_RATE 200
+#define DEVICE_DEFAULT_ALSA_PERIOD 10
+#define DEVICE_DEFAULT_ALSA_BUFFER 40
+#define DEVICE_MAX_PACKET_RATE 2000
+#define DEVICE_DEFAULT_LIMITER_THRESHOLD -1.0
+#define DEVICE_DEFAULT_IDLE_THRESHOLD -70.0
+#define DEVICE_DEFAULT_IDLE_HOLD 10000
+
 static void config_parse(config_t config, cJSON *json);
 
+static void config_parse_clock(config_t config, const cJSON *clock);
+
+static void config_parse_stats(config_t config, const cJSON *stats);
+
+static void config_parse_realtime(config_t config, const cJSON *realtime);
+
+static void config_parse_registry(config_t config, const cJSON *registry);
+
+static void config_parse_admission(config_t config, const cJSON *admission);
+
+static void config_parse_alsa(device_t device, const cJSON *alsa);
+
+static void config_parse_idle(device_t device, const cJSON *idle);
+
+static void config_parse_latency(device_t device, const cJSON *latency);
+
+static void config_parse_dsp(device_t device, const cJSON *dsp);
+
+static void config_parse_eq(device_t device, const cJSON *eq);
+
+static void config_parse_cpus(device_t device, const cJSON *cpus);
+
+static void config_parse_members(device_t device, const cJSON *members);
+
+static void config_parse_loops(config_t config, const cJSON *loops);
+
+static int config_validate_port(const char *port);
+
+static device_t config_find_device(config_t config, const char *endpoint);
+
+static int config_string_equal(const char *string, const char *other);
+
 static void config_destroy(config_t config);
 
 int config_create(config_t *config, const char **error)
@@ -22,6 +71,29 @@ int config_create(config_t *config, const char **error)
     (*config)->port = "8554";
     (*config)->log_level = INFO;
     (*config)->log_path = "stdout";
+    (*config)->log_mode = LOGGER_MODE_SYNC;
+    (*config)->log_format = LOGGER_FORMAT_TEXT;
+    (*config)->log_overflow = LOGGER_OVERFLOW_DROP;
+    (*config)->log_capacity = 1024;
+    (*config)->log_sink = LOG_SINK_FILE;
+    (*config)->log_segment_size = 16 * 1024 * 1024;
+    (*config)->log_segment_count = 4;
+    (*config)->clock_mode = CLOCK_MODE_NONE;
+    (*config)->clock_address = "0.0.0.0";
+    (*config)->clock_port = 8555;
+    (*config)->stats_address = "127.0.0.1";
+    (*config)->stats_port = 0;
+    (*config)->stats_socket = NULL;
+    (*config)->realtime_policy = REALTIME_POLICY_NONE;
+    (*config)->realtime_priority = 50;
+    (*config)->registry_path = NULL;
+    (*config)->registry_update = 1;
+    (*config)->admission_sessions = 0;
+    (*config)->admission_cpu = 0;
+    (*config)->admission_lag = 0;
+    (*config)->admission_policy = ADMISSION_POLICY_REJECT;
+    (*config)->loops = NULL;
+    (*config)->nloops = 0;
     (*config)->devices = NULL;
     (*config)->ndevices = 0;
     (*config)->json = NULL;
@@ -63,6 +135,7 @@ int config_load(config_t config, const char *const path, const char **error)
     IF_THROW(json == NULL, "config_load: failed to create json parser")
 
     config_parse(config, json);
+    config->path = path;
 
     CLEANUP_FUNCTION(config->json, cJSON_Delete((cJSON *)config->json))
 
@@ -81,6 +154,12 @@ int config_validate(config_t config, const char **error)
 {
     int status;
     int port;
+    int index;
+    int member;
+    int band;
+    device_t device;
+    device_t other;
+    loop_config_t loop;
     status = STATUS_OK;
 
     port = atoi(config->port);
@@ -90,11 +169,133 @@ int config_validate(config_t config, const char **error)
 
     IF_THROW(config->log_level < ERROR || config->log_level > TRACE, "config_validate: invalid log level")
 
+    IF_THROW(config->log_format < 0, "config_validate: invalid log format")
+
+    IF_THROW(config->log_overflow < 0, "config_validate: invalid log overflow policy")
+
+    IF_THROW(config->log_capacity <= 0, "config_validate: invalid log capacity")
+
+    IF_THROW(config->log_sink < 0, "config_validate: invalid log sink")
+
+    IF_THROW(config->log_sink == LOG_SINK_MMAP && (strcmp(config->log_path, "stdout") == 0 || strcmp(config->log_path, "stderr") == 0),
+             "config_validate: mmap log sink requires a file path")
+
+    IF_THROW(config->log_segment_size < 4096, "config_validate: log segment size too small")
+
+    IF_THROW(config->log_segment_count < 1, "config_validate: invalid log segment count")
+
+    IF_THROW(config->clock_mode < 0, "config_validate: invalid clock mode")
+
+    IF_THROW(config->clock_address == NULL, "config_validate: invalid clock address")
+
+    IF_THROW(config->clock_port < 1 || config->clock_port > UINT16_MAX, "config_validate: invalid clock port")
+
+    IF_THROW(config->stats_address == NULL, "config_validate: invalid stats address")
+
+    IF_THROW(config->stats_port < 0 || config->stats_port > UINT16_MAX, "config_validate: invalid stats port")
+
+    IF_THROW(config->stats_socket != NULL && strlen(config->stats_socket) >= 108, "config_validate: stats socket path too long")
+
+    IF_THROW(config->realtime_policy < 0, "config_validate: invalid realtime policy")
+
+    IF_THROW(config->realtime_priority < 1 || config->realtime_priority > 99, "config_validate: invalid realtime priority")
+
+    IF_THROW(config->admission_sessions < 0, "config_validate: invalid admission session limit")
+
+    IF_THROW(config->admission_cpu < 0 || config->admission_cpu > 100, "config_validate: invalid admission cpu budget")
+
+    IF_THROW(config->admission_lag < 0, "config_validate: invalid admission latency budget")
+
+    IF_THROW(config->admission_policy < 0, "config_validate: invalid admission policy")
+
+    // every loop runs its own RTSP server, so each needs a port of its own
+    for (index = 0; index < config->nloops; index++)
+    {
+        loop = config->loops + index;
+        IF_THROW(loop->name == NULL, "config_validate: loop missing name")
+        IF_THROW(!config_validate_port(loop->port), "config_validate: invalid loop port")
+        IF_THROW(atoi(loop->port) == port, "config_validate: loop port clashes with server port")
+        for (member = 0; member < index; member++)
+        {
+            IF_THROW(strcmp(config->loops[member].name, loop->name) == 0, "config_validate: duplicate loop name")
+            IF_THROW(atoi(config->loops[member].port) == atoi(loop->port), "config_validate: duplicate loop port")
+        }
+        for (member = 0; member < loop->ndevices; member++)
+        {
+            IF_THROW(loop->device_names[member] == NULL, "config_validate: invalid loop device")
+            device = config_find_device(config, loop->device_names[member]);
+            IF_THROW(device == NULL, "config_validate: loop device not found")
+            IF_THROW(device->loop != NULL && strcmp(device->loop, loop->name) != 0, "config_validate: device in more than one loop")
+            device->loop = loop->name;
+        }
+    }
+
+    for (index = 0; index < config->ndevices; index++)
+    {
+        device = config->devices + index;
+        IF_THROW(device->type < 0, "config_validate: invalid device type")
+        IF_THROW(device->sink < 0, "config_validate: invalid device sink")
+        IF_THROW(device->alsa_period < 1 || device->alsa_period > 100, "config_validate: invalid device alsa period")
+        IF_THROW(device->alsa_buffer < 2 * device->alsa_period || device->alsa_buffer > 1000, "config_validate: invalid device alsa buffer")
+        IF_THROW(device->endpoint == NULL, "config_validate: device missing endpoint")
+        IF_THROW(device->type == DEVICE_TYPE_ZONE && device->name == NULL, "config_validate: device missing name")
+        IF_THROW(config_find_device(config, device->endpoint) != device, "config_validate: duplicate device endpoint")
+        IF_THROW(device->latency_min < 0 || device->latency_min > device->latency_max, "config_validate: invalid device latency bounds")
+        IF_THROW(device->latency < device->latency_min || device->latency > device->latency_max, "config_validate: device latency out of bounds")
+        IF_THROW(device->format == NULL, "config_validate: invalid device format")
+        IF_THROW(device->rate < 8000 || device->rate > 192000, "config_validate: invalid device rate")
+        IF_THROW(device->channels < 1 || device->channels > 8, "config_validate: invalid device channels")
+        IF_THROW(device->cpus < 0, "config_validate: invalid device cpus")
+        IF_THROW(device->mix < 0 || device->mix > DEVICE_MAX_MIX, "config_validate: invalid device mix inputs")
+        IF_THROW(device->packet_rate < 1 || device->packet_rate > DEVICE_MAX_PACKET_RATE, "config_validate: invalid device packet rate")
+        IF_THROW(device->sessions < 0, "config_validate: invalid device session limit")
+        IF_THROW(device->idle < 0, "config_validate: invalid device idle")
+        IF_THROW(device->idle_threshold < -120 || device->idle_threshold > 0, "config_validate: invalid device idle threshold")
+        IF_THROW(device->idle_hold < 100 || device->idle_hold > 3600000, "config_validate: invalid device idle hold")
+        IF_THROW(device->gain < -60 || device->gain > 12, "config_validate: invalid device gain")
+        IF_THROW(device->limiter < 0, "config_validate: invalid device limiter")
+        IF_THROW(device->limiter_threshold < -20 || device->limiter_threshold > 0, "config_validate: invalid device limiter threshold")
+        IF_THROW(device->neq < 0, "config_validate: invalid device eq")
+        for (band = 0; band < device->neq; band++)
+        {
+            IF_THROW(device->eq[band].type < 0, "config_validate: invalid eq band type")
+            IF_THROW(device->eq[band].frequency < 20 || device->eq[band].frequency >= device->rate / 2.0, "config_validate: invalid eq band frequency")
+            IF_THROW(device->eq[band].gain < -24 || device->eq[band].gain > 24, "config_validate: invalid eq band gain")
+            IF_THROW(device->eq[band].q < 0.1 || device->eq[band].q > 10, "config_validate: invalid eq band q")
+        }
+
+        if (device->type != DEVICE_TYPE_GROUP)
+        {
+            continue;
+        }
+
+        // groups tee one decoded stream into their members, so every member
+        // has to take exactly the caps the group decodes to
+        IF_THROW(device->warm, "config_validate: groups cannot be warm, set warm on their members")
+        IF_THROW(device->mix > 0, "config_validate: groups cannot mix")
+        IF_THROW(device->gain != 0 || device->limiter || device->neq > 0, "config_validate: groups have no dsp, set it on their members")
+        IF_THROW(device->nmembers < 1, "config_validate: group has no devices")
+        CLEANUP(device->members)
+        device->members = calloc(device->nmembers, sizeof(device_t));
+        IF_THROW(device->members == NULL, "config_validate: failed to allocate group members")
+        for (member = 0; member < device->nmembers; member++)
+        {
+            IF_THROW(device->member_names[member] == NULL, "config_validate: invalid group device")
+            other = config_find_device(config, device->member_names[member]);
+            IF_THROW(other == NULL || other->type != DEVICE_TYPE_ZONE, "config_validate: group device is not a zone")
+            // a mixing zone only plays what arrives on its own inputs
+            IF_THROW(other->mix > 0, "config_validate: group device mixes")
+            IF_THROW(other->rate != device->rate || other->channels != device->channels || strcmp(other->format, device->format) != 0,
+                     "config_validate: group device format differs from group")
+            device->members[member] = other;
+        }
+    }
+
     goto done;
 error:
     status = STATUS_ERROR;
 done:
-    return 0;
+    return status;
 }
 
 void config_iterate_devices(config_t config, device_iterator_fn device_fn, void * user_data)
@@ -110,16 +311,51 @@ void config_iterate_devices(config_t config, device_iterator_fn device_fn, void
     }
 }
 
+int config_device_equal(device_t device, device_t other)
+{
+    int index;
+
+    if (device->type != other->type || device->sink != other->sink || device->alsa_period != other->alsa_period ||
+        device->alsa_buffer != other->alsa_buffer || device->warm != other->warm || device->trace != other->trace ||
+        device->retransmission != other->retransmission || device->mix != other->mix ||
+        device->packet_rate != other->packet_rate || device->sessions != other->sessions || device->idle != other->idle ||
+        device->idle_threshold != other->idle_threshold || device->idle_hold != other->idle_hold || device->latency != other->latency || device->latency_min != other->latency_min ||
+        device->latency_max != other->latency_max || device->adaptive_latency != other->adaptive_latency ||
+        device->rate != other->rate || device->channels != other->channels || device->cpus != other->cpus ||
+        device->nmembers != other->nmembers || !config_string_equal(device->loop, other->loop))
+    {
+        return 0;
+    }
+
+    if (!config_string_equal(device->name, other->name) || !config_string_equal(device->endpoint, other->endpoint) ||
+        !config_string_equal(device->codec, other->codec) || !config_string_equal(device->format, other->format))
+    {
+        return 0;
+    }
+
+    // a group changes when any of its members does
+    for (index = 0; index < device->nmembers; index++)
+    {
+        if (device->members == NULL || other->members == NULL || !config_device_equal(device->members[index], other->members[index]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 void config_ref(config_t config)
 {
-    config->ref++;
+    // endpoints keep the config their device lives in, and drop it from
+    // streaming threads
+    atomic_fetch_add(&config->ref, 1);
 }
 
 void config_unref(config_t config)
 {
     assert(config != NULL);
-    assert(config->ref >= 1);
-    if (--config->ref == 0)
+    assert(atomic_load(&config->ref) >= 1);
+    if (atomic_fetch_sub(&config->ref, 1) == 1)
     {
         config_destroy(config);
     }
@@ -131,13 +367,44 @@ void config_parse(config_t config, cJSON *json)
     const cJSON *log;
     const cJSON *log_path;
     const cJSON *log_level;
+    const cJSON *log_async;
+    const cJSON *log_format;
+    const cJSON *log_overflow;
+    const cJSON *log_capacity;
+    const cJSON *log_sink;
+    const cJSON *log_segment_size;
+    const cJSON *log_segment_count;
+    const cJSON *clock;
+    const cJSON *stats;
+    const cJSON *realtime;
+    const cJSON *registry;
+    const cJSON *admission;
+    const cJSON *loops;
     const cJSON *devices;
     const cJSON *device;
     const cJSON *device_name;
     const cJSON *device_endpoint;
+    const cJSON *device_latency;
+    const cJSON *device_warm;
+    const cJSON *device_trace;
+    const cJSON *device_retransmission;
+    const cJSON *device_mix;
+    const cJSON *device_packet_rate;
+    const cJSON *device_sessions;
+    const cJSON *device_idle;
+    const cJSON *device_dsp;
+    const cJSON *device_codec;
+    const cJSON *device_format;
+    const cJSON *device_rate;
+    const cJSON *device_channels;
+    const cJSON *device_type;
+    const cJSON *device_sink;
+    const cJSON *device_alsa;
+    const cJSON *device_members;
+    const cJSON *device_cpus;
 
     port = cJSON_GetObjectItem(json, "port");
-    if (port != NULL && cJSON_IsNumber(port))
+    if (port != NULL && cJSON_IsString(port))
     {
         config->port = port->valuestring;
     }
@@ -179,6 +446,117 @@ void config_parse(config_t config, cJSON *json)
                 config->log_level = -1;
             }
         }
+
+        log_async = cJSON_GetObjectItem(log, "async");
+        if (log_async != NULL && cJSON_IsBool(log_async))
+        {
+            config->log_mode = cJSON_IsTrue(log_async) ? LOGGER_MODE_ASYNC : LOGGER_MODE_SYNC;
+        }
+
+        log_format = cJSON_GetObjectItem(log, "format");
+        if (log_format != NULL && cJSON_IsString(log_format))
+        {
+            if (strcmp(log_format->valuestring, "text") == 0)
+            {
+                config->log_format = LOGGER_FORMAT_TEXT;
+            }
+            else if (strcmp(log_format->valuestring, "binary") == 0)
+            {
+                config->log_format = LOGGER_FORMAT_BINARY;
+            }
+            else
+            {
+                config->log_format = -1;
+            }
+        }
+
+        log_overflow = cJSON_GetObjectItem(log, "overflow");
+        if (log_overflow != NULL && cJSON_IsString(log_overflow))
+        {
+            if (strcmp(log_overflow->valuestring, "drop") == 0)
+            {
+                config->log_overflow = LOGGER_OVERFLOW_DROP;
+            }
+            else if (strcmp(log_overflow->valuestring, "block") == 0)
+            {
+                config->log_overflow = LOGGER_OVERFLOW_BLOCK;
+            }
+            else
+            {
+                config->log_overflow = -1;
+            }
+        }
+
+        log_capacity = cJSON_GetObjectItem(log, "capacity");
+        if (log_capacity != NULL && cJSON_IsNumber(log_capacity))
+        {
+            config->log_capacity = log_capacity->valueint;
+        }
+
+        log_sink = cJSON_GetObjectItem(log, "sink");
+        if (log_sink != NULL && cJSON_IsString(log_sink))
+        {
+            if (strcmp(log_sink->valuestring, "file") == 0)
+            {
+                config->log_sink = LOG_SINK_FILE;
+            }
+            else if (strcmp(log_sink->valuestring, "mmap") == 0)
+            {
+                config->log_sink = LOG_SINK_MMAP;
+            }
+            else
+            {
+                config->log_sink = -1;
+            }
+        }
+
+        log_segment_size = cJSON_GetObjectItem(log, "segment_size");
+        if (log_segment_size != NULL && cJSON_IsNumber(log_segment_size))
+        {
+            config->log_segment_size = log_segment_size->valuedouble > 0 ? (size_t)log_segment_size->valuedouble : 0;
+        }
+
+        log_segment_count = cJSON_GetObjectItem(log, "segment_count");
+        if (log_segment_count != NULL && cJSON_IsNumber(log_segment_count))
+        {
+            config->log_segment_count = log_segment_count->valueint;
+        }
+    }
+
+    clock = cJSON_GetObjectItem(json, "clock");
+    if (clock != NULL && cJSON_IsObject(clock))
+    {
+        config_parse_clock(config, clock);
+    }
+
+    stats = cJSON_GetObjectItem(json, "stats");
+    if (stats != NULL && cJSON_IsObject(stats))
+    {
+        config_parse_stats(config, stats);
+    }
+
+    realtime = cJSON_GetObjectItem(json, "realtime");
+    if (realtime != NULL && cJSON_IsObject(realtime))
+    {
+        config_parse_realtime(config, realtime);
+    }
+
+    registry = cJSON_GetObjectItem(json, "registry");
+    if (registry != NULL && cJSON_IsObject(registry))
+    {
+        config_parse_registry(config, registry);
+    }
+
+    admission = cJSON_GetObjectItem(json, "admission");
+    if (admission != NULL && cJSON_IsObject(admission))
+    {
+        config_parse_admission(config, admission);
+    }
+
+    loops = cJSON_GetObjectItem(json, "loops");
+    if (loops != NULL && cJSON_IsArray(loops))
+    {
+        config_parse_loops(config, loops);
     }
 
     devices = cJSON_GetObjectItem(json, "devices");
@@ -186,9 +564,90 @@ void config_parse(config_t config, cJSON *json)
     {
         config->devices = realloc(
             config->devices,
-            sizeof(struct config_s) * (config->ndevices + 1));
+            sizeof(struct device_s) * (config->ndevices + 1));
+        (config->devices + config->ndevices)->type = DEVICE_TYPE_ZONE;
+        (config->devices + config->ndevices)->sink = DEVICE_SINK_PULSE;
+        (config->devices + config->ndevices)->alsa_period = DEVICE_DEFAULT_ALSA_PERIOD;
+        (config->devices + config->ndevices)->alsa_buffer = DEVICE_DEFAULT_ALSA_BUFFER;
         (config->devices + config->ndevices)->name = NULL;
         (config->devices + config->ndevices)->endpoint = NULL;
+        (config->devices + config->ndevices)->latency = DEVICE_DEFAULT_LATENCY;
+        (config->devices + config->ndevices)->latency_min = DEVICE_DEFAULT_LATENCY_MIN;
+        (config->devices + config->ndevices)->latency_max = DEVICE_DEFAULT_LATENCY_MAX;
+        (config->devices + config->ndevices)->adaptive_latency = 0;
+        (config->devices + config->ndevices)->warm = 0;
+        (config->devices + config->ndevices)->trace = 0;
+        (config->devices + config->ndevices)->retransmission = 0;
+        (config->devices + config->ndevices)->mix = 0;
+        (config->devices + config->ndevices)->packet_rate = DEVICE_DEFAULT_PACKET_RATE;
+        (config->devices + config->ndevices)->sessions = 0;
+        (config->devices + config->ndevices)->idle = 0;
+        (config->devices + config->ndevices)->idle_threshold = DEVICE_DEFAULT_IDLE_THRESHOLD;
+        (config->devices + config->ndevices)->idle_hold = DEVICE_DEFAULT_IDLE_HOLD;
+        (config->devices + config->ndevices)->gain = 0;
+        (config->devices + config->ndevices)->limiter = 0;
+        (config->devices + config->ndevices)->limiter_threshold = DEVICE_DEFAULT_LIMITER_THRESHOLD;
+        (config->devices + config->ndevices)->neq = 0;
+        (config->devices + config->ndevices)->codec = NULL;
+        (config->devices + config->ndevices)->format = DEVICE_DEFAULT_FORMAT;
+        (config->devices + config->ndevices)->rate = DEVICE_DEFAULT_RATE;
+        (config->devices + config->ndevices)->channels = DEVICE_DEFAULT_CHANNELS;
+        (config->devices + config->ndevices)->cpus = 0;
+        (config->devices + config->ndevices)->loop = NULL;
+        (config->devices + config->ndevices)->member_names = NULL;
+        (config->devices + config->ndevices)->members = NULL;
+        (config->devices + config->ndevices)->nmembers = 0;
+
+        device_type = cJSON_GetObjectItem(device, "type");
+        if (device_type != NULL && cJSON_IsString(device_type))
+        {
+            if (strcmp(device_type->valuestring, "zone") == 0)
+            {
+                (config->devices + config->ndevices)->type = DEVICE_TYPE_ZONE;
+            }
+            else if (strcmp(device_type->valuestring, "group") == 0)
+            {
+                (config->devices + config->ndevices)->type = DEVICE_TYPE_GROUP;
+            }
+            else
+            {
+                (config->devices + config->ndevices)->type = -1;
+            }
+        }
+
+        device_sink = cJSON_GetObjectItem(device, "sink");
+        if (device_sink != NULL && cJSON_IsString(device_sink))
+        {
+            if (strcmp(device_sink->valuestring, "pulse") == 0)
+            {
+                (config->devices + config->ndevices)->sink = DEVICE_SINK_PULSE;
+            }
+            else if (strcmp(device_sink->valuestring, "fake") == 0)
+            {
+                (config->devices + config->ndevices)->sink = DEVICE_SINK_FAKE;
+            }
+            else if (strcmp(device_sink->valuestring, "alsa") == 0)
+            {
+                (config->devices + config->ndevices)->sink = DEVICE_SINK_ALSA;
+            }
+            else
+            {
+                (config->devices + config->ndevices)->sink = -1;
+            }
+        }
+
+        // period and buffer of an alsa sink in ms, the name is the pcm
+        device_alsa = cJSON_GetObjectItem(device, "alsa");
+        if (device_alsa != NULL)
+        {
+            config_parse_alsa(config->devices + config->ndevices, device_alsa);
+        }
+
+        device_members = cJSON_GetObjectItem(device, "devices");
+        if (device_members != NULL && cJSON_IsArray(device_members))
+        {
+            config_parse_members(config->devices + config->ndevices, device_members);
+        }
 
         device_name = cJSON_GetObjectItem(device, "name");
         if (device_name != NULL && cJSON_IsString(device_name))
@@ -202,19 +661,628 @@ void config_parse(config_t config, cJSON *json)
             (config->devices + config->ndevices)->endpoint = device_endpoint->valuestring;
         }
 
+        device_latency = cJSON_GetObjectItem(device, "latency");
+        if (device_latency != NULL)
+        {
+            config_parse_latency(config->devices + config->ndevices, device_latency);
+        }
+
+        device_warm = cJSON_GetObjectItem(device, "warm");
+        if (device_warm != NULL && cJSON_IsBool(device_warm))
+        {
+            (config->devices + config->ndevices)->warm = cJSON_IsTrue(device_warm);
+        }
+
+        // per-element latency histograms, dumped on SIGUSR1 and at exit
+        device_trace = cJSON_GetObjectItem(device, "trace");
+        if (device_trace != NULL && cJSON_IsBool(device_trace))
+        {
+            (config->devices + config->ndevices)->trace = cJSON_IsTrue(device_trace);
+        }
+
+        device_retransmission = cJSON_GetObjectItem(device, "rtx");
+        if (device_retransmission != NULL && cJSON_IsBool(device_retransmission))
+        {
+            (config->devices + config->ndevices)->retransmission = cJSON_IsTrue(device_retransmission);
+        }
+
+        // the number of sessions mixed into the zone at once
+        device_mix = cJSON_GetObjectItem(device, "mix");
+        if (device_mix != NULL)
+        {
+            (config->devices + config->ndevices)->mix = cJSON_IsNumber(device_mix) ? device_mix->valueint : -1;
+        }
+
+        // RTP packets per second per session, sizes the receive pool
+        device_packet_rate = cJSON_GetObjectItem(device, "packet_rate");
+        if (device_packet_rate != NULL)
+        {
+            (config->devices + config->ndevices)->packet_rate = cJSON_IsNumber(device_packet_rate) ? device_packet_rate->valueint : -1;
+        }
+
+        // sessions admitted on the endpoint at once, 0 for no limit
+        device_sessions = cJSON_GetObjectItem(device, "sessions");
+        if (device_sessions != NULL)
+        {
+            (config->devices + config->ndevices)->sessions = cJSON_IsNumber(device_sessions) ? device_sessions->valueint : -1;
+        }
+
+        // the sink is closed after hold ms below the threshold in dBFS
+        device_idle = cJSON_GetObjectItem(device, "idle");
+        if (device_idle != NULL)
+        {
+            config_parse_idle(config->devices + config->ndevices, device_idle);
+        }
+
+        device_dsp = cJSON_GetObjectItem(device, "dsp");
+        if (device_dsp != NULL)
+        {
+            config_parse_dsp(config->devices + config->ndevices, device_dsp);
+        }
+
+        device_codec = cJSON_GetObjectItem(device, "codec");
+        if (device_codec != NULL && cJSON_IsString(device_codec))
+        {
+            (config->devices + config->ndevices)->codec = device_codec->valuestring;
+        }
+
+        device_format = cJSON_GetObjectItem(device, "format");
+        if (device_format != NULL)
+        {
+            (config->devices + config->ndevices)->format = cJSON_IsString(device_format) ? device_format->valuestring : NULL;
+        }
+
+        device_rate = cJSON_GetObjectItem(device, "rate");
+        if (device_rate != NULL)
+        {
+            (config->devices + config->ndevices)->rate = cJSON_IsNumber(device_rate) ? device_rate->valueint : -1;
+        }
+
+        device_channels = cJSON_GetObjectItem(device, "channels");
+        if (device_channels != NULL)
+        {
+            (config->devices + config->ndevices)->channels = cJSON_IsNumber(device_channels) ? device_channels->valueint : -1;
+        }
+
+        device_cpus = cJSON_GetObjectItem(device, "cpus");
+        if (device_cpus != NULL)
+        {
+            config_parse_cpus(config->devices + config->ndevices, device_cpus);
+        }
+
         config->ndevices++;
     }
 }
 
+void config_parse_clock(config_t config, const cJSON *clock)
+{
+    const cJSON *clock_mode;
+    const cJSON *clock_address;
+    const cJSON *clock_port;
+
+    clock_mode = cJSON_GetObjectItem(clock, "mode");
+    if (clock_mode != NULL && cJSON_IsString(clock_mode))
+    {
+        if (strcmp(clock_mode->valuestring, "none") == 0)
+        {
+            config->clock_mode = CLOCK_MODE_NONE;
+        }
+        else if (strcmp(clock_mode->valuestring, "provide") == 0)
+        {
+            config->clock_mode = CLOCK_MODE_PROVIDE;
+        }
+        else if (strcmp(clock_mode->valuestring, "follow") == 0)
+        {
+            config->clock_mode = CLOCK_MODE_FOLLOW;
+        }
+        else
+        {
+            config->clock_mode = -1;
+        }
+    }
+
+    clock_address = cJSON_GetObjectItem(clock, "address");
+    if (clock_address != NULL)
+    {
+        config->clock_address = cJSON_IsString(clock_address) ? clock_address->valuestring : NULL;
+    }
+
+    clock_port = cJSON_GetObjectItem(clock, "port");
+    if (clock_port != NULL && cJSON_IsNumber(clock_port))
+    {
+        config->clock_port = clock_port->valueint;
+    }
+}
+
+void config_parse_stats(config_t config, const cJSON *stats)
+{
+    const cJSON *stats_address;
+    const cJSON *stats_port;
+    const cJSON *stats_socket;
+
+    // either a TCP listener or a unix socket, both speak plain HTTP
+    stats_address = cJSON_GetObjectItem(stats, "address");
+    if (stats_address != NULL)
+    {
+        config->stats_address = cJSON_IsString(stats_address) ? stats_address->valuestring : NULL;
+    }
+
+    stats_port = cJSON_GetObjectItem(stats, "port");
+    if (stats_port != NULL)
+    {
+        config->stats_port = cJSON_IsNumber(stats_port) ? stats_port->valueint : -1;
+    }
+
+    stats_socket = cJSON_GetObjectItem(stats, "socket");
+    if (stats_socket != NULL && cJSON_IsString(stats_socket))
+    {
+        config->stats_socket = stats_socket->valuestring;
+    }
+}
+
+void config_parse_realtime(config_t config, const cJSON *realtime)
+{
+    const cJSON *realtime_policy;
+    const cJSON *realtime_priority;
+
+    realtime_policy = cJSON_GetObjectItem(realtime, "policy");
+    if (realtime_policy != NULL && cJSON_IsString(realtime_policy))
+    {
+        if (strcmp(realtime_policy->valuestring, "none") == 0)
+        {
+            config->realtime_policy = REALTIME_POLICY_NONE;
+        }
+        else if (strcmp(realtime_policy->valuestring, "fifo") == 0)
+        {
+            config->realtime_policy = REALTIME_POLICY_FIFO;
+        }
+        else if (strcmp(realtime_policy->valuestring, "rr") == 0)
+        {
+            config->realtime_policy = REALTIME_POLICY_RR;
+        }
+        else
+        {
+            config->realtime_policy = -1;
+        }
+    }
+
+    realtime_priority = cJSON_GetObjectItem(realtime, "priority");
+    if (realtime_priority != NULL)
+    {
+        config->realtime_priority = cJSON_IsNumber(realtime_priority) ? realtime_priority->valueint : -1;
+    }
+}
+
+void config_parse_registry(config_t config, const cJSON *registry)
+{
+    const cJSON *registry_path;
+    const cJSON *registry_update;
+
+    registry_path = cJSON_GetObjectItem(registry, "path");
+    if (registry_path != NULL && cJSON_IsString(registry_path))
+    {
+        config->registry_path = registry_path->valuestring;
+    }
+
+    // without rescanning, new or upgraded plugins need the cache deleted
+    registry_update = cJSON_GetObjectItem(registry, "update");
+    if (registry_update != NULL && cJSON_IsBool(registry_update))
+    {
+        config->registry_update = cJSON_IsTrue(registry_update);
+    }
+}
+
+void config_parse_admission(config_t config, const cJSON *admission)
+{
+    const cJSON *admission_sessions;
+    const cJSON *admission_cpu;
+    const cJSON *admission_lag;
+    const cJSON *admission_policy;
+
+    // sessions across every endpoint, 0 for no limit
+    admission_sessions = cJSON_GetObjectItem(admission, "sessions");
+    if (admission_sessions != NULL)
+    {
+        config->admission_sessions = cJSON_IsNumber(admission_sessions) ? admission_sessions->valueint : -1;
+    }
+
+    // percent of all cores the server may use before turning sessions away
+    admission_cpu = cJSON_GetObjectItem(admission, "cpu");
+    if (admission_cpu != NULL)
+    {
+        config->admission_cpu = cJSON_IsNumber(admission_cpu) ? admission_cpu->valueint : -1;
+    }
+
+    // ms the main loop may fall behind before turning sessions away
+    admission_lag = cJSON_GetObjectItem(admission, "lag");
+    if (admission_lag != NULL)
+    {
+        config->admission_lag = cJSON_IsNumber(admission_lag) ? admission_lag->valueint : -1;
+    }
+
+    admission_policy = cJSON_GetObjectItem(admission, "policy");
+    if (admission_policy != NULL && cJSON_IsString(admission_policy))
+    {
+        if (strcmp(admission_policy->valuestring, "reject") == 0)
+        {
+            config->admission_policy = ADMISSION_POLICY_REJECT;
+        }
+        else if (strcmp(admission_policy->valuestring, "preempt") == 0)
+        {
+            config->admission_policy = ADMISSION_POLICY_PREEMPT;
+        }
+        else
+        {
+            config->admission_policy = -1;
+        }
+    }
+}
+
+void config_parse_alsa(device_t device, const cJSON *alsa)
+{
+    const cJSON *alsa_period;
+    const cJSON *alsa_buffer;
+
+    if (!cJSON_IsObject(alsa))
+    {
+        device->alsa_period = -1;
+        return;
+    }
+
+    alsa_period = cJSON_GetObjectItem(alsa, "period");
+    if (alsa_period != NULL)
+    {
+        device->alsa_period = cJSON_IsNumber(alsa_period) ? alsa_period->valueint : -1;
+    }
+
+    alsa_buffer = cJSON_GetObjectItem(alsa, "buffer");
+    if (alsa_buffer != NULL)
+    {
+        device->alsa_buffer = cJSON_IsNumber(alsa_buffer) ? alsa_buffer->valueint : -1;
+    }
+}
+
+void config_parse_idle(device_t device, const cJSON *idle)
+{
+    const cJSON *idle_threshold;
+    const cJSON *idle_hold;
+
+    if (!cJSON_IsObject(idle))
+    {
+        device->idle = -1;
+        return;
+    }
+    device->idle = 1;
+
+    idle_threshold = cJSON_GetObjectItem(idle, "threshold");
+    if (idle_threshold != NULL)
+    {
+        device->idle_threshold = cJSON_IsNumber(idle_threshold) ? idle_threshold->valuedouble : 1;
+    }
+
+    idle_hold = cJSON_GetObjectItem(idle, "hold");
+    if (idle_hold != NULL)
+    {
+        device->idle_hold = cJSON_IsNumber(idle_hold) ? idle_hold->valueint : -1;
+    }
+}
+
+void config_parse_latency(device_t device, const cJSON *latency)
+{
+    const cJSON *latency_target;
+    const cJSON *latency_min;
+    const cJSON *latency_max;
+    const cJSON *latency_adaptive;
+
+    // either a fixed target in ms or an object with adaptive bounds
+    if (cJSON_IsNumber(latency))
+    {
+        device->latency = latency->valueint;
+        return;
+    }
+
+    if (!cJSON_IsObject(latency))
+    {
+        device->latency = -1;
+        return;
+    }
+
+    latency_target = cJSON_GetObjectItem(latency, "target");
+    if (latency_target != NULL && cJSON_IsNumber(latency_target))
+    {
+        device->latency = latency_target->valueint;
+    }
+
+    latency_min = cJSON_GetObjectItem(latency, "min");
+    if (latency_min != NULL && cJSON_IsNumber(latency_min))
+    {
+        device->latency_min = latency_min->valueint;
+    }
+
+    latency_max = cJSON_GetObjectItem(latency, "max");
+    if (latency_max != NULL && cJSON_IsNumber(latency_max))
+    {
+        device->latency_max = latency_max->valueint;
+    }
+
+    latency_adaptive = cJSON_GetObjectItem(latency, "adaptive");
+    if (latency_adaptive != NULL && cJSON_IsBool(latency_adaptive))
+    {
+        device->adaptive_latency = cJSON_IsTrue(latency_adaptive);
+    }
+}
+
+void config_parse_dsp(device_t device, const cJSON *dsp)
+{
+    const cJSON *dsp_gain;
+    const cJSON *dsp_limiter;
+    const cJSON *dsp_eq;
+
+    if (!cJSON_IsObject(dsp))
+    {
+        device->neq = -1;
+        return;
+    }
+
+    // gain in dB, the limiter is either on at its default threshold or
+    // given the threshold in dBFS
+    dsp_gain = cJSON_GetObjectItem(dsp, "gain");
+    if (dsp_gain != NULL)
+    {
+        device->gain = cJSON_IsNumber(dsp_gain) ? dsp_gain->valuedouble : 1000;
+    }
+
+    dsp_limiter = cJSON_GetObjectItem(dsp, "limiter");
+    if (dsp_limiter != NULL && cJSON_IsBool(dsp_limiter))
+    {
+        device->limiter = cJSON_IsTrue(dsp_limiter);
+    }
+    else if (dsp_limiter != NULL && cJSON_IsNumber(dsp_limiter))
+    {
+        device->limiter = 1;
+        device->limiter_threshold = dsp_limiter->valuedouble;
+    }
+    else if (dsp_limiter != NULL)
+    {
+        device->limiter = -1;
+    }
+
+    dsp_eq = cJSON_GetObjectItem(dsp, "eq");
+    if (dsp_eq != NULL)
+    {
+        config_parse_eq(device, dsp_eq);
+    }
+}
+
+void config_parse_eq(device_t device, const cJSON *eq)
+{
+    const cJSON *band;
+    const cJSON *band_type;
+    const cJSON *band_frequency;
+    const cJSON *band_gain;
+    const cJSON *band_q;
+    struct eq_band_s *eq_band;
+
+    if (!cJSON_IsArray(eq) || cJSON_GetArraySize(eq) > DEVICE_MAX_BANDS)
+    {
+        device->neq = -1;
+        return;
+    }
+
+    device->neq = 0;
+    cJSON_ArrayForEach(band, eq)
+    {
+        eq_band = device->eq + device->neq++;
+        eq_band->type = EQ_TYPE_PEAK;
+        eq_band->frequency = 0;
+        eq_band->gain = 0;
+        eq_band->q = 0.707;
+
+        band_type = cJSON_GetObjectItem(band, "type");
+        if (band_type != NULL && cJSON_IsString(band_type))
+        {
+            if (strcmp(band_type->valuestring, "peak") == 0)
+            {
+                eq_band->type = EQ_TYPE_PEAK;
+            }
+            else if (strcmp(band_type->valuestring, "low_shelf") == 0)
+            {
+                eq_band->type = EQ_TYPE_LOW_SHELF;
+            }
+            else if (strcmp(band_type->valuestring, "high_shelf") == 0)
+            {
+                eq_band->type = EQ_TYPE_HIGH_SHELF;
+            }
+            else
+            {
+                eq_band->type = -1;
+            }
+        }
+
+        band_frequency = cJSON_GetObjectItem(band, "frequency");
+        if (band_frequency != NULL && cJSON_IsNumber(band_frequency))
+        {
+            eq_band->frequency = band_frequency->valuedouble;
+        }
+
+        band_gain = cJSON_GetObjectItem(band, "gain");
+        if (band_gain != NULL && cJSON_IsNumber(band_gain))
+        {
+            eq_band->gain = band_gain->valuedouble;
+        }
+
+        band_q = cJSON_GetObjectItem(band, "q");
+        if (band_q != NULL && cJSON_IsNumber(band_q))
+        {
+            eq_band->q = band_q->valuedouble;
+        }
+    }
+}
+
+void config_parse_cpus(device_t device, const cJSON *cpus)
+{
+    const cJSON *cpu;
+
+    // a list of cpu numbers kept as a mask, anything else fails validation
+    device->cpus = 0;
+    if (!cJSON_IsArray(cpus))
+    {
+        device->cpus = -1;
+        return;
+    }
+
+    cJSON_ArrayForEach(cpu, cpus)
+    {
+        if (!cJSON_IsNumber(cpu) || cpu->valueint < 0 || cpu->valueint > DEVICE_MAX_CPUS)
+        {
+            device->cpus = -1;
+            return;
+        }
+        device->cpus |= 1LL << cpu->valueint;
+    }
+}
+
+void config_parse_members(device_t device, const cJSON *members)
+{
+    const cJSON *member;
+    int index;
+
+    device->nmembers = cJSON_GetArraySize(members);
+    device->member_names = calloc(device->nmembers > 0 ? device->nmembers : 1, sizeof(const char *));
+    if (device->member_names == NULL)
+    {
+        device->nmembers = 0;
+        return;
+    }
+
+    index = 0;
+    cJSON_ArrayForEach(member, members)
+    {
+        // non-string entries stay NULL and fail validation
+        if (cJSON_IsString(member))
+        {
+            device->member_names[index] = member->valuestring;
+        }
+        index++;
+    }
+}
+
+void config_parse_loops(config_t config, const cJSON *loops)
+{
+    const cJSON *loop;
+    const cJSON *loop_name;
+    const cJSON *loop_port;
+    const cJSON *loop_devices;
+    const cJSON *loop_device;
+    loop_config_t entry;
+    int index;
+
+    config->nloops = cJSON_GetArraySize(loops);
+    config->loops = calloc(config->nloops > 0 ? config->nloops : 1, sizeof(struct loop_config_s));
+    if (config->loops == NULL)
+    {
+        config->nloops = 0;
+        return;
+    }
+
+    // missing names and ports stay NULL and fail validation
+    entry = config->loops;
+    cJSON_ArrayForEach(loop, loops)
+    {
+        loop_name = cJSON_GetObjectItem(loop, "name");
+        if (loop_name != NULL && cJSON_IsString(loop_name))
+        {
+            entry->name = loop_name->valuestring;
+        }
+
+        loop_port = cJSON_GetObjectItem(loop, "port");
+        if (loop_port != NULL && cJSON_IsString(loop_port))
+        {
+            entry->port = loop_port->valuestring;
+        }
+
+        loop_devices = cJSON_GetObjectItem(loop, "devices");
+        if (loop_devices != NULL && cJSON_IsArray(loop_devices))
+        {
+            entry->ndevices = cJSON_GetArraySize(loop_devices);
+            entry->device_names = calloc(entry->ndevices > 0 ? entry->ndevices : 1, sizeof(const char *));
+            if (entry->device_names == NULL)
+            {
+                entry->ndevices = 0;
+            }
+            index = 0;
+            cJSON_ArrayForEach(loop_device, loop_devices)
+            {
+                if (index < entry->ndevices && cJSON_IsString(loop_device))
+                {
+                    entry->device_names[index] = loop_device->valuestring;
+                }
+                index++;
+            }
+        }
+        entry++;
+    }
+}
+
+int config_validate_port(const char *port)
+{
+    int value;
+
+    if (port == NULL)
+    {
+        return 0;
+    }
+    value = atoi(port);
+    return value >= 1 && value <= UINT16_MAX;
+}
+
+device_t config_find_device(config_t config, const char *endpoint)
+{
+    int index;
+
+    for (index = 0; index < config->ndevices; index++)
+    {
+        if ((config->devices + index)->endpoint != NULL && strcmp((config->devices + index)->endpoint, endpoint) == 0)
+        {
+            return config->devices + index;
+        }
+    }
+    return NULL;
+}
+
+int config_string_equal(const char *string, const char *other)
+{
+    if (string == NULL || other == NULL)
+    {
+        return string == other;
+    }
+    return strcmp(string, other) == 0;
+}
+
 void config_destroy(config_t config)
 {
+    int index;
+
     if (config->json != NULL)
     {
         cJSON_Delete((cJSON *)config->json);
     }
     if (config->devices != NULL)
     {
+        for (index = 0; index < config->ndevices; index++)
+        {
+            CLEANUP((config->devices + index)->member_names)
+            CLEANUP((config->devices + index)->members)
+        }
         free(config->devices);
     }
+    if (config->loops != NULL)
+    {
+        for (index = 0; index < config->nloops; index++)
+        {
+            CLEANUP((config->loops + index)->device_names)
+        }
+        free(config->loops);
+    }
     free(config);
 }
\ No newline at end of file
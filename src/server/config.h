@@ -1,20 +1,141 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 #include "common.h"
+#include <stdatomic.h>
+
+enum log_sinks
+{
+    LOG_SINK_FILE,
+    LOG_SINK_MMAP
+};
+
+enum clock_modes
+{
+    CLOCK_MODE_NONE,
+    CLOCK_MODE_PROVIDE,
+    CLOCK_MODE_FOLLOW
+};
+
+enum realtime_policies
+{
+    REALTIME_POLICY_NONE,
+    REALTIME_POLICY_FIFO,
+    REALTIME_POLICY_RR
+};
+
+enum admission_policies
+{
+    ADMISSION_POLICY_REJECT,
+    ADMISSION_POLICY_PREEMPT
+};
+
+enum device_sinks
+{
+    DEVICE_SINK_PULSE,
+    DEVICE_SINK_FAKE,
+    DEVICE_SINK_ALSA
+};
+
+enum device_types
+{
+    DEVICE_TYPE_ZONE,
+    DEVICE_TYPE_GROUP
+};
+
+enum eq_types
+{
+    EQ_TYPE_PEAK,
+    EQ_TYPE_LOW_SHELF,
+    EQ_TYPE_HIGH_SHELF
+};
+
+#define DEVICE_MAX_BANDS 4
+
+struct eq_band_s
+{
+    int type;
+    double frequency;
+    double gain;
+    double q;
+};
 
 struct device_s
 {
+    int type;
+    int sink;
+    int alsa_period;
+    int alsa_buffer;
     const char *name;
     const char *endpoint;
+    int latency;
+    int latency_min;
+    int latency_max;
+    int adaptive_latency;
+    int warm;
+    int trace;
+    int retransmission;
+    int mix;
+    int packet_rate;
+    int sessions;
+    int idle;
+    double idle_threshold;
+    int idle_hold;
+    double gain;
+    int limiter;
+    double limiter_threshold;
+    struct eq_band_s eq[DEVICE_MAX_BANDS];
+    int neq;
+    const char *codec;
+    const char *format;
+    int rate;
+    int channels;
+    long long cpus;
+    const char *loop;
+    const char **member_names;
+    struct device_s **members;
+    int nmembers;
 };
 typedef struct device_s *device_t;
 
+struct loop_config_s
+{
+    const char *name;
+    const char *port;
+    const char **device_names;
+    int ndevices;
+};
+typedef struct loop_config_s *loop_config_t;
+
 struct config_s
 {
-    int ref;
+    atomic_int ref;
+    const char *path;
     char *port;
     char *log_path;
     int log_level;
+    int log_mode;
+    int log_format;
+    int log_overflow;
+    int log_capacity;
+    int log_sink;
+    size_t log_segment_size;
+    int log_segment_count;
+    int clock_mode;
+    char *clock_address;
+    int clock_port;
+    char *stats_address;
+    int stats_port;
+    char *stats_socket;
+    int realtime_policy;
+    int realtime_priority;
+    char *registry_path;
+    int registry_update;
+    int admission_sessions;
+    int admission_cpu;
+    int admission_lag;
+    int admission_policy;
+    loop_config_t loops;
+    int nloops;
     device_t devices;
     int ndevices;
     void *json;
@@ -31,6 +152,8 @@ int config_validate(config_t config, const char ** error);
 
 void config_iterate_devices(config_t config, device_iterator_fn device_fn, void * user_data);
 
+int config_device_equal(device_t device, device_t other);
+
 void config_ref(config_t config);
 
 void config_unref(config_t config);
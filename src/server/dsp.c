@@ -0,0 +1,778 @@
+#include "dsp.h"
+#include <float.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DSP_X86 1
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(dsp->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(dsp->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(dsp->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(dsp->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(dsp->logger, TRACE, FORMAT, __VA_ARGS__);
+
+// gain changes are spread over this long so a new volume never clicks
+#define DSP_RAMP_MS 20
+
+// filter state below this is a decayed tail, flushing it keeps x86 out of
+// denormal arithmetic on silence
+#define DSP_DENORMAL 1e-20f
+
+#define DSP_S16_SCALE (1.0f / 32768.0f)
+#define DSP_S16_MAX 32767.0f
+
+// load turns s16 samples into floats, store applies the gain ramp and the
+// soft limiter and writes the result back in the stream's format
+struct dsp_kernel_s
+{
+    const char *name;
+    void (*load)(const int16_t *in, float *out, size_t count);
+    void (*store)(const float *in, void *out, int format, size_t count, float gain, float step, float threshold, float knee);
+};
+
+static void dsp_params_from_device(dsp_params_t params, device_t device);
+
+static gboolean dsp_params_equal(dsp_params_t params, dsp_params_t other);
+
+static dsp_params_t dsp_exchange(dsp_t dsp, dsp_params_t params);
+
+static void dsp_apply(dsp_t dsp);
+
+static void dsp_biquad(struct dsp_biquad_s *biquad, const struct eq_band_s *band, int rate);
+
+static void dsp_equalize(dsp_t dsp, float *samples, size_t frames);
+
+static void dsp_load_scalar(const int16_t *in, float *out, size_t count);
+
+static void dsp_store_scalar(const float *in, void *out, int format, size_t count, float gain, float step, float threshold, float knee);
+
+#if defined(__SSE2__)
+static void dsp_load_sse2(const int16_t *in, float *out, size_t count);
+
+static void dsp_store_sse2(const float *in, void *out, int format, size_t count, float gain, float step, float threshold, float knee);
+#endif
+
+#if defined(DSP_X86)
+static void dsp_load_avx2(const int16_t *in, float *out, size_t count);
+
+static void dsp_store_avx2(const float *in, void *out, int format, size_t count, float gain, float step, float threshold, float knee);
+#endif
+
+#if defined(__ARM_NEON)
+static void dsp_load_neon(const int16_t *in, float *out, size_t count);
+
+static void dsp_store_neon(const float *in, void *out, int format, size_t count, float gain, float step, float threshold, float knee);
+#endif
+
+static void dsp_destroy(dsp_t dsp);
+
+static const struct dsp_kernel_s dsp_kernels[DSP_KERNELS] = {
+    [DSP_KERNEL_SCALAR] = {"scalar", dsp_load_scalar, dsp_store_scalar},
+#if defined(__SSE2__)
+    [DSP_KERNEL_SSE2] = {"sse2", dsp_load_sse2, dsp_store_sse2},
+#endif
+#if defined(DSP_X86)
+    [DSP_KERNEL_AVX2] = {"avx2", dsp_load_avx2, dsp_store_avx2},
+#endif
+#if defined(__ARM_NEON)
+    [DSP_KERNEL_NEON] = {"neon", dsp_load_neon, dsp_store_neon},
+#endif
+};
+
+int dsp_create(dsp_t *dsp, device_t device, const char *name, int kernel, logger_t logger, const char **error)
+{
+    int status;
+    dsp_t new_dsp;
+
+    status = STATUS_OK;
+    new_dsp = NULL;
+
+    IF_THROW(dsp == NULL, "dsp_create: null dsp")
+    IF_THROW(device == NULL, "dsp_create: null device")
+    IF_THROW(!dsp_kernel_available(kernel), "dsp_create: kernel not available")
+
+    new_dsp = calloc(1, sizeof(struct dsp_s));
+    IF_THROW(new_dsp == NULL, "dsp_create: failed to allocate dsp")
+
+    new_dsp->ref = 1;
+    new_dsp->logger = logger;
+    logger_ref(logger);
+    new_dsp->kernel = kernel;
+    new_dsp->format = DSP_FORMAT_NONE;
+    new_dsp->gain = 1.0f;
+    new_dsp->target = 1.0f;
+    new_dsp->threshold = FLT_MAX;
+
+    new_dsp->name = g_strdup(name);
+    IF_THROW(new_dsp->name == NULL, "dsp_create: failed to allocate name")
+
+    new_dsp->params = calloc(1, sizeof(struct dsp_params_s));
+    IF_THROW(new_dsp->params == NULL, "dsp_create: failed to allocate params")
+    dsp_params_from_device(new_dsp->params, device);
+    new_dsp->submitted = *new_dsp->params;
+
+    // start at the configured gain rather than ramping up to it
+    new_dsp->gain = (float)pow(10.0, new_dsp->params->gain / 20.0);
+
+    *dsp = new_dsp;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_dsp, dsp_destroy(new_dsp))
+done:
+    return status;
+}
+
+int dsp_update(dsp_t dsp, device_t device)
+{
+    dsp_params_t params;
+
+    params = calloc(1, sizeof(struct dsp_params_s));
+    if (params == NULL)
+    {
+        ERRORF("dsp_update: %s: failed to allocate params\n", dsp->name)
+        return FALSE;
+    }
+    dsp_params_from_device(params, device);
+    if (dsp_params_equal(params, &dsp->submitted))
+    {
+        free(params);
+        return FALSE;
+    }
+
+    // an update the streaming thread never picked up is simply replaced
+    dsp->submitted = *params;
+    free(dsp_exchange(dsp, params));
+    return TRUE;
+}
+
+int dsp_configure(dsp_t dsp, const char *format, int rate, int channels)
+{
+    int status;
+
+    status = STATUS_OK;
+
+    if (!g_atomic_int_compare_and_exchange(&dsp->busy, FALSE, TRUE))
+    {
+        WARNF("dsp_configure: %s: output is busy with another session, passing through\n", dsp->name)
+        return STATUS_ERROR;
+    }
+
+    if (format != NULL && strcmp(format, "S16LE") == 0)
+    {
+        dsp->format = DSP_FORMAT_S16;
+    }
+    else if (format != NULL && strcmp(format, "F32LE") == 0)
+    {
+        dsp->format = DSP_FORMAT_F32;
+    }
+    else
+    {
+        dsp->format = DSP_FORMAT_NONE;
+    }
+
+    if (dsp->format == DSP_FORMAT_NONE || rate <= 0 || channels < 1 || channels > DSP_MAX_CHANNELS)
+    {
+        WARNF("dsp_configure: %s: cannot process %s %d Hz %d ch, passing through\n", dsp->name, format != NULL ? format : "unknown", rate, channels)
+        dsp->format = DSP_FORMAT_NONE;
+        status = STATUS_ERROR;
+        goto done;
+    }
+
+    dsp->rate = rate;
+    dsp->channels = channels;
+    memset(dsp->state, 0, sizeof(dsp->state));
+    dsp_apply(dsp);
+    DEBUGF("dsp_configure: %s: %s %d Hz %d ch with %s kernels\n", dsp->name, format, rate, channels, dsp_kernel_name(dsp->kernel))
+
+done:
+    g_atomic_int_set(&dsp->busy, FALSE);
+    return status;
+}
+
+void dsp_process(dsp_t dsp, void *samples, size_t size)
+{
+    const struct dsp_kernel_s *kernel;
+    dsp_params_t pending;
+    float *buffer;
+    size_t frames;
+    size_t count;
+    size_t ramp;
+    float step;
+
+    if (!g_atomic_int_compare_and_exchange(&dsp->busy, FALSE, TRUE))
+    {
+        return;
+    }
+
+    pending = dsp_exchange(dsp, NULL);
+    if (pending != NULL)
+    {
+        free(dsp->params);
+        dsp->params = pending;
+        dsp_apply(dsp);
+    }
+
+    // a neutral zone leaves the buffer untouched
+    frames = dsp->format != DSP_FORMAT_NONE ? size / ((dsp->format == DSP_FORMAT_S16 ? sizeof(int16_t) : sizeof(float)) * dsp->channels) : 0;
+    if (frames == 0 || (dsp->gain == 1.0f && dsp->target == 1.0f && dsp->nbiquads == 0 && dsp->threshold == FLT_MAX))
+    {
+        goto done;
+    }
+
+    kernel = dsp_kernels + dsp->kernel;
+    count = frames * dsp->channels;
+    if (dsp->format == DSP_FORMAT_S16)
+    {
+        if (dsp->scratch_size < count)
+        {
+            free(dsp->scratch);
+            dsp->scratch = malloc(count * sizeof(float));
+            dsp->scratch_size = dsp->scratch != NULL ? count : 0;
+            if (dsp->scratch == NULL)
+            {
+                goto done;
+            }
+        }
+        kernel->load(samples, dsp->scratch, count);
+        buffer = dsp->scratch;
+    }
+    else
+    {
+        buffer = samples;
+    }
+
+    if (dsp->nbiquads > 0)
+    {
+        dsp_equalize(dsp, buffer, frames);
+    }
+
+    // the ramp covers at most this buffer, a longer one continues in the next
+    step = 0;
+    if (dsp->gain != dsp->target)
+    {
+        ramp = (size_t)dsp->rate * dsp->channels * DSP_RAMP_MS / 1000;
+        step = (dsp->target - dsp->gain) / (float)MAX(count, ramp);
+    }
+    kernel->store(buffer, samples, dsp->format, count, dsp->gain, step, dsp->threshold, dsp->knee);
+    if (step != 0)
+    {
+        dsp->gain += step * (float)count;
+        if ((step > 0 && dsp->gain >= dsp->target) || (step < 0 && dsp->gain <= dsp->target))
+        {
+            dsp->gain = dsp->target;
+        }
+    }
+
+done:
+    g_atomic_int_set(&dsp->busy, FALSE);
+}
+
+gboolean dsp_idle(dsp_t dsp)
+{
+    // lets the caller skip making a shared buffer writable for nothing
+    return dsp->format == DSP_FORMAT_NONE ||
+           (g_atomic_pointer_get(&dsp->pending) == NULL && dsp->gain == 1.0f && dsp->target == 1.0f && dsp->nbiquads == 0 &&
+            dsp->threshold == FLT_MAX);
+}
+
+int dsp_best_kernel(void)
+{
+#if defined(DSP_X86)
+    if (dsp_kernel_available(DSP_KERNEL_AVX2))
+    {
+        return DSP_KERNEL_AVX2;
+    }
+#endif
+#if defined(__SSE2__)
+    return DSP_KERNEL_SSE2;
+#elif defined(__ARM_NEON)
+    return DSP_KERNEL_NEON;
+#else
+    return DSP_KERNEL_SCALAR;
+#endif
+}
+
+gboolean dsp_kernel_available(int kernel)
+{
+    if (kernel < 0 || kernel >= DSP_KERNELS || dsp_kernels[kernel].name == NULL)
+    {
+        return FALSE;
+    }
+#if defined(DSP_X86)
+    // built for every x86 target, only used where the cpu has it
+    if (kernel == DSP_KERNEL_AVX2)
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return TRUE;
+}
+
+const char *dsp_kernel_name(int kernel)
+{
+    return kernel >= 0 && kernel < DSP_KERNELS && dsp_kernels[kernel].name != NULL ? dsp_kernels[kernel].name : "none";
+}
+
+void dsp_ref(dsp_t dsp)
+{
+    g_atomic_int_inc(&dsp->ref);
+}
+
+void dsp_unref(dsp_t dsp)
+{
+    assert(dsp != NULL);
+    if (g_atomic_int_dec_and_test(&dsp->ref))
+    {
+        dsp_destroy(dsp);
+    }
+}
+
+void dsp_params_from_device(dsp_params_t params, device_t device)
+{
+    params->gain = device->gain;
+    params->limiter = device->limiter;
+    params->limiter_threshold = device->limiter_threshold;
+    params->neq = device->neq;
+    memcpy(params->eq, device->eq, sizeof(params->eq));
+}
+
+gboolean dsp_params_equal(dsp_params_t params, dsp_params_t other)
+{
+    int band;
+
+    if (params->gain != other->gain || params->limiter != other->limiter || params->limiter_threshold != other->limiter_threshold ||
+        params->neq != other->neq)
+    {
+        return FALSE;
+    }
+    for (band = 0; band < params->neq; band++)
+    {
+        if (params->eq[band].type != other->eq[band].type || params->eq[band].frequency != other->eq[band].frequency ||
+            params->eq[band].gain != other->eq[band].gain || params->eq[band].q != other->eq[band].q)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+dsp_params_t dsp_exchange(dsp_t dsp, dsp_params_t params)
+{
+    dsp_params_t pending;
+
+    // g_atomic_pointer_exchange needs a newer glib than the rest of the server
+    do
+    {
+        pending = g_atomic_pointer_get(&dsp->pending);
+    } while (!g_atomic_pointer_compare_and_exchange(&dsp->pending, pending, params));
+    return pending;
+}
+
+void dsp_apply(dsp_t dsp)
+{
+    dsp_params_t params;
+    int band;
+
+    // filter state carries over, so new coefficients pick up from the old
+    // output instead of restarting from silence
+    params = dsp->params;
+    dsp->target = (float)pow(10.0, params->gain / 20.0);
+    if (params->limiter)
+    {
+        dsp->threshold = (float)pow(10.0, params->limiter_threshold / 20.0);
+        dsp->knee = 1.0f - dsp->threshold;
+    }
+    else
+    {
+        dsp->threshold = FLT_MAX;
+        dsp->knee = 0;
+    }
+
+    dsp->nbiquads = 0;
+    if (dsp->rate <= 0)
+    {
+        return;
+    }
+    for (band = 0; band < params->neq; band++)
+    {
+        if (params->eq[band].gain != 0)
+        {
+            dsp_biquad(dsp->biquads + dsp->nbiquads++, params->eq + band, dsp->rate);
+        }
+    }
+}
+
+void dsp_biquad(struct dsp_biquad_s *biquad, const struct eq_band_s *band, int rate)
+{
+    double a;
+    double root;
+    double w0;
+    double cosine;
+    double alpha;
+    double b0, b1, b2, a0, a1, a2;
+
+    // RBJ audio EQ cookbook, the band is validated against the zone rate
+    // but a decodebin zone may run at another one
+    a = pow(10.0, band->gain / 40.0);
+    root = sqrt(a);
+    w0 = 2.0 * G_PI * MIN(band->frequency, rate * 0.45) / rate;
+    cosine = cos(w0);
+    alpha = sin(w0) / (2.0 * band->q);
+
+    switch (band->type)
+    {
+    case EQ_TYPE_LOW_SHELF:
+        b0 = a * ((a + 1) - (a - 1) * cosine + 2 * root * alpha);
+        b1 = 2 * a * ((a - 1) - (a + 1) * cosine);
+        b2 = a * ((a + 1) - (a - 1) * cosine - 2 * root * alpha);
+        a0 = (a + 1) + (a - 1) * cosine + 2 * root * alpha;
+        a1 = -2 * ((a - 1) + (a + 1) * cosine);
+        a2 = (a + 1) + (a - 1) * cosine - 2 * root * alpha;
+        break;
+    case EQ_TYPE_HIGH_SHELF:
+        b0 = a * ((a + 1) + (a - 1) * cosine + 2 * root * alpha);
+        b1 = -2 * a * ((a - 1) + (a + 1) * cosine);
+        b2 = a * ((a + 1) + (a - 1) * cosine - 2 * root * alpha);
+        a0 = (a + 1) - (a - 1) * cosine + 2 * root * alpha;
+        a1 = 2 * ((a - 1) - (a + 1) * cosine);
+        a2 = (a + 1) - (a - 1) * cosine - 2 * root * alpha;
+        break;
+    default:
+        b0 = 1 + alpha * a;
+        b1 = -2 * cosine;
+        b2 = 1 - alpha * a;
+        a0 = 1 + alpha / a;
+        a1 = -2 * cosine;
+        a2 = 1 - alpha / a;
+        break;
+    }
+
+    biquad->b0 = (float)(b0 / a0);
+    biquad->b1 = (float)(b1 / a0);
+    biquad->b2 = (float)(b2 / a0);
+    biquad->a1 = (float)(a1 / a0);
+    biquad->a2 = (float)(a2 / a0);
+}
+
+void dsp_equalize(dsp_t dsp, float *samples, size_t frames)
+{
+    const struct dsp_biquad_s *biquad;
+    float *state;
+    float *sample;
+    float x;
+    float y;
+    float s1;
+    float s2;
+    size_t frame;
+    int channel;
+    int band;
+
+    // each output depends on the previous one, so the bands stay scalar and
+    // the vector kernels take over for the per sample work around them
+    for (band = 0; band < dsp->nbiquads; band++)
+    {
+        biquad = dsp->biquads + band;
+        for (channel = 0; channel < dsp->channels; channel++)
+        {
+            state = dsp->state[channel][band];
+            s1 = state[0];
+            s2 = state[1];
+            sample = samples + channel;
+            for (frame = 0; frame < frames; frame++, sample += dsp->channels)
+            {
+                x = *sample;
+                y = biquad->b0 * x + s1;
+                s1 = biquad->b1 * x - biquad->a1 * y + s2;
+                s2 = biquad->b2 * x - biquad->a2 * y;
+                *sample = y;
+            }
+            state[0] = fabsf(s1) < DSP_DENORMAL ? 0 : s1;
+            state[1] = fabsf(s2) < DSP_DENORMAL ? 0 : s2;
+        }
+    }
+}
+
+void dsp_load_scalar(const int16_t *in, float *out, size_t count)
+{
+    size_t index;
+
+    for (index = 0; index < count; index++)
+    {
+        out[index] = in[index] * DSP_S16_SCALE;
+    }
+}
+
+void dsp_store_scalar(const float *in, void *out, int format, size_t count, float gain, float step, float threshold, float knee)
+{
+    float x;
+    float magnitude;
+    float over;
+    float y;
+    long value;
+    size_t index;
+
+    // below the threshold the limiter is a no-op, above it the excess is
+    // squeezed into the remaining headroom and never reaches full scale
+    for (index = 0; index < count; index++)
+    {
+        x = in[index] * (gain + step * (float)index);
+        magnitude = fabsf(x);
+        over = fmaxf(magnitude - threshold, 0.0f) / (knee > 0 ? knee : 1.0f);
+        y = copysignf(fminf(magnitude, threshold) + knee * over / (1.0f + over), x);
+        if (format == DSP_FORMAT_F32)
+        {
+            ((float *)out)[index] = y;
+            continue;
+        }
+        value = lrintf(y * DSP_S16_MAX);
+        ((int16_t *)out)[index] = (int16_t)(value > 32767 ? 32767 : value < -32768 ? -32768 : value);
+    }
+}
+
+#if defined(__SSE2__)
+void dsp_load_sse2(const int16_t *in, float *out, size_t count)
+{
+    __m128i samples;
+    __m128 scale;
+    size_t index;
+
+    scale = _mm_set1_ps(DSP_S16_SCALE);
+    for (index = 0; index + 8 <= count; index += 8)
+    {
+        samples = _mm_loadu_si128((const __m128i *)(in + index));
+        _mm_storeu_ps(out + index, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16)), scale));
+        _mm_storeu_ps(out + index + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16)), scale));
+    }
+    dsp_load_scalar(in + index, out + index, count - index);
+}
+
+static inline __m128 dsp_limit_sse2(__m128 x, __m128 threshold, __m128 knee, __m128 inverse, __m128 sign)
+{
+    __m128 magnitude;
+    __m128 over;
+    __m128 y;
+
+    magnitude = _mm_andnot_ps(sign, x);
+    over = _mm_mul_ps(_mm_max_ps(_mm_sub_ps(magnitude, threshold), _mm_setzero_ps()), inverse);
+    y = _mm_add_ps(_mm_min_ps(magnitude, threshold), _mm_div_ps(_mm_mul_ps(knee, over), _mm_add_ps(_mm_set1_ps(1.0f), over)));
+    return _mm_or_ps(y, _mm_and_ps(x, sign));
+}
+
+void dsp_store_sse2(const float *in, void *out, int format, size_t count, float gain, float step, float threshold, float knee)
+{
+    __m128 vthreshold;
+    __m128 vknee;
+    __m128 vinverse;
+    __m128 vsign;
+    __m128 vscale;
+    __m128 vgain;
+    __m128 vstep;
+    __m128 low;
+    __m128 high;
+    size_t index;
+
+    vthreshold = _mm_set1_ps(threshold);
+    vknee = _mm_set1_ps(knee);
+    vinverse = _mm_set1_ps(knee > 0 ? 1.0f / knee : 1.0f);
+    vsign = _mm_set1_ps(-0.0f);
+    vscale = _mm_set1_ps(DSP_S16_MAX);
+    vgain = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(_mm_set1_ps(step), _mm_set_ps(3, 2, 1, 0)));
+    vstep = _mm_set1_ps(step * 4);
+
+    for (index = 0; index + 8 <= count; index += 8)
+    {
+        low = dsp_limit_sse2(_mm_mul_ps(_mm_loadu_ps(in + index), vgain), vthreshold, vknee, vinverse, vsign);
+        vgain = _mm_add_ps(vgain, vstep);
+        high = dsp_limit_sse2(_mm_mul_ps(_mm_loadu_ps(in + index + 4), vgain), vthreshold, vknee, vinverse, vsign);
+        vgain = _mm_add_ps(vgain, vstep);
+        if (format == DSP_FORMAT_F32)
+        {
+            _mm_storeu_ps((float *)out + index, low);
+            _mm_storeu_ps((float *)out + index + 4, high);
+            continue;
+        }
+        _mm_storeu_si128((__m128i *)((int16_t *)out + index),
+                         _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(low, vscale)), _mm_cvtps_epi32(_mm_mul_ps(high, vscale))));
+    }
+    dsp_store_scalar(in + index, format == DSP_FORMAT_F32 ? (void *)((float *)out + index) : (void *)((int16_t *)out + index), format,
+                     count - index, gain + step * (float)index, step, threshold, knee);
+}
+#endif
+
+#if defined(DSP_X86)
+__attribute__((target("avx2"))) void dsp_load_avx2(const int16_t *in, float *out, size_t count)
+{
+    __m256 scale;
+    size_t index;
+
+    scale = _mm256_set1_ps(DSP_S16_SCALE);
+    for (index = 0; index + 8 <= count; index += 8)
+    {
+        _mm256_storeu_ps(out + index,
+                         _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + index)))), scale));
+    }
+    dsp_load_scalar(in + index, out + index, count - index);
+}
+
+__attribute__((target("avx2"))) static inline __m256 dsp_limit_avx2(__m256 x, __m256 threshold, __m256 knee, __m256 inverse, __m256 sign)
+{
+    __m256 magnitude;
+    __m256 over;
+    __m256 y;
+
+    magnitude = _mm256_andnot_ps(sign, x);
+    over = _mm256_mul_ps(_mm256_max_ps(_mm256_sub_ps(magnitude, threshold), _mm256_setzero_ps()), inverse);
+    y = _mm256_add_ps(_mm256_min_ps(magnitude, threshold), _mm256_div_ps(_mm256_mul_ps(knee, over), _mm256_add_ps(_mm256_set1_ps(1.0f), over)));
+    return _mm256_or_ps(y, _mm256_and_ps(x, sign));
+}
+
+__attribute__((target("avx2"))) void dsp_store_avx2(const float *in, void *out, int format, size_t count, float gain, float step,
+                                                     float threshold, float knee)
+{
+    __m256 vthreshold;
+    __m256 vknee;
+    __m256 vinverse;
+    __m256 vsign;
+    __m256 vscale;
+    __m256 vgain;
+    __m256 vstep;
+    __m256 low;
+    __m256 high;
+    __m256i packed;
+    size_t index;
+
+    vthreshold = _mm256_set1_ps(threshold);
+    vknee = _mm256_set1_ps(knee);
+    vinverse = _mm256_set1_ps(knee > 0 ? 1.0f / knee : 1.0f);
+    vsign = _mm256_set1_ps(-0.0f);
+    vscale = _mm256_set1_ps(DSP_S16_MAX);
+    vgain = _mm256_add_ps(_mm256_set1_ps(gain), _mm256_mul_ps(_mm256_set1_ps(step), _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0)));
+    vstep = _mm256_set1_ps(step * 8);
+
+    for (index = 0; index + 16 <= count; index += 16)
+    {
+        low = dsp_limit_avx2(_mm256_mul_ps(_mm256_loadu_ps(in + index), vgain), vthreshold, vknee, vinverse, vsign);
+        vgain = _mm256_add_ps(vgain, vstep);
+        high = dsp_limit_avx2(_mm256_mul_ps(_mm256_loadu_ps(in + index + 8), vgain), vthreshold, vknee, vinverse, vsign);
+        vgain = _mm256_add_ps(vgain, vstep);
+        if (format == DSP_FORMAT_F32)
+        {
+            _mm256_storeu_ps((float *)out + index, low);
+            _mm256_storeu_ps((float *)out + index + 8, high);
+            continue;
+        }
+        // packs works per 128 bit lane, the permute puts the halves back in order
+        packed = _mm256_packs_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(low, vscale)), _mm256_cvtps_epi32(_mm256_mul_ps(high, vscale)));
+        _mm256_storeu_si256((__m256i *)((int16_t *)out + index), _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+    dsp_store_scalar(in + index, format == DSP_FORMAT_F32 ? (void *)((float *)out + index) : (void *)((int16_t *)out + index), format,
+                     count - index, gain + step * (float)index, step, threshold, knee);
+}
+#endif
+
+#if defined(__ARM_NEON)
+void dsp_load_neon(const int16_t *in, float *out, size_t count)
+{
+    int16x8_t samples;
+    float32x4_t scale;
+    size_t index;
+
+    scale = vdupq_n_f32(DSP_S16_SCALE);
+    for (index = 0; index + 8 <= count; index += 8)
+    {
+        samples = vld1q_s16(in + index);
+        vst1q_f32(out + index, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples))), scale));
+        vst1q_f32(out + index + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(samples))), scale));
+    }
+    dsp_load_scalar(in + index, out + index, count - index);
+}
+
+static inline float32x4_t dsp_limit_neon(float32x4_t x, float32x4_t threshold, float32x4_t knee, float32x4_t inverse)
+{
+    float32x4_t magnitude;
+    float32x4_t over;
+    float32x4_t divisor;
+    float32x4_t reciprocal;
+    float32x4_t y;
+
+    // 32 bit arm has no vector divide, two newton steps on the estimate
+    // are exact enough for 16 bit output
+    magnitude = vabsq_f32(x);
+    over = vmulq_f32(vmaxq_f32(vsubq_f32(magnitude, threshold), vdupq_n_f32(0.0f)), inverse);
+    divisor = vaddq_f32(vdupq_n_f32(1.0f), over);
+    reciprocal = vrecpeq_f32(divisor);
+    reciprocal = vmulq_f32(vrecpsq_f32(divisor, reciprocal), reciprocal);
+    reciprocal = vmulq_f32(vrecpsq_f32(divisor, reciprocal), reciprocal);
+    y = vaddq_f32(vminq_f32(magnitude, threshold), vmulq_f32(vmulq_f32(knee, over), reciprocal));
+    return vbslq_f32(vdupq_n_u32(0x80000000), x, y);
+}
+
+static inline int32x4_t dsp_round_neon(float32x4_t x)
+{
+#if defined(__aarch64__)
+    return vcvtnq_s32_f32(x);
+#else
+    return vcvtq_s32_f32(vaddq_f32(x, vbslq_f32(vdupq_n_u32(0x80000000), x, vdupq_n_f32(0.5f))));
+#endif
+}
+
+void dsp_store_neon(const float *in, void *out, int format, size_t count, float gain, float step, float threshold, float knee)
+{
+    float32x4_t vthreshold;
+    float32x4_t vknee;
+    float32x4_t vinverse;
+    float32x4_t vscale;
+    float32x4_t vgain;
+    float32x4_t vstep;
+    float32x4_t low;
+    float32x4_t high;
+    const float lanes[4] = {0, 1, 2, 3};
+    size_t index;
+
+    vthreshold = vdupq_n_f32(threshold);
+    vknee = vdupq_n_f32(knee);
+    vinverse = vdupq_n_f32(knee > 0 ? 1.0f / knee : 1.0f);
+    vscale = vdupq_n_f32(DSP_S16_MAX);
+    vgain = vaddq_f32(vdupq_n_f32(gain), vmulq_f32(vdupq_n_f32(step), vld1q_f32(lanes)));
+    vstep = vdupq_n_f32(step * 4);
+
+    for (index = 0; index + 8 <= count; index += 8)
+    {
+        low = dsp_limit_neon(vmulq_f32(vld1q_f32(in + index), vgain), vthreshold, vknee, vinverse);
+        vgain = vaddq_f32(vgain, vstep);
+        high = dsp_limit_neon(vmulq_f32(vld1q_f32(in + index + 4), vgain), vthreshold, vknee, vinverse);
+        vgain = vaddq_f32(vgain, vstep);
+        if (format == DSP_FORMAT_F32)
+        {
+            vst1q_f32((float *)out + index, low);
+            vst1q_f32((float *)out + index + 4, high);
+            continue;
+        }
+        vst1q_s16((int16_t *)out + index, vcombine_s16(vqmovn_s32(dsp_round_neon(vmulq_f32(low, vscale))),
+                                                       vqmovn_s32(dsp_round_neon(vmulq_f32(high, vscale)))));
+    }
+    dsp_store_scalar(in + index, format == DSP_FORMAT_F32 ? (void *)((float *)out + index) : (void *)((int16_t *)out + index), format,
+                     count - index, gain + step * (float)index, step, threshold, knee);
+}
+#endif
+
+void dsp_destroy(dsp_t dsp)
+{
+    CLEANUP(dsp->params)
+    CLEANUP(dsp->pending)
+    CLEANUP(dsp->scratch)
+    CLEANUP_FUNCTION(dsp->name, g_free(dsp->name))
+    CLEANUP_FUNCTION(dsp->logger, logger_unref(dsp->logger))
+    free(dsp);
+}
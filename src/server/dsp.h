@@ -0,0 +1,95 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include "config.h"
+#include "logger.h"
+#include <glib.h>
+
+#define DSP_MAX_CHANNELS 8
+
+enum dsp_kernels
+{
+    DSP_KERNEL_SCALAR,
+    DSP_KERNEL_SSE2,
+    DSP_KERNEL_AVX2,
+    DSP_KERNEL_NEON,
+    DSP_KERNELS
+};
+
+enum dsp_formats
+{
+    DSP_FORMAT_NONE,
+    DSP_FORMAT_S16,
+    DSP_FORMAT_F32
+};
+
+// the zone settings as configured, handed to the streaming thread whole
+struct dsp_params_s
+{
+    double gain;
+    int limiter;
+    double limiter_threshold;
+    struct eq_band_s eq[DEVICE_MAX_BANDS];
+    int neq;
+};
+typedef struct dsp_params_s *dsp_params_t;
+
+struct dsp_biquad_s
+{
+    float b0;
+    float b1;
+    float b2;
+    float a1;
+    float a2;
+};
+
+struct dsp_s
+{
+    int ref;
+    logger_t logger;
+    char *name;
+    int kernel;
+    // params belongs to the streaming thread, updates wait in pending
+    // until the next buffer picks them up
+    dsp_params_t params;
+    dsp_params_t pending;
+    struct dsp_params_s submitted;
+    // taken by whichever streaming thread is processing, sessions that
+    // overlap on one output pass through instead of sharing filter state
+    int busy;
+    int format;
+    int rate;
+    int channels;
+    struct dsp_biquad_s biquads[DEVICE_MAX_BANDS];
+    int nbiquads;
+    float state[DSP_MAX_CHANNELS][DEVICE_MAX_BANDS][2];
+    float gain;
+    float target;
+    float threshold;
+    float knee;
+    float *scratch;
+    size_t scratch_size;
+};
+typedef struct dsp_s *dsp_t;
+
+int dsp_create(dsp_t *dsp, device_t device, const char *name, int kernel, logger_t logger, const char **error);
+
+int dsp_update(dsp_t dsp, device_t device);
+
+int dsp_configure(dsp_t dsp, const char *format, int rate, int channels);
+
+void dsp_process(dsp_t dsp, void *samples, size_t size);
+
+gboolean dsp_idle(dsp_t dsp);
+
+int dsp_best_kernel(void);
+
+gboolean dsp_kernel_available(int kernel);
+
+const char *dsp_kernel_name(int kernel);
+
+void dsp_ref(dsp_t dsp);
+
+void dsp_unref(dsp_t dsp);
+
+#endif
@@ -0,0 +1,1200 @@
+#include "endpoint.h"
+#include "codec.h"
+#include "jitter.h"
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(endpoint->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(endpoint->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(endpoint->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(endpoint->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(endpoint->logger, TRACE, FORMAT, __VA_ARGS__);
+
+#define ENDPOINT_SINK_NAME "zone_sink"
+
+struct endpoint_probe_s
+{
+    endpoint_t endpoint;
+    gint64 start;
+};
+typedef struct endpoint_probe_s *endpoint_probe_t;
+
+struct endpoint_input_s
+{
+    endpoint_t endpoint;
+    mixer_t mixer;
+    int input;
+    // set by whichever of unprepare and finalize gives the input back first
+    gint released;
+};
+typedef struct endpoint_input_s *endpoint_input_t;
+
+static char *endpoint_launch_string(endpoint_t endpoint);
+
+static char *endpoint_sink_string(device_t device, const char *name);
+
+static char *endpoint_output_string(device_t device);
+
+static char *endpoint_group_string(endpoint_t endpoint, const char *decode);
+
+static char *endpoint_sink_pipeline_string(device_t device);
+
+static int endpoint_parse(endpoint_t endpoint, const char *description);
+
+static int endpoint_create_dsps(endpoint_t endpoint, const char **error);
+
+static int endpoint_warm(endpoint_t endpoint, const char **error);
+
+static gboolean endpoint_sink_message(GstBus *bus, GstMessage *message, gpointer user_data);
+
+static GstBusSyncReply endpoint_stream_status(GstBus *bus, GstMessage *message, gpointer user_data);
+
+static char *endpoint_thread_name(endpoint_t endpoint, GstElement *owner, long long *cpus);
+
+static char *endpoint_alsa_thread_name(endpoint_t endpoint, GstElement *owner, long long *cpus);
+
+static void endpoint_media_configure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data);
+
+static void endpoint_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data);
+
+static void endpoint_claim_input(endpoint_t endpoint, GstRTSPMedia *media, GstElement *element);
+
+static void endpoint_input_unprepared(GstRTSPMedia *media, gpointer user_data);
+
+static void endpoint_release_input(gpointer data, GObject *media);
+
+static void endpoint_watch_first_sample(endpoint_t endpoint, GstElement *element);
+
+static void endpoint_watch_stats(endpoint_t endpoint, GstElement *element);
+
+static void endpoint_watch_sink(endpoint_t endpoint, GstElement *element, const char *name);
+
+static void endpoint_watch_dsps(endpoint_t endpoint, GstElement *element);
+
+static void endpoint_watch_dsp(endpoint_t endpoint, GstElement *element, const char *name, dsp_t dsp);
+
+static GstPadProbeReturn endpoint_process_dsp(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static void endpoint_watch_idles(endpoint_t endpoint, GstRTSPMedia *media, GstElement *element);
+
+static idle_t endpoint_watch_idle(endpoint_t endpoint, GstElement *element, const char *name, device_t device);
+
+static GstPadProbeReturn endpoint_first_sample(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static void endpoint_probe_destroy(gpointer user_data);
+
+static gboolean endpoint_is_element(GstElement *element, const char *factory_name);
+
+static void endpoint_closure_notify(gpointer data, GClosure *closure);
+
+static void endpoint_destroy(endpoint_t endpoint);
+
+int endpoint_create(endpoint_t *endpoint, config_t config, device_t device, netclock_t netclock, realtime_t realtime, logger_t logger, const char **error)
+{
+    int status;
+    endpoint_t new_endpoint;
+    char *launch_string;
+
+    status = STATUS_OK;
+    new_endpoint = NULL;
+    launch_string = NULL;
+
+    IF_THROW(endpoint == NULL, "endpoint_create: null endpoint")
+    IF_THROW(config == NULL, "endpoint_create: null config")
+    IF_THROW(device == NULL, "endpoint_create: null device")
+    IF_THROW(logger == NULL, "endpoint_create: null logger")
+
+    new_endpoint = calloc(1, sizeof(struct endpoint_s));
+    IF_THROW(new_endpoint == NULL, "endpoint_create: failed to allocate endpoint")
+
+    new_endpoint->ref = 1;
+    // the device lives in the config, which a reload may replace
+    new_endpoint->config = config;
+    config_ref(config);
+    new_endpoint->device = device;
+    new_endpoint->logger = logger;
+    logger_ref(logger);
+    new_endpoint->context = g_main_context_ref_thread_default();
+    if (netclock != NULL)
+    {
+        new_endpoint->netclock = netclock;
+        netclock_ref(netclock);
+    }
+    if (realtime != NULL)
+    {
+        new_endpoint->realtime = realtime;
+        realtime_ref(realtime);
+    }
+
+    new_endpoint->path = g_strdup_printf("/%s", device->endpoint);
+    IF_THROW(new_endpoint->path == NULL, "endpoint_create: failed to allocate path")
+
+    if (stats_create(&new_endpoint->stats, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
+    if (endpoint_create_dsps(new_endpoint, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
+    if (device->trace && trace_create(&new_endpoint->trace, new_endpoint->path, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
+    // udp sessions receive into memory preallocated for the latency they
+    // buffer, interleaved ones arrive in buffers the RTSP client made
+    if (pool_create(&new_endpoint->pool, device, error) != STATUS_OK)
+    {
+        goto error;
+    }
+    stats_watch_pool(new_endpoint->stats, new_endpoint->pool);
+    logger_debugf(logger, "endpoint_create: %s: %u packet buffers preallocated\n", new_endpoint->path, new_endpoint->pool->nblocks);
+
+    new_endpoint->factory = gst_rtsp_media_factory_new();
+    IF_THROW(new_endpoint->factory == NULL, "endpoint_create: failed to allocate media factory")
+
+    launch_string = endpoint_launch_string(new_endpoint);
+    IF_THROW(launch_string == NULL, "endpoint_create: failed to allocate launch string")
+
+    gst_rtsp_media_factory_set_transport_mode(new_endpoint->factory, GST_RTSP_TRANSPORT_MODE_RECORD);
+    gst_rtsp_media_factory_set_launch(new_endpoint->factory, launch_string);
+    gst_rtsp_media_factory_set_latency(new_endpoint->factory, (guint)device->latency);
+    g_signal_connect(new_endpoint->factory, "media-configure", G_CALLBACK(endpoint_media_configure), new_endpoint);
+    if (device->retransmission)
+    {
+        // NACKs need the feedback profile, the client negotiates it with
+        // an rtx stream in its ANNOUNCE
+        gst_rtsp_media_factory_set_profiles(new_endpoint->factory, GST_RTSP_PROFILE_AVP | GST_RTSP_PROFILE_AVPF);
+        gst_rtsp_media_factory_set_retransmission_time(new_endpoint->factory, (GstClockTime)device->latency * GST_MSECOND);
+    }
+    if (netclock != NULL)
+    {
+        gst_rtsp_media_factory_set_clock(new_endpoint->factory, netclock->clock);
+    }
+
+    if (device->mix > 0)
+    {
+        if (mixer_create(&new_endpoint->mixer, device->mix, error) != STATUS_OK)
+        {
+            goto error;
+        }
+        // clients look the mixer up on the factory they matched, which may
+        // outlive the endpoint
+        mixer_ref(new_endpoint->mixer);
+        g_object_set_data_full(G_OBJECT(new_endpoint->factory), MIXER_DATA_KEY, new_endpoint->mixer, (GDestroyNotify)mixer_unref);
+    }
+
+    if ((device->warm || device->mix > 0) && endpoint_warm(new_endpoint, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
+    *endpoint = new_endpoint;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_endpoint, endpoint_destroy(new_endpoint))
+done:
+    CLEANUP_FUNCTION(launch_string, g_free(launch_string))
+    return status;
+}
+
+int endpoint_validate(device_t device, logger_t logger, const char **error)
+{
+    int status;
+    struct endpoint_s scratch;
+    endpoint_t endpoint;
+    char *launch_string;
+    char *description;
+
+    status = STATUS_OK;
+    launch_string = NULL;
+    description = NULL;
+
+    IF_THROW(device == NULL, "endpoint_validate: null device")
+    IF_THROW(logger == NULL, "endpoint_validate: null logger")
+
+    // the pipeline descriptions only read the device, logger and path, so
+    // they are built without creating anything else an endpoint owns
+    memset(&scratch, 0, sizeof(struct endpoint_s));
+    scratch.device = device;
+    scratch.logger = logger;
+    scratch.path = g_strdup_printf("/%s", device->endpoint);
+    endpoint = &scratch;
+    IF_THROW(scratch.path == NULL, "endpoint_validate: failed to allocate path")
+
+    launch_string = endpoint_launch_string(endpoint);
+    IF_THROW(launch_string == NULL, "endpoint_validate: failed to allocate launch string")
+    IF_THROW(endpoint_parse(endpoint, launch_string) != STATUS_OK, "endpoint_validate: invalid session pipeline")
+
+    if (device->warm || device->mix > 0)
+    {
+        description = endpoint_sink_pipeline_string(device);
+        IF_THROW(description == NULL, "endpoint_validate: failed to allocate sink description")
+        IF_THROW(endpoint_parse(endpoint, description) != STATUS_OK, "endpoint_validate: invalid sink pipeline")
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(scratch.path, g_free(scratch.path))
+    CLEANUP_FUNCTION(launch_string, g_free(launch_string))
+    CLEANUP_FUNCTION(description, g_free(description))
+    return status;
+}
+
+int endpoint_update_dsp(endpoint_t endpoint, device_t device)
+{
+    int changed;
+    int index;
+
+    // a group keeps its members in order unless it changed, which remounts it
+    changed = FALSE;
+    for (index = 0; index < endpoint->ndsps; index++)
+    {
+        if (endpoint->dsps[index] == NULL || (device->type == DEVICE_TYPE_GROUP && index >= device->nmembers))
+        {
+            continue;
+        }
+        if (dsp_update(endpoint->dsps[index], device->type == DEVICE_TYPE_GROUP ? device->members[index] : device))
+        {
+            changed = TRUE;
+        }
+    }
+    return changed;
+}
+
+void endpoint_stop_sink(endpoint_t endpoint)
+{
+    GstBus *bus;
+
+    // the watch lives on whichever context was the thread default when the
+    // endpoint was created, the bus knows where
+    if (endpoint->sink_watch != 0)
+    {
+        bus = gst_element_get_bus(endpoint->sink_pipeline);
+        gst_bus_remove_watch(bus);
+        gst_object_unref(bus);
+        endpoint->sink_watch = 0;
+    }
+    if (endpoint->sink_pipeline != NULL)
+    {
+        gst_element_set_state(endpoint->sink_pipeline, GST_STATE_NULL);
+        if (endpoint->sink_idle != NULL)
+        {
+            idle_stop(endpoint->sink_idle);
+            idle_unref(endpoint->sink_idle);
+            endpoint->sink_idle = NULL;
+        }
+        gst_object_unref(endpoint->sink_pipeline);
+        endpoint->sink_pipeline = NULL;
+        DEBUGF("endpoint_stop_sink: %s: sink pipeline stopped\n", endpoint->path)
+    }
+}
+
+void endpoint_dump_trace(endpoint_t endpoint)
+{
+    if (endpoint->trace != NULL)
+    {
+        trace_dump(endpoint->trace, endpoint->logger);
+    }
+}
+
+void endpoint_ref(endpoint_t endpoint)
+{
+    // media signals reach the endpoint from streaming threads
+    g_atomic_int_inc(&endpoint->ref);
+}
+
+void endpoint_unref(endpoint_t endpoint)
+{
+    assert(endpoint != NULL);
+    if (g_atomic_int_dec_and_test(&endpoint->ref))
+    {
+        endpoint_destroy(endpoint);
+    }
+}
+
+char *endpoint_launch_string(endpoint_t endpoint)
+{
+    device_t device;
+    char *chain;
+    char *sink;
+    char *caps;
+    char *launch_string;
+
+    device = endpoint->device;
+    chain = codec_chain(device);
+    if (device->codec != NULL && chain == NULL)
+    {
+        WARNF("endpoint_launch_string: %s: unknown codec \"%s\", falling back to decodebin\n", endpoint->path, device->codec)
+    }
+
+    if (device->type == DEVICE_TYPE_GROUP)
+    {
+        caps = codec_caps(device);
+        sink = g_strdup_printf("%s ! %s", chain != NULL ? chain : "decodebin name=depay0 ! audioconvert ! audioresample", caps);
+        launch_string = endpoint_group_string(endpoint, sink);
+        CLEANUP_FUNCTION(chain, g_free(chain))
+        g_free(caps);
+        g_free(sink);
+        return launch_string;
+    }
+
+    // warm zones only decode per session and hand samples to the sink
+    // pipeline that stays open for the lifetime of the endpoint
+    sink = endpoint_sink_string(device, ENDPOINT_SINK_NAME);
+
+    if (chain != NULL)
+    {
+        caps = codec_caps(device);
+        launch_string = g_strdup_printf("( %s ! %s ! %s )", chain, caps, sink);
+        g_free(caps);
+    }
+    else if (device->mix > 0)
+    {
+        // the mixer takes one fixed format on all of its inputs
+        caps = codec_caps(device);
+        launch_string = g_strdup_printf("( decodebin name=depay0 ! audioconvert ! audioresample ! %s ! %s )", caps, sink);
+        g_free(caps);
+    }
+    else if (device->warm)
+    {
+        launch_string = g_strdup_printf("( decodebin name=depay0 ! audioconvert ! audioresample ! %s )", sink);
+    }
+    else
+    {
+        launch_string = g_strdup_printf("( decodebin name=depay0 ! %s )", sink);
+    }
+
+    CLEANUP_FUNCTION(chain, g_free(chain))
+    g_free(sink);
+    return launch_string;
+}
+
+char *endpoint_sink_string(device_t device, const char *name)
+{
+    char *output;
+    char *sink;
+    char *channel;
+
+    // each session is pointed at its own mixer input once it is configured
+    if (device->mix > 0)
+    {
+        channel = mixer_channel(device, -1);
+        sink = g_strdup_printf("interaudiosink name=%s channel=%s", name, channel);
+        g_free(channel);
+        return sink;
+    }
+    if (device->warm)
+    {
+        return g_strdup_printf("interaudiosink name=%s channel=%s", name, device->endpoint);
+    }
+    output = endpoint_output_string(device);
+    sink = g_strdup_printf("%s name=%s", output, name);
+    g_free(output);
+    return sink;
+}
+
+char *endpoint_output_string(device_t device)
+{
+    // fake outputs still render against the clock, which is enough to
+    // exercise zone timing without sound cards
+    if (device->sink == DEVICE_SINK_FAKE)
+    {
+        return g_strdup("fakesink sync=true");
+    }
+    // nothing converts behind alsasink, the pcm gets a format it takes and
+    // its period and buffer are set here instead of by the daemon
+    if (device->sink == DEVICE_SINK_ALSA)
+    {
+        return g_strdup_printf("audioconvert ! audioresample ! alsasink device=\"%s\" latency-time=%d buffer-time=%d", device->name,
+                               device->alsa_period * 1000, device->alsa_buffer * 1000);
+    }
+    return g_strdup_printf("pulsesink device=%s", device->name);
+}
+
+char *endpoint_group_string(endpoint_t endpoint, const char *decode)
+{
+    GString *launch_string;
+    char *name;
+    char *sink;
+    int index;
+
+    // decode once, tee only hands a reference to the same buffer to each
+    // branch and the queues give every zone its own streaming thread
+    launch_string = g_string_new(NULL);
+    g_string_append_printf(launch_string, "( %s ! tee name=%s", decode, ENDPOINT_SINK_NAME);
+    for (index = 0; index < endpoint->device->nmembers; index++)
+    {
+        name = g_strdup_printf("%s_%s", ENDPOINT_SINK_NAME, endpoint->device->members[index]->endpoint);
+        sink = endpoint_sink_string(endpoint->device->members[index], name);
+        g_string_append_printf(launch_string, " %s. ! queue name=%s_queue ! %s", ENDPOINT_SINK_NAME, name, sink);
+        g_free(sink);
+        g_free(name);
+    }
+    g_string_append(launch_string, " )");
+
+    return g_string_free(launch_string, FALSE);
+}
+
+int endpoint_create_dsps(endpoint_t endpoint, const char **error)
+{
+    int status;
+    device_t member;
+    char *name;
+    int index;
+
+    status = STATUS_OK;
+    name = NULL;
+
+    endpoint->ndsps = endpoint->device->type == DEVICE_TYPE_GROUP ? endpoint->device->nmembers : 1;
+    endpoint->dsps = calloc(endpoint->ndsps, sizeof(dsp_t));
+    IF_THROW(endpoint->dsps == NULL, "endpoint_create_dsps: failed to allocate dsps")
+
+    if (endpoint->device->type != DEVICE_TYPE_GROUP)
+    {
+        IF_THROW(dsp_create(endpoint->dsps, endpoint->device, endpoint->path, dsp_best_kernel(), endpoint->logger, error) != STATUS_OK, *error)
+        goto done;
+    }
+
+    // a warm member plays through its own sink pipeline and its own dsp
+    for (index = 0; index < endpoint->ndsps; index++)
+    {
+        member = endpoint->device->members[index];
+        if (member->warm)
+        {
+            continue;
+        }
+        name = g_strdup_printf("%s /%s", endpoint->path, member->endpoint);
+        IF_THROW(name == NULL, "endpoint_create_dsps: failed to allocate name")
+        IF_THROW(dsp_create(endpoint->dsps + index, member, name, dsp_best_kernel(), endpoint->logger, error) != STATUS_OK, *error)
+        g_free(name);
+        name = NULL;
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(name, g_free(name))
+    return status;
+}
+
+char *endpoint_sink_pipeline_string(device_t device)
+{
+    char *description;
+    char *convert;
+    char *sink;
+    char *output;
+
+    // with a fixed codec both ends of the inter channel share the pinned caps
+    convert = codec_known(device->codec) || device->mix > 0 ? codec_caps(device) : g_strdup("audioconvert ! audioresample");
+    sink = endpoint_output_string(device);
+    output = g_strdup_printf("%s name=%s", sink, ENDPOINT_SINK_NAME);
+    if (device->mix > 0)
+    {
+        description = mixer_sink_string(device, convert, output);
+    }
+    else
+    {
+        description = g_strdup_printf("interaudiosrc channel=%s ! %s ! %s", device->endpoint, convert, output);
+    }
+
+    g_free(convert);
+    g_free(sink);
+    g_free(output);
+    return description;
+}
+
+int endpoint_parse(endpoint_t endpoint, const char *description)
+{
+    GstElement *element;
+    GError *parse_error;
+    int status;
+
+    // a missing element or property fails here instead of on the first
+    // client, and loads the plugins the pipeline needs along the way
+    parse_error = NULL;
+    element = gst_parse_launch_full(description, NULL, GST_PARSE_FLAG_FATAL_ERRORS, &parse_error);
+    status = element != NULL && parse_error == NULL ? STATUS_OK : STATUS_ERROR;
+    if (parse_error != NULL)
+    {
+        ERRORF("endpoint_parse: %s: %s\n", endpoint->path, parse_error->message)
+        g_error_free(parse_error);
+    }
+    if (element != NULL)
+    {
+        gst_object_ref_sink(element);
+        gst_object_unref(element);
+    }
+    return status;
+}
+
+int endpoint_warm(endpoint_t endpoint, const char **error)
+{
+    int status;
+    char *description;
+    GError *parse_error;
+    GstBus *bus;
+
+    status = STATUS_OK;
+    parse_error = NULL;
+
+    description = endpoint_sink_pipeline_string(endpoint->device);
+    IF_THROW(description == NULL, "endpoint_warm: failed to allocate sink description")
+
+    endpoint->sink_pipeline = gst_parse_launch(description, &parse_error);
+    IF_THROW(endpoint->sink_pipeline == NULL || parse_error != NULL, "endpoint_warm: failed to build sink pipeline")
+
+    if (endpoint->netclock != NULL)
+    {
+        netclock_configure_pipeline(endpoint->netclock, endpoint->sink_pipeline);
+    }
+
+    // sessions and the mixer only ever see unprocessed samples
+    endpoint_watch_dsp(endpoint, endpoint->sink_pipeline, ENDPOINT_SINK_NAME, endpoint->dsps[0]);
+    if (endpoint->device->idle)
+    {
+        endpoint->sink_idle = endpoint_watch_idle(endpoint, endpoint->sink_pipeline, ENDPOINT_SINK_NAME, endpoint->device);
+    }
+    if (endpoint->trace != NULL)
+    {
+        trace_watch_bin(endpoint->trace, endpoint->sink_pipeline);
+    }
+
+    // the sink pipeline dies with the endpoint, its handler takes no reference
+    bus = gst_element_get_bus(endpoint->sink_pipeline);
+    endpoint->sink_watch = gst_bus_add_watch(bus, endpoint_sink_message, endpoint);
+    if (endpoint->realtime != NULL)
+    {
+        gst_bus_set_sync_handler(bus, endpoint_stream_status, endpoint, NULL);
+    }
+    gst_object_unref(bus);
+
+    // interaudiosrc plays silence between sessions, so the sink only closes
+    // when the device asks for idle suspend
+    IF_THROW(gst_element_set_state(endpoint->sink_pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE,
+             "endpoint_warm: failed to start sink pipeline")
+
+    INFOF("endpoint_warm: %s: sink pipeline running on %s (%d mixer inputs)\n", endpoint->path, endpoint->device->name, endpoint->device->mix)
+    DEBUGF("endpoint_warm: %s: %s\n", endpoint->path, description)
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    if (parse_error != NULL)
+    {
+        ERRORF("endpoint_warm: %s: %s\n", endpoint->path, parse_error->message)
+    }
+done:
+    CLEANUP_FUNCTION(parse_error, g_error_free(parse_error))
+    CLEANUP_FUNCTION(description, g_free(description))
+    return status;
+}
+
+gboolean endpoint_sink_message(GstBus *bus, GstMessage *message, gpointer user_data)
+{
+    endpoint_t endpoint;
+    GError *message_error;
+    gchar *debug;
+
+    endpoint = (endpoint_t)user_data;
+    message_error = NULL;
+    debug = NULL;
+
+    switch (GST_MESSAGE_TYPE(message))
+    {
+    case GST_MESSAGE_ERROR:
+        gst_message_parse_error(message, &message_error, &debug);
+        ERRORF("endpoint_sink_message: %s: %s\n", endpoint->path, message_error->message)
+        break;
+    case GST_MESSAGE_WARNING:
+        gst_message_parse_warning(message, &message_error, &debug);
+        WARNF("endpoint_sink_message: %s: %s\n", endpoint->path, message_error->message)
+        break;
+    default:
+        break;
+    }
+
+    CLEANUP_FUNCTION(message_error, g_error_free(message_error))
+    CLEANUP_FUNCTION(debug, g_free(debug))
+    return G_SOURCE_CONTINUE;
+}
+
+GstBusSyncReply endpoint_stream_status(GstBus *bus, GstMessage *message, gpointer user_data)
+{
+    endpoint_t endpoint;
+    GstStreamStatusType type;
+    GstElement *owner;
+    char *name;
+    long long cpus;
+
+    endpoint = (endpoint_t)user_data;
+
+    if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_STREAM_STATUS)
+    {
+        return GST_BUS_PASS;
+    }
+
+    // enter and leave are posted synchronously from the task's own thread
+    gst_message_parse_stream_status(message, &type, &owner);
+    if (type == GST_STREAM_STATUS_TYPE_ENTER)
+    {
+        name = endpoint_thread_name(endpoint, owner, &cpus);
+        if (name != NULL)
+        {
+            realtime_enter(endpoint->realtime, name, cpus);
+            g_free(name);
+        }
+    }
+    else if (type == GST_STREAM_STATUS_TYPE_LEAVE)
+    {
+        realtime_leave(endpoint->realtime);
+    }
+
+    return GST_BUS_PASS;
+}
+
+char *endpoint_thread_name(endpoint_t endpoint, GstElement *owner, long long *cpus)
+{
+    device_t member;
+    char *name;
+    int index;
+
+    // a zone's jitterbuffer thread runs its decoder and sink as well, warm
+    // zones and group members get a sink thread of their own
+    *cpus = endpoint->device->cpus;
+    if (endpoint_is_element(owner, "rtpjitterbuffer"))
+    {
+        return g_strdup_printf("%s jitterbuffer", endpoint->path);
+    }
+    if (endpoint_is_element(owner, "interaudiosrc"))
+    {
+        return g_strdup_printf("%s sink", endpoint->path);
+    }
+    if (endpoint_is_element(owner, "audiomixer"))
+    {
+        return g_strdup_printf("%s mixer", endpoint->path);
+    }
+    if (endpoint_is_element(owner, "alsasink"))
+    {
+        return endpoint_alsa_thread_name(endpoint, owner, cpus);
+    }
+    if (!endpoint_is_element(owner, "queue"))
+    {
+        return NULL;
+    }
+
+    for (index = 0; index < endpoint->device->nmembers; index++)
+    {
+        member = endpoint->device->members[index];
+        name = g_strdup_printf("%s_%s_queue", ENDPOINT_SINK_NAME, member->endpoint);
+        if (strcmp(GST_ELEMENT_NAME(owner), name) == 0)
+        {
+            g_free(name);
+            *cpus = member->cpus;
+            return g_strdup_printf("%s sink /%s", endpoint->path, member->endpoint);
+        }
+        g_free(name);
+    }
+    return NULL;
+}
+
+char *endpoint_alsa_thread_name(endpoint_t endpoint, GstElement *owner, long long *cpus)
+{
+    device_t member;
+    char *name;
+    int index;
+
+    // the ring buffer thread is the one writing to the card, a group
+    // member's sink is named after it
+    for (index = 0; index < endpoint->device->nmembers; index++)
+    {
+        member = endpoint->device->members[index];
+        name = g_strdup_printf("%s_%s", ENDPOINT_SINK_NAME, member->endpoint);
+        if (strcmp(GST_ELEMENT_NAME(owner), name) == 0)
+        {
+            g_free(name);
+            *cpus = member->cpus;
+            return g_strdup_printf("%s alsa /%s", endpoint->path, member->endpoint);
+        }
+        g_free(name);
+    }
+    return g_strdup_printf("%s alsa", endpoint->path);
+}
+
+void endpoint_media_configure(GstRTSPMediaFactory *factory, GstRTSPMedia *media, gpointer user_data)
+{
+    endpoint_t endpoint;
+    GstElement *element;
+    GstObject *pipeline;
+    GstBus *bus;
+
+    endpoint = (endpoint_t)user_data;
+    element = gst_rtsp_media_get_element(media);
+    pipeline = gst_object_get_parent(GST_OBJECT(element));
+
+    DEBUGF("endpoint_media_configure: new media for %s\n", endpoint->path)
+
+    endpoint_watch_first_sample(endpoint, element);
+    endpoint_watch_stats(endpoint, element);
+    endpoint_watch_dsps(endpoint, element);
+    endpoint_watch_idles(endpoint, media, element);
+    stats_watch_media(endpoint->stats, media);
+    if (endpoint->trace != NULL)
+    {
+        trace_watch_bin(endpoint->trace, element);
+    }
+
+    if (endpoint->mixer != NULL)
+    {
+        endpoint_claim_input(endpoint, media, element);
+    }
+
+    if (pipeline == NULL)
+    {
+        WARNF("endpoint_media_configure: media for %s has no pipeline\n", endpoint->path)
+        goto done;
+    }
+
+    if (endpoint->netclock != NULL)
+    {
+        netclock_configure_pipeline(endpoint->netclock, GST_ELEMENT(pipeline));
+    }
+
+    if (endpoint->realtime != NULL)
+    {
+        bus = gst_element_get_bus(GST_ELEMENT(pipeline));
+        endpoint_ref(endpoint);
+        gst_bus_set_sync_handler(bus, endpoint_stream_status, endpoint, (GDestroyNotify)endpoint_unref);
+        gst_object_unref(bus);
+    }
+
+    // jitterbuffers only appear once rtpbin sees the first packet of a stream
+    endpoint_ref(endpoint);
+    g_signal_connect_data(pipeline, "deep-element-added", G_CALLBACK(endpoint_element_added), endpoint, endpoint_closure_notify, 0);
+
+done:
+    CLEANUP_FUNCTION(pipeline, gst_object_unref(pipeline))
+    gst_object_unref(element);
+}
+
+void endpoint_claim_input(endpoint_t endpoint, GstRTSPMedia *media, GstElement *element)
+{
+    endpoint_input_t input;
+    GstElement *sink;
+    char *channel;
+
+    sink = gst_bin_get_by_name(GST_BIN(element), ENDPOINT_SINK_NAME);
+    if (sink == NULL)
+    {
+        WARNF("endpoint_claim_input: media for %s has no sink\n", endpoint->path)
+        return;
+    }
+
+    // clients are turned away while the mixer is full, this only misses
+    // when two announces race for the last input
+    input = calloc(1, sizeof(struct endpoint_input_s));
+    if (input == NULL || (input->input = mixer_claim(endpoint->mixer)) < 0)
+    {
+        WARNF("endpoint_claim_input: %s: all %d mixer inputs in use, session is not mixed\n", endpoint->path, endpoint->mixer->inputs)
+        CLEANUP(input)
+        gst_object_unref(sink);
+        return;
+    }
+
+    channel = mixer_channel(endpoint->device, input->input);
+    g_object_set(sink, "channel", channel, NULL);
+    DEBUGF("endpoint_claim_input: %s: session mixed on %s\n", endpoint->path, channel)
+
+    // the input comes back as soon as the media is unprepared, a preempted
+    // session frees it for its successor, or on finalize when the media
+    // was never prepared
+    endpoint_ref(endpoint);
+    input->endpoint = endpoint;
+    mixer_ref(endpoint->mixer);
+    input->mixer = endpoint->mixer;
+    g_signal_connect(media, "unprepared", G_CALLBACK(endpoint_input_unprepared), input);
+    g_object_weak_ref(G_OBJECT(media), endpoint_release_input, input);
+
+    g_free(channel);
+    gst_object_unref(sink);
+}
+
+void endpoint_input_unprepared(GstRTSPMedia *media, gpointer user_data)
+{
+    endpoint_input_t input;
+    endpoint_t endpoint;
+
+    input = (endpoint_input_t)user_data;
+    endpoint = input->endpoint;
+
+    if (g_atomic_int_compare_and_exchange(&input->released, 0, 1))
+    {
+        mixer_release(input->mixer, input->input);
+        DEBUGF("endpoint_input_unprepared: %s: mixer input %d free\n", endpoint->path, input->input)
+    }
+}
+
+void endpoint_release_input(gpointer data, GObject *media)
+{
+    endpoint_input_t input;
+    endpoint_t endpoint;
+
+    input = (endpoint_input_t)data;
+    endpoint = input->endpoint;
+
+    // signal handlers are gone by now, unprepared cannot run after this
+    if (g_atomic_int_compare_and_exchange(&input->released, 0, 1))
+    {
+        mixer_release(input->mixer, input->input);
+        DEBUGF("endpoint_release_input: %s: mixer input %d free\n", endpoint->path, input->input)
+    }
+
+    mixer_unref(input->mixer);
+    endpoint_unref(endpoint);
+    free(input);
+}
+
+void endpoint_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+    endpoint_t endpoint;
+    const char *error;
+
+    endpoint = (endpoint_t)user_data;
+
+    // rtpbin, its sessions, jitterbuffers and demuxers and whatever
+    // decodebin plugs only exist once the stream does
+    if (endpoint->trace != NULL)
+    {
+        trace_watch_element(endpoint->trace, element);
+    }
+
+    if (endpoint->netclock != NULL && endpoint_is_element(element, "rtpbin"))
+    {
+        netclock_configure_rtpbin(endpoint->netclock, element);
+    }
+
+    if (endpoint_is_element(element, "udpsrc"))
+    {
+        pool_watch_source(endpoint->pool, element);
+    }
+
+    if (endpoint_is_element(element, "rtpjitterbuffer"))
+    {
+        // decoders only conceal a loss they are told about
+        g_object_set(element, "do-lost", TRUE, NULL);
+        if (endpoint->device->retransmission)
+        {
+            // a request is only worth sending while the packet can still
+            // make its deadline, -1 bounds both by the current latency so
+            // the bound follows adaptive latency too
+            g_object_set(element, "do-retransmission", TRUE, "rtx-deadline", -1, "rtx-retry-period", -1, NULL);
+        }
+        stats_watch_jitterbuffer(endpoint->stats, element);
+        if (endpoint->device->adaptive_latency && jitter_attach(element, endpoint, &error) != STATUS_OK)
+        {
+            ERRORF("endpoint_element_added: %s: %s\n", endpoint->path, error)
+        }
+        if (endpoint->netclock != NULL)
+        {
+            netclock_watch(endpoint->netclock, element, endpoint->path);
+        }
+    }
+}
+
+void endpoint_watch_first_sample(endpoint_t endpoint, GstElement *element)
+{
+    GstElement *sink;
+    GstPad *pad;
+    endpoint_probe_t probe;
+
+    sink = gst_bin_get_by_name(GST_BIN(element), ENDPOINT_SINK_NAME);
+    if (sink == NULL)
+    {
+        return;
+    }
+
+    pad = gst_element_get_static_pad(sink, "sink");
+    probe = calloc(1, sizeof(struct endpoint_probe_s));
+    if (pad != NULL && probe != NULL)
+    {
+        endpoint_ref(endpoint);
+        probe->endpoint = endpoint;
+        probe->start = g_get_monotonic_time();
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, endpoint_first_sample, probe, endpoint_probe_destroy);
+        probe = NULL;
+    }
+
+    CLEANUP(probe)
+    CLEANUP_FUNCTION(pad, gst_object_unref(pad))
+    gst_object_unref(sink);
+}
+
+void endpoint_watch_stats(endpoint_t endpoint, GstElement *element)
+{
+    GstElement *decoder;
+    char *name;
+    int index;
+
+    // decodebin hides its decoder, only explicit codec chains name one
+    decoder = gst_bin_get_by_name(GST_BIN(element), "decode0");
+    if (decoder != NULL)
+    {
+        stats_watch_decoder(endpoint->stats, decoder);
+        gst_object_unref(decoder);
+    }
+
+    if (endpoint->device->type != DEVICE_TYPE_GROUP)
+    {
+        endpoint_watch_sink(endpoint, element, ENDPOINT_SINK_NAME);
+        return;
+    }
+
+    for (index = 0; index < endpoint->device->nmembers; index++)
+    {
+        name = g_strdup_printf("%s_%s", ENDPOINT_SINK_NAME, endpoint->device->members[index]->endpoint);
+        endpoint_watch_sink(endpoint, element, name);
+        g_free(name);
+    }
+}
+
+void endpoint_watch_sink(endpoint_t endpoint, GstElement *element, const char *name)
+{
+    GstElement *sink;
+
+    sink = gst_bin_get_by_name(GST_BIN(element), name);
+    if (sink != NULL)
+    {
+        stats_watch_sink(endpoint->stats, sink);
+        gst_object_unref(sink);
+    }
+}
+
+void endpoint_watch_dsps(endpoint_t endpoint, GstElement *element)
+{
+    char *name;
+    int index;
+
+    // warm and mixing zones process on their sink pipeline instead
+    if (endpoint->device->type != DEVICE_TYPE_GROUP)
+    {
+        if (!endpoint->device->warm && endpoint->device->mix == 0)
+        {
+            endpoint_watch_dsp(endpoint, element, ENDPOINT_SINK_NAME, endpoint->dsps[0]);
+        }
+        return;
+    }
+
+    for (index = 0; index < endpoint->ndsps; index++)
+    {
+        if (endpoint->dsps[index] != NULL)
+        {
+            name = g_strdup_printf("%s_%s", ENDPOINT_SINK_NAME, endpoint->device->members[index]->endpoint);
+            endpoint_watch_dsp(endpoint, element, name, endpoint->dsps[index]);
+            g_free(name);
+        }
+    }
+}
+
+void endpoint_watch_dsp(endpoint_t endpoint, GstElement *element, const char *name, dsp_t dsp)
+{
+    GstElement *sink;
+    GstPad *pad;
+
+    sink = gst_bin_get_by_name(GST_BIN(element), name);
+    if (sink == NULL)
+    {
+        WARNF("endpoint_watch_dsp: %s: no %s to process\n", endpoint->path, name)
+        return;
+    }
+
+    // right in front of the output, after any conversion the sink asked for
+    pad = gst_element_get_static_pad(sink, "sink");
+    if (pad != NULL)
+    {
+        dsp_ref(dsp);
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, endpoint_process_dsp, dsp,
+                          (GDestroyNotify)dsp_unref);
+        gst_object_unref(pad);
+    }
+    gst_object_unref(sink);
+}
+
+GstPadProbeReturn endpoint_process_dsp(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    dsp_t dsp;
+    GstEvent *event;
+    GstCaps *caps;
+    GstStructure *structure;
+    GstBuffer *buffer;
+    GstMapInfo map;
+    const char *format;
+    const char *layout;
+    int rate;
+    int channels;
+
+    dsp = (dsp_t)user_data;
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+        event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+        {
+            gst_event_parse_caps(event, &caps);
+            structure = gst_caps_get_structure(caps, 0);
+            rate = 0;
+            channels = 0;
+            gst_structure_get_int(structure, "rate", &rate);
+            gst_structure_get_int(structure, "channels", &channels);
+            format = gst_structure_get_string(structure, "format");
+            layout = gst_structure_get_string(structure, "layout");
+            dsp_configure(dsp, layout == NULL || strcmp(layout, "interleaved") == 0 ? format : NULL, rate, channels);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (dsp_idle(dsp))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // a group's tee hands the same buffer to every member, each one gets
+    // its own copy before it is changed
+    buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    if (gst_buffer_map(buffer, &map, GST_MAP_WRITE))
+    {
+        dsp_process(dsp, map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void endpoint_watch_idles(endpoint_t endpoint, GstRTSPMedia *media, GstElement *element)
+{
+    device_t member;
+    idle_t idle;
+    char *name;
+    int index;
+
+    // warm and mixing zones suspend their sink pipeline instead
+    if (endpoint->device->type != DEVICE_TYPE_GROUP)
+    {
+        if (endpoint->device->idle && !endpoint->device->warm && endpoint->device->mix == 0 &&
+            (idle = endpoint_watch_idle(endpoint, element, ENDPOINT_SINK_NAME, endpoint->device)) != NULL)
+        {
+            idle_watch_media(idle, media);
+            idle_unref(idle);
+        }
+        return;
+    }
+
+    // each member goes quiet on its own terms, a warm one in its own endpoint
+    for (index = 0; index < endpoint->device->nmembers; index++)
+    {
+        member = endpoint->device->members[index];
+        if (member->idle && !member->warm)
+        {
+            name = g_strdup_printf("%s_%s", ENDPOINT_SINK_NAME, member->endpoint);
+            idle = endpoint_watch_idle(endpoint, element, name, member);
+            g_free(name);
+            if (idle != NULL)
+            {
+                idle_watch_media(idle, media);
+                idle_unref(idle);
+            }
+        }
+    }
+}
+
+idle_t endpoint_watch_idle(endpoint_t endpoint, GstElement *element, const char *name, device_t device)
+{
+    GstElement *sink;
+    idle_t idle;
+    const char *error;
+
+    sink = gst_bin_get_by_name(GST_BIN(element), name);
+    if (sink == NULL)
+    {
+        WARNF("endpoint_watch_idle: %s: no %s to suspend\n", endpoint->path, name)
+        return NULL;
+    }
+
+    // runs until whoever owns the pipeline stops it
+    if (idle_create(&idle, device, sink, device->endpoint, endpoint->stats, endpoint->logger, &error) != STATUS_OK)
+    {
+        WARNF("endpoint_watch_idle: %s: %s\n", endpoint->path, error)
+        idle = NULL;
+    }
+    gst_object_unref(sink);
+    return idle;
+}
+
+GstPadProbeReturn endpoint_first_sample(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    endpoint_probe_t probe;
+    endpoint_t endpoint;
+
+    probe = (endpoint_probe_t)user_data;
+    endpoint = probe->endpoint;
+
+    INFOF("endpoint_first_sample: %s: first sample %.1f ms after session setup%s\n",
+          endpoint->path, (g_get_monotonic_time() - probe->start) / 1000.0, endpoint->device->warm ? " (warm)" : "")
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+void endpoint_probe_destroy(gpointer user_data)
+{
+    endpoint_probe_t probe;
+
+    probe = (endpoint_probe_t)user_data;
+    endpoint_unref(probe->endpoint);
+    free(probe);
+}
+
+gboolean endpoint_is_element(GstElement *element, const char *factory_name)
+{
+    GstElementFactory *factory;
+
+    factory = gst_element_get_factory(element);
+    return factory != NULL && strcmp(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), factory_name) == 0;
+}
+
+void endpoint_closure_notify(gpointer data, GClosure *closure)
+{
+    endpoint_unref((endpoint_t)data);
+}
+
+void endpoint_destroy(endpoint_t endpoint)
+{
+    int index;
+
+    endpoint_stop_sink(endpoint);
+    if (endpoint->factory != NULL)
+    {
+        g_signal_handlers_disconnect_by_data(endpoint->factory, endpoint);
+        g_object_unref(endpoint->factory);
+    }
+    CLEANUP_FUNCTION(endpoint->path, g_free(endpoint->path))
+    CLEANUP_FUNCTION(endpoint->netclock, netclock_unref(endpoint->netclock))
+    CLEANUP_FUNCTION(endpoint->realtime, realtime_unref(endpoint->realtime))
+    CLEANUP_FUNCTION(endpoint->context, g_main_context_unref(endpoint->context))
+    CLEANUP_FUNCTION(endpoint->mixer, mixer_unref(endpoint->mixer))
+    CLEANUP_FUNCTION(endpoint->pool, pool_unref(endpoint->pool))
+    for (index = 0; endpoint->dsps != NULL && index < endpoint->ndsps; index++)
+    {
+        CLEANUP_FUNCTION(endpoint->dsps[index], dsp_unref(endpoint->dsps[index]))
+    }
+    CLEANUP(endpoint->dsps)
+    CLEANUP_FUNCTION(endpoint->stats, stats_unref(endpoint->stats))
+    CLEANUP_FUNCTION(endpoint->trace, trace_unref(endpoint->trace))
+    CLEANUP_FUNCTION(endpoint->config, config_unref(endpoint->config))
+    CLEANUP_FUNCTION(endpoint->logger, logger_unref(endpoint->logger))
+    free(endpoint);
+}
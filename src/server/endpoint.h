@@ -0,0 +1,56 @@
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include "config.h"
+#include "dsp.h"
+#include "idle.h"
+#include "logger.h"
+#include "mixer.h"
+#include "netclock.h"
+#include "pool.h"
+#include "realtime.h"
+#include "stats.h"
+#include "trace.h"
+#include <gst/rtsp-server/rtsp-server.h>
+
+struct endpoint_s
+{
+    int ref;
+    config_t config;
+    device_t device;
+    logger_t logger;
+    // the loop the endpoint was created on, its timers run there
+    GMainContext *context;
+    netclock_t netclock;
+    realtime_t realtime;
+    mixer_t mixer;
+    pool_t pool;
+    // one per output, a group has one for each member it plays itself
+    dsp_t *dsps;
+    int ndsps;
+    stats_t stats;
+    trace_t trace;
+    char *path;
+    GstRTSPMediaFactory *factory;
+    GstElement *sink_pipeline;
+    guint sink_watch;
+    // suspends the warm sink pipeline's output, stopped with the endpoint
+    idle_t sink_idle;
+};
+typedef struct endpoint_s *endpoint_t;
+
+int endpoint_create(endpoint_t *endpoint, config_t config, device_t device, netclock_t netclock, realtime_t realtime, logger_t logger, const char **error);
+
+int endpoint_validate(device_t device, logger_t logger, const char **error);
+
+int endpoint_update_dsp(endpoint_t endpoint, device_t device);
+
+void endpoint_stop_sink(endpoint_t endpoint);
+
+void endpoint_dump_trace(endpoint_t endpoint);
+
+void endpoint_ref(endpoint_t endpoint);
+
+void endpoint_unref(endpoint_t endpoint);
+
+#endif
@@ -0,0 +1,390 @@
+#include "idle.h"
+#include <math.h>
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(idle->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(idle->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(idle->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(idle->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(idle->logger, TRACE, FORMAT, __VA_ARGS__);
+
+// the hold is checked a few times over, within these bounds
+#define IDLE_CHECK_MIN 20
+#define IDLE_CHECK_MAX 1000
+
+static GstPadProbeReturn idle_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static void idle_configure(idle_t idle, GstCaps *caps);
+
+static gboolean idle_loud(idle_t idle, GstBuffer *buffer);
+
+static gboolean idle_check(gpointer user_data);
+
+static GstPadProbeReturn idle_suspend(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static gboolean idle_resume(idle_t idle);
+
+static gboolean idle_resend(GstPad *pad, GstEvent **event, gpointer user_data);
+
+static void idle_media_unprepared(GstRTSPMedia *media, gpointer user_data);
+
+static void idle_closure_notify(gpointer data, GClosure *closure);
+
+static void idle_destroy(idle_t idle);
+
+int idle_create(idle_t *idle, device_t device, GstElement *sink, const char *name, stats_t stats, logger_t logger, const char **error)
+{
+    int status;
+    idle_t new_idle;
+    guint interval;
+
+    status = STATUS_OK;
+    new_idle = NULL;
+
+    IF_THROW(idle == NULL, "idle_create: null idle")
+    IF_THROW(device == NULL, "idle_create: null device")
+    IF_THROW(sink == NULL, "idle_create: null sink")
+    IF_THROW(stats == NULL, "idle_create: null stats")
+    IF_THROW(logger == NULL, "idle_create: null logger")
+
+    new_idle = calloc(1, sizeof(struct idle_s));
+    IF_THROW(new_idle == NULL, "idle_create: failed to allocate idle")
+
+    new_idle->ref = 1;
+    new_idle->logger = logger;
+    logger_ref(logger);
+    new_idle->stats = stats;
+    stats_ref(stats);
+    new_idle->name = g_strdup(name);
+    IF_THROW(new_idle->name == NULL, "idle_create: failed to allocate name")
+    new_idle->sink = gst_object_ref(sink);
+    new_idle->threshold = pow(10, device->idle_threshold / 20);
+    new_idle->hold = (gint64)device->idle_hold * 1000;
+    new_idle->last_signal = g_get_monotonic_time();
+
+    new_idle->sink_pad = gst_element_get_static_pad(sink, "sink");
+    IF_THROW(new_idle->sink_pad == NULL, "idle_create: sink has no sink pad")
+    new_idle->pad = gst_pad_get_peer(new_idle->sink_pad);
+    IF_THROW(new_idle->pad == NULL, "idle_create: sink is not linked")
+
+    // a sink coming back must neither take the clock away from the rest of
+    // the pipeline nor make it preroll again
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(sink), "provide-clock") != NULL)
+    {
+        g_object_set(sink, "provide-clock", FALSE, NULL);
+    }
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(sink), "async") != NULL)
+    {
+        g_object_set(sink, "async", FALSE, NULL);
+    }
+
+    // the probe sees every buffer, the timer also catches a stream that
+    // stopped altogether, both hold a reference until idle_stop
+    idle_ref(new_idle);
+    new_idle->probe = gst_pad_add_probe(new_idle->pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, idle_probe, new_idle,
+                                        (GDestroyNotify)idle_unref);
+
+    interval = (guint)CLAMP(device->idle_hold / 4, IDLE_CHECK_MIN, IDLE_CHECK_MAX);
+    new_idle->timer = g_timeout_source_new(interval);
+    idle_ref(new_idle);
+    g_source_set_callback(new_idle->timer, idle_check, new_idle, (GDestroyNotify)idle_unref);
+    g_source_attach(new_idle->timer, g_main_context_get_thread_default());
+
+    *idle = new_idle;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_idle, idle_destroy(new_idle))
+done:
+    return status;
+}
+
+void idle_watch_media(idle_t idle, GstRTSPMedia *media)
+{
+    idle_ref(idle);
+    g_signal_connect_data(media, "unprepared", G_CALLBACK(idle_media_unprepared), idle, idle_closure_notify, 0);
+}
+
+void idle_stop(idle_t idle)
+{
+    // the pads and the sink are only let go of with the last reference, a
+    // suspend already on its way finds the idle stopped and leaves
+    if (atomic_exchange(&idle->state, IDLE_STOPPED) == IDLE_SUSPENDED)
+    {
+        atomic_fetch_sub(&idle->stats->idle_suspended, 1);
+    }
+    if (idle->probe != 0)
+    {
+        gst_pad_remove_probe(idle->pad, idle->probe);
+        idle->probe = 0;
+    }
+    g_source_destroy(idle->timer);
+}
+
+void idle_ref(idle_t idle)
+{
+    g_atomic_int_inc(&idle->ref);
+}
+
+void idle_unref(idle_t idle)
+{
+    assert(idle != NULL);
+    if (g_atomic_int_dec_and_test(&idle->ref))
+    {
+        idle_destroy(idle);
+    }
+}
+
+GstPadProbeReturn idle_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    idle_t idle;
+    GstEvent *event;
+    GstCaps *caps;
+    gboolean loud;
+
+    idle = (idle_t)user_data;
+
+    // events reach the sink even while it is down, the sticky ones are sent
+    // again when it comes back
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+        event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+        {
+            gst_event_parse_caps(event, &caps);
+            idle_configure(idle, caps);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    loud = idle_loud(idle, GST_PAD_PROBE_INFO_BUFFER(info));
+    if (loud)
+    {
+        atomic_store(&idle->last_signal, g_get_monotonic_time());
+    }
+
+    switch (atomic_load(&idle->state))
+    {
+    case IDLE_SUSPENDING:
+        return GST_PAD_PROBE_DROP;
+    case IDLE_SUSPENDED:
+        // the sink is brought back on this thread before the buffer that
+        // woke it is pushed, so no signal is lost
+        return loud && idle_resume(idle) ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+    default:
+        return GST_PAD_PROBE_OK;
+    }
+}
+
+void idle_configure(idle_t idle, GstCaps *caps)
+{
+    GstStructure *structure;
+    const char *format;
+    const char *layout;
+
+    structure = gst_caps_get_structure(caps, 0);
+    format = gst_structure_get_string(structure, "format");
+    layout = gst_structure_get_string(structure, "layout");
+
+    // anything else is always treated as signal, only a stream that stops
+    // suspends the sink
+    idle->format = IDLE_FORMAT_NONE;
+    if (format != NULL && (layout == NULL || strcmp(layout, "interleaved") == 0))
+    {
+        if (strcmp(format, "S16LE") == 0)
+        {
+            idle->format = IDLE_FORMAT_S16;
+        }
+        else if (strcmp(format, "F32LE") == 0)
+        {
+            idle->format = IDLE_FORMAT_F32;
+        }
+    }
+}
+
+gboolean idle_loud(idle_t idle, GstBuffer *buffer)
+{
+    GstMapInfo map;
+    const int16_t *s16;
+    const float *f32;
+    gboolean loud;
+    size_t index;
+    int limit;
+
+    // concealment after a loss is not a reason to stay awake
+    if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_GAP))
+    {
+        return FALSE;
+    }
+    if (idle->format == IDLE_FORMAT_NONE)
+    {
+        return TRUE;
+    }
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        return TRUE;
+    }
+
+    // music crosses the threshold within the first few samples, only
+    // silence is scanned to the end
+    loud = FALSE;
+    if (idle->format == IDLE_FORMAT_S16)
+    {
+        s16 = (const int16_t *)map.data;
+        limit = (int)(idle->threshold * 32768);
+        for (index = 0; index < map.size / sizeof(int16_t) && !loud; index++)
+        {
+            loud = abs(s16[index]) > limit;
+        }
+    }
+    else
+    {
+        f32 = (const float *)map.data;
+        for (index = 0; index < map.size / sizeof(float) && !loud; index++)
+        {
+            loud = fabsf(f32[index]) > idle->threshold;
+        }
+    }
+
+    gst_buffer_unmap(buffer, &map);
+    return loud;
+}
+
+gboolean idle_check(gpointer user_data)
+{
+    idle_t idle;
+    int expected;
+
+    idle = (idle_t)user_data;
+
+    if (g_get_monotonic_time() - atomic_load(&idle->last_signal) < idle->hold)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    // from here the probe drops every buffer, the sink goes down as soon as
+    // the one it may be rendering is done
+    expected = IDLE_ACTIVE;
+    if (atomic_compare_exchange_strong(&idle->state, &expected, IDLE_SUSPENDING))
+    {
+        idle_ref(idle);
+        gst_pad_add_probe(idle->pad, GST_PAD_PROBE_TYPE_IDLE, idle_suspend, idle, (GDestroyNotify)idle_unref);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+GstPadProbeReturn idle_suspend(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    idle_t idle;
+    int expected;
+
+    idle = (idle_t)user_data;
+    if (atomic_load(&idle->state) != IDLE_SUSPENDING)
+    {
+        return GST_PAD_PROBE_REMOVE;
+    }
+
+    // the pipeline's state changes pass the sink by until it is back, its
+    // clock and base time are what it resumes with
+    CLEANUP_FUNCTION(idle->clock, gst_object_unref(idle->clock))
+    idle->clock = gst_element_get_clock(idle->sink);
+    idle->base_time = gst_element_get_base_time(idle->sink);
+    gst_element_set_locked_state(idle->sink, TRUE);
+    gst_element_set_state(idle->sink, GST_STATE_NULL);
+
+    idle->suspended = g_get_monotonic_time();
+    expected = IDLE_SUSPENDING;
+    if (!atomic_compare_exchange_strong(&idle->state, &expected, IDLE_SUSPENDED))
+    {
+        return GST_PAD_PROBE_REMOVE;
+    }
+    atomic_fetch_add(&idle->stats->idle_suspends, 1);
+    atomic_fetch_add(&idle->stats->idle_suspended, 1);
+
+    INFOF("idle_suspend: %s: sink suspended after %.1f s below %.0f dBFS\n", idle->name,
+          (idle->suspended - atomic_load(&idle->last_signal)) / 1e6, 20 * log10(idle->threshold))
+    return GST_PAD_PROBE_REMOVE;
+}
+
+gboolean idle_resume(idle_t idle)
+{
+    gint64 started;
+    guint64 elapsed;
+    uint_fast64_t max;
+    int expected;
+
+    started = g_get_monotonic_time();
+
+    gst_element_set_locked_state(idle->sink, FALSE);
+    if (idle->clock != NULL)
+    {
+        gst_element_set_clock(idle->sink, idle->clock);
+    }
+    gst_element_set_base_time(idle->sink, idle->base_time);
+    if (!gst_element_sync_state_with_parent(idle->sink))
+    {
+        // tried again on the next buffer with signal
+        WARNF("idle_resume: %s: sink failed to start\n", idle->name)
+        gst_element_set_state(idle->sink, GST_STATE_NULL);
+        gst_element_set_locked_state(idle->sink, TRUE);
+        return FALSE;
+    }
+
+    // the sink pad forgot its caps and segment when it went down, the pad
+    // feeding it still considers them sent
+    gst_pad_sticky_events_foreach(idle->pad, idle_resend, idle->sink_pad);
+    expected = IDLE_SUSPENDED;
+    if (!atomic_compare_exchange_strong(&idle->state, &expected, IDLE_ACTIVE))
+    {
+        return TRUE;
+    }
+
+    elapsed = (guint64)(g_get_monotonic_time() - started) * GST_USECOND;
+    atomic_fetch_add(&idle->stats->idle_resumes, 1);
+    atomic_fetch_add(&idle->stats->idle_resume_ns, elapsed);
+    atomic_fetch_sub(&idle->stats->idle_suspended, 1);
+    max = atomic_load(&idle->stats->idle_resume_max_ns);
+    while (elapsed > max && !atomic_compare_exchange_weak(&idle->stats->idle_resume_max_ns, &max, elapsed))
+    {
+    }
+
+    INFOF("idle_resume: %s: sink resumed in %.1f ms after %.1f s suspended\n", idle->name, elapsed / 1e6,
+          (started - idle->suspended) / 1e6)
+    return TRUE;
+}
+
+gboolean idle_resend(GstPad *pad, GstEvent **event, gpointer user_data)
+{
+    if (GST_EVENT_TYPE(*event) != GST_EVENT_EOS)
+    {
+        gst_pad_send_event((GstPad *)user_data, gst_event_ref(*event));
+    }
+    return TRUE;
+}
+
+void idle_media_unprepared(GstRTSPMedia *media, gpointer user_data)
+{
+    idle_stop((idle_t)user_data);
+}
+
+void idle_closure_notify(gpointer data, GClosure *closure)
+{
+    idle_unref((idle_t)data);
+}
+
+void idle_destroy(idle_t idle)
+{
+    if (idle->timer != NULL)
+    {
+        g_source_destroy(idle->timer);
+        g_source_unref(idle->timer);
+    }
+    CLEANUP_FUNCTION(idle->clock, gst_object_unref(idle->clock))
+    CLEANUP_FUNCTION(idle->pad, gst_object_unref(idle->pad))
+    CLEANUP_FUNCTION(idle->sink_pad, gst_object_unref(idle->sink_pad))
+    CLEANUP_FUNCTION(idle->sink, gst_object_unref(idle->sink))
+    CLEANUP_FUNCTION(idle->name, g_free(idle->name))
+    CLEANUP_FUNCTION(idle->stats, stats_unref(idle->stats))
+    CLEANUP_FUNCTION(idle->logger, logger_unref(idle->logger))
+    free(idle);
+}
@@ -0,0 +1,62 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include "config.h"
+#include "logger.h"
+#include "stats.h"
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include <stdatomic.h>
+
+enum idle_states
+{
+    IDLE_ACTIVE,
+    // buffers are dropped from here on, the sink goes down once its pad
+    // is idle
+    IDLE_SUSPENDING,
+    IDLE_SUSPENDED,
+    // torn down, nothing is suspended or resumed any more
+    IDLE_STOPPED
+};
+
+enum idle_formats
+{
+    IDLE_FORMAT_NONE,
+    IDLE_FORMAT_S16,
+    IDLE_FORMAT_F32
+};
+
+struct idle_s
+{
+    int ref;
+    logger_t logger;
+    stats_t stats;
+    char *name;
+    GstElement *sink;
+    GstPad *sink_pad;
+    // the pad feeding the sink, watched while the sink itself is down
+    GstPad *pad;
+    gulong probe;
+    GSource *timer;
+    double threshold;
+    gint64 hold;
+    int format;
+    atomic_int state;
+    atomic_int_fast64_t last_signal;
+    gint64 suspended;
+    GstClock *clock;
+    GstClockTime base_time;
+};
+typedef struct idle_s *idle_t;
+
+int idle_create(idle_t *idle, device_t device, GstElement *sink, const char *name, stats_t stats, logger_t logger, const char **error);
+
+void idle_watch_media(idle_t idle, GstRTSPMedia *media);
+
+void idle_stop(idle_t idle);
+
+void idle_ref(idle_t idle);
+
+void idle_unref(idle_t idle);
+
+#endif
@@ -0,0 +1,178 @@
+#include "jitter.h"
+
+#define INFOF(FORMAT, ...) LOGGER_SITEF(jitter->endpoint->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(jitter->endpoint->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(jitter->endpoint->logger, TRACE, FORMAT, __VA_ARGS__);
+
+// sample the jitterbuffer once a second, grow by half on any loss and only
+// shrink by a tenth after several clean intervals, never below a few
+// multiples of the measured interarrival jitter
+#define JITTER_INTERVAL 1000
+#define JITTER_STABLE_INTERVALS 5
+#define JITTER_STEP_UP 20
+#define JITTER_STEP_DOWN 5
+#define JITTER_HEADROOM 4.0
+#define JITTER_MARGIN 10
+
+struct jitter_s
+{
+    endpoint_t endpoint;
+    GstElement *jitterbuffer;
+    // owned by the endpoint's context, which frees it on G_SOURCE_REMOVE
+    GSource *source;
+    guint latency;
+    guint latency_min;
+    guint latency_max;
+    guint stable;
+    guint64 pushed;
+    guint64 lost;
+    guint64 late;
+};
+typedef struct jitter_s *jitter_t;
+
+static gboolean jitter_sample(gpointer user_data);
+
+static guint jitter_target(jitter_t jitter, guint64 missed, gdouble jitter_ms);
+
+static void jitter_destroy(gpointer user_data);
+
+int jitter_attach(GstElement *jitterbuffer, endpoint_t endpoint, const char **error)
+{
+    int status;
+    jitter_t new_jitter;
+
+    status = STATUS_OK;
+    new_jitter = NULL;
+
+    IF_THROW(jitterbuffer == NULL, "jitter_attach: null jitterbuffer")
+    IF_THROW(endpoint == NULL, "jitter_attach: null endpoint")
+
+    new_jitter = calloc(1, sizeof(struct jitter_s));
+    IF_THROW(new_jitter == NULL, "jitter_attach: failed to allocate jitter")
+
+    // copy the bounds, the device may be replaced while the stream lives on
+    new_jitter->latency = (guint)endpoint->device->latency;
+    new_jitter->latency_min = (guint)endpoint->device->latency_min;
+    new_jitter->latency_max = (guint)endpoint->device->latency_max;
+
+    endpoint_ref(endpoint);
+    new_jitter->endpoint = endpoint;
+    new_jitter->jitterbuffer = gst_object_ref(jitterbuffer);
+
+    g_object_set(jitterbuffer, "latency", new_jitter->latency, NULL);
+    // sampled on the loop serving the endpoint, not whichever thread added
+    // the jitterbuffer
+    new_jitter->source = g_timeout_source_new(JITTER_INTERVAL);
+    g_source_set_callback(new_jitter->source, jitter_sample, new_jitter, jitter_destroy);
+    g_source_attach(new_jitter->source, endpoint->context);
+    g_source_unref(new_jitter->source);
+
+    logger_infof(endpoint->logger, "jitter_attach: %s: %s target %u ms (adaptive %u-%u ms)\n",
+                 endpoint->path, GST_ELEMENT_NAME(jitterbuffer), new_jitter->latency, new_jitter->latency_min, new_jitter->latency_max);
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    return status;
+}
+
+gboolean jitter_sample(gpointer user_data)
+{
+    jitter_t jitter;
+    GstObject *parent;
+    GstStructure *stats;
+    guint64 pushed;
+    guint64 lost;
+    guint64 late;
+    guint64 avg_jitter;
+    guint64 missed;
+    gdouble jitter_ms;
+    guint target;
+
+    jitter = (jitter_t)user_data;
+    stats = NULL;
+    pushed = lost = late = avg_jitter = 0;
+
+    // rtpbin drops the jitterbuffer when the session goes away
+    parent = gst_object_get_parent(GST_OBJECT(jitter->jitterbuffer));
+    if (parent == NULL)
+    {
+        DEBUGF("jitter_sample: %s: %s released at %u ms\n", jitter->endpoint->path, GST_ELEMENT_NAME(jitter->jitterbuffer), jitter->latency)
+        return G_SOURCE_REMOVE;
+    }
+    gst_object_unref(parent);
+
+    g_object_get(jitter->jitterbuffer, "stats", &stats, NULL);
+    if (stats == NULL)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+    gst_structure_get_uint64(stats, "num-pushed", &pushed);
+    gst_structure_get_uint64(stats, "num-lost", &lost);
+    gst_structure_get_uint64(stats, "num-late", &late);
+    gst_structure_get_uint64(stats, "avg-jitter", &avg_jitter);
+    gst_structure_free(stats);
+
+    jitter_ms = (gdouble)avg_jitter / GST_MSECOND;
+    missed = (lost - jitter->lost) + (late - jitter->late);
+
+    TRACEF("jitter_sample: %s: pushed %" G_GUINT64_FORMAT " lost %" G_GUINT64_FORMAT " late %" G_GUINT64_FORMAT " jitter %.2f ms target %u ms\n",
+           jitter->endpoint->path, pushed - jitter->pushed, lost - jitter->lost, late - jitter->late, jitter_ms, jitter->latency)
+
+    // nothing flowed, there is nothing to learn from this interval
+    if (pushed == jitter->pushed)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    jitter->pushed = pushed;
+    jitter->lost = lost;
+    jitter->late = late;
+
+    target = jitter_target(jitter, missed, jitter_ms);
+    if (target != jitter->latency)
+    {
+        INFOF("jitter_sample: %s: target %u -> %u ms (jitter %.2f ms, missed %" G_GUINT64_FORMAT ")\n",
+              jitter->endpoint->path, jitter->latency, target, jitter_ms, missed)
+        jitter->latency = target;
+        g_object_set(jitter->jitterbuffer, "latency", target, NULL);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+guint jitter_target(jitter_t jitter, guint64 missed, gdouble jitter_ms)
+{
+    guint target;
+    guint floor;
+
+    target = jitter->latency;
+
+    if (missed > 0)
+    {
+        jitter->stable = 0;
+        target = jitter->latency + MAX(jitter->latency / 2, JITTER_STEP_UP);
+    }
+    else if (++jitter->stable >= JITTER_STABLE_INTERVALS)
+    {
+        jitter->stable = 0;
+        floor = MAX(jitter->latency_min, (guint)(jitter_ms * JITTER_HEADROOM) + JITTER_MARGIN);
+        if (jitter->latency > floor)
+        {
+            target = jitter->latency - MIN(jitter->latency - floor, MAX(jitter->latency / 10, JITTER_STEP_DOWN));
+        }
+    }
+
+    return CLAMP(target, jitter->latency_min, jitter->latency_max);
+}
+
+void jitter_destroy(gpointer user_data)
+{
+    jitter_t jitter;
+
+    jitter = (jitter_t)user_data;
+    gst_object_unref(jitter->jitterbuffer);
+    endpoint_unref(jitter->endpoint);
+    free(jitter);
+}
@@ -0,0 +1,8 @@
+#ifndef JITTER_H
+#define JITTER_H
+
+#include "endpoint.h"
+
+int jitter_attach(GstElement *jitterbuffer, endpoint_t endpoint, const char **error);
+
+#endif
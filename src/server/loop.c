@@ -0,0 +1,227 @@
+#include "loop.h"
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(loop->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(loop->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(loop->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(loop->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(loop->logger, TRACE, FORMAT, __VA_ARGS__);
+
+// a timer fires on every loop at a fixed interval, how late it is dispatched
+// is how long anything else queued on that loop has to wait
+#define LOOP_PROBE_INTERVAL 100
+#define LOOP_REPORT_INTERVAL (10 * G_USEC_PER_SEC)
+
+struct loop_monitor_s
+{
+    logger_t logger;
+    char *name;
+    gint64 expected;
+    gint64 reported;
+    gint64 total;
+    gint64 max;
+    guint samples;
+};
+typedef struct loop_monitor_s *loop_monitor_t;
+
+static gpointer loop_run(gpointer user_data);
+
+static gboolean loop_quit(gpointer user_data);
+
+static gboolean loop_probe(gpointer user_data);
+
+static void loop_monitor_destroy(gpointer user_data);
+
+static void loop_destroy(loop_t loop);
+
+int loop_create(loop_t *loop, const char *name, const char *port, logger_t logger, const char **error)
+{
+    int status;
+    loop_t new_loop;
+
+    status = STATUS_OK;
+    new_loop = NULL;
+
+    IF_THROW(loop == NULL, "loop_create: null loop")
+    IF_THROW(name == NULL, "loop_create: null name")
+    IF_THROW(port == NULL, "loop_create: null port")
+    IF_THROW(logger == NULL, "loop_create: null logger")
+
+    new_loop = calloc(1, sizeof(struct loop_s));
+    IF_THROW(new_loop == NULL, "loop_create: failed to allocate loop")
+
+    new_loop->ref = 1;
+    new_loop->logger = logger;
+    logger_ref(logger);
+
+    new_loop->name = g_strdup(name);
+    IF_THROW(new_loop->name == NULL, "loop_create: failed to allocate name")
+
+    new_loop->context = g_main_context_new();
+    IF_THROW(new_loop->context == NULL, "loop_create: failed to allocate context")
+
+    new_loop->main_loop = g_main_loop_new(new_loop->context, FALSE);
+    IF_THROW(new_loop->main_loop == NULL, "loop_create: failed to allocate main loop")
+
+    // without worker threads the pool gives clients, their media and its bus
+    // watches the thread default context, which is this loop's
+    new_loop->rtsp_server = gst_rtsp_server_new();
+    IF_THROW(new_loop->rtsp_server == NULL, "loop_create: failed to allocate RTSP server")
+    g_object_set(new_loop->rtsp_server, "service", port, NULL);
+
+    new_loop->monitor = loop_monitor(new_loop->context, name, logger);
+
+    *loop = new_loop;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_loop, loop_destroy(new_loop))
+done:
+    return status;
+}
+
+int loop_start(loop_t loop, const char **error)
+{
+    int status;
+    GError *thread_error;
+
+    status = STATUS_OK;
+    thread_error = NULL;
+
+    IF_THROW(loop->thread != NULL, "loop_start: loop already running")
+    IF_THROW(gst_rtsp_server_attach(loop->rtsp_server, loop->context) == 0, "loop_start: failed to attach RTSP server")
+
+    loop->thread = g_thread_try_new(loop->name, loop_run, loop, &thread_error);
+    IF_THROW(loop->thread == NULL, "loop_start: failed to start loop thread")
+
+    INFOF("loop_start: %s: serving on port %d\n", loop->name, gst_rtsp_server_get_bound_port(loop->rtsp_server))
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(thread_error, g_error_free(thread_error))
+    return status;
+}
+
+GSource *loop_monitor(GMainContext *context, const char *name, logger_t logger)
+{
+    GSource *source;
+    loop_monitor_t monitor;
+
+    monitor = calloc(1, sizeof(struct loop_monitor_s));
+    if (monitor == NULL)
+    {
+        return NULL;
+    }
+    monitor->logger = logger;
+    logger_ref(logger);
+    monitor->name = g_strdup(name);
+    monitor->expected = g_get_monotonic_time() + LOOP_PROBE_INTERVAL * 1000;
+    monitor->reported = g_get_monotonic_time();
+
+    source = g_timeout_source_new(LOOP_PROBE_INTERVAL);
+    g_source_set_callback(source, loop_probe, monitor, loop_monitor_destroy);
+    g_source_attach(source, context);
+    return source;
+}
+
+void loop_ref(loop_t loop)
+{
+    g_atomic_int_inc(&loop->ref);
+}
+
+void loop_unref(loop_t loop)
+{
+    assert(loop != NULL);
+    if (g_atomic_int_dec_and_test(&loop->ref))
+    {
+        loop_destroy(loop);
+    }
+}
+
+gpointer loop_run(gpointer user_data)
+{
+    loop_t loop;
+
+    loop = (loop_t)user_data;
+
+    // sources created from this thread, bus watches included, land here
+    g_main_context_push_thread_default(loop->context);
+    DEBUGF("loop_run: %s: running\n", loop->name)
+    g_main_loop_run(loop->main_loop);
+    DEBUGF("loop_run: %s: stopped\n", loop->name)
+    g_main_context_pop_thread_default(loop->context);
+
+    return NULL;
+}
+
+gboolean loop_quit(gpointer user_data)
+{
+    g_main_loop_quit(((loop_t)user_data)->main_loop);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean loop_probe(gpointer user_data)
+{
+    loop_monitor_t monitor;
+    gint64 now;
+    gint64 latency;
+
+    monitor = (loop_monitor_t)user_data;
+    now = g_get_monotonic_time();
+
+    latency = MAX(now - monitor->expected, 0);
+    monitor->expected = now + LOOP_PROBE_INTERVAL * 1000;
+    monitor->total += latency;
+    monitor->max = MAX(monitor->max, latency);
+    monitor->samples++;
+
+    if (now - monitor->reported >= LOOP_REPORT_INTERVAL)
+    {
+        logger_infof(monitor->logger, "loop_probe: %s: dispatch latency %.3f ms average, %.3f ms max over %u samples\n",
+                     monitor->name, (gdouble)monitor->total / monitor->samples / 1000.0, (gdouble)monitor->max / 1000.0, monitor->samples);
+        monitor->reported = now;
+        monitor->total = 0;
+        monitor->max = 0;
+        monitor->samples = 0;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+void loop_monitor_destroy(gpointer user_data)
+{
+    loop_monitor_t monitor;
+
+    monitor = (loop_monitor_t)user_data;
+    g_free(monitor->name);
+    logger_unref(monitor->logger);
+    free(monitor);
+}
+
+void loop_destroy(loop_t loop)
+{
+    GSource *quit;
+
+    if (loop->thread != NULL)
+    {
+        // queued on the loop, so a quit before the thread reaches run is kept
+        quit = g_idle_source_new();
+        g_source_set_callback(quit, loop_quit, loop, NULL);
+        g_source_attach(quit, loop->context);
+        g_source_unref(quit);
+        g_thread_join(loop->thread);
+    }
+    if (loop->monitor != NULL)
+    {
+        g_source_destroy(loop->monitor);
+        g_source_unref(loop->monitor);
+    }
+    CLEANUP_FUNCTION(loop->rtsp_server, g_object_unref(loop->rtsp_server))
+    CLEANUP_FUNCTION(loop->main_loop, g_main_loop_unref(loop->main_loop))
+    CLEANUP_FUNCTION(loop->context, g_main_context_unref(loop->context))
+    CLEANUP_FUNCTION(loop->name, g_free(loop->name))
+    CLEANUP_FUNCTION(loop->logger, logger_unref(loop->logger))
+    free(loop);
+}
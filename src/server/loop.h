@@ -0,0 +1,30 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "logger.h"
+#include <gst/rtsp-server/rtsp-server.h>
+
+struct loop_s
+{
+    int ref;
+    logger_t logger;
+    char *name;
+    GMainContext *context;
+    GMainLoop *main_loop;
+    GThread *thread;
+    GstRTSPServer *rtsp_server;
+    GSource *monitor;
+};
+typedef struct loop_s *loop_t;
+
+int loop_create(loop_t *loop, const char *name, const char *port, logger_t logger, const char **error);
+
+int loop_start(loop_t loop, const char **error);
+
+GSource *loop_monitor(GMainContext *context, const char *name, logger_t logger);
+
+void loop_ref(loop_t loop);
+
+void loop_unref(loop_t loop);
+
+#endif
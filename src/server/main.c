@@ -1,23 +1,43 @@
 #include "server.h"
+#include "sink.h"
 #include <gst/gst.h>
 
+static int main_open_log(config_t config, FILE **file, close_file_fn *close_fn, sink_t *sink, const char **error);
+
+static int main_rotate_log(void *user_data, char *buffer, size_t size);
+
+static void main_init_gstreamer(config_t config);
+
 int main(int argc, char **argv)
 {
-    gst_init(NULL,NULL);
     config_t config;
     logger_t logger;
     server_t server;
+    FILE *log_file;
+    close_file_fn log_close_fn;
+    sink_t log_sink;
+    struct logger_options_s log_options;
     int status;
     const char *error;
+    gint64 started;
+    gint64 configured;
+    gint64 initialized;
 
+    // the registry location comes from the config, so gstreamer starts
+    // after it is read
+    started = g_get_monotonic_time();
+    status = STATUS_OK;
     config = NULL;
     logger = NULL;
     server = NULL;
+    log_file = NULL;
+    log_close_fn = NULL;
+    log_sink = NULL;
 
     if(argc < 2)
     {
         puts("main: no config file");
-        goto error;    
+        goto error;
     }
 
     if(config_create(&config,&error) != STATUS_OK)
@@ -34,12 +54,135 @@ int main(int argc, char **argv)
         goto error;
     }
 
+    if(config_validate(config,&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: config_validate failed");
+        goto error;
+    }
+
+    configured = g_get_monotonic_time();
+    main_init_gstreamer(config);
+    initialized = g_get_monotonic_time();
+
+    if(main_open_log(config,&log_file,&log_close_fn,&log_sink,&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: failed to open log file");
+        goto error;
+    }
+
+    log_options.mode = config->log_mode;
+    log_options.format = config->log_format;
+    log_options.overflow = config->log_overflow;
+    log_options.capacity = config->log_capacity;
+
+    if(logger_create(&logger,config->log_level,log_file,log_close_fn,&log_options,&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: logger_create failed");
+        CLEANUP_FUNCTION(log_close_fn, log_close_fn(log_file))
+        goto error;
+    }
+
+    if(log_sink != NULL)
+    {
+        sink_set_rotate_fn(log_sink, main_rotate_log, logger);
+    }
+
+    logger_infof(logger, "main: config loaded in %.1f ms, gstreamer initialized in %.1f ms%s\n", (configured - started) / 1000.0,
+                 (initialized - configured) / 1000.0, config->registry_path != NULL ? " from the registry cache" : "");
+
+    if(server_create(&server,config,logger,&error) != STATUS_OK)
+    {
+        puts(error);
+        puts("main: server_create failed");
+        goto error;
+    }
+
+    server_deploy(server);
+
     goto done;
 error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(server, server_unref(server))
     CLEANUP_FUNCTION(config, config_unref(config))
+    // the sink is still open here, it closes with the logger
+    if(log_sink != NULL && logger != NULL)
+    {
+        logger_infof(logger, "main: log rotated %llu times\n", (unsigned long long)sink_rotations(log_sink));
+        if(sink_truncate_errors(log_sink) > 0)
+        {
+            logger_warnf(logger, "main: %llu log segments left at full size, their tails could not be dropped\n",
+                         (unsigned long long)sink_truncate_errors(log_sink));
+        }
+    }
     CLEANUP_FUNCTION(logger, logger_unref(logger))
-    
+    if(gst_is_initialized())
+    {
+        gst_deinit();
+    }
+    return status;
+}
+
+int main_open_log(config_t config, FILE **file, close_file_fn *close_fn, sink_t *sink, const char **error)
+{
+    int status;
+
+    status = STATUS_OK;
+    *file = NULL;
+    *close_fn = NULL;
+    *sink = NULL;
+
+    if(strcmp(config->log_path, "stdout") == 0)
+    {
+        *file = stdout;
+    }
+    else if(strcmp(config->log_path, "stderr") == 0)
+    {
+        *file = stderr;
+    }
+    else if(config->log_sink == LOG_SINK_MMAP)
+    {
+        if(sink_open(file, sink, config->log_path, config->log_segment_size, config->log_segment_count, error) != STATUS_OK)
+        {
+            goto error;
+        }
+        *close_fn = fclose;
+    }
+    else
+    {
+        *file = fopen(config->log_path, config->log_format == LOGGER_FORMAT_BINARY ? "ab" : "a");
+        IF_THROW(*file == NULL, "main_open_log: failed to open log path")
+        *close_fn = fclose;
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
 done:
-    gst_deinit();
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
+
+int main_rotate_log(void *user_data, char *buffer, size_t size)
+{
+    // binary logs announce their formats again in every new segment
+    return logger_rotate((logger_t)user_data, buffer, size);
+}
+
+void main_init_gstreamer(config_t config)
+{
+    // a cache outside the service user's home survives reboots, and not
+    // rescanning it skips a stat of every plugin on each start, plugins
+    // themselves only load when the pipelines first use them
+    if(config->registry_path != NULL)
+    {
+        g_setenv("GST_REGISTRY", config->registry_path, FALSE);
+        if(!config->registry_update)
+        {
+            g_setenv("GST_REGISTRY_UPDATE", "no", FALSE);
+        }
+    }
+    gst_init(NULL,NULL);
+}
@@ -0,0 +1,318 @@
+#include "metrics.h"
+#include <gio/gunixsocketaddress.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(metrics->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(metrics->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(metrics->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(metrics->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(metrics->logger, TRACE, FORMAT, __VA_ARGS__);
+
+#define DEBUGLN(STRING) logger_debugln(metrics->logger, STRING);
+
+// scrapes are answered from a small worker pool so a slow client never
+// stalls the main loop that runs the RTSP server
+#define METRICS_THREADS 2
+#define METRICS_TIMEOUT 5
+#define METRICS_REQUEST_SIZE 1024
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+struct metrics_field_s
+{
+    const char *name;
+    const char *type;
+    const char *help;
+    size_t offset;
+};
+
+static const struct metrics_field_s metrics_fields[] = {
+    {"sound_system_sessions_active", "gauge", "RECORD sessions currently prepared.", offsetof(struct stats_snapshot_s, sessions_active)},
+    {"sound_system_sessions_total", "counter", "RECORD sessions configured.", offsetof(struct stats_snapshot_s, sessions_total)},
+    {"sound_system_rtp_packets_total", "counter", "RTP packets pushed out of the jitterbuffer.", offsetof(struct stats_snapshot_s, packets_received)},
+    {"sound_system_rtp_packets_lost_total", "counter", "RTP packets never received.", offsetof(struct stats_snapshot_s, packets_lost)},
+    {"sound_system_rtp_packets_late_total", "counter", "RTP packets dropped for arriving too late.", offsetof(struct stats_snapshot_s, packets_late)},
+    {"sound_system_rtp_packets_duplicate_total", "counter", "Duplicate RTP packets dropped.", offsetof(struct stats_snapshot_s, packets_duplicate)},
+    {"sound_system_rtx_requests_total", "counter", "Retransmissions requested from the client.", offsetof(struct stats_snapshot_s, rtx_requested)},
+    {"sound_system_rtx_recovered_total", "counter", "Retransmitted packets that arrived in time.", offsetof(struct stats_snapshot_s, rtx_recovered)},
+    {"sound_system_rtp_jitter_seconds", "gauge", "Average interarrival jitter of the worst live session.", offsetof(struct stats_snapshot_s, jitter_seconds)},
+    {"sound_system_jitterbuffer_fill_ratio", "gauge", "Jitterbuffer fill level of the worst live session.", offsetof(struct stats_snapshot_s, jitterbuffer_fill_ratio)},
+    {"sound_system_jitterbuffer_latency_seconds", "gauge", "Jitterbuffer latency target of the live sessions.", offsetof(struct stats_snapshot_s, jitterbuffer_latency_seconds)},
+    {"sound_system_sink_buffers_total", "counter", "Buffers delivered to the audio sinks.", offsetof(struct stats_snapshot_s, sink_buffers)},
+    {"sound_system_sink_underruns_total", "counter", "Runs of buffers reaching a sink after their render time.", offsetof(struct stats_snapshot_s, sink_underruns)},
+    {"sound_system_decode_buffers_total", "counter", "Buffers decoded.", offsetof(struct stats_snapshot_s, decode_buffers)},
+    {"sound_system_decode_seconds_total", "counter", "Time spent decoding.", offsetof(struct stats_snapshot_s, decode_seconds)},
+    {"sound_system_pool_allocations_total", "counter", "RTP packet memories served from the preallocated pool.", offsetof(struct stats_snapshot_s, pool_allocations)},
+    {"sound_system_pool_heap_allocations_total", "counter", "RTP packet memories that fell back to the heap.", offsetof(struct stats_snapshot_s, pool_heap_allocations)},
+    {"sound_system_pool_in_use", "gauge", "Pool blocks currently holding a packet.", offsetof(struct stats_snapshot_s, pool_in_use)},
+    {"sound_system_idle_suspends_total", "counter", "Zone sinks closed after a run of silence.", offsetof(struct stats_snapshot_s, idle_suspends)},
+    {"sound_system_idle_resumes_total", "counter", "Zone sinks reopened when signal came back.", offsetof(struct stats_snapshot_s, idle_resumes)},
+    {"sound_system_idle_resume_seconds_total", "counter", "Time spent reopening zone sinks.", offsetof(struct stats_snapshot_s, idle_resume_seconds)},
+    {"sound_system_idle_resume_max_seconds", "gauge", "Slowest zone sink reopen.", offsetof(struct stats_snapshot_s, idle_resume_max_seconds)},
+    {"sound_system_idle_suspended", "gauge", "Zone sinks currently closed for silence.", offsetof(struct stats_snapshot_s, idle_suspended)},
+};
+
+static int metrics_listen(metrics_t metrics, GSocketAddress *address, const char **error);
+
+static gboolean metrics_run(GThreadedSocketService *service, GSocketConnection *connection, GObject *source, gpointer user_data);
+
+static char *metrics_render(metrics_t metrics);
+
+static void metrics_append_label(GString *text, const char *value);
+
+static void metrics_destroy(metrics_t metrics);
+
+int metrics_create(metrics_t *metrics, config_t config, logger_t logger, const char **error)
+{
+    int status;
+    metrics_t new_metrics;
+    GSocketAddress *address;
+
+    status = STATUS_OK;
+    new_metrics = NULL;
+    address = NULL;
+
+    IF_THROW(metrics == NULL, "metrics_create: null metrics")
+    IF_THROW(config == NULL, "metrics_create: null config")
+    IF_THROW(logger == NULL, "metrics_create: null logger")
+    IF_THROW(config->stats_port == 0 && config->stats_socket == NULL, "metrics_create: no stats address")
+
+    new_metrics = calloc(1, sizeof(struct metrics_s));
+    IF_THROW(new_metrics == NULL, "metrics_create: failed to allocate metrics")
+
+    new_metrics->ref = 1;
+    new_metrics->logger = logger;
+    logger_ref(logger);
+    g_mutex_init(&new_metrics->lock);
+
+    new_metrics->endpoints = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)stats_unref);
+    IF_THROW(new_metrics->endpoints == NULL, "metrics_create: failed to allocate endpoints")
+
+    new_metrics->service = g_threaded_socket_service_new(METRICS_THREADS);
+    IF_THROW(new_metrics->service == NULL, "metrics_create: failed to allocate socket service")
+
+    if (config->stats_port > 0)
+    {
+        address = g_inet_socket_address_new_from_string(config->stats_address, (guint)config->stats_port);
+        IF_THROW(address == NULL, "metrics_create: invalid stats address")
+        IF_THROW(metrics_listen(new_metrics, address, error) != STATUS_OK, *error)
+        g_object_unref(address);
+        address = NULL;
+        logger_infof(logger, "metrics_create: serving metrics on http://%s:%d/metrics\n", config->stats_address, config->stats_port);
+    }
+
+    if (config->stats_socket != NULL)
+    {
+        // a socket left behind by an earlier run would make bind fail
+        unlink(config->stats_socket);
+        new_metrics->socket_path = g_strdup(config->stats_socket);
+        address = g_unix_socket_address_new(config->stats_socket);
+        IF_THROW(address == NULL, "metrics_create: invalid stats socket")
+        IF_THROW(metrics_listen(new_metrics, address, error) != STATUS_OK, *error)
+        g_object_unref(address);
+        address = NULL;
+        logger_infof(logger, "metrics_create: serving metrics on unix:%s\n", config->stats_socket);
+    }
+
+    g_signal_connect(new_metrics->service, "run", G_CALLBACK(metrics_run), new_metrics);
+    g_socket_service_start(new_metrics->service);
+
+    *metrics = new_metrics;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_metrics, metrics_destroy(new_metrics))
+done:
+    CLEANUP_FUNCTION(address, g_object_unref(address))
+    return status;
+}
+
+void metrics_register(metrics_t metrics, const char *path, stats_t stats)
+{
+    stats_ref(stats);
+    g_mutex_lock(&metrics->lock);
+    g_hash_table_replace(metrics->endpoints, g_strdup(path), stats);
+    g_mutex_unlock(&metrics->lock);
+}
+
+void metrics_unregister(metrics_t metrics, const char *path)
+{
+    g_mutex_lock(&metrics->lock);
+    g_hash_table_remove(metrics->endpoints, path);
+    g_mutex_unlock(&metrics->lock);
+}
+
+void metrics_ref(metrics_t metrics)
+{
+    g_atomic_int_inc(&metrics->ref);
+}
+
+void metrics_unref(metrics_t metrics)
+{
+    assert(metrics != NULL);
+    if (g_atomic_int_dec_and_test(&metrics->ref))
+    {
+        metrics_destroy(metrics);
+    }
+}
+
+int metrics_listen(metrics_t metrics, GSocketAddress *address, const char **error)
+{
+    int status;
+    GError *listen_error;
+
+    status = STATUS_OK;
+    listen_error = NULL;
+
+    if (!g_socket_listener_add_address(G_SOCKET_LISTENER(metrics->service), address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &listen_error))
+    {
+        ERRORF("metrics_listen: %s\n", listen_error->message)
+        IF_THROW(1, "metrics_listen: failed to listen on stats address")
+    }
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    CLEANUP_FUNCTION(listen_error, g_error_free(listen_error))
+    return status;
+}
+
+gboolean metrics_run(GThreadedSocketService *service, GSocketConnection *connection, GObject *source, gpointer user_data)
+{
+    metrics_t metrics;
+    char request[METRICS_REQUEST_SIZE];
+    gssize length;
+    char *body;
+    char *response;
+    GOutputStream *output;
+
+    metrics = (metrics_t)user_data;
+    body = NULL;
+    response = NULL;
+
+    g_socket_set_timeout(g_socket_connection_get_socket(connection), METRICS_TIMEOUT);
+    length = g_input_stream_read(g_io_stream_get_input_stream(G_IO_STREAM(connection)), request, sizeof(request) - 1, NULL, NULL);
+    if (length <= 0)
+    {
+        return TRUE;
+    }
+    request[length] = '\0';
+
+    // only the request line matters, headers and keep-alive are ignored
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0)
+    {
+        body = metrics_render(metrics);
+        response = g_strdup_printf("HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                                   METRICS_CONTENT_TYPE, strlen(body), body);
+    }
+    else
+    {
+        response = g_strdup("HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    }
+
+    output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    if (!g_output_stream_write_all(output, response, strlen(response), NULL, NULL, NULL))
+    {
+        DEBUGLN("metrics_run: client went away before the response was written")
+    }
+
+    CLEANUP_FUNCTION(body, g_free(body))
+    CLEANUP_FUNCTION(response, g_free(response))
+    return TRUE;
+}
+
+char *metrics_render(metrics_t metrics)
+{
+    GString *text;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    char **paths;
+    stats_snapshot_t snapshots;
+    guint count;
+    guint index;
+    size_t field;
+
+    text = g_string_new(NULL);
+    count = 0;
+
+    // snapshot every endpoint once, then write metric by metric so each
+    // family's HELP and TYPE lines appear a single time
+    g_mutex_lock(&metrics->lock);
+    paths = calloc(g_hash_table_size(metrics->endpoints) + 1, sizeof(char *));
+    snapshots = calloc(g_hash_table_size(metrics->endpoints) + 1, sizeof(struct stats_snapshot_s));
+    if (paths != NULL && snapshots != NULL)
+    {
+        g_hash_table_iter_init(&iter, metrics->endpoints);
+        while (g_hash_table_iter_next(&iter, &key, &value))
+        {
+            paths[count] = g_strdup((const char *)key);
+            stats_snapshot((stats_t)value, snapshots + count);
+            count++;
+        }
+    }
+    g_mutex_unlock(&metrics->lock);
+
+    for (field = 0; field < G_N_ELEMENTS(metrics_fields); field++)
+    {
+        g_string_append_printf(text, "# HELP %s %s\n# TYPE %s %s\n",
+                               metrics_fields[field].name, metrics_fields[field].help, metrics_fields[field].name, metrics_fields[field].type);
+        for (index = 0; index < count; index++)
+        {
+            g_string_append_printf(text, "%s{endpoint=\"", metrics_fields[field].name);
+            metrics_append_label(text, paths[index]);
+            g_string_append_printf(text, "\"} %.9g\n", *(double *)((char *)(snapshots + index) + metrics_fields[field].offset));
+        }
+    }
+
+    g_string_append_printf(text, "# HELP sound_system_log_dropped_total Log records dropped by the async logger.\n"
+                                 "# TYPE sound_system_log_dropped_total counter\n"
+                                 "sound_system_log_dropped_total %" G_GUINT64_FORMAT "\n",
+                           (guint64)logger_dropped(metrics->logger));
+
+    for (index = 0; index < count; index++)
+    {
+        g_free(paths[index]);
+    }
+    CLEANUP(paths)
+    CLEANUP(snapshots)
+    return g_string_free(text, FALSE);
+}
+
+void metrics_append_label(GString *text, const char *value)
+{
+    for (; *value != '\0'; value++)
+    {
+        if (*value == '\\' || *value == '"')
+        {
+            g_string_append_c(text, '\\');
+        }
+        if (*value == '\n')
+        {
+            g_string_append(text, "\\n");
+            continue;
+        }
+        g_string_append_c(text, *value);
+    }
+}
+
+void metrics_destroy(metrics_t metrics)
+{
+    if (metrics->service != NULL)
+    {
+        g_socket_service_stop(metrics->service);
+        g_socket_listener_close(G_SOCKET_LISTENER(metrics->service));
+        g_object_unref(metrics->service);
+    }
+    if (metrics->socket_path != NULL)
+    {
+        unlink(metrics->socket_path);
+        g_free(metrics->socket_path);
+    }
+    CLEANUP_FUNCTION(metrics->endpoints, g_hash_table_unref(metrics->endpoints))
+    g_mutex_clear(&metrics->lock);
+    CLEANUP_FUNCTION(metrics->logger, logger_unref(metrics->logger))
+    free(metrics);
+}
@@ -0,0 +1,30 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "config.h"
+#include "logger.h"
+#include "stats.h"
+#include <gio/gio.h>
+
+struct metrics_s
+{
+    int ref;
+    logger_t logger;
+    GSocketService *service;
+    GMutex lock;
+    GHashTable *endpoints;
+    char *socket_path;
+};
+typedef struct metrics_s *metrics_t;
+
+int metrics_create(metrics_t *metrics, config_t config, logger_t logger, const char **error);
+
+void metrics_register(metrics_t metrics, const char *path, stats_t stats);
+
+void metrics_unregister(metrics_t metrics, const char *path);
+
+void metrics_ref(metrics_t metrics);
+
+void metrics_unref(metrics_t metrics);
+
+#endif
@@ -0,0 +1,120 @@
+#include "mixer.h"
+
+static void mixer_destroy(mixer_t mixer);
+
+int mixer_create(mixer_t *mixer, int inputs, const char **error)
+{
+    int status;
+    mixer_t new_mixer;
+
+    status = STATUS_OK;
+    new_mixer = NULL;
+
+    IF_THROW(mixer == NULL, "mixer_create: null mixer")
+    IF_THROW(inputs < 1 || inputs > MIXER_MAX_INPUTS, "mixer_create: invalid inputs")
+
+    new_mixer = calloc(1, sizeof(struct mixer_s));
+    IF_THROW(new_mixer == NULL, "mixer_create: failed to allocate mixer")
+
+    new_mixer->ref = 1;
+    g_mutex_init(&new_mixer->lock);
+    new_mixer->inputs = inputs;
+    new_mixer->used = 0;
+
+    *mixer = new_mixer;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+done:
+    return status;
+}
+
+char *mixer_sink_string(device_t device, const char *caps, const char *output)
+{
+    GString *description;
+    char *channel;
+    int input;
+
+    // every input plays silence until a session claims its channel, so the
+    // mixer always has data on each pad and lines the sessions up by their
+    // running time on the one pipeline clock
+    description = g_string_new(NULL);
+    g_string_append_printf(description, "audiomixer name=mix ! %s ! %s", caps, output);
+    for (input = 0; input < device->mix; input++)
+    {
+        channel = mixer_channel(device, input);
+        g_string_append_printf(description, " interaudiosrc name=mix_input%d channel=%s ! %s ! mix.", input, channel, caps);
+        g_free(channel);
+    }
+
+    return g_string_free(description, FALSE);
+}
+
+char *mixer_channel(device_t device, int input)
+{
+    if (input < 0)
+    {
+        // nothing reads this channel, a session that found no free input
+        // still runs but is never heard
+        return g_strdup_printf("%s_unmixed", device->endpoint);
+    }
+    return g_strdup_printf("%s_mix%d", device->endpoint, input);
+}
+
+int mixer_claim(mixer_t mixer)
+{
+    int input;
+
+    g_mutex_lock(&mixer->lock);
+    for (input = 0; input < mixer->inputs; input++)
+    {
+        if ((mixer->used & (1u << input)) == 0)
+        {
+            mixer->used |= 1u << input;
+            break;
+        }
+    }
+    g_mutex_unlock(&mixer->lock);
+
+    return input < mixer->inputs ? input : -1;
+}
+
+void mixer_release(mixer_t mixer, int input)
+{
+    g_mutex_lock(&mixer->lock);
+    mixer->used &= ~(1u << input);
+    g_mutex_unlock(&mixer->lock);
+}
+
+gboolean mixer_full(mixer_t mixer)
+{
+    gboolean full;
+
+    g_mutex_lock(&mixer->lock);
+    // a shift by the full width of used is undefined
+    full = mixer->used == (mixer->inputs >= MIXER_MAX_INPUTS ? ~0u : (1u << mixer->inputs) - 1);
+    g_mutex_unlock(&mixer->lock);
+
+    return full;
+}
+
+void mixer_ref(mixer_t mixer)
+{
+    g_atomic_int_inc(&mixer->ref);
+}
+
+void mixer_unref(mixer_t mixer)
+{
+    assert(mixer != NULL);
+    if (g_atomic_int_dec_and_test(&mixer->ref))
+    {
+        mixer_destroy(mixer);
+    }
+}
+
+void mixer_destroy(mixer_t mixer)
+{
+    g_mutex_clear(&mixer->lock);
+    free(mixer);
+}
@@ -0,0 +1,39 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "config.h"
+#include <glib.h>
+
+// one bit of used per input
+#define MIXER_MAX_INPUTS 32
+
+// attached to the media factory so the RTSP clients can check for a free
+// input before a session is set up
+#define MIXER_DATA_KEY "zone-mixer"
+
+struct mixer_s
+{
+    int ref;
+    GMutex lock;
+    int inputs;
+    guint used;
+};
+typedef struct mixer_s *mixer_t;
+
+int mixer_create(mixer_t *mixer, int inputs, const char **error);
+
+char *mixer_sink_string(device_t device, const char *caps, const char *output);
+
+char *mixer_channel(device_t device, int input);
+
+int mixer_claim(mixer_t mixer);
+
+void mixer_release(mixer_t mixer, int input);
+
+gboolean mixer_full(mixer_t mixer);
+
+void mixer_ref(mixer_t mixer);
+
+void mixer_unref(mixer_t mixer);
+
+#endif
@@ -0,0 +1,322 @@
+#include "netclock.h"
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(netclock->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(netclock->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(netclock->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(netclock->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(netclock->logger, TRACE, FORMAT, __VA_ARGS__);
+
+// each zone is sampled at most once a second and the skew between zones is
+// reported every few seconds from whatever was sampled since the last report
+#define NETCLOCK_SYNC_TIMEOUT (5 * GST_SECOND)
+#define NETCLOCK_SAMPLE_INTERVAL GST_SECOND
+#define NETCLOCK_REPORT_INTERVAL 5000
+
+// rtpbin's GstRtpNtpTimeSource, take sender times from the pipeline clock
+#define NETCLOCK_NTP_TIME_SOURCE_CLOCK_TIME 3
+
+struct netclock_zone_s
+{
+    gint64 offset;
+    gint64 updated;
+};
+typedef struct netclock_zone_s *netclock_zone_t;
+
+struct netclock_probe_s
+{
+    netclock_t netclock;
+    char *zone;
+    GstClockTime sampled;
+    gboolean warned;
+};
+typedef struct netclock_probe_s *netclock_probe_t;
+
+static void netclock_set_if_exists(GstElement *element, const char *property, gboolean value);
+
+static GstPadProbeReturn netclock_sample(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static void netclock_record(netclock_t netclock, const char *zone, gint64 offset);
+
+static gboolean netclock_report(gpointer user_data);
+
+static void netclock_probe_destroy(gpointer user_data);
+
+static void netclock_destroy(netclock_t netclock);
+
+int netclock_create(netclock_t *netclock, config_t config, logger_t logger, const char **error)
+{
+    int status;
+    netclock_t new_netclock;
+
+    status = STATUS_OK;
+    new_netclock = NULL;
+
+    IF_THROW(netclock == NULL, "netclock_create: null netclock")
+    IF_THROW(config == NULL, "netclock_create: null config")
+    IF_THROW(logger == NULL, "netclock_create: null logger")
+    IF_THROW(config->clock_mode == CLOCK_MODE_NONE, "netclock_create: clock mode is none")
+
+    new_netclock = calloc(1, sizeof(struct netclock_s));
+    IF_THROW(new_netclock == NULL, "netclock_create: failed to allocate netclock")
+
+    new_netclock->ref = 1;
+    new_netclock->logger = logger;
+    logger_ref(logger);
+    g_mutex_init(&new_netclock->lock);
+
+    // every instance renders against base time 0, so running time is clock
+    // time and zones on other servers following the same clock line up
+    new_netclock->base_time = 0;
+
+    new_netclock->zones = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
+    IF_THROW(new_netclock->zones == NULL, "netclock_create: failed to allocate zones")
+
+    if (config->clock_mode == CLOCK_MODE_PROVIDE)
+    {
+        new_netclock->clock = gst_system_clock_obtain();
+        IF_THROW(new_netclock->clock == NULL, "netclock_create: failed to obtain system clock")
+        new_netclock->provider = gst_net_time_provider_new(new_netclock->clock, config->clock_address, config->clock_port);
+        IF_THROW(new_netclock->provider == NULL, "netclock_create: failed to start network time provider")
+        logger_infof(logger, "netclock_create: providing clock on %s:%d\n", config->clock_address, config->clock_port);
+    }
+    else
+    {
+        new_netclock->clock = gst_net_client_clock_new("sound-system", config->clock_address, config->clock_port, 0);
+        IF_THROW(new_netclock->clock == NULL, "netclock_create: failed to create network client clock")
+        if (!gst_clock_wait_for_sync(new_netclock->clock, NETCLOCK_SYNC_TIMEOUT))
+        {
+            logger_warnf(logger, "netclock_create: clock at %s:%d not synced yet, continuing\n", config->clock_address, config->clock_port);
+        }
+        logger_infof(logger, "netclock_create: following clock at %s:%d\n", config->clock_address, config->clock_port);
+    }
+
+    new_netclock->report_source = g_timeout_add(NETCLOCK_REPORT_INTERVAL, netclock_report, new_netclock);
+
+    *netclock = new_netclock;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_netclock, netclock_destroy(new_netclock))
+done:
+    return status;
+}
+
+void netclock_configure_pipeline(netclock_t netclock, GstElement *pipeline)
+{
+    // keep the pipeline from picking its own base time on PLAYING
+    gst_pipeline_use_clock(GST_PIPELINE(pipeline), netclock->clock);
+    gst_element_set_start_time(pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(pipeline, netclock->base_time);
+}
+
+void netclock_configure_rtpbin(netclock_t netclock, GstElement *rtpbin)
+{
+    // map sender timestamps through RTCP SR or RFC 7273 a=ts-refclk onto the
+    // shared clock so the same content gets the same running time in every zone
+    netclock_set_if_exists(rtpbin, "ntp-sync", TRUE);
+    netclock_set_if_exists(rtpbin, "rfc7273-sync", TRUE);
+    netclock_set_if_exists(rtpbin, "add-reference-timestamp-meta", TRUE);
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(rtpbin), "ntp-time-source") != NULL)
+    {
+        g_object_set(rtpbin, "ntp-time-source", NETCLOCK_NTP_TIME_SOURCE_CLOCK_TIME, NULL);
+    }
+    DEBUGF("netclock_configure_rtpbin: %s synced to shared clock\n", GST_ELEMENT_NAME(rtpbin))
+}
+
+void netclock_watch(netclock_t netclock, GstElement *jitterbuffer, const char *zone)
+{
+    GstPad *pad;
+    netclock_probe_t probe;
+
+    netclock_set_if_exists(jitterbuffer, "add-reference-timestamp-meta", TRUE);
+
+    pad = gst_element_get_static_pad(jitterbuffer, "src");
+    probe = calloc(1, sizeof(struct netclock_probe_s));
+    if (pad != NULL && probe != NULL)
+    {
+        netclock_ref(netclock);
+        probe->netclock = netclock;
+        probe->zone = g_strdup(zone);
+        probe->sampled = GST_CLOCK_TIME_NONE;
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, netclock_sample, probe, netclock_probe_destroy);
+        probe = NULL;
+    }
+
+    CLEANUP(probe)
+    CLEANUP_FUNCTION(pad, gst_object_unref(pad))
+}
+
+void netclock_ref(netclock_t netclock)
+{
+    g_atomic_int_inc(&netclock->ref);
+}
+
+void netclock_unref(netclock_t netclock)
+{
+    assert(netclock != NULL);
+    if (g_atomic_int_dec_and_test(&netclock->ref))
+    {
+        netclock_destroy(netclock);
+    }
+}
+
+void netclock_set_if_exists(GstElement *element, const char *property, gboolean value)
+{
+    // older GStreamer releases lack some of the sync properties
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), property) != NULL)
+    {
+        g_object_set(element, property, value, NULL);
+    }
+}
+
+GstPadProbeReturn netclock_sample(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    netclock_probe_t probe;
+    netclock_t netclock;
+    GstBuffer *buffer;
+    GstReferenceTimestampMeta *meta;
+    GstEvent *event;
+    const GstSegment *segment;
+    GstClockTime now;
+    GstClockTime running_time;
+
+    probe = (netclock_probe_t)user_data;
+    netclock = probe->netclock;
+    buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    now = gst_clock_get_time(netclock->clock);
+    if (GST_CLOCK_TIME_IS_VALID(probe->sampled) && now - probe->sampled < NETCLOCK_SAMPLE_INTERVAL)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+    probe->sampled = now;
+
+    // the reference timestamp is the sender's time for this content, the
+    // same value in every zone that plays the same stream
+    meta = gst_buffer_get_reference_timestamp_meta(buffer, NULL);
+    if (meta == NULL || !GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        if (!probe->warned)
+        {
+            DEBUGF("netclock_sample: %s: no sender reference timestamps yet\n", probe->zone)
+            probe->warned = TRUE;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+    if (event == NULL)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+    gst_event_parse_segment(event, &segment);
+    running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    gst_event_unref(event);
+
+    if (GST_CLOCK_TIME_IS_VALID(running_time))
+    {
+        netclock_record(netclock, probe->zone, (gint64)(netclock->base_time + running_time) - (gint64)meta->timestamp);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void netclock_record(netclock_t netclock, const char *zone, gint64 offset)
+{
+    netclock_zone_t entry;
+
+    g_mutex_lock(&netclock->lock);
+    entry = g_hash_table_lookup(netclock->zones, zone);
+    if (entry == NULL)
+    {
+        entry = calloc(1, sizeof(struct netclock_zone_s));
+        if (entry != NULL)
+        {
+            g_hash_table_insert(netclock->zones, g_strdup(zone), entry);
+        }
+    }
+    if (entry != NULL)
+    {
+        entry->offset = offset;
+        entry->updated = g_get_monotonic_time();
+    }
+    g_mutex_unlock(&netclock->lock);
+}
+
+gboolean netclock_report(gpointer user_data)
+{
+    netclock_t netclock;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    netclock_zone_t entry;
+    gint64 cutoff;
+    const char *earliest;
+    const char *latest;
+    gint64 min_offset;
+    gint64 max_offset;
+    int zones;
+
+    netclock = (netclock_t)user_data;
+    cutoff = g_get_monotonic_time() - (gint64)NETCLOCK_REPORT_INTERVAL * 1000;
+    earliest = latest = NULL;
+    min_offset = max_offset = 0;
+    zones = 0;
+
+    g_mutex_lock(&netclock->lock);
+    g_hash_table_iter_init(&iter, netclock->zones);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        entry = (netclock_zone_t)value;
+        if (entry->updated < cutoff)
+        {
+            continue;
+        }
+        if (zones == 0 || entry->offset < min_offset)
+        {
+            min_offset = entry->offset;
+            earliest = (const char *)key;
+        }
+        if (zones == 0 || entry->offset > max_offset)
+        {
+            max_offset = entry->offset;
+            latest = (const char *)key;
+        }
+        zones++;
+    }
+
+    // the offsets are the running time each zone scheduled for the same
+    // sender time, their spread is how far apart the rooms play
+    if (zones > 1)
+    {
+        INFOF("netclock_report: inter-zone skew %.3f ms across %d zones (%s earliest, %s latest)\n",
+              (gdouble)(max_offset - min_offset) / GST_MSECOND, zones, earliest, latest)
+    }
+    g_mutex_unlock(&netclock->lock);
+
+    return G_SOURCE_CONTINUE;
+}
+
+void netclock_probe_destroy(gpointer user_data)
+{
+    netclock_probe_t probe;
+
+    probe = (netclock_probe_t)user_data;
+    g_free(probe->zone);
+    netclock_unref(probe->netclock);
+    free(probe);
+}
+
+void netclock_destroy(netclock_t netclock)
+{
+    if (netclock->report_source != 0)
+    {
+        g_source_remove(netclock->report_source);
+    }
+    CLEANUP_FUNCTION(netclock->provider, gst_object_unref(netclock->provider))
+    CLEANUP_FUNCTION(netclock->clock, gst_object_unref(netclock->clock))
+    CLEANUP_FUNCTION(netclock->zones, g_hash_table_unref(netclock->zones))
+    g_mutex_clear(&netclock->lock);
+    CLEANUP_FUNCTION(netclock->logger, logger_unref(netclock->logger))
+    free(netclock);
+}
@@ -0,0 +1,34 @@
+#ifndef NETCLOCK_H
+#define NETCLOCK_H
+
+#include "config.h"
+#include "logger.h"
+#include <gst/gst.h>
+#include <gst/net/net.h>
+
+struct netclock_s
+{
+    int ref;
+    logger_t logger;
+    GstClock *clock;
+    GstClockTime base_time;
+    GstNetTimeProvider *provider;
+    GHashTable *zones;
+    GMutex lock;
+    guint report_source;
+};
+typedef struct netclock_s *netclock_t;
+
+int netclock_create(netclock_t *netclock, config_t config, logger_t logger, const char **error);
+
+void netclock_configure_pipeline(netclock_t netclock, GstElement *pipeline);
+
+void netclock_configure_rtpbin(netclock_t netclock, GstElement *rtpbin);
+
+void netclock_watch(netclock_t netclock, GstElement *jitterbuffer, const char *zone);
+
+void netclock_ref(netclock_t netclock);
+
+void netclock_unref(netclock_t netclock);
+
+#endif
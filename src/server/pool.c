@@ -0,0 +1,336 @@
+#include "pool.h"
+
+// packets held for the whole jitterbuffer latency, twice over for the
+// ones in flight around it, and never fewer than this
+#define POOL_MIN_BLOCKS 64
+#define POOL_MAX_BLOCKS 16384
+
+#define POOL_MEMORY_TYPE "SoundSystemPool"
+
+typedef struct
+{
+    GstAllocator parent;
+    pool_t pool;
+} PoolAllocator;
+
+typedef struct
+{
+    GstAllocatorClass parent_class;
+} PoolAllocatorClass;
+
+static GstMemory *pool_alloc(GstAllocator *allocator, gsize size, GstAllocationParams *params);
+
+static void pool_free(GstAllocator *allocator, GstMemory *memory);
+
+static gpointer pool_map(GstMemory *memory, gsize maxsize, GstMapFlags flags);
+
+static void pool_unmap(GstMemory *memory);
+
+static GstMemory *pool_share(GstMemory *memory, gssize offset, gssize size);
+
+static GstMemory *pool_copy(GstMemory *memory, gssize offset, gssize size);
+
+static pool_memory_t pool_take(pool_t pool, pool_memory_t *list);
+
+static GstPadProbeReturn pool_query(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static void pool_destroy(pool_t pool);
+
+G_DEFINE_TYPE(PoolAllocator, pool_allocator, GST_TYPE_ALLOCATOR)
+
+int pool_create(pool_t *pool, device_t device, const char **error)
+{
+    int status;
+    pool_t new_pool;
+    guint64 blocks;
+    guint index;
+
+    status = STATUS_OK;
+    new_pool = NULL;
+
+    IF_THROW(pool == NULL, "pool_create: null pool")
+    IF_THROW(device == NULL, "pool_create: null device")
+
+    new_pool = calloc(1, sizeof(struct pool_s));
+    IF_THROW(new_pool == NULL, "pool_create: failed to allocate pool")
+
+    new_pool->ref = 1;
+    g_mutex_init(&new_pool->lock);
+
+    // adaptive latency can grow up to its maximum, a mixing zone receives
+    // that many sessions at once
+    blocks = (guint64)device->packet_rate * (device->adaptive_latency ? device->latency_max : device->latency) * 2 / 1000;
+    blocks = blocks * MAX(device->mix, 1) + POOL_MIN_BLOCKS;
+    new_pool->nblocks = (guint)MIN(blocks, POOL_MAX_BLOCKS);
+
+    // touched once here so the first packets do not fault the pages in
+    IF_THROW(posix_memalign((void **)&new_pool->arena, 64, (size_t)new_pool->nblocks * POOL_BLOCK_SIZE) != 0,
+             "pool_create: failed to allocate arena")
+    memset(new_pool->arena, 0, (size_t)new_pool->nblocks * POOL_BLOCK_SIZE);
+
+    new_pool->blocks = calloc(new_pool->nblocks, sizeof(struct pool_memory_s));
+    IF_THROW(new_pool->blocks == NULL, "pool_create: failed to allocate blocks")
+    new_pool->headers = calloc(new_pool->nblocks, sizeof(struct pool_memory_s));
+    IF_THROW(new_pool->headers == NULL, "pool_create: failed to allocate headers")
+
+    for (index = 0; index < new_pool->nblocks; index++)
+    {
+        new_pool->blocks[index].kind = POOL_MEMORY_BLOCK;
+        new_pool->blocks[index].data = new_pool->arena + (size_t)index * POOL_BLOCK_SIZE;
+        new_pool->blocks[index].next = new_pool->free_blocks;
+        new_pool->free_blocks = new_pool->blocks + index;
+        new_pool->headers[index].kind = POOL_MEMORY_HEADER;
+        new_pool->headers[index].next = new_pool->free_headers;
+        new_pool->free_headers = new_pool->headers + index;
+    }
+
+    new_pool->allocator = g_object_new(pool_allocator_get_type(), NULL);
+    IF_THROW(new_pool->allocator == NULL, "pool_create: failed to allocate allocator")
+    gst_object_ref_sink(new_pool->allocator);
+    ((PoolAllocator *)new_pool->allocator)->pool = new_pool;
+
+    *pool = new_pool;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_pool, pool_destroy(new_pool))
+done:
+    return status;
+}
+
+void pool_watch_source(pool_t pool, GstElement *source)
+{
+    GstPad *pad;
+
+    pad = gst_element_get_static_pad(source, "src");
+    if (pad == NULL)
+    {
+        return;
+    }
+
+    pool_ref(pool);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, pool_query, pool, (GDestroyNotify)pool_unref);
+    gst_object_unref(pad);
+}
+
+void pool_ref(pool_t pool)
+{
+    // every memory handed out holds one, the arena outlives the endpoint
+    // until the last packet is released
+    g_atomic_int_inc(&pool->ref);
+}
+
+void pool_unref(pool_t pool)
+{
+    assert(pool != NULL);
+    if (g_atomic_int_dec_and_test(&pool->ref))
+    {
+        pool_destroy(pool);
+    }
+}
+
+void pool_allocator_class_init(PoolAllocatorClass *klass)
+{
+    GstAllocatorClass *allocator_class;
+
+    allocator_class = GST_ALLOCATOR_CLASS(klass);
+    allocator_class->alloc = pool_alloc;
+    allocator_class->free = pool_free;
+}
+
+void pool_allocator_init(PoolAllocator *allocator)
+{
+    GstAllocator *base;
+
+    base = GST_ALLOCATOR_CAST(allocator);
+    base->mem_type = POOL_MEMORY_TYPE;
+    base->mem_map = pool_map;
+    base->mem_unmap = pool_unmap;
+    base->mem_share = pool_share;
+    base->mem_copy = pool_copy;
+}
+
+GstMemory *pool_alloc(GstAllocator *allocator, gsize size, GstAllocationParams *params)
+{
+    pool_t pool;
+    pool_memory_t memory;
+    gsize align;
+    gsize maxsize;
+    gsize shift;
+
+    pool = ((PoolAllocator *)allocator)->pool;
+    align = params->align | gst_memory_alignment;
+    maxsize = size + params->prefix + params->padding + align;
+
+    // larger requests are the 64k datagram udpsrc keeps for oversized
+    // packets, allocated once per source
+    memory = maxsize <= POOL_BLOCK_SIZE ? pool_take(pool, &pool->free_blocks) : NULL;
+    if (memory != NULL)
+    {
+        maxsize = POOL_BLOCK_SIZE;
+        atomic_fetch_add(&pool->allocations, 1);
+        atomic_fetch_add(&pool->in_use, 1);
+    }
+    else
+    {
+        memory = malloc(sizeof(struct pool_memory_s) + maxsize);
+        if (memory == NULL)
+        {
+            return NULL;
+        }
+        memory->kind = POOL_MEMORY_HEAP;
+        memory->data = (guint8 *)(memory + 1);
+        atomic_fetch_add(&pool->heap_allocations, 1);
+    }
+
+    shift = ((guintptr)memory->data & align) != 0 ? (align + 1) - ((guintptr)memory->data & align) : 0;
+    memory->data += shift;
+    gst_memory_init(GST_MEMORY_CAST(memory), params->flags, allocator, NULL, maxsize - shift, align, params->prefix, size);
+    if (params->prefix > 0 && (params->flags & GST_MEMORY_FLAG_ZERO_PREFIXED))
+    {
+        memset(memory->data, 0, params->prefix);
+    }
+    if (params->padding > 0 && (params->flags & GST_MEMORY_FLAG_ZERO_PADDED))
+    {
+        memset(memory->data + params->prefix + size, 0, maxsize - shift - params->prefix - size);
+    }
+
+    pool_ref(pool);
+    return GST_MEMORY_CAST(memory);
+}
+
+void pool_free(GstAllocator *allocator, GstMemory *memory)
+{
+    pool_t pool;
+    pool_memory_t pool_memory;
+
+    pool = ((PoolAllocator *)allocator)->pool;
+    pool_memory = (pool_memory_t)memory;
+
+    switch (pool_memory->kind)
+    {
+    case POOL_MEMORY_BLOCK:
+        pool_memory->data = pool->arena + (size_t)(pool_memory - pool->blocks) * POOL_BLOCK_SIZE;
+        atomic_fetch_sub(&pool->in_use, 1);
+        g_mutex_lock(&pool->lock);
+        pool_memory->next = pool->free_blocks;
+        pool->free_blocks = pool_memory;
+        g_mutex_unlock(&pool->lock);
+        break;
+    case POOL_MEMORY_HEADER:
+        g_mutex_lock(&pool->lock);
+        pool_memory->next = pool->free_headers;
+        pool->free_headers = pool_memory;
+        g_mutex_unlock(&pool->lock);
+        break;
+    default:
+        free(pool_memory);
+        break;
+    }
+
+    pool_unref(pool);
+}
+
+gpointer pool_map(GstMemory *memory, gsize maxsize, GstMapFlags flags)
+{
+    return ((pool_memory_t)memory)->data;
+}
+
+void pool_unmap(GstMemory *memory)
+{
+}
+
+GstMemory *pool_share(GstMemory *memory, gssize offset, gssize size)
+{
+    pool_t pool;
+    pool_memory_t share;
+    GstMemory *parent;
+
+    pool = ((PoolAllocator *)memory->allocator)->pool;
+    parent = memory->parent != NULL ? memory->parent : memory;
+    if (size == -1)
+    {
+        size = memory->size - offset;
+    }
+
+    share = pool_take(pool, &pool->free_headers);
+    if (share == NULL)
+    {
+        share = malloc(sizeof(struct pool_memory_s));
+        if (share == NULL)
+        {
+            return NULL;
+        }
+        share->kind = POOL_MEMORY_HEAP;
+        atomic_fetch_add(&pool->heap_allocations, 1);
+    }
+    share->data = ((pool_memory_t)memory)->data;
+
+    gst_memory_init(GST_MEMORY_CAST(share), GST_MINI_OBJECT_FLAGS(parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY, memory->allocator, parent,
+                    memory->maxsize, memory->align, memory->offset + offset, size);
+    pool_ref(pool);
+    return GST_MEMORY_CAST(share);
+}
+
+GstMemory *pool_copy(GstMemory *memory, gssize offset, gssize size)
+{
+    GstMemory *copy;
+
+    if (size == -1)
+    {
+        size = memory->size > (gsize)offset ? memory->size - offset : 0;
+    }
+
+    copy = gst_allocator_alloc(memory->allocator, size, NULL);
+    if (copy != NULL)
+    {
+        memcpy(((pool_memory_t)copy)->data + copy->offset, ((pool_memory_t)memory)->data + memory->offset + offset, size);
+    }
+    return copy;
+}
+
+pool_memory_t pool_take(pool_t pool, pool_memory_t *list)
+{
+    pool_memory_t memory;
+
+    // held across two pointer moves, udpsrc takes and the decoder thread
+    // gives back
+    g_mutex_lock(&pool->lock);
+    memory = *list;
+    if (memory != NULL)
+    {
+        *list = memory->next;
+    }
+    g_mutex_unlock(&pool->lock);
+    return memory;
+}
+
+GstPadProbeReturn pool_query(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    pool_t pool;
+    GstQuery *query;
+    GstAllocationParams params;
+
+    pool = (pool_t)user_data;
+    query = GST_PAD_PROBE_INFO_QUERY(info);
+
+    // rtpbin answers no allocation query, the source takes the first
+    // allocator it is offered and the default one otherwise
+    if ((GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_PUSH) && GST_QUERY_TYPE(query) == GST_QUERY_ALLOCATION)
+    {
+        gst_allocation_params_init(&params);
+        gst_query_add_allocation_param(query, pool->allocator, &params);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void pool_destroy(pool_t pool)
+{
+    CLEANUP_FUNCTION(pool->allocator, gst_object_unref(pool->allocator))
+    CLEANUP(pool->blocks)
+    CLEANUP(pool->headers)
+    CLEANUP(pool->arena)
+    g_mutex_clear(&pool->lock);
+    free(pool);
+}
@@ -0,0 +1,54 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "config.h"
+#include <gst/gst.h>
+#include <stdatomic.h>
+
+// udpsrc reads each datagram into memory of its mtu, 1492 by default
+#define POOL_BLOCK_SIZE 2048
+
+enum pool_memory_kinds
+{
+    POOL_MEMORY_BLOCK,
+    POOL_MEMORY_HEADER,
+    POOL_MEMORY_HEAP
+};
+
+struct pool_memory_s
+{
+    GstMemory memory;
+    guint8 *data;
+    int kind;
+    struct pool_memory_s *next;
+};
+typedef struct pool_memory_s *pool_memory_t;
+
+struct pool_s
+{
+    int ref;
+    GMutex lock;
+    GstAllocator *allocator;
+    guint8 *arena;
+    guint nblocks;
+    // blocks carry packet data, headers are for the slices the depayloader
+    // shares out of them
+    pool_memory_t blocks;
+    pool_memory_t headers;
+    pool_memory_t free_blocks;
+    pool_memory_t free_headers;
+    atomic_uint_fast64_t allocations;
+    atomic_uint_fast64_t heap_allocations;
+    atomic_int in_use;
+};
+typedef struct pool_s *pool_t;
+
+int pool_create(pool_t *pool, device_t device, const char **error);
+
+void pool_watch_source(pool_t pool, GstElement *source);
+
+void pool_ref(pool_t pool);
+
+void pool_unref(pool_t pool);
+
+#endif
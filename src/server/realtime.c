@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include "realtime.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(realtime->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(realtime->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(realtime->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(realtime->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(realtime->logger, TRACE, FORMAT, __VA_ARGS__);
+
+// scheduling latency of every tracked thread is reported at this interval,
+// measured from the run queue wait the kernel accounts per thread
+#define REALTIME_REPORT_INTERVAL 10000
+
+struct realtime_thread_s
+{
+    char *name;
+    pid_t tid;
+    int policy;
+    struct sched_param param;
+    cpu_set_t cpus;
+    gboolean scheduled;
+    gboolean pinned;
+    guint64 wait;
+    guint64 slices;
+    guint64 reported_wait;
+    guint64 reported_slices;
+};
+typedef struct realtime_thread_s *realtime_thread_t;
+
+static gboolean realtime_schedule(realtime_t realtime, realtime_thread_t thread);
+
+static gboolean realtime_pin(realtime_t realtime, realtime_thread_t thread, long long cpus);
+
+static gboolean realtime_read_schedstat(pid_t tid, guint64 *wait, guint64 *slices);
+
+static gdouble realtime_latency_us(guint64 wait, guint64 slices);
+
+static gboolean realtime_report(gpointer user_data);
+
+static void realtime_thread_destroy(gpointer user_data);
+
+static void realtime_destroy(realtime_t realtime);
+
+int realtime_create(realtime_t *realtime, config_t config, logger_t logger, const char **error)
+{
+    int status;
+    realtime_t new_realtime;
+
+    status = STATUS_OK;
+    new_realtime = NULL;
+
+    IF_THROW(realtime == NULL, "realtime_create: null realtime")
+    IF_THROW(config == NULL, "realtime_create: null config")
+    IF_THROW(logger == NULL, "realtime_create: null logger")
+
+    new_realtime = calloc(1, sizeof(struct realtime_s));
+    IF_THROW(new_realtime == NULL, "realtime_create: failed to allocate realtime")
+
+    new_realtime->ref = 1;
+    new_realtime->logger = logger;
+    logger_ref(logger);
+    g_mutex_init(&new_realtime->lock);
+
+    new_realtime->policy = config->realtime_policy;
+    new_realtime->priority = config->realtime_priority;
+
+    new_realtime->threads = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, realtime_thread_destroy);
+    IF_THROW(new_realtime->threads == NULL, "realtime_create: failed to allocate threads")
+
+    // latency is tracked with or without a policy so the two can be compared
+    new_realtime->report_source = g_timeout_add(REALTIME_REPORT_INTERVAL, realtime_report, new_realtime);
+
+    if (new_realtime->policy != REALTIME_POLICY_NONE)
+    {
+        logger_infof(logger, "realtime_create: streaming threads at %s priority %d\n",
+                     new_realtime->policy == REALTIME_POLICY_FIFO ? "SCHED_FIFO" : "SCHED_RR", new_realtime->priority);
+    }
+
+    *realtime = new_realtime;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_realtime, realtime_destroy(new_realtime))
+done:
+    return status;
+}
+
+void realtime_enter(realtime_t realtime, const char *name, long long cpus)
+{
+    realtime_thread_t thread;
+
+    // called on the streaming thread itself as its task starts
+    thread = calloc(1, sizeof(struct realtime_thread_s));
+    if (thread == NULL)
+    {
+        return;
+    }
+    thread->name = g_strdup(name);
+    thread->tid = (pid_t)syscall(SYS_gettid);
+
+    // remember what the thread ran with, task pools hand it to other
+    // elements once this task leaves
+    pthread_getschedparam(pthread_self(), &thread->policy, &thread->param);
+    CPU_ZERO(&thread->cpus);
+    pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &thread->cpus);
+
+    thread->scheduled = realtime_schedule(realtime, thread);
+    thread->pinned = realtime_pin(realtime, thread, cpus);
+
+    realtime_read_schedstat(thread->tid, &thread->wait, &thread->slices);
+    thread->reported_wait = thread->wait;
+    thread->reported_slices = thread->slices;
+
+    DEBUGF("realtime_enter: %s (tid %d)%s%s\n", thread->name, thread->tid,
+           thread->scheduled ? " realtime" : "", thread->pinned ? " pinned" : "")
+
+    g_mutex_lock(&realtime->lock);
+    g_hash_table_replace(realtime->threads, GINT_TO_POINTER(thread->tid), thread);
+    g_mutex_unlock(&realtime->lock);
+}
+
+void realtime_leave(realtime_t realtime)
+{
+    realtime_thread_t thread;
+    pid_t tid;
+    guint64 wait;
+    guint64 slices;
+
+    tid = (pid_t)syscall(SYS_gettid);
+
+    g_mutex_lock(&realtime->lock);
+    thread = g_hash_table_lookup(realtime->threads, GINT_TO_POINTER(tid));
+    if (thread != NULL)
+    {
+        g_hash_table_steal(realtime->threads, GINT_TO_POINTER(tid));
+    }
+    g_mutex_unlock(&realtime->lock);
+
+    if (thread == NULL)
+    {
+        return;
+    }
+
+    if (thread->scheduled)
+    {
+        pthread_setschedparam(pthread_self(), thread->policy, &thread->param);
+    }
+    if (thread->pinned)
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &thread->cpus);
+    }
+
+    if (realtime_read_schedstat(tid, &wait, &slices) && slices > thread->slices)
+    {
+        INFOF("realtime_leave: %s (tid %d): scheduling latency %.1f us average over %" G_GUINT64_FORMAT " slices\n",
+              thread->name, tid, realtime_latency_us(wait - thread->wait, slices - thread->slices), slices - thread->slices)
+    }
+
+    realtime_thread_destroy(thread);
+}
+
+void realtime_ref(realtime_t realtime)
+{
+    g_atomic_int_inc(&realtime->ref);
+}
+
+void realtime_unref(realtime_t realtime)
+{
+    assert(realtime != NULL);
+    if (g_atomic_int_dec_and_test(&realtime->ref))
+    {
+        realtime_destroy(realtime);
+    }
+}
+
+gboolean realtime_schedule(realtime_t realtime, realtime_thread_t thread)
+{
+    struct sched_param param;
+    int result;
+
+    if (realtime->policy == REALTIME_POLICY_NONE)
+    {
+        return FALSE;
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = realtime->priority;
+    result = pthread_setschedparam(pthread_self(), realtime->policy == REALTIME_POLICY_FIFO ? SCHED_FIFO : SCHED_RR, &param);
+    if (result == 0)
+    {
+        return TRUE;
+    }
+
+    // without CAP_SYS_NICE or an rtprio limit every thread would fail the
+    // same way, say so once and keep streaming at the default policy
+    if (result == EPERM)
+    {
+        if (!g_atomic_int_get(&realtime->denied))
+        {
+            g_atomic_int_set(&realtime->denied, TRUE);
+            WARNF("realtime_schedule: %s: not permitted, streaming threads stay on the default policy (grant CAP_SYS_NICE or an rtprio limit)\n",
+                  thread->name)
+        }
+        return FALSE;
+    }
+
+    WARNF("realtime_schedule: %s: %s\n", thread->name, strerror(result))
+    return FALSE;
+}
+
+gboolean realtime_pin(realtime_t realtime, realtime_thread_t thread, long long cpus)
+{
+    cpu_set_t set;
+    int cpu;
+    int result;
+
+    if (cpus <= 0)
+    {
+        return FALSE;
+    }
+
+    CPU_ZERO(&set);
+    for (cpu = 0; cpu < (int)(sizeof(cpus) * 8) - 1; cpu++)
+    {
+        if (cpus & (1LL << cpu))
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+    if (result != 0)
+    {
+        WARNF("realtime_pin: %s: failed to pin to cpus 0x%llx: %s\n", thread->name, cpus, strerror(result))
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean realtime_read_schedstat(pid_t tid, guint64 *wait, guint64 *slices)
+{
+    char path[64];
+    FILE *file;
+    unsigned long long run;
+    unsigned long long queued;
+    unsigned long long count;
+    int fields;
+
+    // cpu time, time spent runnable waiting for a cpu, and timeslices run;
+    // missing when the kernel is built without CONFIG_SCHED_INFO
+    snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", tid);
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        *wait = *slices = 0;
+        return FALSE;
+    }
+    fields = fscanf(file, "%llu %llu %llu", &run, &queued, &count);
+    fclose(file);
+    if (fields != 3)
+    {
+        *wait = *slices = 0;
+        return FALSE;
+    }
+
+    *wait = queued;
+    *slices = count;
+    return TRUE;
+}
+
+gdouble realtime_latency_us(guint64 wait, guint64 slices)
+{
+    return slices > 0 ? (gdouble)wait / slices / 1000.0 : 0.0;
+}
+
+gboolean realtime_report(gpointer user_data)
+{
+    realtime_t realtime;
+    GHashTableIter iter;
+    gpointer value;
+    realtime_thread_t thread;
+    guint64 wait;
+    guint64 slices;
+
+    realtime = (realtime_t)user_data;
+
+    g_mutex_lock(&realtime->lock);
+    g_hash_table_iter_init(&iter, realtime->threads);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        thread = (realtime_thread_t)value;
+        if (!realtime_read_schedstat(thread->tid, &wait, &slices) || slices <= thread->reported_slices)
+        {
+            continue;
+        }
+        INFOF("realtime_report: %s (tid %d%s): scheduling latency %.1f us average over %" G_GUINT64_FORMAT " slices\n",
+              thread->name, thread->tid, thread->scheduled ? ", realtime" : "",
+              realtime_latency_us(wait - thread->reported_wait, slices - thread->reported_slices), slices - thread->reported_slices)
+        thread->reported_wait = wait;
+        thread->reported_slices = slices;
+    }
+    g_mutex_unlock(&realtime->lock);
+
+    return G_SOURCE_CONTINUE;
+}
+
+void realtime_thread_destroy(gpointer user_data)
+{
+    realtime_thread_t thread;
+
+    thread = (realtime_thread_t)user_data;
+    g_free(thread->name);
+    free(thread);
+}
+
+void realtime_destroy(realtime_t realtime)
+{
+    if (realtime->report_source != 0)
+    {
+        g_source_remove(realtime->report_source);
+    }
+    CLEANUP_FUNCTION(realtime->threads, g_hash_table_unref(realtime->threads))
+    g_mutex_clear(&realtime->lock);
+    CLEANUP_FUNCTION(realtime->logger, logger_unref(realtime->logger))
+    free(realtime);
+}
@@ -0,0 +1,31 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include "config.h"
+#include "logger.h"
+#include <glib.h>
+
+struct realtime_s
+{
+    int ref;
+    logger_t logger;
+    int policy;
+    int priority;
+    GHashTable *threads;
+    GMutex lock;
+    gboolean denied;
+    guint report_source;
+};
+typedef struct realtime_s *realtime_t;
+
+int realtime_create(realtime_t *realtime, config_t config, logger_t logger, const char **error);
+
+void realtime_enter(realtime_t realtime, const char *name, long long cpus);
+
+void realtime_leave(realtime_t realtime);
+
+void realtime_ref(realtime_t realtime);
+
+void realtime_unref(realtime_t realtime);
+
+#endif
@@ -1,12 +1,18 @@
 #include "server.h"
+#include "admission.h"
+#include "endpoint.h"
+#include "loop.h"
+#include "metrics.h"
+#include "mixer.h"
+#include "realtime.h"
 #include <glib-unix.h>
 #include <gst/rtsp-server/rtsp-server.h>
 
-#define ERRORF(FORMAT, ...) logger_errorf(server->logger, FORMAT, __VA_ARGS__);
-#define WARNF(FORMAT, ...) logger_warnf(server->logger, FORMAT, __VA_ARGS__);
-#define INFOF(FORMAT, ...) logger_infof(server->logger, FORMAT, __VA_ARGS__);
-#define DEBUGF(FORMAT, ...) logger_debugf(server->logger, FORMAT, __VA_ARGS__);
-#define TRACEF(FORMAT, ...) logger_tracef(server->logger, FORMAT, __VA_ARGS__);
+#define ERRORF(FORMAT, ...) LOGGER_SITEF(server->logger, ERROR, FORMAT, __VA_ARGS__);
+#define WARNF(FORMAT, ...) LOGGER_SITEF(server->logger, WARN, FORMAT, __VA_ARGS__);
+#define INFOF(FORMAT, ...) LOGGER_SITEF(server->logger, INFO, FORMAT, __VA_ARGS__);
+#define DEBUGF(FORMAT, ...) LOGGER_SITEF(server->logger, DEBUG, FORMAT, __VA_ARGS__);
+#define TRACEF(FORMAT, ...) LOGGER_SITEF(server->logger, TRACE, FORMAT, __VA_ARGS__);
 
 #define ERRORLN(STRING) logger_errorln(server->logger, STRING);
 #define WARNLN(STRING) logger_warnln(server->logger, STRING);
@@ -18,28 +24,73 @@ struct server_internal_s
 {
     GstRTSPServer *rtsp_server;
     GMainLoop *main_loop;
+    GSource *monitor;
+    GHashTable *loops;
+    GHashTable *endpoints;
+    netclock_t netclock;
+    realtime_t realtime;
+    metrics_t metrics;
+    admission_t admission;
 };
 typedef struct server_internal_s *server_internal_t;
 
 struct mount_device_user_data_s
 {
     server_t server;
-    GstRTSPMountPoints *mount_points;
+    config_t config;
     gboolean has_error;
     int index;
+    GHashTable *seen;
+    int added;
+    int repointed;
+    int unchanged;
 };
 typedef struct mount_device_user_data_s *mount_device_user_data_t;
 
+struct validate_device_s
+{
+    device_t device;
+    logger_t logger;
+    int status;
+    const char *error;
+    gint64 elapsed;
+};
+typedef struct validate_device_s *validate_device_t;
+
 static int server_internal_create(server_internal_t *server_internal, server_t server, config_t config, const char **error);
 
+static int server_validate(server_t server);
+
+static void server_collect_device(device_t device, void *user_data);
+
+static void server_validate_device(gpointer data, gpointer user_data);
+
 static void server_mount_device(device_t device, void *user_data);
 
+static loop_t server_loop(server_t server, device_t device);
+
+static GstRTSPMountPoints *server_mount_points(server_t server, loop_t loop);
+
+static void server_client_connected(GstRTSPServer *rtsp_server, GstRTSPClient *client, gpointer user_data);
+
+static GstRTSPStatusCode server_pre_announce(GstRTSPClient *client, GstRTSPContext *context, gpointer user_data);
+
+static void server_announce(GstRTSPClient *client, GstRTSPContext *context, gpointer user_data);
+
+static void server_send_message(GstRTSPClient *client, GstRTSPContext *context, GstRTSPMessage *message, gpointer user_data);
+
+static void server_reload_device(device_t device, void *user_data);
+
+static gboolean server_reload(gpointer user_data);
+
 static void server_internal_destroy(server_internal_t server_internal);
 
 static void server_destroy(server_t server);
 
 static void server_signal(void *user_data);
 
+static gboolean server_dump_traces(gpointer user_data);
+
 int server_create(server_t *server, config_t config, logger_t logger, const char **error)
 {
     int status;
@@ -83,15 +134,30 @@ void server_deploy(server_t server)
     INFOLN("server_deploy: starting deployment")
     server_internal_t server_internal;
     mount_device_user_data_t mount_device_user_data;
-    GstRTSPMountPoints *mount_points;
+    GHashTableIter iter;
+    gpointer value;
+    const char *error;
+    gint64 started;
+    gint64 validated;
+    gint64 mounted;
 
     server_internal = (server_internal_t)server->internal;
     mount_device_user_data = NULL;
-    mount_points = NULL;
+    started = g_get_monotonic_time();
 
     DEBUGLN("server_deploy: adding signal handlers")
     g_unix_signal_add(SIGINT, (GSourceFunc)server_signal, server);
     g_unix_signal_add(SIGTERM, (GSourceFunc)server_signal, server);
+    g_unix_signal_add(SIGHUP, server_reload, server);
+    g_unix_signal_add(SIGUSR1, server_dump_traces, server);
+
+    DEBUGLN("server_deploy: validating devices")
+    if (server_validate(server) != STATUS_OK)
+    {
+        ERRORLN("server_deploy: failed to validate device(s)")
+        goto error;
+    }
+    validated = g_get_monotonic_time();
 
     DEBUGLN("server_deploy: mounting devices")
 
@@ -102,15 +168,8 @@ void server_deploy(server_t server)
         goto error;
     }
 
-    mount_points = gst_rtsp_server_get_mount_points(server_internal->rtsp_server);
-    if (mount_points == NULL)
-    {
-        ERRORLN("server_deploy: failed to get mount_points from rtsp_server")
-        goto error;
-    }
-
     mount_device_user_data->server = server;
-    mount_device_user_data->mount_points = mount_points;
+    mount_device_user_data->config = server->config;
 
     config_iterate_devices(server->config, server_mount_device, mount_device_user_data);
     if (mount_device_user_data->has_error)
@@ -119,10 +178,25 @@ void server_deploy(server_t server)
         goto error;
     }
     free(mount_device_user_data);
-    g_object_unref(mount_points);
+    mount_device_user_data = NULL;
+    mounted = g_get_monotonic_time();
+
+    DEBUGLN("server_deploy: starting loops")
+    g_hash_table_iter_init(&iter, server_internal->loops);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        if (loop_start((loop_t)value, &error) != STATUS_OK)
+        {
+            ERRORF("server_deploy: %s\n", error)
+            goto error;
+        }
+    }
 
     DEBUGLN("server_deploy: attaching RTSP server")
     gst_rtsp_server_attach(server_internal->rtsp_server, NULL);
+    admission_start(server_internal->admission);
+    INFOF("server_deploy: ready in %.1f ms (validate %.1f ms, mount %.1f ms, loops %.1f ms)\n", (g_get_monotonic_time() - started) / 1e3,
+          (validated - started) / 1e3, (mounted - validated) / 1e3, (g_get_monotonic_time() - mounted) / 1e3)
 
     DEBUGLN("server_deploy: starting main loop")
     g_main_loop_run(server_internal->main_loop);
@@ -131,7 +205,6 @@ void server_deploy(server_t server)
 error:
     ERRORLN("server_deploy: error(s) occurred while deploying server")
     CLEANUP(mount_device_user_data)
-    CLEANUP_FUNCTION(mount_points, g_object_unref(mount_points))
 done:
     INFOLN("server_deploy: server exit")
 }
@@ -149,43 +222,441 @@ void server_unref(server_t server)
     }
 }
 
+int server_validate(server_t server)
+{
+    int status;
+    GPtrArray *devices;
+    GThreadPool *pool;
+    GError *pool_error;
+    validate_device_t validate_device;
+    guint index;
+    gint threads;
+
+    status = STATUS_OK;
+    pool_error = NULL;
+    devices = g_ptr_array_new_with_free_func(free);
+
+    config_iterate_devices(server->config, server_collect_device, devices);
+    for (index = 0; index < devices->len; index++)
+    {
+        validate_device = (validate_device_t)g_ptr_array_index(devices, index);
+        validate_device->logger = server->logger;
+    }
+
+    // parsing each pipeline once loads its plugins from the registry, which
+    // is most of the startup cost and safe to spread over every core
+    threads = MAX(1, MIN(g_get_num_processors(), (gint)devices->len));
+    pool = g_thread_pool_new(server_validate_device, NULL, threads, TRUE, &pool_error);
+    if (pool == NULL)
+    {
+        ERRORF("server_validate: %s\n", pool_error->message)
+        g_error_free(pool_error);
+        status = STATUS_ERROR;
+        goto done;
+    }
+    for (index = 0; index < devices->len; index++)
+    {
+        g_thread_pool_push(pool, g_ptr_array_index(devices, index), NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    for (index = 0; index < devices->len; index++)
+    {
+        validate_device = (validate_device_t)g_ptr_array_index(devices, index);
+        if (validate_device->status != STATUS_OK)
+        {
+            ERRORF("server_validate: /%s: %s\n", validate_device->device->endpoint, validate_device->error)
+            status = STATUS_ERROR;
+            continue;
+        }
+        DEBUGF("server_validate: /%s validated in %.1f ms\n", validate_device->device->endpoint, validate_device->elapsed / 1e3)
+    }
+    INFOF("server_validate: %u device(s) validated on %d thread(s)\n", devices->len, threads)
+
+done:
+    g_ptr_array_unref(devices);
+    return status;
+}
+
+void server_collect_device(device_t device, void *user_data)
+{
+    validate_device_t validate_device;
+
+    validate_device = calloc(1, sizeof(struct validate_device_s));
+    if (validate_device == NULL)
+    {
+        return;
+    }
+    validate_device->device = device;
+    g_ptr_array_add((GPtrArray *)user_data, validate_device);
+}
+
+void server_validate_device(gpointer data, gpointer user_data)
+{
+    validate_device_t validate_device;
+    gint64 started;
+
+    validate_device = (validate_device_t)data;
+    started = g_get_monotonic_time();
+    validate_device->status = endpoint_validate(validate_device->device, validate_device->logger, &validate_device->error);
+    validate_device->elapsed = g_get_monotonic_time() - started;
+}
+
 void server_mount_device(device_t device, void *user_data)
 {
     mount_device_user_data_t mount_device_user_data;
     server_t server;
-    GstRTSPMediaFactory *factory;
+    server_internal_t server_internal;
+    endpoint_t endpoint;
+    loop_t loop;
+    GstRTSPMountPoints *mount_points;
     char *launch_string;
-    char *endpoint_string;
+    const char *error;
+    int status;
 
     mount_device_user_data = (mount_device_user_data_t)user_data;
     server = mount_device_user_data->server;
-    
-    launch_string = g_strdup_printf("( decodebin name=depay0 ! pulsesink device=%s )", device->name);
-    endpoint_string = g_strdup_printf("/%s", device->endpoint);
-
-    factory = gst_rtsp_media_factory_new();
-    gst_rtsp_media_factory_set_transport_mode(factory, GST_RTSP_TRANSPORT_MODE_RECORD);
-    gst_rtsp_media_factory_set_launch(factory, launch_string);
-    gst_rtsp_media_factory_set_latency(factory,500);
-    gst_rtsp_mount_points_add_factory(mount_device_user_data->mount_points, endpoint_string, factory);
-    INFOF("mounted device \"%s\" at endpoint %s\n", device->name, endpoint_string)
+    server_internal = (server_internal_t)server->internal;
+
+    // the warm sink pipeline's bus watch follows the thread default context
+    loop = server_loop(server, device);
+    if (loop != NULL)
+    {
+        g_main_context_push_thread_default(loop->context);
+    }
+    status = endpoint_create(&endpoint, mount_device_user_data->config, device, server_internal->netclock, server_internal->realtime, server->logger, &error);
+    if (loop != NULL)
+    {
+        g_main_context_pop_thread_default(loop->context);
+    }
+    if (status != STATUS_OK)
+    {
+        ERRORF("server_mount_device: %s\n", error)
+        mount_device_user_data->has_error = TRUE;
+        return;
+    }
+
+    // mount points take ownership of their reference to the factory
+    g_object_set_data(G_OBJECT(endpoint->factory), ADMISSION_LIMIT_KEY, GINT_TO_POINTER(device->sessions));
+    mount_points = server_mount_points(server, loop);
+    g_object_ref(endpoint->factory);
+    gst_rtsp_mount_points_add_factory(mount_points, endpoint->path, endpoint->factory);
+    g_object_unref(mount_points);
+    g_hash_table_replace(server_internal->endpoints, endpoint->path, endpoint);
+    if (server_internal->metrics != NULL)
+    {
+        metrics_register(server_internal->metrics, endpoint->path, endpoint->stats);
+    }
+
+    launch_string = gst_rtsp_media_factory_get_launch(endpoint->factory);
+    if (device->type == DEVICE_TYPE_GROUP)
+    {
+        INFOF("mounted group of %d devices at endpoint %s\n", device->nmembers, endpoint->path)
+    }
+    else
+    {
+        INFOF("mounted device \"%s\" at endpoint %s\n", device->name, endpoint->path)
+    }
+    if (loop != NULL)
+    {
+        DEBUGF("loop: %s\n", loop->name)
+    }
     DEBUGF("launch string: %s\n", launch_string)
+    DEBUGF("latency: %d ms%s\n", device->latency, device->adaptive_latency ? " (adaptive)" : "")
+    DEBUGF("codec: %s (%s %d Hz %d ch)\n", device->codec != NULL ? device->codec : "decodebin", device->format, device->rate, device->channels)
     g_free(launch_string);
-    g_free(endpoint_string);
     mount_device_user_data->index++;
 }
 
+void server_client_connected(GstRTSPServer *rtsp_server, GstRTSPClient *client, gpointer user_data)
+{
+    server_t server;
+
+    server = (server_t)user_data;
+    g_signal_connect(client, "pre-announce-request", G_CALLBACK(server_pre_announce), user_data);
+    g_signal_connect(client, "announce-request", G_CALLBACK(server_announce), user_data);
+    g_signal_connect(client, "send-message", G_CALLBACK(server_send_message), user_data);
+    admission_watch_client(((server_internal_t)server->internal)->admission, client);
+}
+
+GstRTSPStatusCode server_pre_announce(GstRTSPClient *client, GstRTSPContext *context, gpointer user_data)
+{
+    server_t server;
+    GstRTSPMountPoints *mount_points;
+    GstRTSPMediaFactory *factory;
+    mixer_t mixer;
+    GstRTSPStatusCode code;
+    server_internal_t server_internal;
+
+    server = (server_t)user_data;
+    server_internal = (server_internal_t)server->internal;
+    code = GST_RTSP_STS_OK;
+    factory = NULL;
+
+    // runs on the thread of the loop serving the client, the factory and
+    // its mixer are reference counted so a reload cannot pull them away
+    mount_points = gst_rtsp_client_get_mount_points(client);
+    if (mount_points != NULL && context->uri != NULL)
+    {
+        factory = gst_rtsp_mount_points_match(mount_points, context->uri->abspath, NULL);
+    }
+
+    // decided before any media is built, a rejected client costs one reply.
+    // A preempted session is closed in here, so its mixer input is already
+    // back when the mixer is looked at
+    if (factory != NULL &&
+        !admission_admit(server_internal->admission, client, context->uri->abspath,
+                         GPOINTER_TO_INT(g_object_get_data(G_OBJECT(factory), ADMISSION_LIMIT_KEY))))
+    {
+        code = GST_RTSP_STS_SERVICE_UNAVAILABLE;
+    }
+
+    mixer = factory != NULL ? g_object_get_data(G_OBJECT(factory), MIXER_DATA_KEY) : NULL;
+    if (code == GST_RTSP_STS_OK && mixer != NULL && mixer_full(mixer))
+    {
+        WARNF("server_pre_announce: %s: all %d mixer inputs in use, rejecting session\n", context->uri->abspath, mixer->inputs)
+        code = GST_RTSP_STS_SERVICE_UNAVAILABLE;
+    }
+
+    CLEANUP_FUNCTION(factory, g_object_unref(factory))
+    CLEANUP_FUNCTION(mount_points, g_object_unref(mount_points))
+    return code;
+}
+
+void server_announce(GstRTSPClient *client, GstRTSPContext *context, gpointer user_data)
+{
+    server_t server;
+
+    server = (server_t)user_data;
+    if (context->media != NULL)
+    {
+        admission_bind(((server_internal_t)server->internal)->admission, client, context->media);
+    }
+}
+
+void server_send_message(GstRTSPClient *client, GstRTSPContext *context, GstRTSPMessage *message, gpointer user_data)
+{
+    server_t server;
+    GstRTSPStatusCode code;
+
+    server = (server_t)user_data;
+
+    // any ANNOUNCE that is not answered with 200, including the 503 from
+    // pre-announce, gives its place back
+    if (context == NULL || context->method != GST_RTSP_ANNOUNCE || gst_rtsp_message_get_type(message) != GST_RTSP_MESSAGE_RESPONSE)
+    {
+        return;
+    }
+    if (gst_rtsp_message_parse_response(message, &code, NULL, NULL) == GST_RTSP_OK && code != GST_RTSP_STS_OK)
+    {
+        admission_release(((server_internal_t)server->internal)->admission, client);
+    }
+}
+
+void server_reload_device(device_t device, void *user_data)
+{
+    mount_device_user_data_t mount_device_user_data;
+    server_t server;
+    server_internal_t server_internal;
+    endpoint_t endpoint;
+    loop_t loop;
+    GstRTSPMountPoints *mount_points;
+    char *path;
+    int index;
+
+    mount_device_user_data = (mount_device_user_data_t)user_data;
+    server = mount_device_user_data->server;
+    server_internal = (server_internal_t)server->internal;
+
+    path = g_strdup_printf("/%s", device->endpoint);
+    g_hash_table_add(mount_device_user_data->seen, path);
+
+    endpoint = g_hash_table_lookup(server_internal->endpoints, path);
+    if (endpoint != NULL && config_device_equal(endpoint->device, device))
+    {
+        // volume, eq and limiter apply to running sessions in place
+        if (endpoint_update_dsp(endpoint, device))
+        {
+            INFOF("server_reload: %s dsp updated\n", path)
+        }
+        else
+        {
+            DEBUGF("server_reload: %s unchanged\n", path)
+        }
+        mount_device_user_data->unchanged++;
+        return;
+    }
+
+    // a device moving between loops leaves its old server's mount points
+    loop = endpoint != NULL ? server_loop(server, endpoint->device) : NULL;
+    if (endpoint != NULL && loop != server_loop(server, device))
+    {
+        mount_points = server_mount_points(server, loop);
+        gst_rtsp_mount_points_remove_factory(mount_points, path);
+        g_object_unref(mount_points);
+    }
+
+    // mounting over an existing path swaps its factory, clients already
+    // streaming keep their media until they disconnect, the histograms
+    // collected so far go with the old endpoint. Its warm sink pipeline
+    // stops first, two cannot hold the same device and interaudio channel
+    if (endpoint != NULL)
+    {
+        endpoint_dump_trace(endpoint);
+        endpoint_stop_sink(endpoint);
+    }
+    index = mount_device_user_data->index;
+    server_mount_device(device, user_data);
+    if (mount_device_user_data->index == index)
+    {
+        return;
+    }
+    if (endpoint != NULL)
+    {
+        mount_device_user_data->repointed++;
+    }
+    else
+    {
+        mount_device_user_data->added++;
+    }
+}
+
+gboolean server_reload(gpointer user_data)
+{
+    server_t server;
+    server_internal_t server_internal;
+    config_t new_config;
+    struct mount_device_user_data_s mount_device_user_data;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    GstRTSPMountPoints *mount_points;
+    int removed;
+    int index;
+    const char *error;
+
+    server = (server_t)user_data;
+    server_internal = (server_internal_t)server->internal;
+    new_config = NULL;
+    memset(&mount_device_user_data, 0, sizeof(mount_device_user_data));
+    removed = 0;
+
+    INFOF("server_reload: reloading %s\n", server->config->path)
+
+    if (config_create(&new_config, &error) != STATUS_OK || config_load(new_config, server->config->path, &error) != STATUS_OK ||
+        config_validate(new_config, &error) != STATUS_OK)
+    {
+        ERRORF("server_reload: %s, keeping current config\n", error)
+        goto done;
+    }
+
+    // only the devices are diffed, everything else is bound at startup
+    if (strcmp(new_config->port, server->config->port) != 0 || new_config->clock_mode != server->config->clock_mode ||
+        new_config->stats_port != server->config->stats_port || new_config->realtime_policy != server->config->realtime_policy ||
+        new_config->realtime_priority != server->config->realtime_priority)
+    {
+        WARNLN("server_reload: port, clock, stats and realtime changes require a restart")
+    }
+    for (index = 0; index < new_config->nloops; index++)
+    {
+        if (g_hash_table_lookup(server_internal->loops, new_config->loops[index].name) == NULL)
+        {
+            WARNF("server_reload: loop %s is not running, its devices stay on the main loop until a restart\n", new_config->loops[index].name)
+        }
+    }
+
+    mount_device_user_data.server = server;
+    mount_device_user_data.config = new_config;
+    mount_device_user_data.seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    config_iterate_devices(new_config, server_reload_device, &mount_device_user_data);
+
+    g_hash_table_iter_init(&iter, server_internal->endpoints);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        if (g_hash_table_contains(mount_device_user_data.seen, key))
+        {
+            continue;
+        }
+        INFOF("unmounted endpoint %s\n", (const char *)key)
+        endpoint_dump_trace((endpoint_t)value);
+        mount_points = server_mount_points(server, server_loop(server, ((endpoint_t)value)->device));
+        gst_rtsp_mount_points_remove_factory(mount_points, key);
+        g_object_unref(mount_points);
+        if (server_internal->metrics != NULL)
+        {
+            metrics_unregister(server_internal->metrics, key);
+        }
+        g_hash_table_iter_remove(&iter);
+        removed++;
+    }
+
+    if (mount_device_user_data.has_error)
+    {
+        WARNLN("server_reload: some devices failed to mount and were left as before")
+    }
+
+    admission_update(server_internal->admission, new_config);
+
+    // endpoints still on the old config hold their own reference to it
+    config_unref(server->config);
+    server->config = new_config;
+    new_config = NULL;
+
+    INFOF("server_reload: %d added, %d re-pointed, %d removed, %d unchanged\n",
+          mount_device_user_data.added, mount_device_user_data.repointed, removed, mount_device_user_data.unchanged)
+
+done:
+    CLEANUP_FUNCTION(new_config, config_unref(new_config))
+    CLEANUP_FUNCTION(mount_device_user_data.seen, g_hash_table_unref(mount_device_user_data.seen))
+    return G_SOURCE_CONTINUE;
+}
+
+loop_t server_loop(server_t server, device_t device)
+{
+    server_internal_t server_internal;
+
+    server_internal = (server_internal_t)server->internal;
+    if (device->loop == NULL)
+    {
+        return NULL;
+    }
+    return g_hash_table_lookup(server_internal->loops, device->loop);
+}
+
+GstRTSPMountPoints *server_mount_points(server_t server, loop_t loop)
+{
+    server_internal_t server_internal;
+
+    server_internal = (server_internal_t)server->internal;
+    return gst_rtsp_server_get_mount_points(loop != NULL ? loop->rtsp_server : server_internal->rtsp_server);
+}
+
 int server_internal_create(server_internal_t *server_internal, server_t server, config_t config, const char **error)
 {
     int status;
     server_internal_t new_server_internal;
     GMainLoop *new_main_loop;
     GstRTSPServer *new_rtsp_server;
+    GHashTable *new_endpoints;
+    GHashTable *new_loops;
+    loop_t new_loop;
+    netclock_t new_netclock;
+    realtime_t new_realtime;
+    metrics_t new_metrics;
+    admission_t new_admission;
+    int index;
 
     status = STATUS_OK;
     new_server_internal = NULL;
     new_main_loop = NULL;
     new_rtsp_server = NULL;
+    new_endpoints = NULL;
+    new_loops = NULL;
+    new_netclock = NULL;
+    new_realtime = NULL;
+    new_metrics = NULL;
+    new_admission = NULL;
 
     // NOTE: skipping null throws for function args as they are currenty unreachable
 
@@ -198,10 +669,55 @@ int server_internal_create(server_internal_t *server_internal, server_t server,
     new_main_loop = g_main_loop_new(NULL, FALSE);
     IF_THROW(new_main_loop == NULL, "server_create: server_private_create: failed to allocate loop")
 
+    new_endpoints = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)endpoint_unref);
+    IF_THROW(new_endpoints == NULL, "server_create: server_private_create: failed to allocate endpoints")
+
+    new_loops = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)loop_unref);
+    IF_THROW(new_loops == NULL, "server_create: server_private_create: failed to allocate loops")
+
+    // zones on a loop of their own get their own server, context and thread
+    for (index = 0; index < config->nloops; index++)
+    {
+        if (loop_create(&new_loop, config->loops[index].name, config->loops[index].port, server->logger, error) != STATUS_OK)
+        {
+            goto error;
+        }
+        g_hash_table_replace(new_loops, new_loop->name, new_loop);
+        g_signal_connect(new_loop->rtsp_server, "client-connected", G_CALLBACK(server_client_connected), server);
+    }
+
+    if (config->clock_mode != CLOCK_MODE_NONE && netclock_create(&new_netclock, config, server->logger, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
+    if (realtime_create(&new_realtime, config, server->logger, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
+    if ((config->stats_port > 0 || config->stats_socket != NULL) && metrics_create(&new_metrics, config, server->logger, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
+    if (admission_create(&new_admission, config, server->logger, error) != STATUS_OK)
+    {
+        goto error;
+    }
+
     g_object_set(new_rtsp_server, "service", config->port, NULL);
+    g_signal_connect(new_rtsp_server, "client-connected", G_CALLBACK(server_client_connected), server);
 
     new_server_internal->rtsp_server = new_rtsp_server;
     new_server_internal->main_loop = new_main_loop;
+    new_server_internal->monitor = loop_monitor(NULL, "main", server->logger);
+    new_server_internal->loops = new_loops;
+    new_server_internal->endpoints = new_endpoints;
+    new_server_internal->netclock = new_netclock;
+    new_server_internal->realtime = new_realtime;
+    new_server_internal->metrics = new_metrics;
+    new_server_internal->admission = new_admission;
 
     *server_internal = new_server_internal;
 
@@ -210,6 +726,12 @@ error:
     CLEANUP(new_server_internal)
     CLEANUP_FUNCTION(new_rtsp_server, g_object_unref(new_rtsp_server))
     CLEANUP_FUNCTION(new_main_loop, g_main_loop_unref(new_main_loop))
+    CLEANUP_FUNCTION(new_endpoints, g_hash_table_unref(new_endpoints))
+    CLEANUP_FUNCTION(new_loops, g_hash_table_unref(new_loops))
+    CLEANUP_FUNCTION(new_netclock, netclock_unref(new_netclock))
+    CLEANUP_FUNCTION(new_realtime, realtime_unref(new_realtime))
+    CLEANUP_FUNCTION(new_metrics, metrics_unref(new_metrics))
+    CLEANUP_FUNCTION(new_admission, admission_unref(new_admission))
     status = STATUS_ERROR;
 done:
     return status;
@@ -217,6 +739,18 @@ done:
 
 void server_internal_destroy(server_internal_t server_internal)
 {
+    // stop the loop threads before the endpoints their clients use go away
+    g_hash_table_unref(server_internal->loops);
+    g_hash_table_unref(server_internal->endpoints);
+    if (server_internal->monitor != NULL)
+    {
+        g_source_destroy(server_internal->monitor);
+        g_source_unref(server_internal->monitor);
+    }
+    CLEANUP_FUNCTION(server_internal->netclock, netclock_unref(server_internal->netclock))
+    CLEANUP_FUNCTION(server_internal->realtime, realtime_unref(server_internal->realtime))
+    CLEANUP_FUNCTION(server_internal->metrics, metrics_unref(server_internal->metrics))
+    CLEANUP_FUNCTION(server_internal->admission, admission_unref(server_internal->admission))
     g_main_loop_unref(server_internal->main_loop);
     g_object_unref(server_internal->rtsp_server);
     free(server_internal);
@@ -235,5 +769,25 @@ void server_signal(void *user_data)
     server_t server;
     server = (server_t)user_data;
     INFOLN("server_signal: signal received");
+    server_dump_traces(server);
     g_main_loop_quit(((server_internal_t)server->internal)->main_loop);
-}
\ No newline at end of file
+}
+
+gboolean server_dump_traces(gpointer user_data)
+{
+    server_t server;
+    server_internal_t server_internal;
+    GHashTableIter iter;
+    gpointer value;
+
+    server = (server_t)user_data;
+    server_internal = (server_internal_t)server->internal;
+
+    // only endpoints with tracing enabled have anything to report
+    g_hash_table_iter_init(&iter, server_internal->endpoints);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        endpoint_dump_trace((endpoint_t)value);
+    }
+    return G_SOURCE_CONTINUE;
+}
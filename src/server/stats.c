@@ -0,0 +1,422 @@
+#include "stats.h"
+
+struct stats_jitter_s
+{
+    GstElement *jitterbuffer;
+    guint64 pushed;
+    guint64 lost;
+    guint64 late;
+    guint64 duplicates;
+    guint64 rtx_requested;
+    guint64 rtx_recovered;
+};
+typedef struct stats_jitter_s *stats_jitter_t;
+
+struct stats_sink_s
+{
+    stats_t stats;
+    gboolean late;
+};
+typedef struct stats_sink_s *stats_sink_t;
+
+struct stats_decoder_s
+{
+    stats_t stats;
+    gint64 entered;
+};
+typedef struct stats_decoder_s *stats_decoder_t;
+
+static void stats_media_unprepared(GstRTSPMedia *media, gpointer user_data);
+
+static void stats_closure_notify(gpointer data, GClosure *closure);
+
+static void stats_jitterbuffer_removed(GstBin *bin, GstElement *element, gpointer user_data);
+
+static void stats_retire_jitterbuffer(stats_t stats, guint index);
+
+static void stats_sample_jitterbuffer(stats_jitter_t jitter, stats_snapshot_t snapshot);
+
+static GstPadProbeReturn stats_sink_buffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static GstPadProbeReturn stats_decoder_enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static GstPadProbeReturn stats_decoder_leave(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static void stats_sink_destroy(gpointer user_data);
+
+static void stats_decoder_destroy(gpointer user_data);
+
+static void stats_jitter_destroy(gpointer user_data);
+
+static void stats_destroy(stats_t stats);
+
+int stats_create(stats_t *stats, const char **error)
+{
+    int status;
+    stats_t new_stats;
+
+    status = STATUS_OK;
+    new_stats = NULL;
+
+    IF_THROW(stats == NULL, "stats_create: null stats")
+
+    new_stats = calloc(1, sizeof(struct stats_s));
+    IF_THROW(new_stats == NULL, "stats_create: failed to allocate stats")
+
+    new_stats->ref = 1;
+    g_mutex_init(&new_stats->lock);
+    new_stats->jitterbuffers = g_ptr_array_new_with_free_func(stats_jitter_destroy);
+    IF_THROW(new_stats->jitterbuffers == NULL, "stats_create: failed to allocate jitterbuffers")
+
+    *stats = new_stats;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_stats, stats_destroy(new_stats))
+done:
+    return status;
+}
+
+void stats_watch_media(stats_t stats, GstRTSPMedia *media)
+{
+    atomic_fetch_add(&stats->sessions_total, 1);
+    atomic_fetch_add(&stats->sessions_active, 1);
+
+    stats_ref(stats);
+    g_signal_connect_data(media, "unprepared", G_CALLBACK(stats_media_unprepared), stats, stats_closure_notify, 0);
+}
+
+void stats_watch_jitterbuffer(stats_t stats, GstElement *jitterbuffer)
+{
+    stats_jitter_t jitter;
+    GstObject *parent;
+
+    jitter = calloc(1, sizeof(struct stats_jitter_s));
+    if (jitter == NULL)
+    {
+        return;
+    }
+    jitter->jitterbuffer = gst_object_ref(jitterbuffer);
+
+    g_mutex_lock(&stats->lock);
+    g_ptr_array_add(stats->jitterbuffers, jitter);
+    g_mutex_unlock(&stats->lock);
+
+    // rtpbin removes the jitterbuffer with its session, or when it is torn
+    // down with the media, whether or not anyone ever scrapes
+    parent = gst_object_get_parent(GST_OBJECT(jitterbuffer));
+    if (parent != NULL)
+    {
+        stats_ref(stats);
+        g_signal_connect_data(parent, "element-removed", G_CALLBACK(stats_jitterbuffer_removed), stats, stats_closure_notify, 0);
+        gst_object_unref(parent);
+    }
+}
+
+void stats_watch_sink(stats_t stats, GstElement *sink)
+{
+    GstPad *pad;
+    stats_sink_t probe;
+
+    pad = gst_element_get_static_pad(sink, "sink");
+    probe = calloc(1, sizeof(struct stats_sink_s));
+    if (pad != NULL && probe != NULL)
+    {
+        stats_ref(stats);
+        probe->stats = stats;
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, stats_sink_buffer, probe, stats_sink_destroy);
+        probe = NULL;
+    }
+
+    CLEANUP(probe)
+    CLEANUP_FUNCTION(pad, gst_object_unref(pad))
+}
+
+void stats_watch_decoder(stats_t stats, GstElement *decoder)
+{
+    GstPad *sink_pad;
+    GstPad *src_pad;
+    stats_decoder_t probe;
+
+    sink_pad = gst_element_get_static_pad(decoder, "sink");
+    src_pad = gst_element_get_static_pad(decoder, "src");
+    probe = calloc(1, sizeof(struct stats_decoder_s));
+    if (sink_pad != NULL && src_pad != NULL && probe != NULL)
+    {
+        // both probes share the timestamp, the decoder owns it so it
+        // outlives either pad
+        stats_ref(stats);
+        probe->stats = stats;
+        g_object_set_data_full(G_OBJECT(decoder), "stats-decoder", probe, stats_decoder_destroy);
+        gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, stats_decoder_enter, probe, NULL);
+        gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, stats_decoder_leave, probe, NULL);
+        probe = NULL;
+    }
+
+    CLEANUP(probe)
+    CLEANUP_FUNCTION(sink_pad, gst_object_unref(sink_pad))
+    CLEANUP_FUNCTION(src_pad, gst_object_unref(src_pad))
+}
+
+void stats_watch_pool(stats_t stats, pool_t pool)
+{
+    pool_ref(pool);
+    stats->pool = pool;
+}
+
+void stats_snapshot(stats_t stats, stats_snapshot_t snapshot)
+{
+    stats_jitter_t jitter;
+    GstObject *parent;
+    guint index;
+
+    memset(snapshot, 0, sizeof(struct stats_snapshot_s));
+
+    snapshot->sessions_active = atomic_load(&stats->sessions_active);
+    snapshot->sessions_total = atomic_load(&stats->sessions_total);
+    snapshot->sink_buffers = atomic_load(&stats->sink_buffers);
+    snapshot->sink_underruns = atomic_load(&stats->sink_underruns);
+    snapshot->decode_buffers = atomic_load(&stats->decode_buffers);
+    snapshot->decode_seconds = (double)atomic_load(&stats->decode_ns) / GST_SECOND;
+    snapshot->idle_suspends = atomic_load(&stats->idle_suspends);
+    snapshot->idle_resumes = atomic_load(&stats->idle_resumes);
+    snapshot->idle_resume_seconds = (double)atomic_load(&stats->idle_resume_ns) / GST_SECOND;
+    snapshot->idle_resume_max_seconds = (double)atomic_load(&stats->idle_resume_max_ns) / GST_SECOND;
+    snapshot->idle_suspended = atomic_load(&stats->idle_suspended);
+    if (stats->pool != NULL)
+    {
+        snapshot->pool_allocations = atomic_load(&stats->pool->allocations);
+        snapshot->pool_heap_allocations = atomic_load(&stats->pool->heap_allocations);
+        snapshot->pool_in_use = atomic_load(&stats->pool->in_use);
+    }
+
+    g_mutex_lock(&stats->lock);
+    index = 0;
+    while (index < stats->jitterbuffers->len)
+    {
+        jitter = g_ptr_array_index(stats->jitterbuffers, index);
+
+        // one that left its bin unnoticed is retired here instead
+        parent = gst_object_get_parent(GST_OBJECT(jitter->jitterbuffer));
+        if (parent == NULL)
+        {
+            stats_retire_jitterbuffer(stats, index);
+            continue;
+        }
+        gst_object_unref(parent);
+
+        stats_sample_jitterbuffer(jitter, snapshot);
+        index++;
+    }
+    snapshot->packets_received += stats->retired_pushed;
+    snapshot->packets_lost += stats->retired_lost;
+    snapshot->packets_late += stats->retired_late;
+    snapshot->packets_duplicate += stats->retired_duplicates;
+    snapshot->rtx_requested += stats->retired_rtx_requested;
+    snapshot->rtx_recovered += stats->retired_rtx_recovered;
+    g_mutex_unlock(&stats->lock);
+}
+
+void stats_ref(stats_t stats)
+{
+    g_atomic_int_inc(&stats->ref);
+}
+
+void stats_unref(stats_t stats)
+{
+    assert(stats != NULL);
+    if (g_atomic_int_dec_and_test(&stats->ref))
+    {
+        stats_destroy(stats);
+    }
+}
+
+void stats_media_unprepared(GstRTSPMedia *media, gpointer user_data)
+{
+    atomic_fetch_sub(&((stats_t)user_data)->sessions_active, 1);
+}
+
+void stats_closure_notify(gpointer data, GClosure *closure)
+{
+    stats_unref((stats_t)data);
+}
+
+void stats_jitterbuffer_removed(GstBin *bin, GstElement *element, gpointer user_data)
+{
+    stats_t stats;
+    stats_jitter_t jitter;
+    guint index;
+
+    stats = (stats_t)user_data;
+
+    g_mutex_lock(&stats->lock);
+    for (index = 0; index < stats->jitterbuffers->len; index++)
+    {
+        jitter = g_ptr_array_index(stats->jitterbuffers, index);
+        if (jitter->jitterbuffer == element)
+        {
+            stats_retire_jitterbuffer(stats, index);
+            break;
+        }
+    }
+    g_mutex_unlock(&stats->lock);
+}
+
+void stats_retire_jitterbuffer(stats_t stats, guint index)
+{
+    stats_jitter_t jitter;
+    struct stats_snapshot_s last;
+
+    // keep what it counted up to the end, not just up to the last scrape,
+    // so the totals stay monotonic and complete
+    jitter = g_ptr_array_index(stats->jitterbuffers, index);
+    memset(&last, 0, sizeof(struct stats_snapshot_s));
+    stats_sample_jitterbuffer(jitter, &last);
+    stats->retired_pushed += jitter->pushed;
+    stats->retired_lost += jitter->lost;
+    stats->retired_late += jitter->late;
+    stats->retired_duplicates += jitter->duplicates;
+    stats->retired_rtx_requested += jitter->rtx_requested;
+    stats->retired_rtx_recovered += jitter->rtx_recovered;
+    g_ptr_array_remove_index_fast(stats->jitterbuffers, index);
+}
+
+void stats_sample_jitterbuffer(stats_jitter_t jitter, stats_snapshot_t snapshot)
+{
+    GstStructure *structure;
+    guint64 avg_jitter;
+    guint latency;
+    gint percent;
+
+    structure = NULL;
+    avg_jitter = 0;
+    latency = 0;
+    percent = 0;
+
+    g_object_get(jitter->jitterbuffer, "stats", &structure, "latency", &latency, "percent", &percent, NULL);
+    if (structure != NULL)
+    {
+        gst_structure_get_uint64(structure, "num-pushed", &jitter->pushed);
+        gst_structure_get_uint64(structure, "num-lost", &jitter->lost);
+        // a retransmission arriving after its deadline counts as late
+        gst_structure_get_uint64(structure, "num-late", &jitter->late);
+        gst_structure_get_uint64(structure, "num-duplicates", &jitter->duplicates);
+        gst_structure_get_uint64(structure, "avg-jitter", &avg_jitter);
+        gst_structure_get_uint64(structure, "rtx-count", &jitter->rtx_requested);
+        gst_structure_get_uint64(structure, "rtx-success-count", &jitter->rtx_recovered);
+        gst_structure_free(structure);
+    }
+
+    snapshot->packets_received += jitter->pushed;
+    snapshot->packets_lost += jitter->lost;
+    snapshot->packets_late += jitter->late;
+    snapshot->packets_duplicate += jitter->duplicates;
+    snapshot->rtx_requested += jitter->rtx_requested;
+    snapshot->rtx_recovered += jitter->rtx_recovered;
+
+    // gauges report the worst live session of the endpoint
+    snapshot->jitter_seconds = MAX(snapshot->jitter_seconds, (double)avg_jitter / GST_SECOND);
+    snapshot->jitterbuffer_fill_ratio = MAX(snapshot->jitterbuffer_fill_ratio, percent / 100.0);
+    snapshot->jitterbuffer_latency_seconds = MAX(snapshot->jitterbuffer_latency_seconds, latency / 1000.0);
+}
+
+GstPadProbeReturn stats_sink_buffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    stats_sink_t probe;
+    GstBuffer *buffer;
+    GstElement *sink;
+    GstClock *clock;
+    GstEvent *event;
+    const GstSegment *segment;
+    GstClockTime running_time;
+    gboolean late;
+
+    probe = (stats_sink_t)user_data;
+    buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    atomic_fetch_add(&probe->stats->sink_buffers, 1);
+
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    sink = GST_PAD_PARENT(pad);
+    clock = gst_element_get_clock(sink);
+    event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+    if (clock != NULL && event != NULL)
+    {
+        // a buffer reaching the sink after its render time means the device
+        // already ran dry, count each run of late buffers once
+        gst_event_parse_segment(event, &segment);
+        running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+        late = GST_CLOCK_TIME_IS_VALID(running_time) &&
+               gst_element_get_base_time(sink) + running_time < gst_clock_get_time(clock);
+        if (late && !probe->late)
+        {
+            atomic_fetch_add(&probe->stats->sink_underruns, 1);
+        }
+        probe->late = late;
+    }
+
+    CLEANUP_FUNCTION(event, gst_event_unref(event))
+    CLEANUP_FUNCTION(clock, gst_object_unref(clock))
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn stats_decoder_enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    ((stats_decoder_t)user_data)->entered = g_get_monotonic_time();
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn stats_decoder_leave(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    stats_decoder_t probe;
+
+    // decoders push from inside their chain function, so the first output
+    // after an input closes the decode of that input
+    probe = (stats_decoder_t)user_data;
+    if (probe->entered != 0)
+    {
+        atomic_fetch_add(&probe->stats->decode_ns, (g_get_monotonic_time() - probe->entered) * GST_USECOND);
+        atomic_fetch_add(&probe->stats->decode_buffers, 1);
+        probe->entered = 0;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void stats_sink_destroy(gpointer user_data)
+{
+    stats_sink_t probe;
+
+    probe = (stats_sink_t)user_data;
+    stats_unref(probe->stats);
+    free(probe);
+}
+
+void stats_decoder_destroy(gpointer user_data)
+{
+    stats_decoder_t probe;
+
+    probe = (stats_decoder_t)user_data;
+    stats_unref(probe->stats);
+    free(probe);
+}
+
+void stats_jitter_destroy(gpointer user_data)
+{
+    stats_jitter_t jitter;
+
+    jitter = (stats_jitter_t)user_data;
+    gst_object_unref(jitter->jitterbuffer);
+    free(jitter);
+}
+
+void stats_destroy(stats_t stats)
+{
+    CLEANUP_FUNCTION(stats->jitterbuffers, g_ptr_array_unref(stats->jitterbuffers))
+    CLEANUP_FUNCTION(stats->pool, pool_unref(stats->pool))
+    g_mutex_clear(&stats->lock);
+    free(stats);
+}
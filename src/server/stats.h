@@ -0,0 +1,82 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+#include "pool.h"
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include <stdatomic.h>
+
+struct stats_snapshot_s
+{
+    double sessions_active;
+    double sessions_total;
+    double packets_received;
+    double packets_lost;
+    double packets_late;
+    double packets_duplicate;
+    double rtx_requested;
+    double rtx_recovered;
+    double jitter_seconds;
+    double jitterbuffer_fill_ratio;
+    double jitterbuffer_latency_seconds;
+    double sink_buffers;
+    double sink_underruns;
+    double decode_buffers;
+    double decode_seconds;
+    double pool_allocations;
+    double pool_heap_allocations;
+    double pool_in_use;
+    double idle_suspends;
+    double idle_resumes;
+    double idle_resume_seconds;
+    double idle_resume_max_seconds;
+    double idle_suspended;
+};
+typedef struct stats_snapshot_s *stats_snapshot_t;
+
+struct stats_s
+{
+    int ref;
+    GMutex lock;
+    GPtrArray *jitterbuffers;
+    guint64 retired_pushed;
+    guint64 retired_lost;
+    guint64 retired_late;
+    guint64 retired_duplicates;
+    guint64 retired_rtx_requested;
+    guint64 retired_rtx_recovered;
+    atomic_int sessions_active;
+    atomic_uint_fast64_t sessions_total;
+    atomic_uint_fast64_t sink_buffers;
+    atomic_uint_fast64_t sink_underruns;
+    atomic_uint_fast64_t decode_buffers;
+    atomic_uint_fast64_t decode_ns;
+    atomic_uint_fast64_t idle_suspends;
+    atomic_uint_fast64_t idle_resumes;
+    atomic_uint_fast64_t idle_resume_ns;
+    atomic_uint_fast64_t idle_resume_max_ns;
+    atomic_int idle_suspended;
+    pool_t pool;
+};
+typedef struct stats_s *stats_t;
+
+int stats_create(stats_t *stats, const char **error);
+
+void stats_watch_media(stats_t stats, GstRTSPMedia *media);
+
+void stats_watch_jitterbuffer(stats_t stats, GstElement *jitterbuffer);
+
+void stats_watch_sink(stats_t stats, GstElement *sink);
+
+void stats_watch_decoder(stats_t stats, GstElement *decoder);
+
+void stats_watch_pool(stats_t stats, pool_t pool);
+
+void stats_snapshot(stats_t stats, stats_snapshot_t snapshot);
+
+void stats_ref(stats_t stats);
+
+void stats_unref(stats_t stats);
+
+#endif
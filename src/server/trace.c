@@ -0,0 +1,495 @@
+#include "trace.h"
+#include <gst/base/gstbasesink.h>
+
+#define INFOF(FORMAT, ...) LOGGER_SITEF(logger, INFO, FORMAT, __VA_ARGS__);
+
+#define TRACE_PROBE_KEY "trace-probe"
+
+struct trace_entry_s
+{
+    GstClockTime pts;
+    gint64 time;
+    GThread *thread;
+};
+
+struct trace_probe_s
+{
+    trace_t trace;
+    trace_stage_t stage;
+    GstElement *element;
+    gboolean sink;
+    // the last buffers in, matched by timestamp against the ones going out
+    GMutex lock;
+    struct trace_entry_s entries[TRACE_RING];
+    guint next;
+    GstSegment segment;
+};
+typedef struct trace_probe_s *trace_probe_t;
+
+static trace_stage_t trace_stage(trace_t trace, GstElement *element);
+
+static gboolean trace_watch_pad(GstElement *element, GstPad *pad, gpointer user_data);
+
+static void trace_pad_added(GstElement *element, GstPad *pad, gpointer user_data);
+
+static GstPadProbeReturn trace_enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static GstPadProbeReturn trace_leave(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+static void trace_wait(trace_probe_t probe, GstClockTime pts);
+
+static void trace_record(trace_histogram_t histogram, guint64 elapsed_us);
+
+static void trace_dump_histogram(trace_t trace, trace_stage_t stage, int kind, logger_t logger);
+
+static double trace_bound_ms(int bucket);
+
+static void trace_bound_string(char *string, size_t size, int bucket);
+
+static void trace_probe_destroy(gpointer user_data);
+
+static void trace_stage_destroy(gpointer user_data);
+
+static void trace_destroy(trace_t trace);
+
+static const char *trace_kind_names[TRACE_KINDS] = {"process", "queue", "wait"};
+
+int trace_create(trace_t *trace, const char *path, const char **error)
+{
+    int status;
+    trace_t new_trace;
+
+    status = STATUS_OK;
+    new_trace = NULL;
+
+    IF_THROW(trace == NULL, "trace_create: null trace")
+    IF_THROW(path == NULL, "trace_create: null path")
+
+    new_trace = calloc(1, sizeof(struct trace_s));
+    IF_THROW(new_trace == NULL, "trace_create: failed to allocate trace")
+
+    new_trace->ref = 1;
+    g_mutex_init(&new_trace->lock);
+    new_trace->started = g_get_monotonic_time();
+    new_trace->path = g_strdup(path);
+    IF_THROW(new_trace->path == NULL, "trace_create: failed to allocate path")
+    new_trace->stages = g_hash_table_new(g_str_hash, g_str_equal);
+    IF_THROW(new_trace->stages == NULL, "trace_create: failed to allocate stages")
+    new_trace->order = g_ptr_array_new_with_free_func(trace_stage_destroy);
+    IF_THROW(new_trace->order == NULL, "trace_create: failed to allocate stage order")
+
+    *trace = new_trace;
+
+    goto done;
+error:
+    status = STATUS_ERROR;
+    CLEANUP_FUNCTION(new_trace, trace_destroy(new_trace))
+done:
+    return status;
+}
+
+void trace_watch_bin(trace_t trace, GstElement *bin)
+{
+    GstIterator *iterator;
+    GValue item = G_VALUE_INIT;
+
+    // elements added later are reported through deep-element-added
+    iterator = gst_bin_iterate_recurse(GST_BIN(bin));
+    while (gst_iterator_next(iterator, &item) == GST_ITERATOR_OK)
+    {
+        trace_watch_element(trace, GST_ELEMENT(g_value_get_object(&item)));
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+}
+
+void trace_watch_element(trace_t trace, GstElement *element)
+{
+    trace_probe_t probe;
+
+    // a bin's children are traced themselves, a source has nothing coming in
+    if (GST_IS_BIN(element) || GST_OBJECT_FLAG_IS_SET(element, GST_ELEMENT_FLAG_SOURCE) ||
+        g_object_get_data(G_OBJECT(element), TRACE_PROBE_KEY) != NULL)
+    {
+        return;
+    }
+
+    probe = calloc(1, sizeof(struct trace_probe_s));
+    if (probe == NULL)
+    {
+        return;
+    }
+    probe->stage = trace_stage(trace, element);
+    if (probe->stage == NULL)
+    {
+        free(probe);
+        return;
+    }
+    trace_ref(trace);
+    probe->trace = trace;
+    probe->element = element;
+    probe->sink = GST_OBJECT_FLAG_IS_SET(element, GST_ELEMENT_FLAG_SINK) && GST_IS_BASE_SINK(element);
+    g_mutex_init(&probe->lock);
+    gst_segment_init(&probe->segment, GST_FORMAT_UNDEFINED);
+
+    // the element owns the probe state, so it outlives every pad probe and
+    // the pad-added handler
+    g_object_set_data_full(G_OBJECT(element), TRACE_PROBE_KEY, probe, trace_probe_destroy);
+    g_signal_connect(element, "pad-added", G_CALLBACK(trace_pad_added), probe);
+    gst_element_foreach_pad(element, trace_watch_pad, probe);
+}
+
+void trace_dump(trace_t trace, logger_t logger)
+{
+    trace_stage_t stage;
+    guint index;
+    int kind;
+
+    INFOF("trace_dump: %s: latency over the last %.0f s\n", trace->path, (g_get_monotonic_time() - trace->started) / 1e6)
+
+    g_mutex_lock(&trace->lock);
+    for (index = 0; index < trace->order->len; index++)
+    {
+        stage = (trace_stage_t)g_ptr_array_index(trace->order, index);
+        for (kind = 0; kind < TRACE_KINDS; kind++)
+        {
+            trace_dump_histogram(trace, stage, kind, logger);
+        }
+    }
+    g_mutex_unlock(&trace->lock);
+}
+
+void trace_ref(trace_t trace)
+{
+    g_atomic_int_inc(&trace->ref);
+}
+
+void trace_unref(trace_t trace)
+{
+    assert(trace != NULL);
+    if (g_atomic_int_dec_and_test(&trace->ref))
+    {
+        trace_destroy(trace);
+    }
+}
+
+trace_stage_t trace_stage(trace_t trace, GstElement *element)
+{
+    trace_stage_t stage;
+    GstElementFactory *factory;
+    const char *factory_name;
+    char *name;
+    char *suffix;
+    size_t length;
+
+    // automatic names count up with every session, they share the stage
+    // of their factory, names from the launch string are kept
+    name = gst_element_get_name(element);
+    factory = gst_element_get_factory(element);
+    factory_name = factory != NULL ? gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)) : NULL;
+    length = factory_name != NULL ? strlen(factory_name) : 0;
+    if (length > 0 && strncmp(name, factory_name, length) == 0)
+    {
+        suffix = name + length;
+        suffix += *suffix == '-';
+        if (*suffix != '\0' && strspn(suffix, "0123456789") == strlen(suffix))
+        {
+            name[length] = '\0';
+        }
+    }
+
+    g_mutex_lock(&trace->lock);
+    stage = g_hash_table_lookup(trace->stages, name);
+    if (stage == NULL && (stage = calloc(1, sizeof(struct trace_stage_s))) != NULL)
+    {
+        stage->name = name;
+        name = NULL;
+        g_hash_table_insert(trace->stages, stage->name, stage);
+        g_ptr_array_add(trace->order, stage);
+    }
+    g_mutex_unlock(&trace->lock);
+
+    g_free(name);
+    return stage;
+}
+
+gboolean trace_watch_pad(GstElement *element, GstPad *pad, gpointer user_data)
+{
+    trace_probe_t probe;
+
+    probe = (trace_probe_t)user_data;
+    if (GST_PAD_IS_SINK(pad))
+    {
+        gst_pad_add_probe(pad, probe->sink ? GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM : GST_PAD_PROBE_TYPE_BUFFER,
+                          trace_enter, probe, NULL);
+    }
+    else
+    {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, trace_leave, probe, NULL);
+    }
+    return TRUE;
+}
+
+void trace_pad_added(GstElement *element, GstPad *pad, gpointer user_data)
+{
+    // demuxers, tees and decoders add theirs once data flows
+    trace_watch_pad(element, pad, user_data);
+}
+
+GstPadProbeReturn trace_enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    trace_probe_t probe;
+    GstEvent *event;
+    GstBuffer *buffer;
+    struct trace_entry_s *entry;
+
+    probe = (trace_probe_t)user_data;
+
+    // events and buffers on one pad are serialized, the segment needs no lock
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+        event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT)
+        {
+            gst_event_copy_segment(event, &probe->segment);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (probe->sink)
+    {
+        trace_wait(probe, GST_BUFFER_PTS(buffer));
+        return GST_PAD_PROBE_OK;
+    }
+
+    g_mutex_lock(&probe->lock);
+    entry = probe->entries + probe->next;
+    entry->pts = GST_BUFFER_PTS(buffer);
+    entry->time = g_get_monotonic_time();
+    entry->thread = g_thread_self();
+    probe->next = (probe->next + 1) % TRACE_RING;
+    g_mutex_unlock(&probe->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn trace_leave(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    trace_probe_t probe;
+    GstBuffer *buffer;
+    struct trace_entry_s *entry;
+    gint64 now;
+    gint64 entered;
+    gboolean queued;
+    guint index;
+
+    probe = (trace_probe_t)user_data;
+    buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // newest first, a tee pushes the same buffer out of every branch and
+    // each one is timed against the same arrival
+    now = g_get_monotonic_time();
+    entered = 0;
+    queued = FALSE;
+    g_mutex_lock(&probe->lock);
+    for (index = 1; index <= TRACE_RING; index++)
+    {
+        entry = probe->entries + (probe->next + TRACE_RING - index) % TRACE_RING;
+        if (entry->time != 0 && entry->pts == GST_BUFFER_PTS(buffer))
+        {
+            entered = entry->time;
+            queued = entry->thread != g_thread_self();
+            break;
+        }
+    }
+    g_mutex_unlock(&probe->lock);
+
+    // a decoder or depayloader that retimestamps is only timed when the
+    // output keeps the input timestamp
+    if (entered != 0)
+    {
+        trace_record(probe->stage->histograms + (queued ? TRACE_QUEUE : TRACE_PROCESS), (guint64)(now - entered));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void trace_wait(trace_probe_t probe, GstClockTime pts)
+{
+    GstClock *clock;
+    GstClockTime running_time;
+    GstClockTime render;
+    GstClockTime now;
+
+    if (probe->segment.format != GST_FORMAT_TIME)
+    {
+        return;
+    }
+    running_time = gst_segment_to_running_time(&probe->segment, GST_FORMAT_TIME, pts);
+    clock = gst_element_get_clock(probe->element);
+    if (running_time == GST_CLOCK_TIME_NONE || clock == NULL)
+    {
+        CLEANUP_FUNCTION(clock, gst_object_unref(clock))
+        return;
+    }
+
+    // the same deadline the sink syncs on, without the device's own buffer
+    render = gst_element_get_base_time(probe->element) + running_time + gst_base_sink_get_latency(GST_BASE_SINK(probe->element)) +
+             gst_base_sink_get_render_delay(GST_BASE_SINK(probe->element));
+    now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+
+    if (render < now)
+    {
+        atomic_fetch_add(&probe->stage->late, 1);
+        return;
+    }
+    trace_record(probe->stage->histograms + TRACE_WAIT, (render - now) / GST_USECOND);
+}
+
+void trace_record(trace_histogram_t histogram, guint64 elapsed_us)
+{
+    uint_fast64_t max;
+    int bucket;
+
+    bucket = elapsed_us < 16 ? 0 : MIN(g_bit_storage(elapsed_us) - 4, TRACE_BUCKETS - 1);
+    atomic_fetch_add(histogram->buckets + bucket, 1);
+    atomic_fetch_add(&histogram->count, 1);
+    atomic_fetch_add(&histogram->sum_us, elapsed_us);
+    max = atomic_load(&histogram->max_us);
+    while (elapsed_us > max && !atomic_compare_exchange_weak(&histogram->max_us, &max, elapsed_us))
+    {
+    }
+}
+
+void trace_dump_histogram(trace_t trace, trace_stage_t stage, int kind, logger_t logger)
+{
+    trace_histogram_t histogram;
+    guint64 counts[TRACE_BUCKETS];
+    guint64 count;
+    guint64 seen;
+    guint64 late;
+    GString *buckets;
+    char late_string[48];
+    char p50_string[24];
+    char p99_string[24];
+    int p50;
+    int p99;
+    int bucket;
+
+    histogram = stage->histograms + kind;
+    late = kind == TRACE_WAIT ? atomic_load(&stage->late) : 0;
+
+    // counters move while this reads them, the totals come from the
+    // buckets so the percentiles stay consistent with them
+    count = 0;
+    for (bucket = 0; bucket < TRACE_BUCKETS; bucket++)
+    {
+        counts[bucket] = atomic_load(histogram->buckets + bucket);
+        count += counts[bucket];
+    }
+    if (count == 0 && late == 0)
+    {
+        return;
+    }
+
+    buckets = g_string_new(NULL);
+    p50 = -1;
+    p99 = -1;
+    seen = 0;
+    for (bucket = 0; bucket < TRACE_BUCKETS; bucket++)
+    {
+        seen += counts[bucket];
+        if (p50 < 0 && seen * 2 >= count)
+        {
+            p50 = bucket;
+        }
+        if (p99 < 0 && seen * 100 >= count * 99)
+        {
+            p99 = bucket;
+        }
+        if (counts[bucket] > 0)
+        {
+            g_string_append_printf(buckets, bucket < TRACE_BUCKETS - 1 ? " <%.3g:%" G_GUINT64_FORMAT : " >=%.3g:%" G_GUINT64_FORMAT,
+                                   bucket < TRACE_BUCKETS - 1 ? trace_bound_ms(bucket) : trace_bound_ms(bucket - 1), counts[bucket]);
+        }
+    }
+
+    // only a sink can be late, for everything else the line ends at max
+    late_string[0] = '\0';
+    if (late > 0)
+    {
+        snprintf(late_string, sizeof(late_string), ", %" G_GUINT64_FORMAT " late", late);
+    }
+
+    if (count > 0)
+    {
+        trace_bound_string(p50_string, sizeof(p50_string), p50);
+        trace_bound_string(p99_string, sizeof(p99_string), p99);
+        INFOF("trace_dump: %s %s %s: %" G_GUINT64_FORMAT " buffers, mean %.2f ms, p50 %s ms, p99 %s ms, max %.2f ms%s\n", trace->path,
+              stage->name, trace_kind_names[kind], count, atomic_load(&histogram->sum_us) / 1e3 / MAX(atomic_load(&histogram->count), 1),
+              p50_string, p99_string, atomic_load(&histogram->max_us) / 1e3, late_string)
+        INFOF("trace_dump: %s %s %s ms:%s\n", trace->path, stage->name, trace_kind_names[kind], buckets->str)
+    }
+    else
+    {
+        INFOF("trace_dump: %s %s %s: %" G_GUINT64_FORMAT " late, none on time\n", trace->path, stage->name, trace_kind_names[kind], late)
+    }
+    g_string_free(buckets, TRUE);
+}
+
+double trace_bound_ms(int bucket)
+{
+    // the upper bound of a bucket, 16 us doubling up to about a second
+    return (double)(G_GUINT64_CONSTANT(16) << bucket) / 1e3;
+}
+
+void trace_bound_string(char *string, size_t size, int bucket)
+{
+    // the last bucket has no upper bound, only the lower one
+    if (bucket < TRACE_BUCKETS - 1)
+    {
+        snprintf(string, size, "< %.3g", trace_bound_ms(bucket));
+    }
+    else
+    {
+        snprintf(string, size, ">= %.3g", trace_bound_ms(bucket - 1));
+    }
+}
+
+void trace_probe_destroy(gpointer user_data)
+{
+    trace_probe_t probe;
+
+    probe = (trace_probe_t)user_data;
+    g_mutex_clear(&probe->lock);
+    trace_unref(probe->trace);
+    free(probe);
+}
+
+void trace_stage_destroy(gpointer user_data)
+{
+    trace_stage_t stage;
+
+    stage = (trace_stage_t)user_data;
+    g_free(stage->name);
+    free(stage);
+}
+
+void trace_destroy(trace_t trace)
+{
+    CLEANUP_FUNCTION(trace->stages, g_hash_table_unref(trace->stages))
+    CLEANUP_FUNCTION(trace->order, g_ptr_array_unref(trace->order))
+    CLEANUP_FUNCTION(trace->path, g_free(trace->path))
+    g_mutex_clear(&trace->lock);
+    free(trace);
+}
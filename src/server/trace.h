@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "common.h"
+#include "logger.h"
+#include <gst/gst.h>
+#include <stdatomic.h>
+
+// power of two buckets in microseconds, the first holds everything under
+// 16 us and the last everything from about a second up
+#define TRACE_BUCKETS 18
+#define TRACE_RING 32
+
+enum trace_kinds
+{
+    // sink to src pad on one streaming thread
+    TRACE_PROCESS,
+    // sink to src pad across a thread boundary, queues and jitterbuffers
+    TRACE_QUEUE,
+    // arrival at a sink until its render time
+    TRACE_WAIT,
+    TRACE_KINDS
+};
+
+struct trace_histogram_s
+{
+    atomic_uint_fast64_t buckets[TRACE_BUCKETS];
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum_us;
+    atomic_uint_fast64_t max_us;
+};
+typedef struct trace_histogram_s *trace_histogram_t;
+
+// every session's elements of one name accumulate into the same stage
+struct trace_stage_s
+{
+    char *name;
+    struct trace_histogram_s histograms[TRACE_KINDS];
+    atomic_uint_fast64_t late;
+};
+typedef struct trace_stage_s *trace_stage_t;
+
+struct trace_s
+{
+    int ref;
+    GMutex lock;
+    char *path;
+    GHashTable *stages;
+    GPtrArray *order;
+    gint64 started;
+};
+typedef struct trace_s *trace_t;
+
+int trace_create(trace_t *trace, const char *path, const char **error);
+
+void trace_watch_bin(trace_t trace, GstElement *bin);
+
+void trace_watch_element(trace_t trace, GstElement *element);
+
+void trace_dump(trace_t trace, logger_t logger);
+
+void trace_ref(trace_t trace);
+
+void trace_unref(trace_t trace);
+
+#endif